@@ -0,0 +1,149 @@
+// Compares the JSON and binary (BinaryProtocol) WebSocket codecs on the
+// messages that dominate room traffic: a one-character keystroke, a pasted
+// paragraph, and a cursor move. Reports bytes on the wire and the CPU time to
+// encode the server's frame and to decode the client's submission.
+//
+//   cmake -S . -B build -DDOCS_BUILD_BENCHMARKS=ON && cmake --build build --target codec_bench
+//   ./build/codec_bench
+
+#include "utils/BinaryProtocol.h"
+#include "utils/OperationJson.h"
+#include "crow/json.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const int ITERATIONS = 200000;
+    const char *USER_ID = "3f2b8c1e-9a4d-4e7b-8c2f-1d5e6a7b8c9d";
+
+    struct Case
+    {
+        const char *label;
+        std::vector<TextOperation> ops;
+    };
+
+    double nanosPer(Clock::time_point start, int count)
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        return static_cast<double>(elapsed) / count;
+    }
+
+    std::string jsonSubmit(int revision, const std::vector<TextOperation> &ops)
+    {
+        return "{\"type\":\"op\",\"revision\":" + std::to_string(revision) + ",\"ops\":" + OperationJson::serialize(ops) + "}";
+    }
+
+    std::string binarySubmit(int revision, const std::vector<TextOperation> &ops)
+    {
+        std::string frame;
+        BinaryProtocol::putVarint(frame, BinaryProtocol::SUBMIT);
+        BinaryProtocol::putVarint(frame, static_cast<uint64_t>(revision));
+        BinaryProtocol::putVarint(frame, ops.size());
+        for (const auto &op : ops)
+        {
+            BinaryProtocol::putVarint(frame, op.isInsert() ? 0 : 1);
+            BinaryProtocol::putVarint(frame, op.position);
+            if (op.isInsert())
+                BinaryProtocol::putString(frame, op.text);
+            else
+                BinaryProtocol::putVarint(frame, op.length);
+        }
+        return frame;
+    }
+
+    void runOperation(const Case &c)
+    {
+        AppliedOperation applied;
+        applied.revision = 48213;
+        applied.user_id = USER_ID;
+        applied.ops = c.ops;
+        uint32_t user = BinaryProtocol::internUser(USER_ID);
+        volatile size_t sink = 0;
+
+        auto start = Clock::now();
+        for (int i = 0; i < ITERATIONS; ++i)
+            sink += OperationJson::opFrame(applied).size();
+        double json_encode = nanosPer(start, ITERATIONS);
+
+        start = Clock::now();
+        for (int i = 0; i < ITERATIONS; ++i)
+            sink += BinaryProtocol::opFrame(applied, user).size();
+        double binary_encode = nanosPer(start, ITERATIONS);
+
+        std::string json_in = jsonSubmit(applied.revision, c.ops);
+        start = Clock::now();
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            auto msg = crow::json::load(json_in);
+            sink += OperationJson::parse(msg["ops"]).size() + static_cast<size_t>(msg["revision"].i());
+        }
+        double json_decode = nanosPer(start, ITERATIONS);
+
+        std::string binary_in = binarySubmit(applied.revision, c.ops);
+        start = Clock::now();
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            auto message = BinaryProtocol::decode(binary_in);
+            sink += message.ops.size() + static_cast<size_t>(message.revision);
+        }
+        double binary_decode = nanosPer(start, ITERATIONS);
+
+        std::printf("%-10s out %4zu B json  %4zu B binary | in %4zu B json  %4zu B binary | "
+                    "encode %6.0f ns json  %5.0f ns binary | decode %6.0f ns json  %5.0f ns binary\n",
+                    c.label, OperationJson::opFrame(applied).size(), BinaryProtocol::opFrame(applied, user).size(),
+                    json_in.size(), binary_in.size(), json_encode, binary_encode, json_decode, binary_decode);
+    }
+
+    void runCursor()
+    {
+        uint32_t user = BinaryProtocol::internUser(USER_ID, "Ada Lovelace");
+        volatile size_t sink = 0;
+
+        auto start = Clock::now();
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            crow::json::wvalue cursor;
+            cursor["type"] = "cursor";
+            cursor["position"] = 12345 + (i & 7);
+            cursor["userId"] = USER_ID;
+            cursor["username"] = "Ada Lovelace";
+            sink += cursor.dump().size();
+        }
+        double json_encode = nanosPer(start, ITERATIONS);
+
+        start = Clock::now();
+        for (int i = 0; i < ITERATIONS; ++i)
+            sink += BinaryProtocol::cursorFrame(user, true, 12345 + (i & 7)).size();
+        double binary_encode = nanosPer(start, ITERATIONS);
+
+        crow::json::wvalue cursor;
+        cursor["type"] = "cursor";
+        cursor["position"] = 12345;
+        cursor["userId"] = USER_ID;
+        cursor["username"] = "Ada Lovelace";
+
+        std::printf("%-10s out %4zu B json  %4zu B binary | encode %6.0f ns json  %5.0f ns binary\n",
+                    "cursor", cursor.dump().size(), BinaryProtocol::cursorFrame(user, true, 12345).size(),
+                    json_encode, binary_encode);
+    }
+}
+
+int main()
+{
+    const Case cases[] = {
+        {"keystroke", {TextOperation::insert(10452, "e")}},
+        {"paste", {TextOperation::remove(200, 12),
+                   TextOperation::insert(200, std::string("The quick brown fox jumps over the lazy dog, and \"quotes\"\n"
+                                                          "and a second line with some more words in it. "
+                                                          "The quick brown fox jumps over the lazy dog again.\n"))}},
+    };
+
+    for (const auto &c : cases)
+        runOperation(c);
+    runCursor();
+    return 0;
+}
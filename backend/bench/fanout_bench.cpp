@@ -0,0 +1,175 @@
+// Measures the cost of relaying room traffic between processes through the
+// FanoutBroker: latency of one hop (publisher -> broker -> subscriber, one
+// message in flight) and throughput with 1 and 4 subscribing processes,
+// for small and large frames. A bus subscribed to another room counts what
+// reaches it, which should be nothing. Each bus stands in for a process;
+// they all run here, over a real Unix domain socket.
+//
+//   cmake -S . -B build -DDOCS_BUILD_BENCHMARKS=ON && cmake --build build --target fanout_bench
+//   ./build/fanout_bench
+
+#include "utils/BrokerBus.h"
+#include "utils/FanoutBroker.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const int LATENCY_SAMPLES = 20000;
+    const int THROUGHPUT_MESSAGES = 200000;
+    // Messages a publisher keeps in flight, well inside the backlog limits
+    const int WINDOW = 2000;
+
+    int64_t nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    struct Subscriber
+    {
+        std::shared_ptr<BrokerBus> bus;
+        std::atomic<long> received{0};
+        std::atomic<int64_t> last_latency_ns{0};
+    };
+
+    std::unique_ptr<Subscriber> makeSubscriber(const std::string &path, const std::string &room)
+    {
+        auto subscriber = std::make_unique<Subscriber>();
+        subscriber->bus = std::make_shared<BrokerBus>(path, false);
+        Subscriber *self = subscriber.get();
+        subscriber->bus->onMessage(FanoutBus::Kind::Broadcast, [self](const FanoutBus::Message &message) {
+            int64_t sent = 0;
+            std::memcpy(&sent, message.payload.data(), sizeof(sent));
+            self->last_latency_ns.store(nowNs() - sent, std::memory_order_relaxed);
+            self->received.fetch_add(1, std::memory_order_release);
+        });
+        subscriber->bus->subscribe(room);
+        subscriber->bus->start();
+        return subscriber;
+    }
+
+    void waitConnected(const BrokerBus &bus)
+    {
+        while (!bus.getStats().connected)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    FanoutBus::Message message(size_t size)
+    {
+        FanoutBus::Message m;
+        m.kind = FanoutBus::Kind::Broadcast;
+        m.room = "doc-0";
+        m.payload.assign(std::max(size, sizeof(int64_t)), 'x');
+        return m;
+    }
+
+    void stamp(FanoutBus::Message &m)
+    {
+        int64_t now = nowNs();
+        std::memcpy(&m.payload[0], &now, sizeof(now));
+    }
+
+    void runLatency(const std::string &path, BrokerBus &publisher, size_t size)
+    {
+        auto subscriber = makeSubscriber(path, "doc-0");
+        waitConnected(*subscriber->bus);
+        // Let the subscription reach the broker
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        auto m = message(size);
+        std::vector<int64_t> samples;
+        samples.reserve(LATENCY_SAMPLES);
+        for (int i = 0; i < LATENCY_SAMPLES; ++i)
+        {
+            stamp(m);
+            publisher.publish(m);
+            while (subscriber->received.load(std::memory_order_acquire) <= i)
+                std::this_thread::yield();
+            samples.push_back(subscriber->last_latency_ns.load(std::memory_order_relaxed));
+        }
+        subscriber->bus->stop();
+
+        std::sort(samples.begin(), samples.end());
+        double mean = 0;
+        for (int64_t s : samples)
+            mean += s;
+        mean /= samples.size();
+        std::printf("latency %6zu B   p50 %7.1f us   p99 %7.1f us   mean %7.1f us\n", size,
+                    samples[samples.size() / 2] / 1000.0, samples[samples.size() * 99 / 100] / 1000.0, mean / 1000.0);
+    }
+
+    void runThroughput(const std::string &path, BrokerBus &publisher, size_t size, int subscribers)
+    {
+        std::vector<std::unique_ptr<Subscriber>> subs;
+        for (int i = 0; i < subscribers; ++i)
+            subs.push_back(makeSubscriber(path, "doc-0"));
+        auto bystander = makeSubscriber(path, "doc-1");
+        for (auto &sub : subs)
+            waitConnected(*sub->bus);
+        waitConnected(*bystander->bus);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        auto slowest = [&] {
+            long least = THROUGHPUT_MESSAGES;
+            for (auto &sub : subs)
+                least = std::min(least, sub->received.load(std::memory_order_acquire));
+            return least;
+        };
+
+        auto m = message(size);
+        auto start = Clock::now();
+        for (int i = 0; i < THROUGHPUT_MESSAGES; ++i)
+        {
+            while (i - slowest() >= WINDOW)
+                std::this_thread::yield();
+            stamp(m);
+            publisher.publish(m);
+        }
+        while (slowest() < THROUGHPUT_MESSAGES)
+            std::this_thread::yield();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::printf("throughput %6zu B x %d subscribers   %9.0f msg/s   %7.1f MB/s delivered   bystander got %ld\n",
+                    size, subscribers, THROUGHPUT_MESSAGES / seconds,
+                    double(THROUGHPUT_MESSAGES) * size * subscribers / seconds / (1 << 20), bystander->received.load());
+
+        for (auto &sub : subs)
+            sub->bus->stop();
+        bystander->bus->stop();
+    }
+}
+
+int main()
+{
+    const std::string path = "/tmp/fanout_bench_" + std::to_string(getpid()) + ".sock";
+    FanoutBroker broker(path);
+    broker.start();
+
+    BrokerBus publisher(path, false);
+    publisher.start();
+    waitConnected(publisher);
+
+    for (size_t size : {100, 4096})
+        runLatency(path, publisher, size);
+    for (size_t size : {100, 4096})
+        for (int subscribers : {1, 4})
+            runThroughput(path, publisher, size, subscribers);
+
+    auto stats = broker.getStats();
+    std::printf("broker: published %llu   relayed %llu   presence dropped %llu   disconnected %llu\n",
+                static_cast<unsigned long long>(stats.published), static_cast<unsigned long long>(stats.relayed),
+                static_cast<unsigned long long>(stats.presence_dropped), static_cast<unsigned long long>(stats.disconnected));
+
+    publisher.stop();
+    broker.stop();
+    return 0;
+}
@@ -0,0 +1,125 @@
+// Measures WebSocketManager throughput as threads are added: joins and
+// leaves (membership churn) and broadcasts, with 10k connections spread
+// over 2k rooms. Each thread drives its own slice of connections, the way
+// Crow's worker threads each own the connections they accepted.
+//
+//   cmake -S . -B build -DDOCS_BUILD_BENCHMARKS=ON && cmake --build build --target registry_bench
+//   ./build/registry_bench
+
+#include "utils/WebSocketManager.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const int CONNECTIONS = 10000;
+    const int ROOMS = 2000;
+    const int CHURN_PER_THREAD = 100000;
+    const int BROADCASTS_PER_THREAD = 100000;
+
+    // Counts frames instead of writing to a socket
+    struct FakeConnection : crow::websocket::connection
+    {
+        std::atomic<size_t> frames{0};
+
+        void send_binary(std::string) override { frames.fetch_add(1, std::memory_order_relaxed); }
+        void send_text(std::string) override { frames.fetch_add(1, std::memory_order_relaxed); }
+        void send_ping(std::string) override {}
+        void send_pong(std::string) override {}
+        void close(std::string const &, uint16_t) override {}
+        std::string get_remote_ip() override { return "127.0.0.1"; }
+        std::string get_subprotocol() const override { return ""; }
+    };
+
+    std::vector<std::string> makeRooms()
+    {
+        std::vector<std::string> rooms;
+        rooms.reserve(ROOMS);
+        for (int i = 0; i < ROOMS; ++i)
+            rooms.push_back("doc-" + std::to_string(i));
+        return rooms;
+    }
+
+    // Runs body(thread_index) on each thread and returns operations per second
+    template <typename Fn>
+    double throughput(int threads, long operations, Fn &&body)
+    {
+        std::atomic<bool> go{false};
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t)
+            workers.emplace_back([&, t] {
+                while (!go.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+                body(t);
+            });
+
+        auto start = Clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto &worker : workers)
+            worker.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return operations / seconds;
+    }
+
+    void run(int threads, std::vector<FakeConnection> &connections, const std::vector<std::string> &rooms)
+    {
+        auto &manager = WebSocketManager::getInstance();
+        const int slice = CONNECTIONS / threads;
+
+        // Everyone in a room, five connections per room
+        for (int i = 0; i < CONNECTIONS; ++i)
+            manager.joinDocument(rooms[i % ROOMS], &connections[i], "user-" + std::to_string(i), "User");
+
+        // Churn: a connection of this thread moves to another room, which is
+        // a leave plus a join
+        double churn = throughput(threads, 2L * CHURN_PER_THREAD * threads, [&](int t) {
+            std::mt19937 rng(t + 1);
+            for (int i = 0; i < CHURN_PER_THREAD; ++i)
+            {
+                auto *conn = &connections[t * slice + rng() % slice];
+                manager.leaveAll(conn);
+                manager.joinDocument(rooms[rng() % ROOMS], conn, "user", "User");
+            }
+        });
+
+        const std::string message = "{\"type\":\"cursor_update\",\"user_id\":\"u\",\"position\":42}";
+        size_t frames_before = 0;
+        for (auto &conn : connections)
+            frames_before += conn.frames.load();
+
+        double broadcast = throughput(threads, static_cast<long>(BROADCASTS_PER_THREAD) * threads, [&](int t) {
+            std::mt19937 rng(t + 101);
+            for (int i = 0; i < BROADCASTS_PER_THREAD; ++i)
+                manager.broadcastToDocument(rooms[rng() % ROOMS], message);
+        });
+
+        size_t frames = 0;
+        for (auto &conn : connections)
+        {
+            frames += conn.frames.load();
+            manager.leaveAll(&conn);
+        }
+
+        std::printf("%2d threads  join/leave %10.0f ops/s  broadcast %10.0f rooms/s (%.1f frames each)\n",
+                    threads, churn, broadcast,
+                    static_cast<double>(frames - frames_before) / (static_cast<double>(BROADCASTS_PER_THREAD) * threads));
+    }
+}
+
+int main()
+{
+    std::vector<FakeConnection> connections(CONNECTIONS);
+    auto rooms = makeRooms();
+
+    std::printf("%d connections, %d rooms, %zu shards, %u hardware threads\n",
+                CONNECTIONS, ROOMS, WebSocketManager::SHARD_COUNT, std::thread::hardware_concurrency());
+    for (int threads : {1, 2, 4, 8})
+        run(threads, connections, rooms);
+    return 0;
+}
@@ -0,0 +1,143 @@
+// Compares the session content buffer (Rope) against std::string for the
+// operations a hot document sees: keystroke inserts and deletes at random
+// positions, offset lookups, and snapshots for persistence.
+//
+//   cmake -S . -B build -DDOCS_BUILD_BENCHMARKS=ON && cmake --build build --target rope_bench
+//   ./build/rope_bench
+
+#include "utils/Rope.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Size
+    {
+        const char *label;
+        size_t bytes;
+        int edits;
+    };
+
+    double nanosPer(Clock::time_point start, int count)
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        return static_cast<double>(elapsed) / count;
+    }
+
+    std::string makeText(size_t bytes)
+    {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz     \n";
+        std::mt19937 rng(42);
+        std::string text(bytes, ' ');
+        for (auto &c : text)
+            c = alphabet[rng() % (sizeof(alphabet) - 1)];
+        return text;
+    }
+
+    // Positions are generated up front so both buffers see the same edits;
+    // ASCII text keeps byte and UTF-16 offsets identical for std::string
+    std::vector<size_t> makePositions(size_t length, int count)
+    {
+        std::mt19937 rng(7);
+        std::vector<size_t> positions;
+        positions.reserve(count);
+        for (int i = 0; i < count; ++i)
+            positions.push_back(rng() % length);
+        return positions;
+    }
+
+    void run(const Size &size)
+    {
+        std::string text = makeText(size.bytes);
+        auto positions = makePositions(size.bytes, size.edits);
+        volatile size_t sink = 0;
+
+        auto start = Clock::now();
+        Rope rope(text);
+        double rope_build = nanosPer(start, 1);
+
+        // Keystrokes: insert a character, then delete one elsewhere. The
+        // session used to copy its whole content per operation, which is
+        // what the copying std::string column measures.
+        start = Clock::now();
+        for (int i = 0; i < size.edits; ++i)
+        {
+            rope.insert(positions[i], "x");
+            rope.erase(positions[size.edits - 1 - i], 1);
+        }
+        double rope_edit = nanosPer(start, size.edits * 2);
+
+        std::string in_place = text;
+        start = Clock::now();
+        for (int i = 0; i < size.edits; ++i)
+        {
+            in_place.insert(positions[i], "x");
+            in_place.erase(positions[size.edits - 1 - i], 1);
+        }
+        double string_edit = nanosPer(start, size.edits * 2);
+
+        std::string copied = text;
+        start = Clock::now();
+        for (int i = 0; i < size.edits; ++i)
+        {
+            std::string next = copied;
+            next.insert(positions[i], "x");
+            copied.swap(next);
+            next = copied;
+            next.erase(positions[size.edits - 1 - i], 1);
+            copied.swap(next);
+        }
+        double copy_edit = nanosPer(start, size.edits * 2);
+
+        start = Clock::now();
+        for (int i = 0; i < size.edits; ++i)
+            sink += rope.byteOffset(positions[i]);
+        double rope_lookup = nanosPer(start, size.edits);
+
+        start = Clock::now();
+        for (int i = 0; i < size.edits; ++i)
+        {
+            Rope snapshot = rope;
+            sink += snapshot.size();
+        }
+        double rope_snapshot = nanosPer(start, size.edits);
+
+        start = Clock::now();
+        for (int i = 0; i < size.edits; ++i)
+        {
+            std::string snapshot = in_place;
+            sink += snapshot.size();
+        }
+        double string_snapshot = nanosPer(start, size.edits);
+
+        start = Clock::now();
+        sink += rope.toString().size();
+        double rope_flatten = nanosPer(start, 1);
+
+        if (rope.toString() != in_place || in_place != copied)
+            std::printf("%s: buffers diverged\n", size.label);
+
+        std::printf("%-6s edit rope %9.0f ns  string %11.0f ns  string+copy %11.0f ns | "
+                    "lookup rope %6.0f ns | snapshot rope %6.0f ns  string %11.0f ns | "
+                    "build %9.0f ns  flatten %9.0f ns  height %d\n",
+                    size.label, rope_edit, string_edit, copy_edit, rope_lookup,
+                    rope_snapshot, string_snapshot, rope_build, rope_flatten, rope.height());
+    }
+}
+
+int main()
+{
+    const Size sizes[] = {
+        {"1KB", 1024, 20000},
+        {"1MB", 1024 * 1024, 2000},
+        {"50MB", 50 * 1024 * 1024, 100},
+    };
+
+    for (const auto &size : sizes)
+        run(size);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Documents and users that were hot before the last shutdown, hottest first
+struct AccessProfile
+{
+    std::vector<std::string> documents;
+    std::vector<std::string> users;
+};
+
+// Counts document and user accesses and periodically writes the hottest ids
+// to a small text file (one "d <id>" or "u <id>" per line) that CacheWarmer
+// replays at the next boot. Counts decay by half whenever a table grows past
+// MAX_TRACKED, so the profile follows recent traffic.
+class AccessRecorder
+{
+public:
+    static const size_t MAX_TRACKED = 20000;
+    static const size_t MAX_SAVED = 2000;
+
+    static AccessRecorder &getInstance();
+
+    void recordDocument(const std::string &doc_id);
+    void recordUser(const std::string &user_id);
+
+    // Saves every interval_seconds until stop(), which saves once more
+    void start(const std::string &path, int interval_seconds = 60);
+    void stop();
+
+    bool save(const std::string &path) const;
+    static AccessProfile load(const std::string &path);
+
+    AccessRecorder(const AccessRecorder &) = delete;
+    AccessRecorder &operator=(const AccessRecorder &) = delete;
+
+private:
+    AccessRecorder() = default;
+    ~AccessRecorder();
+
+    static void bump(std::unordered_map<std::string, uint32_t> &counts, const std::string &id);
+    static std::vector<std::string> hottest(const std::unordered_map<std::string, uint32_t> &counts);
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, uint32_t> documents_;
+    std::unordered_map<std::string, uint32_t> users_;
+
+    std::mutex thread_mutex_;
+    std::condition_variable cv_;
+    std::thread saver_;
+    bool running_ = false;
+    std::string path_;
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include "utils/FanoutBus.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Permission bits stored per (document, user). "write" implies "read".
+enum AclPermission : uint8_t
+{
+    ACL_NONE = 0,
+    ACL_READ = 1 << 0,
+    ACL_WRITE = 1 << 1,
+};
+
+// Immutable access list for one document. Replaced wholesale on change.
+struct DocumentAcl
+{
+    std::string owner_id;
+    // Sorted by user id for binary search
+    std::vector<std::pair<std::string, uint8_t>> grants;
+
+    uint8_t permissionsFor(const std::string &user_id) const;
+};
+
+// In-memory index of document ownership and collaborator permissions used by
+// CollaborationService::checkAccess. Each shard publishes an immutable map
+// that readers load atomically, so access checks never take the writer lock,
+// query SQLite, or touch document bodies once a document has been loaded.
+// Writers copy the shard map, modify it and publish the new one.
+class AclIndex
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t loads = 0;
+        uint64_t updates = 0;
+        size_t documents = 0;
+    };
+
+    static AclIndex &getInstance();
+
+    static uint8_t maskFor(const std::string &permission);
+
+    // Returns the ACL for doc_id, loading it from the database on first use.
+    // Returns nullptr if the document does not exist.
+    std::shared_ptr<const DocumentAcl> get(const std::string &doc_id);
+
+    bool checkAccess(const std::string &doc_id, const std::string &user_id, uint8_t required);
+
+    // Keep loaded entries current; unloaded documents are picked up lazily.
+    // Called after the database write. Other processes drop their entry
+    // for doc_id on grant, revoke and erase and load it again on next use;
+    // a new document's owner needs no telling, nobody has it loaded.
+    void setOwner(const std::string &doc_id, const std::string &owner_id);
+    void grant(const std::string &doc_id, const std::string &user_id, const std::string &permission);
+    void revoke(const std::string &doc_id, const std::string &user_id);
+    void erase(const std::string &doc_id);
+
+    // Relays changes to and from other processes sharing the database
+    void attachBus(const std::shared_ptr<FanoutBus> &bus);
+
+    Stats getStats() const;
+
+    AclIndex(const AclIndex &) = delete;
+    AclIndex &operator=(const AclIndex &) = delete;
+
+private:
+    AclIndex();
+
+    using Map = std::unordered_map<std::string, std::shared_ptr<const DocumentAcl>>;
+
+    struct Shard
+    {
+        std::shared_ptr<const Map> map;
+        std::mutex write_mutex;
+        // Bumped by every mutation so a lazy load that raced with one is
+        // not published
+        std::atomic<uint64_t> epoch{0};
+    };
+
+    static const size_t SHARD_COUNT = 64;
+
+    Shard &shardFor(const std::string &doc_id);
+    const Shard &shardFor(const std::string &doc_id) const;
+    std::shared_ptr<const DocumentAcl> find(const std::string &doc_id) const;
+    std::shared_ptr<const DocumentAcl> loadFromDatabase(const std::string &doc_id);
+
+    // Applies fn to a copy of the loaded ACL for doc_id and publishes it
+    template <typename Fn>
+    void update(const std::string &doc_id, Fn fn);
+    // Drops the loaded entry for doc_id, here only
+    void drop(const std::string &doc_id);
+    void publish(const std::string &doc_id);
+
+    std::array<Shard, SHARD_COUNT> shards_;
+
+    // Set once at startup; read with std::atomic_load
+    std::shared_ptr<FanoutBus> bus_;
+
+    mutable std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> loads_{0};
+    std::atomic<uint64_t> updates_{0};
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include "cache/AccessRecorder.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Replays an AccessProfile at boot. Worker threads prefetch the recorded
+// documents (SQLite pages, DocumentCache, AclIndex, ResponseCache) and users
+// (UserProfileCache) behind a shared rate limit, so early requests are not
+// starved. It also tracks request latency in fixed windows since boot and
+// reports when p99 settled (time to steady state).
+class CacheWarmer
+{
+public:
+    static const int WINDOW_SECONDS = 10;
+    static const size_t MAX_WINDOWS = 90;
+    static const uint64_t MIN_WINDOW_SAMPLES = 20;
+    // Consecutive windows whose p99 differ by at most this fraction are steady
+    static constexpr double STEADY_TOLERANCE = 0.25;
+
+    struct Stats
+    {
+        bool running = false;
+        size_t documents_planned = 0;
+        size_t users_planned = 0;
+        uint64_t documents_warmed = 0;
+        uint64_t users_warmed = 0;
+        uint64_t failures = 0;
+        int64_t duration_ms = 0;
+        // p99 (microseconds) of each closed window since boot
+        std::vector<uint64_t> window_p99_us;
+        std::optional<int64_t> time_to_steady_state_ms;
+    };
+
+    static CacheWarmer &getInstance();
+
+    // Starts warming in the background and returns immediately
+    void start(const AccessProfile &profile, size_t threads = 4, double items_per_second = 200.0);
+    void stop();
+
+    // Latency of one request served by the process
+    void recordLatency(std::chrono::microseconds latency);
+
+    Stats getStats();
+
+    CacheWarmer(const CacheWarmer &) = delete;
+    CacheWarmer &operator=(const CacheWarmer &) = delete;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Log-linear histogram: 8 buckets per power of two, about 9% resolution
+    static const size_t BUCKETS = 8 * 32;
+
+    CacheWarmer();
+    ~CacheWarmer();
+
+    void work();
+    bool acquireToken();
+    void rollWindows(Clock::time_point now);
+    static size_t bucketFor(uint64_t micros);
+    static uint64_t bucketUpperBound(size_t bucket);
+
+    AccessProfile profile_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_{0};
+    std::atomic<bool> stopping_{false};
+    std::atomic<size_t> active_workers_{0};
+    std::atomic<uint64_t> documents_warmed_{0};
+    std::atomic<uint64_t> users_warmed_{0};
+    std::atomic<uint64_t> failures_{0};
+    Clock::time_point warmup_started_;
+    std::atomic<int64_t> duration_ms_{0};
+
+    // Token bucket shared by all workers
+    std::mutex rate_mutex_;
+    double rate_;
+    double tokens_;
+    Clock::time_point refilled_;
+
+    // Latency windows
+    std::mutex latency_mutex_;
+    Clock::time_point boot_;
+    size_t window_index_;
+    std::array<uint64_t, BUCKETS> window_buckets_;
+    uint64_t window_samples_;
+    std::vector<uint64_t> window_p99_us_;
+    std::optional<int64_t> steady_at_ms_;
+};
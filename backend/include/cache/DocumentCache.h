@@ -0,0 +1,36 @@
+#pragma once
+#include "cache/ShardedLruCache.h"
+#include "models/Document.h"
+#include <string>
+#include <memory>
+
+// Process-wide cache of Document rows keyed by id. Entries are charged by the
+// size of their strings, so a handful of large bodies cannot blow the budget.
+// DocumentRepository populates it on reads and invalidates it on writes.
+class DocumentCache
+{
+public:
+    using Stats = ShardedLruCache<std::string, Document>::Stats;
+
+    static DocumentCache &getInstance();
+
+    std::shared_ptr<const Document> get(const std::string &id);
+    std::shared_ptr<const Document> peek(const std::string &id) const;
+    void put(const Document &document);
+
+    // Drops the cached row if it is older than min_version
+    void invalidate(const std::string &id, int min_version);
+    void invalidate(const std::string &id);
+
+    Stats getStats() const;
+
+    static size_t entrySize(const std::string &id, const Document &document);
+
+    DocumentCache(const DocumentCache &) = delete;
+    DocumentCache &operator=(const DocumentCache &) = delete;
+
+private:
+    DocumentCache();
+
+    ShardedLruCache<std::string, Document> cache_;
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include "cache/ShardedLruCache.h"
+#include "models/Document.h"
+#include <memory>
+#include <string>
+
+// Serialized bytes for one version of a document
+struct CachedResponse
+{
+    int version = 0;
+    // Full body of GET /api/documents/:id for this version
+    std::string body;
+    // Gzipped body, present once a gzip-capable client has asked for it
+    std::string body_gzip;
+    // The content as a quoted, escaped JSON string, for WebSocket frames
+    std::string content_json;
+};
+
+// Cache of pre-serialized document responses keyed by document id. An entry
+// only answers lookups for the version it was built from, and the document
+// repository drops it whenever it writes a newer version.
+class ResponseCache
+{
+public:
+    using Stats = ShardedLruCache<std::string, CachedResponse>::Stats;
+
+    // Bodies smaller than this are not worth compressing
+    static const size_t GZIP_MIN_BYTES = 1024;
+
+    static ResponseCache &getInstance();
+
+    std::shared_ptr<const CachedResponse> find(const std::string &doc_id, int version);
+    // Serializes doc (once per version) and caches the result
+    std::shared_ptr<const CachedResponse> getOrBuild(const Document &doc);
+    std::shared_ptr<const CachedResponse> put(const std::string &doc_id, CachedResponse response);
+
+    // Returns entry with body_gzip filled in, compressing and re-caching once
+    std::shared_ptr<const CachedResponse> withGzip(const std::string &doc_id,
+                                                   const std::shared_ptr<const CachedResponse> &entry);
+
+    void invalidate(const std::string &doc_id, int min_version);
+    void invalidate(const std::string &doc_id);
+
+    Stats getStats() const;
+
+    ResponseCache(const ResponseCache &) = delete;
+    ResponseCache &operator=(const ResponseCache &) = delete;
+
+private:
+    ResponseCache();
+
+    ShardedLruCache<std::string, CachedResponse> cache_;
+};
@@ -0,0 +1,230 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Lock-striped LRU cache. Keys are spread over a fixed number of shards, each
+// with its own mutex, recency list and byte budget, so readers of different
+// keys rarely contend. Values are held as shared_ptr<const V> so a hit hands
+// out the cached object without copying it under the shard lock.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class ShardedLruCache
+{
+public:
+    // Returns the number of bytes an entry is charged against the budget
+    using SizeFn = std::function<size_t(const K &, const V &)>;
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+        uint64_t rejections = 0; // entries larger than a whole shard
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t capacity_bytes = 0;
+
+        double hitRatio() const
+        {
+            uint64_t lookups = hits + misses;
+            return lookups == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(lookups);
+        }
+    };
+
+    ShardedLruCache(size_t capacity_bytes, size_t shard_count, SizeFn size_fn)
+        : capacity_bytes_(capacity_bytes), size_fn_(std::move(size_fn))
+    {
+        // Round up to a power of two so shard selection is a mask
+        size_t count = 1;
+        while (count < shard_count)
+            count <<= 1;
+        shard_mask_ = count - 1;
+        shard_capacity_ = capacity_bytes / count;
+
+        shards_.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            shards_.push_back(std::make_unique<Shard>());
+    }
+
+    ShardedLruCache(const ShardedLruCache &) = delete;
+    ShardedLruCache &operator=(const ShardedLruCache &) = delete;
+
+    std::shared_ptr<const V> get(const K &key)
+    {
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if (it == shard.index.end())
+        {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        // Move to front (most recently used)
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return it->second->value;
+    }
+
+    // Looks up without touching recency or hit/miss counters
+    std::shared_ptr<const V> peek(const K &key) const
+    {
+        const Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if (it == shard.index.end())
+            return nullptr;
+        return it->second->value;
+    }
+
+    void put(const K &key, std::shared_ptr<const V> value)
+    {
+        if (!value)
+            return;
+
+        size_t bytes = size_fn_(key, *value);
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            shard.bytes -= it->second->bytes;
+            shard.lru.erase(it->second);
+            shard.index.erase(it);
+        }
+
+        if (bytes > shard_capacity_)
+        {
+            rejections_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        shard.lru.push_front(Entry{key, std::move(value), bytes});
+        shard.index[key] = shard.lru.begin();
+        shard.bytes += bytes;
+        insertions_.fetch_add(1, std::memory_order_relaxed);
+
+        while (shard.bytes > shard_capacity_ && !shard.lru.empty())
+        {
+            Entry &victim = shard.lru.back();
+            shard.bytes -= victim.bytes;
+            shard.index.erase(victim.key);
+            shard.lru.pop_back();
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool erase(const K &key)
+    {
+        return eraseIf(key, [](const V &) { return true; });
+    }
+
+    // Erases the entry for key only if pred(value) holds
+    template <typename Pred>
+    bool eraseIf(const K &key, Pred pred)
+    {
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if (it == shard.index.end() || !pred(*it->second->value))
+            return false;
+
+        shard.bytes -= it->second->bytes;
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+        invalidations_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void clear()
+    {
+        for (auto &shard : shards_)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->lru.clear();
+            shard->index.clear();
+            shard->bytes = 0;
+        }
+    }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        stats.hits = hits_.load(std::memory_order_relaxed);
+        stats.misses = misses_.load(std::memory_order_relaxed);
+        stats.insertions = insertions_.load(std::memory_order_relaxed);
+        stats.evictions = evictions_.load(std::memory_order_relaxed);
+        stats.invalidations = invalidations_.load(std::memory_order_relaxed);
+        stats.rejections = rejections_.load(std::memory_order_relaxed);
+        stats.capacity_bytes = capacity_bytes_;
+
+        for (const auto &shard : shards_)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            stats.entries += shard->index.size();
+            stats.bytes += shard->bytes;
+        }
+        return stats;
+    }
+
+private:
+    struct Entry
+    {
+        K key;
+        std::shared_ptr<const V> value;
+        size_t bytes;
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<K, typename std::list<Entry>::iterator, Hash> index;
+        size_t bytes = 0;
+    };
+
+    Shard &shardFor(const K &key)
+    {
+        return *shards_[mix(Hash{}(key)) & shard_mask_];
+    }
+
+    const Shard &shardFor(const K &key) const
+    {
+        return *shards_[mix(Hash{}(key)) & shard_mask_];
+    }
+
+    // std::hash is the identity for integers on libstdc++; spread the bits so
+    // the low bits used for shard selection differ from the bucket index
+    static size_t mix(size_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t shard_mask_ = 0;
+    size_t shard_capacity_ = 0;
+    size_t capacity_bytes_ = 0;
+    SizeFn size_fn_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> insertions_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> invalidations_{0};
+    std::atomic<uint64_t> rejections_{0};
+};
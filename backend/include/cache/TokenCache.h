@@ -0,0 +1,67 @@
+#pragma once
+#include "cache/ShardedLruCache.h"
+#include "utils/FanoutBus.h"
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Result of a successful JWT verification
+struct VerifiedToken
+{
+    std::string user_id;
+    std::time_t exp;
+};
+
+// Sharded cache from a SHA-256 digest of a token to its verified claims, so a
+// token that has already been verified costs one hash lookup instead of an
+// HMAC and two base64 decodes. Expired entries are treated as misses and
+// revoked tokens are never (re)admitted.
+class TokenCache
+{
+public:
+    using Stats = ShardedLruCache<std::string, VerifiedToken>::Stats;
+
+    static TokenCache &getInstance();
+
+    static std::string digest(const std::string &token);
+
+    std::optional<VerifiedToken> lookup(const std::string &digest);
+    // Returns false (and caches nothing) if the digest has been revoked
+    bool insert(const std::string &digest, const VerifiedToken &claims);
+
+    // Revoked digests are remembered until the token would have expired.
+    // Revocations are held in memory and do not survive a restart; other
+    // processes on the bus are told and remember them too.
+    void revoke(const std::string &digest, std::time_t exp);
+    bool isRevoked(const std::string &digest);
+
+    // Relays revocations to and from other processes sharing the database
+    void attachBus(const std::shared_ptr<FanoutBus> &bus);
+
+    Stats getStats() const;
+    size_t revokedCount() const;
+
+    TokenCache(const TokenCache &) = delete;
+    TokenCache &operator=(const TokenCache &) = delete;
+
+private:
+    TokenCache();
+
+    void purgeExpiredRevocations(std::time_t now);
+    // Here only
+    void remember(const std::string &digest, std::time_t exp);
+
+    ShardedLruCache<std::string, VerifiedToken> cache_;
+
+    // digest -> exp; guarded by revoked_mutex_, which insert() also takes so
+    // a token cannot be cached after it has been revoked
+    std::unordered_map<std::string, std::time_t> revoked_;
+    mutable std::mutex revoked_mutex_;
+    std::time_t next_purge_ = 0;
+
+    // Set once at startup; read with std::atomic_load
+    std::shared_ptr<FanoutBus> bus_;
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include "cache/ShardedLruCache.h"
+#include "utils/FanoutBus.h"
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string>
+
+// The public part of a user row needed for presence, cursors and
+// collaborator listings
+struct UserProfile
+{
+    std::string id;
+    std::string username;
+    std::string email;
+};
+
+// Bounded cache of user profiles keyed by id. Misses fall through to
+// UserRepository; UserRepository invalidates entries on update and delete,
+// here and in other processes on the bus.
+class UserProfileCache
+{
+public:
+    using Stats = ShardedLruCache<std::string, UserProfile>::Stats;
+
+    static UserProfileCache &getInstance();
+
+    // Returns the profile for user_id, loading it on a miss
+    std::optional<UserProfile> get(const std::string &user_id);
+
+    // Username for display, or fallback if the user cannot be found
+    std::string getUsername(const std::string &user_id, const std::string &fallback = "User");
+
+    void invalidate(const std::string &user_id);
+
+    // Relays invalidations to and from other processes sharing the database
+    void attachBus(const std::shared_ptr<FanoutBus> &bus);
+
+    Stats getStats() const;
+
+    UserProfileCache(const UserProfileCache &) = delete;
+    UserProfileCache &operator=(const UserProfileCache &) = delete;
+
+private:
+    UserProfileCache();
+
+    // Here only
+    void drop(const std::string &user_id);
+
+    ShardedLruCache<std::string, UserProfile> cache_;
+
+    // Bumped on every invalidation so a load that raced with an update is
+    // not cached
+    std::atomic<uint64_t> generation_{0};
+
+    // Set once at startup; read with std::atomic_load
+    std::shared_ptr<FanoutBus> bus_;
+};
@@ -21,6 +21,7 @@ public:
     
     // Version History
     static crow::response getVersionHistory(const crow::request &req, const std::string &doc_id, const std::string &user_id);
+    static crow::response getDocumentVersion(const crow::request &req, const std::string &doc_id, int version, const std::string &user_id);
     static crow::response restoreVersion(const crow::request &req, const std::string &doc_id, const std::string &version_id, const std::string &user_id);
     
     // Real-time Collaboration
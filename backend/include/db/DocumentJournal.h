@@ -0,0 +1,60 @@
+#pragma once
+#include "models/Document.h"
+#include "models/Operation.h"
+#include "utils/Rope.h"
+#include <optional>
+#include <string>
+#include <vector>
+
+// Durability log for one document's in-memory session: a checksummed
+// snapshot (id, title, content, version) followed by deltas, each the
+// operations taking one version to a later one plus the title there.
+// Recovery takes the snapshot and replays the deltas that follow on from
+// it, so a torn tail write is simply ignored. Once the deltas outgrow the
+// snapshot, the next write is a fresh snapshot renamed over the file, so
+// the journal stays within about twice the document's size however fast
+// it is edited. The journal is truncated once the database holds the same
+// state.
+class DocumentJournal
+{
+public:
+    // Deltas below this many bytes never force a snapshot
+    static const size_t MIN_DELTA_BYTES = 64 * 1024;
+
+    explicit DocumentJournal(const std::string& path);
+    ~DocumentJournal();
+
+    DocumentJournal(const DocumentJournal&) = delete;
+    DocumentJournal& operator=(const DocumentJournal&) = delete;
+
+    // Replaces the file with a snapshot of document's metadata with
+    // content, synced before it takes the journal's place
+    bool writeSnapshot(const Document& document, const Rope& content);
+    // Appends the operations taking version() to document's version; not
+    // durable until sync()
+    bool appendDelta(const Document& document, const std::vector<TextOperation>& ops);
+    bool sync();
+    bool reset();
+    void remove();
+
+    // Version of the last record written, -1 while the file holds none
+    // this journal wrote (the next write must then be a snapshot)
+    int version() const { return version_; }
+    bool needsSnapshot() const;
+    size_t size() const { return size_; }
+
+    static std::string pathFor(const std::string& dir, const std::string& doc_id);
+
+    // Document as the file at path last recorded it, if it holds a snapshot
+    static std::optional<Document> read(const std::string& path);
+
+    // Journal files present in dir; removes snapshots left half-written
+    static std::vector<std::string> list(const std::string& dir);
+
+private:
+    std::string path_;
+    int fd_;
+    size_t size_;
+    size_t snapshot_size_;
+    int version_;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// One insert or delete. Positions and lengths are UTF-16 code units, the way
+// the editor addresses text; for inserts length caches the UTF-16 length of
+// text.
+struct TextOperation
+{
+    enum class Type
+    {
+        Insert,
+        Delete
+    };
+
+    Type type = Type::Insert;
+    size_t position = 0;
+    size_t length = 0;
+    std::string text;
+
+    static TextOperation insert(size_t position, const std::string &text);
+    static TextOperation remove(size_t position, size_t length);
+
+    bool isInsert() const { return type == Type::Insert; }
+    bool isDelete() const { return type == Type::Delete; }
+};
+
+// A client's edit after it was sequenced: the components as applied (already
+// transformed) and the document revision they produced
+struct AppliedOperation
+{
+    int revision = 0;
+    std::string user_id;
+    std::vector<TextOperation> ops;
+};
@@ -1,10 +1,13 @@
 #pragma once
 #include "models/Document.h"
+#include <memory>
 #include <string>
 #include <optional>
 #include <vector>
 
+struct sqlite3;
 struct sqlite3_stmt;
+class FanoutBus;
 
 class DocumentRepository
 {
@@ -17,13 +20,26 @@ public:
     std::vector<Document> findByOwnerId(const std::string& owner_id);
     bool updateDocument(const Document& document);
     bool deleteDocument(const std::string& id);
+    // Writes a session snapshot with its own version number, guarded by the
+    // version the database is expected to hold
+    bool persistSnapshot(const Document& document, int expected_version);
     
     // Utility
     bool documentExists(const std::string& id);
     bool isOwner(const std::string& doc_id, const std::string& user_id);
+    std::optional<std::string> findOwnerId(const std::string& id);
+    std::optional<int> findVersion(const std::string& id);
+    
+    // Other processes sharing the database drop their cached rows when this
+    // one writes, and the other way round
+    static void attachBus(const std::shared_ptr<FanoutBus>& bus);
 
 private:
     std::string generateId();
+    std::optional<Document> fetchById(sqlite3* conn, const std::string& id);
     Document mapRowToDocument(sqlite3_stmt* stmt);
+    // Drops cached rows older than min_version (all of them if negative),
+    // here and in other processes; called with the database mutex held
+    static void invalidate(const std::string& id, int min_version);
 };
 
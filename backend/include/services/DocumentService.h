@@ -3,13 +3,26 @@
 #include <string>
 #include <vector>
 
+namespace crow
+{
+    namespace websocket
+    {
+        struct connection;
+    }
+}
+
 class DocumentService
 {
 public:
     static Document createDocument(const std::string& owner_id, const std::string& title, const std::string& content = "");
     static Document getDocumentById(const std::string& doc_id, const std::string& user_id);
+    // Current version after an access check, without reading the body
+    static int getDocumentVersion(const std::string& doc_id, const std::string& user_id);
     static std::vector<Document> getAllUserDocuments(const std::string& user_id);
-    static Document updateDocument(const std::string& doc_id, const std::string& user_id, const std::string& title, const std::string& content, int expected_version = -1);
+    // With an open room the change goes to it as an operation in revision
+    // order; origin, the connection that saved, gets an ack instead
+    static Document updateDocument(const std::string& doc_id, const std::string& user_id, const std::string& title, const std::string& content, int expected_version = -1,
+                                   crow::websocket::connection* origin = nullptr);
     static Document renameDocument(const std::string& doc_id, const std::string& user_id, const std::string& new_title);
     static void deleteDocument(const std::string& doc_id, const std::string& user_id);
 };
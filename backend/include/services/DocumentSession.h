@@ -0,0 +1,133 @@
+#pragma once
+#include "models/Document.h"
+#include "models/Operation.h"
+#include "utils/Rope.h"
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Authoritative state of a document while it has an active room. Edits
+// apply here and bump the version exactly as a database update would;
+// DocumentSessionManager persists the latest state write-behind.
+// The version doubles as the OT revision: every change is kept in a bounded
+// history so operations made against an older revision can be transformed.
+// Content lives in a Rope, so an edit costs O(log n) rather than a copy of
+// the whole document, and snapshots for persistence share its nodes.
+// A session whose room another process owns follows that process instead:
+// it takes the owner's revisions and state as they come, and is never
+// written or journaled, since the owner does both.
+class DocumentSession
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Metadata (content left empty) and content, taken together in O(1)
+    struct State
+    {
+        Document document;
+        Rope content;
+    };
+
+    static const size_t MAX_HISTORY = 1000;
+
+    explicit DocumentSession(const Document& persisted);
+
+    // Flattens the content; prefer state() where chunks will do
+    Document snapshot() const;
+    State state() const;
+    std::string getTitle() const;
+    int getVersion() const;
+
+    // Replaces title and content. expected_version > 0 enables optimistic
+    // locking and throws VERSION_CONFLICT on mismatch, like DocumentService.
+    // Returns nullopt once the session has been closed; callers then fall
+    // back to the database. Resubmitting the current state changes nothing
+    // and keeps the version. The revision made, if any, goes to recorded
+    // (revision 0 otherwise) for the caller to announce under sequencer().
+    std::optional<Document> apply(const std::string& title, const std::string& content, int expected_version = -1,
+                                  AppliedOperation* recorded = nullptr);
+
+    // Changes only the title, keeping whatever content is current
+    std::optional<Document> rename(const std::string& title, AppliedOperation* recorded = nullptr);
+
+    // Transforms ops made at base_revision past everything sequenced since,
+    // applies them and assigns the next revision. Throws REVISION_TOO_OLD
+    // when the history no longer reaches base_revision.
+    std::optional<AppliedOperation> applyOperations(int base_revision, std::vector<TextOperation> ops, const std::string& user_id);
+
+    // Operations sequenced after revision, oldest first
+    std::vector<AppliedOperation> operationsSince(int revision) const;
+    // Operations taking revision from to revision to, in one sequence;
+    // nullopt once the history no longer covers every revision between
+    std::optional<std::vector<TextOperation>> operationsBetween(int from, int to) const;
+
+    // Held while a revision (operation, full-content save or rename) is
+    // made and announced, so peers receive revisions in order
+    std::mutex& sequencer() { return sequencer_; }
+
+    // Connection bookkeeping; returns the new count
+    size_t addConnection();
+    size_t removeConnection();
+    size_t connectionCount() const;
+
+    // Write-behind bookkeeping, driven by DocumentSessionManager
+    bool isDirty() const;
+    bool needsJournal() const;
+    int getPersistedVersion() const;
+    // persisted is the state() that was written
+    void markPersisted(const State& persisted);
+    void markJournaled(int version);
+    // The database moved underneath the session: the row's changes since
+    // the last write are merged into the session as one revision, returned
+    // for the caller to announce under sequencer(). A title changed on both
+    // sides keeps the session's. Revisions jump past the database's
+    // version when they must, and operations against older ones resync.
+    std::optional<AppliedOperation> merge(const Document& database);
+
+    // Follower bookkeeping, driven by DocumentSessionManager. Following
+    // starts from a clean session.
+    bool isFollowing() const;
+    void startFollowing();
+    // Applies a revision the owner made, titled title. Revisions already
+    // applied are skipped; returns false for one that does not follow on
+    // from this copy's version.
+    bool follow(const AppliedOperation& applied, const std::string& title);
+    // Takes the owner's title, content and version. Returns false if the
+    // version was this copy's already, which then had the same state.
+    bool resync(const Document& owner);
+    // Stops following, taking the database's state as the new owner;
+    // returns false if this copy was at its version already
+    bool adopt(const Document& database);
+    // Closes a clean, unattended session so it can be evicted
+    bool close();
+    Clock::time_point lastEdit() const;
+    Clock::time_point lastPersist() const;
+
+private:
+    void record(AppliedOperation applied);
+    void checkHistoryReaches(int revision) const;
+    // Replaces title, content and version, dropping the history if the
+    // version changes; returns whether it did
+    bool replaceLocked(const Document& document);
+    // A follower's copy is the owner's to write; nothing is left dirty
+    void settleLocked();
+
+    mutable std::mutex mutex_;
+    std::mutex sequencer_;
+    Document document_;
+    Rope content_;
+    std::deque<AppliedOperation> history_;
+    // What the last write left in the database, the base of merge()
+    std::string persisted_title_;
+    Rope persisted_content_;
+    int persisted_version_;
+    int journaled_version_;
+    size_t connections_;
+    bool closed_;
+    bool following_;
+    Clock::time_point last_edit_;
+    Clock::time_point last_persist_;
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include "services/DocumentSession.h"
+#include "db/DocumentJournal.h"
+#include "utils/FanoutBus.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+// Owns the in-memory sessions of documents with an active room. The first
+// connection loads the document, edits apply to the session, and a
+// background thread journals changes every JOURNAL_INTERVAL and writes the
+// latest state to SQLite when the document goes idle, every
+// MAX_PERSIST_INTERVAL while it keeps changing, and on last leave.
+// Both delays stretch with room size (up to MAX_ROOM_SCALE times), and no
+// session is written more often than every MIN_PERSIST_SPACING, so a room
+// costs a bounded number of database writes per minute however many
+// clients it has. The journal covers whatever is still waiting.
+// With a FanoutBus attached, only the process that owns a document's room
+// makes revisions; it relays each one to the processes following the room
+// and keeps the lease until its session has been written and evicted, so
+// whoever owns the room next finds the latest state in the database.
+// Followers keep their sessions current from the relayed revisions, and
+// resync from the owner's state when they start following or miss one.
+class DocumentSessionManager
+{
+public:
+    struct Stats
+    {
+        size_t active_sessions = 0;
+        uint64_t persists = 0;
+        uint64_t persist_failures = 0;
+        uint64_t persists_deferred = 0;
+        uint64_t journal_records = 0;
+        // Of journal_records, full snapshots rather than operations
+        uint64_t journal_snapshots = 0;
+        uint64_t journal_syncs = 0;
+        uint64_t recovered = 0;
+    };
+
+    static const std::chrono::milliseconds JOURNAL_INTERVAL;
+    static const std::chrono::milliseconds IDLE_PERSIST_DELAY;
+    static const std::chrono::milliseconds MAX_PERSIST_INTERVAL;
+    static const std::chrono::milliseconds MIN_PERSIST_SPACING;
+    static const size_t MAX_ROOM_SCALE = 4;
+
+    static DocumentSessionManager& getInstance();
+
+    // Replays journals left by an unclean exit, then starts the writer thread
+    void start(const std::string& journal_dir = "docs_journal");
+    // Persists every dirty session and stops the writer thread
+    void shutdown();
+
+    // Registers a connection, loading the session on first join.
+    // Returns nullptr if the document does not exist.
+    std::shared_ptr<DocumentSession> join(const std::string& doc_id);
+    void leave(const std::string& doc_id);
+
+    // Active session for doc_id, if any
+    std::shared_ptr<DocumentSession> find(const std::string& doc_id) const;
+
+    // Drops a session and its journal without persisting (document deleted)
+    void discard(const std::string& doc_id);
+
+    // Follows rooms other processes own over bus; call before the bus
+    // starts
+    void attachBus(const std::shared_ptr<FanoutBus>& bus);
+    // Relays a revision just made to the room's followers, if this process
+    // owns it. Called with the session's sequencer held, like
+    // EditService::announce.
+    void relay(const std::string& doc_id, const AppliedOperation& applied);
+
+    // Called with the session's sequencer held when its state jumped to the
+    // owner's (or, for a new owner, the database's), for the room to be
+    // sent a fresh snapshot
+    using ResyncHandler = std::function<void(const std::string& doc_id, const DocumentSession& session)>;
+    void onResync(ResyncHandler handler);
+
+    Stats getStats() const;
+
+private:
+    DocumentSessionManager();
+    ~DocumentSessionManager();
+    DocumentSessionManager(const DocumentSessionManager&) = delete;
+    DocumentSessionManager& operator=(const DocumentSessionManager&) = delete;
+
+    void run();
+    void flush(bool force);
+    // Whether a dirty session's write is due now. A due write held back by
+    // MIN_PERSIST_SPACING counts as deferred on every check.
+    bool persistDue(const DocumentSession& session, DocumentSession::Clock::time_point now);
+    // announce: send the room a merge the write ran into
+    void persist(const std::string& doc_id, const std::shared_ptr<DocumentSession>& session, bool announce = true);
+    // Merges the database's row, at database_version, into the session
+    void mergeDatabase(const std::string& doc_id, const std::shared_ptr<DocumentSession>& session, int database_version,
+                       bool announce);
+    void recover();
+    DocumentJournal& journalFor(const std::string& doc_id);
+
+    // Bus handlers, on the bus's thread
+    void leased(const std::string& doc_id, FanoutBus::Lease lease);
+    void followRevision(const FanoutBus::Message& message);
+    void answerSync(const std::string& doc_id);
+    void takeSync(const FanoutBus::Message& message);
+    // Writes what a session sequenced itself, then has it follow the owner
+    void demote(const std::string& doc_id, const std::shared_ptr<DocumentSession>& session);
+    // Asks the owner for its state, unless already waiting for it
+    void requestSync(const std::string& doc_id, bool again = false);
+    void publishSync(FanoutBus& bus, const std::string& doc_id, const Document& document);
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<DocumentSession>> sessions_;
+    // Rooms subscribed on the bus until their session is evicted, which
+    // keeps the lease here until the session's revisions are written;
+    // guarded by mutex_
+    std::unordered_set<std::string> held_;
+    // Rooms waiting for the owner's state; guarded by mutex_
+    std::unordered_set<std::string> syncing_;
+    // Set once at startup; read with std::atomic_load
+    std::shared_ptr<FanoutBus> bus_;
+    // Read with std::atomic_load
+    std::shared_ptr<const ResyncHandler> resync_handler_;
+
+    // Held by the writer for a whole flush; guards journals_
+    std::mutex io_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<DocumentJournal>> journals_;
+
+    std::condition_variable cv_;
+    std::thread worker_;
+    bool running_;
+    bool wake_;
+    std::string journal_dir_;
+
+    std::atomic<uint64_t> persists_;
+    std::atomic<uint64_t> persist_failures_;
+    std::atomic<uint64_t> persists_deferred_;
+    std::atomic<uint64_t> journal_records_;
+    std::atomic<uint64_t> journal_snapshots_;
+    std::atomic<uint64_t> journal_syncs_;
+    std::atomic<uint64_t> recovered_;
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include "models/Operation.h"
+#include "crow/websocket.h"
+#include <string>
+#include <vector>
+
+// Entry point for operation-based editing from WebSocket and REST clients.
+// Operations are sequenced by the document's session, which gives every
+// document a single total order.
+class EditService
+{
+public:
+    // Applies ops made at base_revision, acks origin (if any) and sends the
+    // transformed operation to the rest of the room
+    static AppliedOperation submitOperations(const std::string& doc_id, const std::string& user_id, int base_revision,
+                                             std::vector<TextOperation> ops, crow::websocket::connection* origin = nullptr);
+
+    // Sends a revision just made by the session to the room, origin (if
+    // any) getting an ack in its place. Called with the session's
+    // sequencer held, in the same critical section that made the revision.
+    static void announce(const std::string& doc_id, const AppliedOperation& applied, crow::websocket::connection* origin = nullptr);
+
+    // Operations sequenced after revision; current_revision receives the
+    // document's revision. Throws REVISION_TOO_OLD when they are gone.
+    static std::vector<AppliedOperation> getOperationsSince(const std::string& doc_id, const std::string& user_id, int revision, int& current_revision);
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include "models/Operation.h"
+#include "utils/Rope.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+// Insert/delete operational transform. An operation is a sequence of
+// components applied left to right; transform() rewrites one sequence so it
+// applies after a concurrent one and both orders converge.
+class OperationalTransform
+{
+public:
+    using Operations = std::vector<TextOperation>;
+
+    // ops rewritten to apply after against. Both must describe edits to the
+    // same document state. Inserts at the same position keep against first,
+    // since it was sequenced earlier.
+    static Operations transform(const Operations& ops, const Operations& against);
+
+    // Applies ops to UTF-8 content. Throws std::out_of_range or
+    // std::invalid_argument for a position the content does not have, in
+    // which case content is left unchanged.
+    static void apply(std::string& content, const Operations& ops);
+    static void apply(Rope& content, const Operations& ops);
+
+    // Operations turning old_content into new_content; a minimal edit
+    // script where TextDiff can find one within its budget
+    static Operations replace(const std::string& old_content, const std::string& new_content);
+
+private:
+    static std::pair<Operations, Operations> transformPair(const Operations& a, const Operations& b);
+    static Operations transformComponent(TextOperation a, const TextOperation& b, bool a_wins_ties);
+};
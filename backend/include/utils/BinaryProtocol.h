@@ -0,0 +1,91 @@
+#pragma once
+#include "models/Operation.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Compact binary framing for WebSocket clients that connect with
+// ?protocol=bin1; everyone else keeps the JSON frames. A message is a varint
+// type followed by its fields: integers are LEB128 varints, strings a varint
+// byte length and raw UTF-8. Users are interned: USER binds a small index to
+// an id and name the first time a connection needs it (and again if the name
+// changes), and later messages carry only the index. The document is implied
+// by the connection, except in a CHANNEL, which names it (either direction).
+//
+//   server -> client                        client -> server
+//   HELLO   version                         SUBMIT   revision, ops
+//   USER    index, user_id, username        CURSOR   position
+//   OP      revision, user, ops             RECEIPT  count
+//   ACK     revision
+//   CURSOR  user, position + 1 (0: none)
+//   BATCH   count, (length, message)...
+//   DEFLATE a compressed message; see FrameDeflater
+//   SEQ     seq, message (the rest of the frame); see ReplayLog
+//   CHANNEL doc_id, message (the rest of the frame)
+//
+// ops is a count, then per component a kind (0 insert, 1 delete), the
+// UTF-16 position, and the text or the UTF-16 length.
+class BinaryProtocol
+{
+public:
+    static const uint32_t VERSION = 1;
+    static const char* const NAME;
+
+    enum Type : uint32_t
+    {
+        HELLO = 1,
+        USER = 2,
+        OP = 3,
+        ACK = 4,
+        CURSOR = 5,
+        BATCH = 6,
+        DEFLATE = 7,
+        SEQ = 8,
+        CHANNEL = 9,
+        SUBMIT = 16,
+        CLIENT_CURSOR = 17,
+        RECEIPT = 18
+    };
+
+    struct ClientMessage
+    {
+        Type type = SUBMIT;
+        int revision = 0;
+        std::vector<TextOperation> ops;
+        bool has_position = false;
+        size_t position = 0;
+        uint64_t count = 0;
+        // Document of a CHANNEL message; empty for the connection's own
+        std::string channel;
+    };
+
+    struct InternedUser
+    {
+        std::string user_id;
+        std::string username;
+        // Bumped when the username changes, so connections learn it again
+        uint32_t generation = 0;
+    };
+
+    // Index for user_id, starting at 1. An empty username leaves the known
+    // one in place.
+    static uint32_t internUser(const std::string& user_id, const std::string& username = "");
+    static bool lookupUser(uint32_t index, InternedUser& user);
+
+    static std::string helloFrame();
+    static std::string userFrame(uint32_t index, const InternedUser& user);
+    static std::string opFrame(const AppliedOperation& applied, uint32_t user);
+    static std::string ackFrame(int revision);
+    static std::string cursorFrame(uint32_t user, bool has_position, size_t position);
+    static std::string batchFrame(const std::vector<std::shared_ptr<const std::string>>& messages);
+    static std::string seqFrame(uint64_t seq, const std::string& message);
+    static std::string channelFrame(const std::string& doc_id, const std::string& message);
+
+    // Parses a client message. Throws std::invalid_argument on malformed
+    // input, with the same limits as the JSON path.
+    static ClientMessage decode(const std::string& frame);
+
+    static void putVarint(std::string& out, uint64_t value);
+    static void putString(std::string& out, const std::string& value);
+};
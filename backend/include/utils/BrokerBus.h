@@ -0,0 +1,122 @@
+#pragma once
+#include "utils/FanoutBroker.h"
+#include "utils/FanoutBus.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// FanoutBus over a FanoutBroker's Unix domain socket. The first process to
+// take the lock file next to the socket runs the broker itself, so a group
+// of processes needs nothing else started; if it exits, the next process
+// to reconnect takes over. Subscriptions are sent again on every
+// reconnect, and whatever is published while disconnected is dropped, as
+// is a message too large for the wire format; publish never throws, since
+// it is called in the middle of a local broadcast. From when a connection
+// is lost or cannot be made until the next one is, the bus is degraded
+// (see FanoutBus) and every subscribed room is Owned.
+// One thread writes everything queued since its last write in one go and
+// dispatches what arrives to the handlers.
+class BrokerBus : public FanoutBus
+{
+public:
+    struct Stats
+    {
+        bool connected = false;
+        bool hosting = false;
+        uint64_t published = 0;
+        uint64_t delivered = 0;
+        uint64_t dropped = 0;
+        // Of dropped, messages over FanoutBroker::MAX_MESSAGE
+        uint64_t oversize = 0;
+        uint64_t reconnects = 0;
+    };
+
+    static const std::chrono::milliseconds RECONNECT_DELAY;
+    // Messages published while this far behind the socket are dropped
+    static const size_t MAX_BACKLOG = 64 << 20;
+
+    // With host, runs the broker at path when no other process does
+    explicit BrokerBus(const std::string& path, bool host = true);
+    ~BrokerBus() override;
+
+    void start();
+    void stop();
+
+    void subscribe(const std::string& room) override;
+    void unsubscribe(const std::string& room) override;
+    void publish(const Message& message) override;
+    Lease lease(const std::string& room) const override;
+    Lease awaitLease(const std::string& room, std::chrono::milliseconds timeout) const override;
+    void onMessage(Kind kind, Handler handler) override;
+    void onLease(LeaseHandler handler) override;
+
+    Stats getStats() const;
+
+private:
+    BrokerBus(const BrokerBus&) = delete;
+    BrokerBus& operator=(const BrokerBus&) = delete;
+
+    void run();
+    int connect();
+    bool host();
+    // Called with mutex_ held
+    void queue(FanoutBroker::Op op, const Message& message);
+    void wakeLocked();
+    void dispatch(const char* data, const FanoutBroker::Parsed& parsed);
+    // Own or Follow from the broker
+    void leased(const FanoutBroker::Parsed& parsed, const std::string& subscription);
+    // Calls the lease handler, if any, logging what it throws
+    void notifyLease(const std::string& room, Lease lease);
+    // Every room back to Pending; called with mutex_ held
+    void resetLeasesLocked();
+    // Without the broker: every room Owned, a followed one once the lease
+    // handler has taken it over
+    void degrade();
+
+    struct Subscription
+    {
+        // Of its Subscribe on this connection, 0 if not sent yet
+        uint64_t number = 0;
+        // subscribe() calls not yet matched by unsubscribe()
+        size_t count = 0;
+        Lease lease = Lease::Pending;
+    };
+
+    std::string path_;
+    bool host_;
+    std::unique_ptr<FanoutBroker> broker_;
+    int lock_fd_;
+    std::array<Handler, KIND_COUNT> handlers_;
+    LeaseHandler lease_handler_;
+
+    // Guards rooms_, subscribes_, out_, connected_, degraded_, running_
+    // and wake_pending_
+    mutable std::mutex mutex_;
+    // Signalled when a lease changes
+    mutable std::condition_variable leased_;
+    // Owned while degraded, Pending again on connecting until the broker
+    // answers anew
+    std::unordered_map<std::string, Subscription> rooms_;
+    uint64_t subscribes_;
+    // Encoded messages waiting for the socket
+    std::string out_;
+    bool connected_;
+    bool degraded_;
+    bool running_;
+    bool wake_pending_;
+    int wake_[2];
+    std::thread worker_;
+
+    std::atomic<bool> hosting_;
+    std::atomic<uint64_t> published_;
+    std::atomic<uint64_t> delivered_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> oversize_;
+    std::atomic<uint64_t> reconnects_;
+};
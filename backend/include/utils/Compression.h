@@ -0,0 +1,12 @@
+#pragma once
+#include <string>
+
+class Compression
+{
+public:
+    // gzip container (RFC 1952), suitable for Content-Encoding: gzip
+    static std::string gzip(const std::string& input, int level = 6);
+    
+    // Whether an Accept-Encoding header value allows gzip
+    static bool acceptsGzip(const std::string& accept_encoding);
+};
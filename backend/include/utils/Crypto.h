@@ -11,6 +11,9 @@ public:
     // Generate random salt
     static std::string generateSalt();
     
+    // 128 random bits as 32 hex digits, for opaque session tokens
+    static std::string generateToken();
+    
 private:
     // Simple SHA-256 based hashing (for production, use bcrypt or argon2)
     static std::string sha256(const std::string& input);
@@ -0,0 +1,150 @@
+#pragma once
+#include "utils/FanoutBus.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct iovec;
+
+// Local broker for FanoutBus: a Unix domain socket that docs_app processes
+// on one host connect to. It keeps each process's subscriptions and hands
+// every published message to the other processes subscribed to its room,
+// forwarding the bytes as they came, copied once however many receive them.
+// One thread polls every connection. A process that stops reading first
+// loses presence (past PRESENCE_BACKLOG) and is then disconnected (past
+// MAX_BACKLOG), so it never holds up the others.
+//
+// Each room is leased to one of its subscribers, the one that subscribed
+// earliest and is still subscribed; that process alone sequences edits to
+// the document. Every Subscribe is answered with Own or Follow, and when
+// the owner unsubscribes or disconnects the next one is sent Own.
+//
+// On the wire every message is a little-endian u32 length, then u8 Op,
+// u8 FanoutBus::Kind, u16 room length, the room and the payload. Publish
+// is sent back out unchanged to subscribers. Own and Follow carry the
+// number of the subscription they answer, counting the Subscribes a
+// process has sent on its connection from 1, so one that arrives after the
+// process unsubscribed and subscribed again is recognised as stale.
+class FanoutBroker
+{
+public:
+    enum class Op : uint8_t
+    {
+        Subscribe = 1,
+        Unsubscribe = 2,
+        Publish = 3,
+        // Broker to process: the room is leased to it
+        Own = 4,
+        // Broker to process: the room is leased to another process
+        Follow = 5
+    };
+
+    // A message found at the front of a buffer; payload is an offset into it
+    struct Parsed
+    {
+        Op op = Op::Publish;
+        FanoutBus::Kind kind = FanoutBus::Kind::Broadcast;
+        std::string room;
+        size_t payload = 0;
+        size_t payload_size = 0;
+        // Bytes of the whole message
+        size_t size = 0;
+    };
+
+    struct Stats
+    {
+        uint64_t peers = 0;
+        uint64_t rooms = 0;
+        uint64_t published = 0;
+        uint64_t relayed = 0;
+        uint64_t presence_dropped = 0;
+        uint64_t disconnected = 0;
+        // Rooms leased to a process, first subscribers and handovers
+        uint64_t leases = 0;
+    };
+
+    static const size_t HEADER_SIZE = 8;
+    static const size_t MAX_MESSAGE = 16 << 20;
+    static const size_t PRESENCE_BACKLOG = 1 << 20;
+    static const size_t MAX_BACKLOG = 64 << 20;
+
+    explicit FanoutBroker(const std::string& path);
+    ~FanoutBroker();
+
+    // Listens on path, replacing whatever file is there; throws
+    // std::runtime_error if it cannot
+    void start();
+    // Disconnects every process and removes the socket
+    void stop();
+
+    Stats getStats() const;
+
+    // Whether encode() takes the message: a room and payload within the
+    // wire format's limits
+    static bool fits(const FanoutBus::Message& message);
+    // Throws std::runtime_error for a message that does not fit
+    static std::string encode(Op op, const FanoutBus::Message& message);
+    // Size of the message at the front of data (0 if it is incomplete);
+    // throws std::runtime_error on a malformed one
+    static size_t parse(const char* data, size_t size, Parsed& parsed);
+
+    // Connected, non-blocking socket to a broker at path; -1 if none answers
+    static int connect(const std::string& path);
+    // sendmsg without SIGPIPE on a closed peer
+    static ssize_t sendSome(int fd, const struct iovec* iov, int count);
+
+private:
+    struct Peer
+    {
+        int fd = -1;
+        std::string in;
+        std::deque<std::shared_ptr<const std::string>> out;
+        // Bytes of out.front() already written
+        size_t out_offset = 0;
+        size_t backlog = 0;
+        // Room -> number of the Subscribe that joined it
+        std::unordered_map<std::string, uint64_t> rooms;
+        uint64_t subscribes = 0;
+        bool closing = false;
+    };
+
+    void run();
+    void acceptPeers();
+    // False once the peer is gone or sent garbage
+    bool readFrom(Peer& peer);
+    void handle(Peer& from, const Parsed& parsed, const char* data);
+    void enqueue(Peer& peer, const std::shared_ptr<const std::string>& bytes, FanoutBus::Kind kind);
+    bool flush(Peer& peer);
+    void drop(int fd);
+    // Removes fd from room's subscribers, leasing the room to the next one
+    // if fd held it
+    void leave(const std::string& room, int fd);
+    // Sends peer Own or Follow for room
+    void lease(Peer& peer, const std::string& room, Op op = Op::Own);
+
+    std::string path_;
+    int listen_fd_;
+    int wake_[2];
+    std::thread worker_;
+    std::atomic<bool> running_;
+
+    // Worker thread only
+    std::unordered_map<int, Peer> peers_;
+    std::unordered_map<std::string, std::vector<int>> rooms_;
+
+    std::atomic<uint64_t> peer_count_;
+    std::atomic<uint64_t> room_count_;
+    std::atomic<uint64_t> published_;
+    std::atomic<uint64_t> relayed_;
+    std::atomic<uint64_t> presence_dropped_;
+    std::atomic<uint64_t> disconnected_;
+    std::atomic<uint64_t> leases_;
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Carries room traffic between docs_app processes, so the members of a room
+// can be connected to different processes. A process subscribes to the
+// rooms it has members in and publishes what it broadcasts to them; a
+// message reaches every other process subscribed to its room and no process
+// that is not. Invalidations go to every other process, since any of them
+// may have the document, access list, token or profile cached.
+// Delivery is at most once, in publish order per publisher.
+// Each subscribed room is owned by one of its subscribers at a time, the
+// only process that may sequence edits to the document. The others follow:
+// the owner publishes every revision it makes, and a follower keeps its
+// copy of the document current from them, asking the owner for its whole
+// state when it first follows or finds a revision missing.
+// A bus that cannot reach the others degrades to how a process runs with
+// no bus at all: it owns every room it has subscribed to, and processes
+// sharing a room each sequence their own edits, reconciled by the merge
+// each makes when it writes over the other's. Once the bus is back every
+// room is leased anew; a process that has to follow writes what it has
+// first, and the owner merges that in when the follower asks for its state.
+class FanoutBus
+{
+public:
+    enum class Kind : uint8_t
+    {
+        // Frames broadcast to a room
+        Broadcast = 1,
+        // Presence frames; dropped for a process that falls behind, as a
+        // newer one supersedes them anyway
+        Presence = 2,
+        // The document with the room's id changed in the database
+        Invalidate = 3,
+        // The access list of the document with the room's id changed
+        AclChanged = 4,
+        // The token whose TokenCache digest is the room was revoked; the
+        // payload is its expiry in seconds since the epoch
+        TokenRevoked = 5,
+        // The user with the room's id changed or was deleted
+        ProfileChanged = 6,
+        // A revision the room's owner made
+        Revision = 7,
+        // A follower asks the room's owner for its state
+        SyncRequest = 8,
+        // The room's owner's state of the document
+        Sync = 9
+    };
+
+    static const uint8_t KIND_COUNT = 10;
+
+    // Where this process stands with a room
+    enum class Lease : uint8_t
+    {
+        // Not subscribed
+        None,
+        // Subscribed; the broker has not answered yet
+        Pending,
+        Owned,
+        Following
+    };
+
+    // Kinds that go to every other process rather than to a room's
+    // subscribers
+    static bool toAllProcesses(Kind kind)
+    {
+        return kind == Kind::Invalidate || kind == Kind::AclChanged || kind == Kind::TokenRevoked ||
+               kind == Kind::ProfileChanged;
+    }
+
+    struct Message
+    {
+        Kind kind = Kind::Broadcast;
+        std::string room;
+        std::string payload;
+    };
+
+    // Called on the bus's own thread, one message at a time
+    using Handler = std::function<void(const Message&)>;
+    // Called on the bus's own thread when the broker leases room to this
+    // process (Owned) or to another one (Following), or with Owned for a
+    // room this process followed when the bus degrades; before lease()
+    // reports it
+    using LeaseHandler = std::function<void(const std::string& room, Lease lease)>;
+
+    virtual ~FanoutBus() = default;
+
+    // Subscriptions are counted: a room stays subscribed, and its lease
+    // held, until every subscribe has been matched by an unsubscribe
+    virtual void subscribe(const std::string& room) = 0;
+    virtual void unsubscribe(const std::string& room) = 0;
+    virtual void publish(const Message& message) = 0;
+
+    virtual Lease lease(const std::string& room) const = 0;
+    // lease(room), once it is no longer Pending or after timeout
+    virtual Lease awaitLease(const std::string& room, std::chrono::milliseconds timeout) const = 0;
+    // Whether this process owns room. False until the bus hears it does,
+    // and for a room it has not subscribed to.
+    bool owns(const std::string& room) const { return lease(room) == Lease::Owned; }
+
+    // Sets the handler for messages of kind from other processes; set
+    // before the bus starts
+    virtual void onMessage(Kind kind, Handler handler) = 0;
+    // Sets the handler for lease changes; set before the bus starts
+    virtual void onLease(LeaseHandler handler) = 0;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <zlib.h>
+#include <cstdint>
+#include <string>
+
+// Deflate for WebSocket frames at or above THRESHOLD bytes, mostly "saved"
+// frames carrying a whole document. Crow does not negotiate RFC 7692
+// permessage-deflate, so this is the same scheme carried in the message:
+// clients opt in at connect with ?deflate=1 and get binary frames
+//
+//   DEFLATE  form (0 JSON text, 1 BinaryProtocol), length, raw deflate data
+//
+// that inflate to length bytes of the original message. Without context
+// takeover (the default) every frame is a complete deflate stream, so a
+// broadcast is compressed once and the bytes are shared by every recipient
+// with the same window size. With ?deflate_takeover=1 a connection keeps
+// its own stream and frames end in a sync flush with the trailing
+// 00 00 ff ff removed, as in RFC 7692; ratios improve for repetitive traffic
+// at the cost of per-connection state. ?deflate_window_bits=N asks for a
+// smaller window; the server caps it at MAX_WINDOW_BITS and uses MEM_LEVEL,
+// which bounds a stream to about 2^(bits+2) + 2^(MEM_LEVEL+9) bytes.
+class FrameDeflater
+{
+public:
+    struct Options
+    {
+        bool enabled = false;
+        bool context_takeover = false;
+        int window_bits = 12;
+    };
+
+    struct Stats
+    {
+        uint64_t frames = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        uint64_t shared_reuses = 0;
+    };
+
+    static const size_t THRESHOLD = 512;
+    static const int MIN_WINDOW_BITS = 9;
+    static const int MAX_WINDOW_BITS = 12;
+    static const int MEM_LEVEL = 5;
+    static const int LEVEL = 6;
+
+    // From the connect URL's deflate, deflate_takeover and
+    // deflate_window_bits parameters; any may be null
+    static Options negotiate(const char* deflate, const char* takeover, const char* window_bits);
+
+    explicit FrameDeflater(int window_bits);
+    ~FrameDeflater();
+    FrameDeflater(const FrameDeflater&) = delete;
+    FrameDeflater& operator=(const FrameDeflater&) = delete;
+
+    // DEFLATE frame for message, continuing this connection's stream
+    std::string wrap(const std::string& message, bool binary);
+
+    // DEFLATE frame for message as a stream of its own
+    static std::string wrapOnce(const std::string& message, bool binary, int window_bits);
+
+    static void countSharedReuse();
+    static Stats getStats();
+
+private:
+    static std::string header(const std::string& message, bool binary);
+
+    z_stream stream_;
+    int window_bits_;
+    bool ready_;
+};
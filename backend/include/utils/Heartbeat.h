@@ -0,0 +1,104 @@
+#pragma once
+#include "crow/websocket.h"
+#include "utils/TimerWheel.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+// Finds WebSocket connections whose client is gone. A half-open TCP
+// connection (a laptop that went to sleep) does not error until the kernel
+// gives up on it, and until then broadcasts keep queueing to it and the
+// room shows its user. Any message from the client is a sign of life; a
+// connection idle for half the timeout is sent {"type":"ping"}, which
+// clients answer with {"type":"pong"}, and one idle for the whole timeout
+// is handed to the reaper.
+// Deadlines live in a TimerWheel of TICK ticks. Activity only stamps the
+// connection's Liveness; its timer is moved when it comes due, so a tick
+// costs the connections due in it, not every connection.
+class Heartbeat
+{
+public:
+    struct Stats
+    {
+        uint64_t watched = 0;
+        uint64_t pings = 0;
+        uint64_t reaped = 0;
+    };
+
+    static const std::chrono::milliseconds TICK;
+    static const std::chrono::seconds DEFAULT_TIMEOUT;
+    static const char* const PING;
+
+    // Stamped by the connection's handlers on every message; lock-free
+    class Liveness
+    {
+    public:
+        void touch();
+
+    private:
+        friend class Heartbeat;
+        std::atomic<int64_t> seen_ms_{0};
+    };
+
+    using Reaper = std::function<void(crow::websocket::connection*)>;
+
+    static Heartbeat& getInstance();
+
+    // Starts the tick thread; connections idle for timeout are reaped
+    void start(std::chrono::seconds timeout = DEFAULT_TIMEOUT);
+    void stop();
+
+    // Called on the tick thread, outside any lock, for each dead connection;
+    // it is no longer watched
+    void onTimeout(Reaper reaper);
+
+    std::shared_ptr<Liveness> watch(crow::websocket::connection* conn);
+    // Stops watching conn, waiting out a reap of it in progress
+    void forget(crow::websocket::connection* conn);
+
+    Stats getStats() const;
+
+private:
+    Heartbeat();
+    ~Heartbeat();
+    Heartbeat(const Heartbeat&) = delete;
+    Heartbeat& operator=(const Heartbeat&) = delete;
+
+    struct Watched
+    {
+        crow::websocket::connection* conn;
+        std::shared_ptr<Liveness> liveness;
+        // When it was last pinged, -1 if never
+        int64_t pinged_ms = -1;
+    };
+
+    static int64_t nowMs();
+    static uint64_t tickOf(int64_t ms);
+    static uint64_t keyOf(crow::websocket::connection* conn);
+
+    void run();
+    void tick();
+
+    // Guards wheel_, watched_, reaping_ and reaper_
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable reaped_cv_;
+    TimerWheel wheel_;
+    std::unordered_map<uint64_t, Watched> watched_;
+    // Handed to the reaper and not yet back
+    std::unordered_set<crow::websocket::connection*> reaping_;
+    Reaper reaper_;
+
+    std::thread worker_;
+    bool running_;
+    std::chrono::milliseconds timeout_;
+
+    std::atomic<uint64_t> pings_;
+    std::atomic<uint64_t> reaped_;
+};
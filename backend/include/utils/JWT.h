@@ -5,7 +5,10 @@ class JWT
 {
 public:
     static std::string verifyAndGetUserId(const std::string &token);
+    // Signature and expiry, and not revoked
     static bool verify(const std::string &token);
     static std::string generate(const std::string &user_id);
+    // Rejects token until it expires; returns false if it was not valid
+    static bool revoke(const std::string &token);
 };
 
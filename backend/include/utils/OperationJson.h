@@ -0,0 +1,26 @@
+#pragma once
+#include "models/Operation.h"
+#include "crow/json.h"
+#include <string>
+#include <vector>
+
+// JSON form of operations, shared by the WebSocket and REST endpoints:
+//   {"type":"insert","position":3,"text":"abc"}
+//   {"type":"delete","position":3,"length":2}
+class OperationJson
+{
+public:
+    static const size_t MAX_COMPONENTS = 1000;
+
+    // Parses a list of components, dropping no-ops. Throws
+    // std::invalid_argument on malformed input.
+    static std::vector<TextOperation> parse(const crow::json::rvalue& ops);
+
+    static std::string serialize(const std::vector<TextOperation>& ops);
+
+    // {"type":"op","revision":N,"userId":"...","ops":[...]} for peers
+    static std::string opFrame(const AppliedOperation& applied);
+
+    // {"type":"ack","revision":N} for the sender
+    static std::string ackFrame(int revision);
+};
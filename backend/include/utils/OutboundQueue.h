@@ -0,0 +1,165 @@
+#pragma once
+#include "crow/websocket.h"
+#include "utils/FrameDeflater.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bounded, prioritised outbound frames for one WebSocket connection.
+// Frames come in both wire forms and the queue sends the one its connection
+// negotiated (JSON text or BinaryProtocol), defining interned users on
+// first use, and deflated at or above FrameDeflater::THRESHOLD if the
+// connection asked for it.
+//
+// Crow's send_text only appends to the connection's write buffer, so a
+// client on a bad network would otherwise buffer without limit. Clients
+// report how many frames they have received ({"type":"recv","count":n});
+// once they do, at most WINDOW_BYTES are handed to Crow unacknowledged and
+// the rest waits here, control before edits before presence. Queued frames
+// go out together as one {"type":"batch"} frame when the window reopens.
+//
+// Presence frames carry a key (the user) and replace the queued frame with
+// the same key; past PRESENCE_HIGH_WATER new ones are dropped, and they are
+// evicted first when the queue hits MAX_QUEUED_BYTES. A connection that
+// still overflows, or stays above BACKLOG_HIGH_WATER for SLOW_TIMEOUT, is
+// sent {"type":"resync"} and closed.
+class OutboundQueue
+{
+public:
+    enum class Priority
+    {
+        Control = 0,
+        Edit = 1,
+        Presence = 2
+    };
+
+    // Message bytes, immutable once shared: a broadcast hands every queue
+    // the same buffer instead of a copy each. share() allocates them
+    // mutable, so whoever holds the last reference may move them out.
+    using Buffer = std::shared_ptr<const std::string>;
+    static Buffer share(std::string data);
+
+    struct Frame
+    {
+        // JSON text
+        Buffer data;
+        // BinaryProtocol form; null if the message only exists as JSON
+        Buffer binary;
+        // Interned user the binary form refers to, 0 if none
+        uint32_t user = 0;
+        Priority priority = Priority::Edit;
+        // Presence only: a newer frame with the same key replaces this one
+        std::string key;
+    };
+
+    // What the connection negotiated at connect
+    struct Wire
+    {
+        bool binary = false;
+        FrameDeflater::Options deflate;
+    };
+
+    // Deflated frames of one broadcast, reused by every queue without
+    // context takeover that shares the window size. Used by one thread for
+    // the length of one broadcast.
+    class SharedDeflate
+    {
+    public:
+        const Buffer& get(const Buffer& message, bool binary, int window_bits);
+
+    private:
+        std::map<std::pair<const std::string*, int>, Buffer> frames_;
+    };
+
+    struct Stats
+    {
+        uint64_t frames_sent = 0;
+        uint64_t batches_sent = 0;
+        uint64_t presence_collapsed = 0;
+        uint64_t presence_dropped = 0;
+        uint64_t slow_disconnects = 0;
+    };
+
+    static const size_t WINDOW_BYTES = 256 * 1024;
+    static const size_t MAX_QUEUED_BYTES = 1024 * 1024;
+    static const size_t PRESENCE_HIGH_WATER = 64 * 1024;
+    static const size_t BACKLOG_HIGH_WATER = 256 * 1024;
+    static const size_t MAX_BATCH_BYTES = 64 * 1024;
+    static const std::chrono::seconds SLOW_TIMEOUT;
+    // Close code sent with the resync hint (1013: try again later)
+    static const uint16_t SLOW_CLOSE_CODE = 1013;
+
+    explicit OutboundQueue(crow::websocket::connection* conn);
+    OutboundQueue(crow::websocket::connection* conn, const Wire& wire);
+
+    // Queues frames and sends what the window allows. Returns false if the
+    // connection is closed or was just closed as a slow consumer.
+    bool push(const Frame& frame, SharedDeflate* shared = nullptr);
+    bool push(const std::vector<Frame>& frames, SharedDeflate* shared = nullptr);
+
+    bool isBinary() const { return wire_.binary; }
+
+    // The client has received `received` frames in total
+    void acknowledge(uint64_t received);
+
+    // Stops all sending; used when the connection leaves
+    void close();
+
+    size_t queuedBytes();
+
+    static Stats getStats();
+
+private:
+    // A queued message in the connection's wire form
+    struct Entry
+    {
+        Buffer data;
+        bool binary = false;
+        // Already a DEFLATE frame; sent on its own, never batched
+        bool deflated = false;
+
+        size_t size() const { return data->size(); }
+    };
+
+    Entry render(const Frame& frame, SharedDeflate* shared);
+    bool enqueue(const Frame& frame, SharedDeflate* shared);
+    bool enqueue(Entry&& entry, Priority priority, const std::string& key);
+    bool defineUser(uint32_t user, Entry& definition);
+    void pump();
+    void transmit(Entry&& wire, size_t frames);
+    void dropPresence();
+    void disconnectSlow();
+    void clear();
+
+    crow::websocket::connection* conn_;
+    const Wire wire_;
+    // Context takeover only: this connection's deflate stream
+    std::unique_ptr<FrameDeflater> deflater_;
+    std::mutex mutex_;
+    bool closed_;
+
+    // Interned user index -> generation this connection was told about
+    std::unordered_map<uint32_t, uint32_t> known_users_;
+
+    std::deque<Entry> control_;
+    std::deque<Entry> edits_;
+    std::deque<std::string> presence_order_;
+    std::unordered_map<std::string, Entry> presence_;
+    uint64_t unkeyed_presence_;
+    size_t queued_bytes_;
+    std::chrono::steady_clock::time_point backlogged_since_;
+    bool backlogged_;
+
+    // Flow control starts with the client's first receipt
+    bool flow_control_;
+    uint64_t sent_;
+    uint64_t acked_;
+    std::deque<size_t> in_flight_;
+    size_t in_flight_bytes_;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include "utils/OutboundQueue.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Recent broadcasts of one room, numbered in the order its members were
+// sent them, so a client that reconnects is sent what it missed instead of
+// reloading the document. Every frame except presence gets the next seq
+// ("seq" in JSON, a SEQ prefix in BinaryProtocol) and is kept until the log
+// holds more than MAX_FRAMES or MAX_BYTES. Sequenced frames all go out at
+// Edit priority, so a connection receives them in order and the highest seq
+// a client has seen is a safe point to resume from.
+//
+// A stream is one lifetime of a room: seqs from another stream mean nothing
+// here. Frames a client was excluded from (its own join, operations it sent)
+// remember its session and are skipped, or replaced by its own variant
+// (the ack), on replay. Not thread-safe; WebSocketManager holds the room's
+// order lock around every call.
+class ReplayLog
+{
+public:
+    static const size_t MAX_FRAMES = 1024;
+    static const size_t MAX_BYTES = 1 << 20;
+
+    struct Entry
+    {
+        uint64_t seq = 0;
+        OutboundQueue::Frame frame;
+        // Session the frame was not sent to, and what it got instead
+        std::string origin;
+        OutboundQueue::Frame origin_frame;
+    };
+
+    explicit ReplayLog(uint64_t stream);
+
+    uint64_t stream() const { return stream_; }
+    // Seq of the latest frame, 0 before the first
+    uint64_t seq() const { return seq_; }
+
+    // Numbers frame and the origin's variant (if any) and keeps them.
+    // Presence is neither numbered nor kept and comes back as it is.
+    Entry append(const OutboundQueue::Frame& frame, const std::string& origin = "",
+                 const OutboundQueue::Frame* origin_frame = nullptr);
+
+    // What a client of session that has seen everything up to seq in
+    // stream is missing; false if any of it is gone
+    bool since(uint64_t stream, uint64_t seq, const std::string& session,
+               std::vector<OutboundQueue::Frame>& missed) const;
+
+    // Sent after a join, replayed frames and all: the session to resume
+    // with, the stream and its latest seq
+    static std::string sessionFrame(const std::string& session, uint64_t stream, uint64_t seq, bool resumed);
+
+private:
+    static OutboundQueue::Frame stamp(const OutboundQueue::Frame& frame, uint64_t seq);
+    static size_t sizeOf(const OutboundQueue::Frame& frame);
+
+    uint64_t stream_;
+    uint64_t seq_;
+    std::deque<Entry> entries_;
+    size_t bytes_;
+};
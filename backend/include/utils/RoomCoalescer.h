@@ -0,0 +1,101 @@
+#pragma once
+#include "utils/OutboundQueue.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Batches high-rate, supersedable room traffic. Cursor updates keep only the
+// latest frame per user and "saved" notifications only the newest version;
+// once per tick each room with pending frames gets a single broadcast, which
+// each connection's OutboundQueue sends as one frame (a {"type":"batch"}
+// when it holds more than one). Cursors go out as keyed presence, so a
+// backed-up connection keeps only the latest per user.
+// Operations are never coalesced: each one is needed, in order.
+// "user_left" for a client that dropped without closing is held for
+// LEAVE_GRACE, so a reconnect that resumes is invisible to the room.
+class RoomCoalescer
+{
+public:
+    struct Stats
+    {
+        uint64_t frames_in = 0;
+        uint64_t superseded = 0;
+        uint64_t flushes = 0;
+        uint64_t sends = 0;
+        uint64_t leaves_held = 0;
+        uint64_t leaves_cancelled = 0;
+    };
+
+    static const std::chrono::milliseconds DEFAULT_TICK;
+    static const std::chrono::milliseconds LEAVE_GRACE;
+
+    static RoomCoalescer& getInstance();
+
+    void start(std::chrono::milliseconds tick = DEFAULT_TICK);
+    // Stops the tick thread, dropping whatever is pending
+    void stop();
+
+    // Queues a cursor frame, replacing user_id's pending one
+    void cursor(const std::string& doc_id, const std::string& user_id, OutboundQueue::Frame frame);
+    // Queues a "saved" frame unless a newer version is already pending
+    void saved(const std::string& doc_id, int version, std::string frame);
+    // Drops a departed user's pending cursor so it is not shown again
+    void dropUser(const std::string& doc_id, const std::string& user_id);
+    // Broadcasts a client session's "user_left" frame after LEAVE_GRACE
+    // unless it comes back first
+    void departed(const std::string& doc_id, const std::string& session, const std::string& user_id, std::string frame);
+    // Cancels the session's held "user_left"; true if there was one, in
+    // which case the room never saw it leave
+    bool returned(const std::string& doc_id, const std::string& session, const std::string& user_id);
+
+    // Sends everything pending now
+    void flush();
+
+    Stats getStats() const;
+
+private:
+    RoomCoalescer();
+    ~RoomCoalescer();
+    RoomCoalescer(const RoomCoalescer&) = delete;
+    RoomCoalescer& operator=(const RoomCoalescer&) = delete;
+
+    struct Room
+    {
+        std::map<std::string, OutboundQueue::Frame> cursors;
+        std::string saved;
+        int saved_version = 0;
+    };
+
+    struct Departure
+    {
+        std::string doc_id;
+        std::string user_id;
+        std::string frame;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    static std::string departureKey(const std::string& session, const std::string& doc_id);
+    void run();
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, Room> pending_;
+    // Held "user_left" frames by client session and room
+    std::unordered_map<std::string, Departure> departures_;
+
+    std::condition_variable cv_;
+    std::thread worker_;
+    bool running_;
+    std::chrono::milliseconds tick_;
+
+    std::atomic<uint64_t> frames_in_;
+    std::atomic<uint64_t> superseded_;
+    std::atomic<uint64_t> flushes_;
+    std::atomic<uint64_t> sends_;
+    std::atomic<uint64_t> leaves_held_;
+    std::atomic<uint64_t> leaves_cancelled_;
+};
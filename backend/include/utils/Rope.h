@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Persistent balanced rope of UTF-8 text. Leaves hold chunks of up to
+// LEAF_MAX bytes; internal nodes cache byte and UTF-16 lengths, so edits
+// and offset lookups are O(log n). Nodes are immutable and shared, so
+// copying a Rope is an O(1) snapshot that later edits never disturb.
+class Rope
+{
+public:
+    static const size_t LEAF_TARGET = 1024;
+    static const size_t LEAF_MAX = 2048;
+
+    Rope() = default;
+    explicit Rope(const std::string& text);
+
+    size_t size() const { return root_ ? root_->bytes : 0; }
+    size_t utf16Length() const { return root_ ? root_->utf16 : 0; }
+    bool empty() const { return size() == 0; }
+    int height() const { return root_ ? root_->height : 0; }
+
+    // Editing addressed in UTF-16 code units, like TextOperation. Throws
+    // std::out_of_range past the end and std::invalid_argument inside a
+    // surrogate pair; the rope is unchanged on failure.
+    void insert(size_t utf16_position, const std::string& text);
+    void erase(size_t utf16_position, size_t utf16_length);
+
+    // Byte offset of a UTF-16 position
+    size_t byteOffset(size_t utf16_position) const;
+
+    std::string toString() const;
+
+    // Calls fn(const std::string&) for each chunk in order without flattening
+    template <typename Fn>
+    void forEachChunk(Fn&& fn) const
+    {
+        std::vector<const Node *> stack;
+        const Node *node = root_.get();
+        while (node || !stack.empty())
+        {
+            while (node)
+            {
+                stack.push_back(node);
+                node = node->left.get();
+            }
+            node = stack.back();
+            stack.pop_back();
+            if (!node->left && !node->right && !node->text.empty())
+                fn(node->text);
+            node = node->right.get();
+        }
+    }
+
+private:
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node
+    {
+        NodePtr left;
+        NodePtr right;
+        std::string text;
+        size_t bytes = 0;
+        size_t utf16 = 0;
+        int height = 0;
+    };
+
+    explicit Rope(NodePtr root) : root_(std::move(root)) {}
+
+    static NodePtr leaf(std::string text);
+    static NodePtr leaf(std::string text, size_t utf16);
+    static NodePtr branch(NodePtr left, NodePtr right);
+    static NodePtr balance(NodePtr left, NodePtr right);
+    static NodePtr join(const NodePtr& left, const NodePtr& right);
+    static std::pair<NodePtr, NodePtr> split(const NodePtr& node, size_t utf16_position);
+    static NodePtr build(const std::string& text, size_t begin, size_t end);
+    static int heightOf(const NodePtr& node) { return node ? node->height : -1; }
+
+    NodePtr root_;
+};
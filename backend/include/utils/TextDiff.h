@@ -0,0 +1,45 @@
+#pragma once
+#include "models/Operation.h"
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Edit script between two versions of a document, for clients that send the
+// full body. The common prefix and suffix are trimmed with SSE2 compares;
+// Myers' O(ND) diff runs on the code points in between. When the middle
+// is too large, differs too much or the time budget runs out, the middle is
+// replaced wholesale, which is still a correct script.
+class TextDiff
+{
+public:
+    using Operations = std::vector<TextOperation>;
+
+    static const int MAX_EDIT_DISTANCE = 1000;
+    static const size_t MAX_MIDDLE_BYTES = 1024 * 1024;
+    static constexpr std::chrono::microseconds DEFAULT_BUDGET{2000};
+
+    // Operations turning old_text into new_text, applied left to right as
+    // OperationalTransform::apply does
+    static Operations compute(const std::string& old_text, const std::string& new_text,
+                              std::chrono::microseconds budget = DEFAULT_BUDGET);
+
+    // Length of the common prefix/suffix of a and b, in bytes
+    static size_t commonPrefix(const char* a, const char* b, size_t length);
+    static size_t commonSuffix(const char* a, const char* b, size_t length);
+
+private:
+    // A code point as its bytes, with the UTF-16 units it occupies
+    struct Token
+    {
+        std::string_view bytes;
+        size_t units;
+    };
+
+    static std::vector<Token> tokenize(std::string_view text);
+
+    // Script over tokens: '=' keep, '-' delete from a, '+' insert from b.
+    // Empty when the edit distance exceeds the limit or the deadline passes.
+    static std::string myers(const std::vector<Token>& a, const std::vector<Token>& b,
+                             std::chrono::steady_clock::time_point deadline);
+};
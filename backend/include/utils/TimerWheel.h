@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS slots, a slot of each
+// level spanning a whole turn of the level below. A timer sits in the
+// lowest level whose turn it falls in and moves down a level each time the
+// wheel reaches its slot, so scheduling and cancelling are O(1) and a tick
+// only touches the slots that come due, however many timers there are.
+// Time is in ticks; the caller decides how long one is. Not thread-safe.
+class TimerWheel
+{
+public:
+    static const unsigned SLOT_BITS = 6;
+    static const size_t SLOTS = size_t(1) << SLOT_BITS;
+    static const size_t LEVELS = 4;
+    // Timers further out than this many ticks fire at it. One slot short of
+    // the top level's turn, so a timer never lands in the slot being passed.
+    static const uint64_t RANGE = uint64_t(SLOTS - 1) << (SLOT_BITS * (LEVELS - 1));
+
+    explicit TimerWheel(uint64_t now = 0);
+
+    uint64_t now() const { return now_; }
+    size_t size() const { return timers_.size(); }
+
+    // Fires key at tick when (the next tick if that has passed), replacing
+    // any timer it had
+    void schedule(uint64_t key, uint64_t when);
+    void cancel(uint64_t key);
+
+    // Moves to tick now, appending the keys that came due
+    void advance(uint64_t now, std::vector<uint64_t>& expired);
+
+private:
+    struct Timer
+    {
+        uint64_t when;
+        uint32_t level;
+        uint32_t slot;
+        // Position in the slot's vector
+        size_t index;
+    };
+
+    void place(uint64_t key, uint64_t when);
+    void unlink(const Timer& timer);
+    void cascade(size_t level);
+
+    uint64_t now_;
+    std::array<std::array<std::vector<uint64_t>, SLOTS>, LEVELS> wheels_;
+    std::unordered_map<uint64_t, Timer> timers_;
+};
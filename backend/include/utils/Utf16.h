@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+// Document content is stored as UTF-8, but editors address it in UTF-16 code
+// units (JavaScript string indices). These helpers translate between the two;
+// the counting loops use SSE2 where available, 16 bytes per step. A sequence
+// counts at its lead byte, so stray continuation bytes count as nothing.
+class Utf16
+{
+public:
+    // UTF-16 code units needed for utf8[begin, end)
+    static size_t length(const std::string& utf8, size_t begin = 0, size_t end = std::string::npos);
+
+    // Byte offset of the UTF-16 offset counted from start_byte. Throws
+    // std::out_of_range past the end and std::invalid_argument for an offset
+    // that falls inside a surrogate pair.
+    static size_t toByteOffset(const std::string& utf8, size_t utf16_offset, size_t start_byte = 0);
+
+    // Well-formed UTF-8: no overlong forms, surrogates or code points past
+    // U+10FFFF. ASCII runs are checked 64 bytes at a time.
+    static bool isValidUtf8(const std::string& utf8);
+};
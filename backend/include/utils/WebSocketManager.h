@@ -1,47 +1,300 @@
 #pragma once
 #include "crow/websocket.h"
+#include "utils/FanoutBus.h"
+#include "utils/OutboundQueue.h"
+#include "utils/ReplayLog.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 #include <mutex>
 #include <memory>
 
-// Manages WebSocket connections for document collaboration
+// Manages WebSocket connections for document collaboration.
+// Rooms are partitioned into SHARD_COUNT shards by document id, each with
+// its own lock, so joins and leaves in different shards never contend.
+// Within a shard, room membership is published as immutable snapshots:
+// joins and leaves build a new member list under the shard lock and swap it
+// in, while broadcasts load the current list without locking and queue
+// outside any shared lock, so a slow room never holds up another. Every
+// frame goes through the connection's OutboundQueue, so a slow client only
+// ever backs up its own queue.
+// Broadcasts are numbered and kept in the room's ReplayLog, and a room
+// outlives its last member by RESUME_WINDOW, so a client that reconnects
+// within it is sent only the frames it missed.
+// A connection may be in many rooms: its document (joinDocument), whose
+// frames reach it as they are, and any number of channels (subscribe),
+// whose frames are tagged with their document. Its rooms share one queue,
+// kept in the connection's home shard; each room's shard indexes the
+// connections in it.
+// With a FanoutBus attached, a room is subscribed on the bus for as long as
+// it exists here, and its broadcasts are published there, so members
+// connected to other processes get them too. Relayed frames are numbered
+// into the local room's log like any other, and go out as JSON only: the
+// binary form names users by an index interned in the sending process.
 class WebSocketManager
 {
 public:
+    static const size_t SHARD_COUNT = 16;
+    static const std::chrono::seconds RESUME_WINDOW;
+    // How long an edit waits for the bus to lease a new room
+    static const std::chrono::milliseconds LEASE_WAIT;
+
+    // Identifies a client across reconnects. stream and seq are what it saw
+    // before reconnecting; stream is 0 on a fresh join.
+    struct Resume
+    {
+        std::string session;
+        uint64_t stream;
+        uint64_t seq;
+    };
+
+    // A member as the room's snapshot shows it
+    struct Participant
+    {
+        std::string user_id;
+        std::string username;
+        bool has_cursor = false;
+        size_t cursor = 0;
+    };
+
+    struct Stats
+    {
+        uint64_t resumes = 0;
+        uint64_t resume_gaps = 0;
+        uint64_t replayed_frames = 0;
+        uint64_t subscribes = 0;
+        uint64_t relayed_out = 0;
+        uint64_t relayed_in = 0;
+    };
+
     static WebSocketManager& getInstance();
     
-    // Document room management
-    void joinDocument(const std::string& doc_id, crow::websocket::connection* conn, const std::string& user_id);
+    // Shares rooms with other processes over bus; call before connections
+    // arrive and before the bus starts
+    void attachBus(const std::shared_ptr<FanoutBus>& bus);
+
+    // Whether this process may sequence edits to doc_id: it has no bus, or
+    // no room for the document, or the bus leased the room to it. A
+    // process with a room it does not own would order edits differently
+    // from the owner, whose frames its members already get. A room the
+    // broker has not leased yet is waited for, up to LEASE_WAIT, so the
+    // first edits after a join are not refused.
+    bool ownsDocument(const std::string& doc_id);
+    
+    // Registers a connection without a document, for channels only; wire
+    // is what it negotiated (binary frames, deflate)
+    void connect(crow::websocket::connection* conn, const std::string& user_id, const OutboundQueue::Wire& wire,
+                 const std::string& session);
+    
+    // Registers a connection with doc_id as its document, leaving any rooms
+    // it was in. With a session, the connection is sent the frames it missed
+    // (if the log still has them) and then ReplayLog::sessionFrame. Returns
+    // true if it resumed.
+    bool joinDocument(const std::string& doc_id, crow::websocket::connection* conn, const std::string& user_id,
+                      const std::string& username, const OutboundQueue::Wire& wire = OutboundQueue::Wire(),
+                      const Resume& resume = Resume());
+    // Adds doc_id as a channel of a registered connection, resuming from
+    // resume.stream and resume.seq like joinDocument (the session is the
+    // connection's). Frames of the room carry "doc" or come in a
+    // BinaryProtocol::CHANNEL. Throws std::runtime_error if conn is not
+    // registered or already in the room.
+    bool subscribe(const std::string& doc_id, crow::websocket::connection* conn, const std::string& username,
+                   const Resume& resume = Resume());
+    // Leaves one room; the connection stays registered and no frame of the
+    // room reaches it after this returns
     void leaveDocument(const std::string& doc_id, crow::websocket::connection* conn);
+    // Leaves every room and closes the connection's queue
     void leaveAll(crow::websocket::connection* conn);
     
-    // Broadcast messages to all users in a document room
-    void broadcastToDocument(const std::string& doc_id, const std::string& message, crow::websocket::connection* exclude_conn = nullptr);
+    // Broadcast messages to all users in a document room; returns the number
+    // of connections sent to
+    size_t broadcastToDocument(const std::string& doc_id, const std::string& message, crow::websocket::connection* exclude_conn = nullptr,
+                               OutboundQueue::Priority priority = OutboundQueue::Priority::Edit);
+    size_t broadcastToDocument(const std::string& doc_id, const OutboundQueue::Frame& frame, crow::websocket::connection* exclude_conn = nullptr);
+    size_t broadcastToDocument(const std::string& doc_id, const std::vector<OutboundQueue::Frame>& frames, crow::websocket::connection* exclude_conn = nullptr);
+    // Sends origin_frame to origin instead, in the same place in the room's
+    // order (an operation and its ack)
+    size_t broadcastToDocument(const std::string& doc_id, const OutboundQueue::Frame& frame, crow::websocket::connection* origin,
+                               const OutboundQueue::Frame& origin_frame);
+    // To this process's members of the room only, for state each process
+    // sends its own members
+    size_t broadcastLocally(const std::string& doc_id, const std::string& message);
+    
+    // Queue a message for one connection; false if it is not registered
+    bool sendTo(crow::websocket::connection* conn, const std::string& message,
+                OutboundQueue::Priority priority = OutboundQueue::Priority::Edit);
+    bool sendTo(crow::websocket::connection* conn, const OutboundQueue::Frame& frame);
+    
+    // The client has received `received` frames in total
+    void acknowledge(crow::websocket::connection* conn, uint64_t received);
     
     // Get users currently viewing a document
     std::vector<std::string> getDocumentUsers(const std::string& doc_id);
     
+    // One entry per user in the room, with the last cursor any of its
+    // connections reported
+    std::vector<Participant> getParticipants(const std::string& doc_id);
+    
+    // Remembers conn's cursor in doc_id for later joiners
+    void setCursor(const std::string& doc_id, crow::websocket::connection* conn, bool has_position, size_t position);
+    
     // Check if user is in document room
     bool isUserInDocument(const std::string& doc_id, const std::string& user_id);
+    
+    Stats getStats() const;
 
 private:
-    WebSocketManager() = default;
+    WebSocketManager();
     ~WebSocketManager() = default;
     WebSocketManager(const WebSocketManager&) = delete;
     WebSocketManager& operator=(const WebSocketManager&) = delete;
     
-    // doc_id -> set of connections
-    std::unordered_map<std::string, std::unordered_set<crow::websocket::connection*>> document_rooms_;
+    // A registered connection. Its rooms share the queue, which leaveAll
+    // closes, so a connection is never written to after it left.
+    struct Link
+    {
+        crow::websocket::connection* conn;
+        std::string user_id;
+        std::string session;
+        std::shared_ptr<OutboundQueue> outbound;
+        // Rooms it is in; guarded by the home shard's mutex
+        std::vector<std::string> rooms;
+    };
+    
+    // A connection in a room
+    struct Member
+    {
+        crow::websocket::connection* conn;
+        std::string user_id;
+        std::string username;
+        std::string session;
+        std::shared_ptr<OutboundQueue> outbound;
+        // Joined with subscribe: sent the room's tagged frames
+        bool channel = false;
+        // Last cursor position, -1 if none
+        std::atomic<int64_t> cursor{-1};
+    };
+    using Members = std::vector<std::shared_ptr<Member>>;
+    
+    // One per room; members is swapped with std::atomic_store
+    struct Room
+    {
+        Room(const std::string& doc_id, uint64_t stream);
+        
+        std::string doc_id;
+        // {"doc":"<doc_id>", the start of every JSON frame of a channel
+        std::string channel_prefix;
+        std::shared_ptr<const Members> members;
+        
+        // Held while frames are numbered and queued to every member, and
+        // while a member is added or removed, so members receive frames in
+        // seq order and a joiner gets each frame either live or from the log
+        std::mutex order;
+        ReplayLog log;
+        
+        // When the last member left; guarded by the shard mutex
+        std::chrono::steady_clock::time_point emptied;
+    };
+    using Rooms = std::unordered_map<std::string, std::shared_ptr<Room>>;
     
-    // connection -> (doc_id, user_id)
-    std::unordered_map<crow::websocket::connection*, std::pair<std::string, std::string>> connection_info_;
+    struct alignas(64) Shard
+    {
+        // Serializes membership changes in this shard
+        std::mutex mutex;
+        
+        // doc_id -> room; replaced with std::atomic_store only when a room
+        // is created or expires
+        std::shared_ptr<const Rooms> rooms;
+        
+        // Rooms that lost their last member, oldest first; guarded by mutex
+        std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> emptied;
+        
+        // Connections whose home is this shard; guarded by mutex
+        std::unordered_map<crow::websocket::connection*, std::shared_ptr<Link>> links;
+        
+        // connection -> doc_id -> member, for this shard's rooms; guarded by
+        // mutex
+        std::unordered_map<crow::websocket::connection*, std::unordered_map<std::string, std::shared_ptr<Member>>> members;
+    };
     
-    // doc_id -> set of user_ids
-    std::unordered_map<std::string, std::unordered_set<std::string>> document_users_;
+    // Lock-free connection -> home shard map: open addressing with linear
+    // probing over a fixed table. A connection is only added and removed
+    // by its own handlers, which Crow runs one at a time, so a slot is
+    // claimed with a CAS and released to a tombstone. Probes are bounded;
+    // a connection with no free slot in reach spills into a locked map.
+    class ConnectionDirectory
+    {
+    public:
+        static const size_t CAPACITY = 1 << 16;
+        static const size_t MAX_PROBE = 64;
+        
+        ConnectionDirectory();
+        void insert(crow::websocket::connection* conn, uint32_t shard);
+        // SHARD_COUNT if the connection is not registered
+        uint32_t find(crow::websocket::connection* conn);
+        void erase(crow::websocket::connection* conn);
+        
+    private:
+        static const uintptr_t EMPTY = 0;
+        static const uintptr_t TOMBSTONE = 1;
+        static const uintptr_t RESERVED = 2;
+        
+        struct Slot
+        {
+            std::atomic<uintptr_t> key{EMPTY};
+            std::atomic<uint32_t> shard{0};
+        };
+        
+        size_t home(crow::websocket::connection* conn) const;
+        
+        std::unique_ptr<Slot[]> slots_;
+        std::mutex overflow_mutex_;
+        std::unordered_map<crow::websocket::connection*, uint32_t> overflow_;
+        std::atomic<size_t> overflow_size_{0};
+    };
     
-    mutable std::mutex mutex_;
+    Shard& shardFor(const std::string& doc_id);
+    // Home of a connection without a document
+    Shard& shardFor(crow::websocket::connection* conn);
+    // Registers conn in home, in doc_id's room if not empty
+    std::shared_ptr<Link> addLink(Shard& home, crow::websocket::connection* conn, const std::string& user_id,
+                                  const OutboundQueue::Wire& wire, const std::string& session, const std::string& doc_id);
+    std::shared_ptr<Link> findLink(crow::websocket::connection* conn);
+    bool join(const std::string& doc_id, const std::shared_ptr<Link>& link, const std::string& username,
+              const Resume& resume, bool channel);
+    std::shared_ptr<Room> loadRoom(const std::string& doc_id);
+    std::shared_ptr<const Members> loadMembers(const std::string& doc_id);
+    // Called with shard.mutex held
+    void removeMember(Shard& shard, crow::websocket::connection* conn, const std::string& doc_id);
+    // Drops rooms empty for RESUME_WINDOW; called with shard.mutex held
+    void expireRooms(Shard& shard);
+    // relay: publish to the bus too (frames that came from it are not)
+    size_t broadcast(const std::string& doc_id, const std::vector<OutboundQueue::Frame>& frames,
+                     crow::websocket::connection* origin, const OutboundQueue::Frame* origin_frame, bool relay = true);
+    // Frames of a room published by another process
+    void deliver(const FanoutBus::Message& message);
+    void publish(FanoutBus& bus, const std::string& doc_id, const std::vector<OutboundQueue::Frame>& frames);
+    static std::string encodeFrames(const std::vector<OutboundQueue::Frame>& frames, bool& presence);
+    static bool decodeFrames(const std::string& payload, std::vector<OutboundQueue::Frame>& frames);
+    // frame as a channel of room gets it
+    static OutboundQueue::Frame channelFrame(const Room& room, const OutboundQueue::Frame& frame);
+    std::shared_ptr<Member> findMember(const std::string& doc_id, crow::websocket::connection* conn);
+    std::shared_ptr<OutboundQueue> findQueue(crow::websocket::connection* conn);
+    
+    std::array<Shard, SHARD_COUNT> shards_;
+    ConnectionDirectory directory_;
+    // Set once at startup; read with std::atomic_load
+    std::shared_ptr<FanoutBus> bus_;
+    
+    std::atomic<uint64_t> resumes_{0};
+    std::atomic<uint64_t> resume_gaps_{0};
+    std::atomic<uint64_t> replayed_frames_{0};
+    std::atomic<uint64_t> subscribes_{0};
+    std::atomic<uint64_t> relayed_out_{0};
+    std::atomic<uint64_t> relayed_in_{0};
 };
-
-
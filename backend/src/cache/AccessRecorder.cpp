@@ -0,0 +1,161 @@
+#include "cache/AccessRecorder.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+const size_t AccessRecorder::MAX_TRACKED;
+const size_t AccessRecorder::MAX_SAVED;
+
+AccessRecorder &AccessRecorder::getInstance()
+{
+    static AccessRecorder instance;
+    return instance;
+}
+
+AccessRecorder::~AccessRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (saver_.joinable())
+        saver_.join();
+}
+
+void AccessRecorder::recordDocument(const std::string &doc_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    bump(documents_, doc_id);
+}
+
+void AccessRecorder::recordUser(const std::string &user_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    bump(users_, user_id);
+}
+
+void AccessRecorder::bump(std::unordered_map<std::string, uint32_t> &counts, const std::string &id)
+{
+    if (id.empty())
+        return;
+
+    ++counts[id];
+    if (counts.size() <= MAX_TRACKED)
+        return;
+
+    for (auto it = counts.begin(); it != counts.end();)
+    {
+        it->second /= 2;
+        if (it->second == 0)
+            it = counts.erase(it);
+        else
+            ++it;
+    }
+}
+
+std::vector<std::string> AccessRecorder::hottest(const std::unordered_map<std::string, uint32_t> &counts)
+{
+    std::vector<std::pair<uint32_t, const std::string *>> ranked;
+    ranked.reserve(counts.size());
+    for (const auto &[id, count] : counts)
+        ranked.emplace_back(count, &id);
+
+    size_t keep = std::min(ranked.size(), MAX_SAVED);
+    std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(),
+                      [](const auto &a, const auto &b)
+                      { return a.first > b.first; });
+
+    std::vector<std::string> ids;
+    ids.reserve(keep);
+    for (size_t i = 0; i < keep; ++i)
+        ids.push_back(*ranked[i].second);
+    return ids;
+}
+
+void AccessRecorder::start(const std::string &path, int interval_seconds)
+{
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (running_)
+        return;
+
+    path_ = path;
+    running_ = true;
+    saver_ = std::thread([this, interval_seconds]
+                         {
+        std::unique_lock<std::mutex> lock(thread_mutex_);
+        while (running_)
+        {
+            if (cv_.wait_for(lock, std::chrono::seconds(interval_seconds), [this] { return !running_; }))
+                break;
+            lock.unlock();
+            save(path_);
+            lock.lock();
+        } });
+}
+
+void AccessRecorder::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        if (!running_)
+            return;
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (saver_.joinable())
+        saver_.join();
+
+    save(path_);
+}
+
+bool AccessRecorder::save(const std::string &path) const
+{
+    std::vector<std::string> documents;
+    std::vector<std::string> users;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        documents = hottest(documents_);
+        users = hottest(users_);
+    }
+
+    if (documents.empty() && users.empty())
+        return true;
+
+    // Write beside the target and rename so a crash never leaves half a file
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "Failed to write access profile: " << tmp_path << std::endl;
+            return false;
+        }
+        for (const auto &id : documents)
+            out << "d " << id << '\n';
+        for (const auto &id : users)
+            out << "u " << id << '\n';
+        if (!out.good())
+            return false;
+    }
+
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+AccessProfile AccessRecorder::load(const std::string &path)
+{
+    AccessProfile profile;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.size() < 3 || line[1] != ' ')
+            continue;
+        if (line[0] == 'd')
+            profile.documents.push_back(line.substr(2));
+        else if (line[0] == 'u')
+            profile.users.push_back(line.substr(2));
+    }
+    return profile;
+}
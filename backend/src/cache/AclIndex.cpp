@@ -0,0 +1,245 @@
+#include "cache/AclIndex.h"
+#include "cache/DocumentCache.h"
+#include "repositories/CollaboratorRepository.h"
+#include "repositories/DocumentRepository.h"
+#include <algorithm>
+#include <functional>
+
+uint8_t DocumentAcl::permissionsFor(const std::string &user_id) const
+{
+    auto it = std::lower_bound(grants.begin(), grants.end(), user_id,
+                               [](const std::pair<std::string, uint8_t> &grant, const std::string &id)
+                               { return grant.first < id; });
+    if (it != grants.end() && it->first == user_id)
+        return it->second;
+    return ACL_NONE;
+}
+
+AclIndex &AclIndex::getInstance()
+{
+    static AclIndex instance;
+    return instance;
+}
+
+AclIndex::AclIndex()
+{
+    for (auto &shard : shards_)
+        shard.map = std::make_shared<const Map>();
+}
+
+uint8_t AclIndex::maskFor(const std::string &permission)
+{
+    if (permission == "read")
+        return ACL_READ;
+    if (permission == "write")
+        return ACL_READ | ACL_WRITE;
+    return ACL_NONE;
+}
+
+AclIndex::Shard &AclIndex::shardFor(const std::string &doc_id)
+{
+    return shards_[std::hash<std::string>{}(doc_id) % SHARD_COUNT];
+}
+
+const AclIndex::Shard &AclIndex::shardFor(const std::string &doc_id) const
+{
+    return shards_[std::hash<std::string>{}(doc_id) % SHARD_COUNT];
+}
+
+std::shared_ptr<const DocumentAcl> AclIndex::find(const std::string &doc_id) const
+{
+    auto map = std::atomic_load(&shardFor(doc_id).map);
+    auto it = map->find(doc_id);
+    if (it == map->end())
+        return nullptr;
+    return it->second;
+}
+
+std::shared_ptr<const DocumentAcl> AclIndex::get(const std::string &doc_id)
+{
+    if (auto acl = find(doc_id))
+    {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return acl;
+    }
+    return loadFromDatabase(doc_id);
+}
+
+std::shared_ptr<const DocumentAcl> AclIndex::loadFromDatabase(const std::string &doc_id)
+{
+    Shard &shard = shardFor(doc_id);
+    uint64_t epoch = shard.epoch.load(std::memory_order_acquire);
+
+    // Owner comes from the document cache when the row is already there,
+    // otherwise from a query that does not read the body
+    std::string owner_id;
+    if (auto cached = DocumentCache::getInstance().peek(doc_id))
+    {
+        owner_id = cached->getOwnerId();
+    }
+    else
+    {
+        DocumentRepository docRepo;
+        auto owner = docRepo.findOwnerId(doc_id);
+        if (!owner.has_value())
+            return nullptr;
+        owner_id = owner.value();
+    }
+
+    auto acl = std::make_shared<DocumentAcl>();
+    acl->owner_id = owner_id;
+
+    CollaboratorRepository collabRepo;
+    for (const auto &collab : collabRepo.findByDocumentId(doc_id))
+    {
+        acl->grants.emplace_back(collab.getUserId(), maskFor(collab.getPermission()));
+    }
+    std::sort(acl->grants.begin(), acl->grants.end());
+    loads_.fetch_add(1, std::memory_order_relaxed);
+
+    std::shared_ptr<const DocumentAcl> result = acl;
+
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+    if (shard.epoch.load(std::memory_order_acquire) != epoch)
+    {
+        // A share/unshare landed while we were reading; serve what we read
+        // but let the next caller load a fresh copy
+        return result;
+    }
+
+    auto next = std::make_shared<Map>(*shard.map);
+    auto inserted = next->emplace(doc_id, result);
+    if (!inserted.second)
+        return inserted.first->second;
+    std::atomic_store(&shard.map, std::shared_ptr<const Map>(std::move(next)));
+    return result;
+}
+
+bool AclIndex::checkAccess(const std::string &doc_id, const std::string &user_id, uint8_t required)
+{
+    auto acl = get(doc_id);
+    if (!acl)
+        return false;
+
+    // Owners always have full access
+    if (acl->owner_id == user_id)
+        return true;
+
+    if (required == ACL_NONE)
+        return false;
+
+    return (acl->permissionsFor(user_id) & required) == required;
+}
+
+template <typename Fn>
+void AclIndex::update(const std::string &doc_id, Fn fn)
+{
+    Shard &shard = shardFor(doc_id);
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+    shard.epoch.fetch_add(1, std::memory_order_acq_rel);
+
+    auto it = shard.map->find(doc_id);
+    if (it == shard.map->end())
+        return;
+
+    auto acl = std::make_shared<DocumentAcl>(*it->second);
+    fn(*acl);
+
+    auto next = std::make_shared<Map>(*shard.map);
+    (*next)[doc_id] = std::move(acl);
+    std::atomic_store(&shard.map, std::shared_ptr<const Map>(std::move(next)));
+    updates_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AclIndex::setOwner(const std::string &doc_id, const std::string &owner_id)
+{
+    Shard &shard = shardFor(doc_id);
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+    shard.epoch.fetch_add(1, std::memory_order_acq_rel);
+
+    auto acl = std::make_shared<DocumentAcl>();
+    acl->owner_id = owner_id;
+    auto existing = shard.map->find(doc_id);
+    if (existing != shard.map->end())
+        acl->grants = existing->second->grants;
+
+    auto next = std::make_shared<Map>(*shard.map);
+    (*next)[doc_id] = std::move(acl);
+    std::atomic_store(&shard.map, std::shared_ptr<const Map>(std::move(next)));
+    updates_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AclIndex::grant(const std::string &doc_id, const std::string &user_id, const std::string &permission)
+{
+    uint8_t mask = maskFor(permission);
+    update(doc_id, [&](DocumentAcl &acl)
+           {
+        auto it = std::lower_bound(acl.grants.begin(), acl.grants.end(), user_id,
+                                   [](const std::pair<std::string, uint8_t> &grant, const std::string &id)
+                                   { return grant.first < id; });
+        if (it != acl.grants.end() && it->first == user_id)
+            it->second = mask;
+        else
+            acl.grants.insert(it, {user_id, mask}); });
+    publish(doc_id);
+}
+
+void AclIndex::revoke(const std::string &doc_id, const std::string &user_id)
+{
+    update(doc_id, [&](DocumentAcl &acl)
+           {
+        auto it = std::lower_bound(acl.grants.begin(), acl.grants.end(), user_id,
+                                   [](const std::pair<std::string, uint8_t> &grant, const std::string &id)
+                                   { return grant.first < id; });
+        if (it != acl.grants.end() && it->first == user_id)
+            acl.grants.erase(it); });
+    publish(doc_id);
+}
+
+void AclIndex::erase(const std::string &doc_id)
+{
+    drop(doc_id);
+    publish(doc_id);
+}
+
+void AclIndex::drop(const std::string &doc_id)
+{
+    Shard &shard = shardFor(doc_id);
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+    shard.epoch.fetch_add(1, std::memory_order_acq_rel);
+
+    if (shard.map->find(doc_id) == shard.map->end())
+        return;
+
+    auto next = std::make_shared<Map>(*shard.map);
+    next->erase(doc_id);
+    std::atomic_store(&shard.map, std::shared_ptr<const Map>(std::move(next)));
+    updates_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AclIndex::attachBus(const std::shared_ptr<FanoutBus> &bus)
+{
+    // A load racing with the drop sees the epoch move and is not kept
+    bus->onMessage(FanoutBus::Kind::AclChanged, [this](const FanoutBus::Message &message)
+                   { drop(message.room); });
+    std::atomic_store(&bus_, bus);
+}
+
+void AclIndex::publish(const std::string &doc_id)
+{
+    if (auto bus = std::atomic_load(&bus_))
+        bus->publish({FanoutBus::Kind::AclChanged, doc_id, ""});
+}
+
+AclIndex::Stats AclIndex::getStats() const
+{
+    Stats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.loads = loads_.load(std::memory_order_relaxed);
+    stats.updates = updates_.load(std::memory_order_relaxed);
+    for (const auto &shard : shards_)
+    {
+        stats.documents += std::atomic_load(&shard.map)->size();
+    }
+    return stats;
+}
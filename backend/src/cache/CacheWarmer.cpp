@@ -0,0 +1,227 @@
+#include "cache/CacheWarmer.h"
+#include "cache/AclIndex.h"
+#include "cache/ResponseCache.h"
+#include "cache/UserProfileCache.h"
+#include "repositories/DocumentRepository.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+const int CacheWarmer::WINDOW_SECONDS;
+const size_t CacheWarmer::MAX_WINDOWS;
+const uint64_t CacheWarmer::MIN_WINDOW_SAMPLES;
+constexpr double CacheWarmer::STEADY_TOLERANCE;
+const size_t CacheWarmer::BUCKETS;
+
+CacheWarmer &CacheWarmer::getInstance()
+{
+    static CacheWarmer instance;
+    return instance;
+}
+
+CacheWarmer::CacheWarmer()
+    : rate_(0), tokens_(0), refilled_(Clock::now()),
+      boot_(Clock::now()), window_index_(0), window_buckets_{}, window_samples_(0)
+{
+}
+
+CacheWarmer::~CacheWarmer()
+{
+    stop();
+}
+
+void CacheWarmer::start(const AccessProfile &profile, size_t threads, double items_per_second)
+{
+    if (!workers_.empty() || threads == 0 || items_per_second <= 0)
+        return;
+
+    profile_ = profile;
+    if (profile_.documents.empty() && profile_.users.empty())
+        return;
+
+    rate_ = items_per_second;
+    tokens_ = 0;
+    refilled_ = Clock::now();
+    warmup_started_ = Clock::now();
+
+    std::cout << "Warming caches: " << profile_.documents.size() << " documents, "
+              << profile_.users.size() << " users" << std::endl;
+
+    active_workers_ = threads;
+    for (size_t i = 0; i < threads; ++i)
+        workers_.emplace_back(&CacheWarmer::work, this);
+}
+
+void CacheWarmer::stop()
+{
+    stopping_ = true;
+    for (auto &worker : workers_)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+    workers_.clear();
+}
+
+void CacheWarmer::work()
+{
+    const size_t total = profile_.documents.size() + profile_.users.size();
+
+    while (!stopping_)
+    {
+        size_t index = next_++;
+        if (index >= total || !acquireToken())
+            break;
+
+        try
+        {
+            if (index < profile_.documents.size())
+            {
+                const std::string &doc_id = profile_.documents[index];
+                DocumentRepository repo;
+                auto doc = repo.findById(doc_id);
+                if (doc.has_value())
+                {
+                    AclIndex::getInstance().get(doc_id);
+                    ResponseCache::getInstance().getOrBuild(doc.value());
+                    documents_warmed_++;
+                }
+                else
+                {
+                    failures_++;
+                }
+            }
+            else
+            {
+                const std::string &user_id = profile_.users[index - profile_.documents.size()];
+                if (UserProfileCache::getInstance().get(user_id).has_value())
+                    users_warmed_++;
+                else
+                    failures_++;
+            }
+        }
+        catch (...)
+        {
+            failures_++;
+        }
+    }
+
+    if (--active_workers_ == 0)
+    {
+        duration_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - warmup_started_).count();
+        std::cout << "Cache warmup finished in " << duration_ms_.load() << " ms" << std::endl;
+    }
+}
+
+bool CacheWarmer::acquireToken()
+{
+    while (!stopping_)
+    {
+        std::chrono::duration<double> wait;
+        {
+            std::lock_guard<std::mutex> lock(rate_mutex_);
+            auto now = Clock::now();
+            double elapsed = std::chrono::duration<double>(now - refilled_).count();
+            refilled_ = now;
+
+            // Allow a burst of a tenth of a second at most
+            tokens_ = std::min(tokens_ + elapsed * rate_, std::max(1.0, rate_ / 10.0));
+            if (tokens_ >= 1.0)
+            {
+                tokens_ -= 1.0;
+                return true;
+            }
+            wait = std::chrono::duration<double>((1.0 - tokens_) / rate_);
+        }
+        std::this_thread::sleep_for(wait);
+    }
+    return false;
+}
+
+size_t CacheWarmer::bucketFor(uint64_t micros)
+{
+    if (micros < 8)
+        return static_cast<size_t>(micros);
+
+    int exponent = 63 - __builtin_clzll(micros);
+    size_t sub = static_cast<size_t>((micros >> (exponent - 3)) & 7);
+    return std::min(BUCKETS - 1, static_cast<size_t>(exponent) * 8 + sub);
+}
+
+uint64_t CacheWarmer::bucketUpperBound(size_t bucket)
+{
+    if (bucket < 8)
+        return bucket + 1;
+
+    uint64_t exponent = bucket / 8;
+    uint64_t sub = bucket % 8;
+    return ((8 + sub + 1) << exponent) >> 3;
+}
+
+void CacheWarmer::rollWindows(Clock::time_point now)
+{
+    size_t current = static_cast<size_t>(std::chrono::duration_cast<std::chrono::seconds>(now - boot_).count() / WINDOW_SECONDS);
+
+    while (window_index_ < current && window_p99_us_.size() < MAX_WINDOWS)
+    {
+        uint64_t p99 = 0;
+        if (window_samples_ >= MIN_WINDOW_SAMPLES)
+        {
+            uint64_t rank = window_samples_ - window_samples_ / 100;
+            uint64_t seen = 0;
+            for (size_t b = 0; b < BUCKETS; ++b)
+            {
+                seen += window_buckets_[b];
+                if (seen >= rank)
+                {
+                    p99 = bucketUpperBound(b);
+                    break;
+                }
+            }
+        }
+
+        // Steady once two consecutive busy windows agree on p99
+        size_t closed = window_p99_us_.size();
+        if (!steady_at_ms_ && p99 > 0 && closed > 0 && window_p99_us_.back() > 0)
+        {
+            double previous = static_cast<double>(window_p99_us_.back());
+            if (std::abs(static_cast<double>(p99) - previous) <= STEADY_TOLERANCE * previous)
+                steady_at_ms_ = static_cast<int64_t>(closed) * WINDOW_SECONDS * 1000;
+        }
+
+        window_p99_us_.push_back(p99);
+        window_buckets_.fill(0);
+        window_samples_ = 0;
+        ++window_index_;
+    }
+}
+
+void CacheWarmer::recordLatency(std::chrono::microseconds latency)
+{
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    if (window_p99_us_.size() >= MAX_WINDOWS)
+        return;
+
+    rollWindows(now);
+    window_buckets_[bucketFor(static_cast<uint64_t>(std::max<int64_t>(0, latency.count())))]++;
+    window_samples_++;
+}
+
+CacheWarmer::Stats CacheWarmer::getStats()
+{
+    Stats stats;
+    stats.running = active_workers_.load() > 0;
+    stats.documents_planned = profile_.documents.size();
+    stats.users_planned = profile_.users.size();
+    stats.documents_warmed = documents_warmed_.load();
+    stats.users_warmed = users_warmed_.load();
+    stats.failures = failures_.load();
+    stats.duration_ms = duration_ms_.load();
+
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    rollWindows(Clock::now());
+    stats.window_p99_us = window_p99_us_;
+    stats.time_to_steady_state_ms = steady_at_ms_;
+    return stats;
+}
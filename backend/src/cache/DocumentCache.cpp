@@ -0,0 +1,59 @@
+#include "cache/DocumentCache.h"
+
+namespace {
+    const size_t CAPACITY_BYTES = 64 * 1024 * 1024;
+    const size_t SHARD_COUNT = 16;
+
+    // Approximate per-entry bookkeeping: list node, hash node, shared_ptr block
+    const size_t ENTRY_OVERHEAD = 128;
+}
+
+DocumentCache &DocumentCache::getInstance()
+{
+    static DocumentCache instance;
+    return instance;
+}
+
+DocumentCache::DocumentCache()
+    : cache_(CAPACITY_BYTES, SHARD_COUNT, &DocumentCache::entrySize)
+{
+}
+
+size_t DocumentCache::entrySize(const std::string &id, const Document &document)
+{
+    return ENTRY_OVERHEAD + sizeof(Document) + id.capacity() +
+           document.getId().size() + document.getTitle().size() +
+           document.getContent().size() + document.getOwnerId().size() +
+           document.getCreatedAt().size() + document.getUpdatedAt().size();
+}
+
+std::shared_ptr<const Document> DocumentCache::get(const std::string &id)
+{
+    return cache_.get(id);
+}
+
+std::shared_ptr<const Document> DocumentCache::peek(const std::string &id) const
+{
+    return cache_.peek(id);
+}
+
+void DocumentCache::put(const Document &document)
+{
+    cache_.put(document.getId(), std::make_shared<const Document>(document));
+}
+
+void DocumentCache::invalidate(const std::string &id, int min_version)
+{
+    cache_.eraseIf(id, [min_version](const Document &cached)
+                   { return cached.getVersion() < min_version; });
+}
+
+void DocumentCache::invalidate(const std::string &id)
+{
+    cache_.erase(id);
+}
+
+DocumentCache::Stats DocumentCache::getStats() const
+{
+    return cache_.getStats();
+}
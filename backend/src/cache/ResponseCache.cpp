@@ -0,0 +1,97 @@
+#include "cache/ResponseCache.h"
+#include "utils/Compression.h"
+#include "crow/json.h"
+
+namespace {
+    const size_t CAPACITY_BYTES = 64 * 1024 * 1024;
+    const size_t SHARD_COUNT = 16;
+    const size_t ENTRY_OVERHEAD = 128;
+
+    size_t responseSize(const std::string &key, const CachedResponse &response)
+    {
+        return ENTRY_OVERHEAD + sizeof(CachedResponse) + key.capacity() +
+               response.body.size() + response.body_gzip.size() + response.content_json.size();
+    }
+}
+
+const size_t ResponseCache::GZIP_MIN_BYTES;
+
+ResponseCache &ResponseCache::getInstance()
+{
+    static ResponseCache instance;
+    return instance;
+}
+
+ResponseCache::ResponseCache()
+    : cache_(CAPACITY_BYTES, SHARD_COUNT, responseSize)
+{
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::find(const std::string &doc_id, int version)
+{
+    auto cached = cache_.get(doc_id);
+    if (!cached || cached->version != version)
+        return nullptr;
+    return cached;
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::getOrBuild(const Document &doc)
+{
+    if (auto cached = find(doc.getId(), doc.getVersion()))
+        return cached;
+
+    crow::json::wvalue response;
+    response["document"] = {
+        {"id", doc.getId()},
+        {"title", doc.getTitle()},
+        {"content", doc.getContent()},
+        {"owner_id", doc.getOwnerId()},
+        {"version", doc.getVersion()},
+        {"created_at", doc.getCreatedAt()},
+        {"updated_at", doc.getUpdatedAt()}};
+
+    CachedResponse entry;
+    entry.version = doc.getVersion();
+    entry.body = response.dump();
+    entry.content_json = crow::json::wvalue(doc.getContent()).dump();
+    return put(doc.getId(), std::move(entry));
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::put(const std::string &doc_id, CachedResponse response)
+{
+    // Never replace a newer version with an older one
+    auto existing = cache_.peek(doc_id);
+    if (existing && existing->version > response.version)
+        return std::make_shared<const CachedResponse>(std::move(response));
+
+    auto entry = std::make_shared<const CachedResponse>(std::move(response));
+    cache_.put(doc_id, entry);
+    return entry;
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::withGzip(const std::string &doc_id,
+                                                              const std::shared_ptr<const CachedResponse> &entry)
+{
+    if (!entry->body_gzip.empty() || entry->body.size() < GZIP_MIN_BYTES)
+        return entry;
+
+    CachedResponse compressed = *entry;
+    compressed.body_gzip = Compression::gzip(entry->body);
+    return put(doc_id, std::move(compressed));
+}
+
+void ResponseCache::invalidate(const std::string &doc_id, int min_version)
+{
+    cache_.eraseIf(doc_id, [min_version](const CachedResponse &cached)
+                   { return cached.version < min_version; });
+}
+
+void ResponseCache::invalidate(const std::string &doc_id)
+{
+    cache_.erase(doc_id);
+}
+
+ResponseCache::Stats ResponseCache::getStats() const
+{
+    return cache_.getStats();
+}
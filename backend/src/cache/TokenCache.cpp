@@ -0,0 +1,113 @@
+#include "cache/TokenCache.h"
+#include <openssl/sha.h>
+
+namespace {
+    const size_t CAPACITY_BYTES = 4 * 1024 * 1024;
+    const size_t SHARD_COUNT = 16;
+    const size_t ENTRY_OVERHEAD = 128;
+    const std::time_t PURGE_INTERVAL_SECONDS = 300;
+
+    size_t tokenSize(const std::string &key, const VerifiedToken &claims)
+    {
+        return ENTRY_OVERHEAD + sizeof(VerifiedToken) + key.capacity() + claims.user_id.size();
+    }
+}
+
+TokenCache &TokenCache::getInstance()
+{
+    static TokenCache instance;
+    return instance;
+}
+
+TokenCache::TokenCache()
+    : cache_(CAPACITY_BYTES, SHARD_COUNT, tokenSize)
+{
+}
+
+std::string TokenCache::digest(const std::string &token)
+{
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char *>(token.data()), token.size(), hash);
+    return std::string(reinterpret_cast<const char *>(hash), SHA256_DIGEST_LENGTH);
+}
+
+std::optional<VerifiedToken> TokenCache::lookup(const std::string &digest)
+{
+    auto cached = cache_.get(digest);
+    if (!cached)
+        return std::nullopt;
+
+    if (std::time(nullptr) > cached->exp)
+    {
+        cache_.erase(digest);
+        return std::nullopt;
+    }
+    return *cached;
+}
+
+bool TokenCache::insert(const std::string &digest, const VerifiedToken &claims)
+{
+    std::lock_guard<std::mutex> lock(revoked_mutex_);
+    if (revoked_.count(digest))
+        return false;
+    cache_.put(digest, std::make_shared<const VerifiedToken>(claims));
+    return true;
+}
+
+void TokenCache::revoke(const std::string &digest, std::time_t exp)
+{
+    remember(digest, exp);
+    if (auto bus = std::atomic_load(&bus_))
+        bus->publish({FanoutBus::Kind::TokenRevoked, digest, std::to_string(exp)});
+}
+
+void TokenCache::remember(const std::string &digest, std::time_t exp)
+{
+    std::lock_guard<std::mutex> lock(revoked_mutex_);
+    std::time_t now = std::time(nullptr);
+    if (exp >= now)
+        revoked_[digest] = exp;
+    cache_.erase(digest);
+    purgeExpiredRevocations(now);
+}
+
+void TokenCache::attachBus(const std::shared_ptr<FanoutBus> &bus)
+{
+    bus->onMessage(FanoutBus::Kind::TokenRevoked, [this](const FanoutBus::Message &message)
+                   { remember(message.room, static_cast<std::time_t>(std::stoll(message.payload))); });
+    std::atomic_store(&bus_, bus);
+}
+
+bool TokenCache::isRevoked(const std::string &digest)
+{
+    std::lock_guard<std::mutex> lock(revoked_mutex_);
+    purgeExpiredRevocations(std::time(nullptr));
+    return revoked_.count(digest) > 0;
+}
+
+// Caller must hold revoked_mutex_
+void TokenCache::purgeExpiredRevocations(std::time_t now)
+{
+    if (now < next_purge_)
+        return;
+    next_purge_ = now + PURGE_INTERVAL_SECONDS;
+
+    for (auto it = revoked_.begin(); it != revoked_.end();)
+    {
+        if (it->second < now)
+            it = revoked_.erase(it);
+        else
+            ++it;
+    }
+}
+
+TokenCache::Stats TokenCache::getStats() const
+{
+    return cache_.getStats();
+}
+
+size_t TokenCache::revokedCount() const
+{
+    std::lock_guard<std::mutex> lock(revoked_mutex_);
+    return revoked_.size();
+}
@@ -0,0 +1,78 @@
+#include "cache/UserProfileCache.h"
+#include "repositories/UserRepository.h"
+
+namespace {
+    const size_t CAPACITY_BYTES = 8 * 1024 * 1024;
+    const size_t SHARD_COUNT = 16;
+    const size_t ENTRY_OVERHEAD = 128;
+
+    size_t profileSize(const std::string &key, const UserProfile &profile)
+    {
+        return ENTRY_OVERHEAD + sizeof(UserProfile) + key.capacity() +
+               profile.id.size() + profile.username.size() + profile.email.size();
+    }
+}
+
+UserProfileCache &UserProfileCache::getInstance()
+{
+    static UserProfileCache instance;
+    return instance;
+}
+
+UserProfileCache::UserProfileCache()
+    : cache_(CAPACITY_BYTES, SHARD_COUNT, profileSize)
+{
+}
+
+std::optional<UserProfile> UserProfileCache::get(const std::string &user_id)
+{
+    if (auto cached = cache_.get(user_id))
+        return *cached;
+
+    uint64_t generation = generation_.load(std::memory_order_acquire);
+
+    UserRepository userRepo;
+    auto user = userRepo.findById(user_id);
+    if (!user.has_value())
+        return std::nullopt;
+
+    UserProfile profile{user.value().getId(), user.value().getUsername(), user.value().getEmail()};
+    if (generation_.load(std::memory_order_acquire) == generation)
+    {
+        cache_.put(user_id, std::make_shared<const UserProfile>(profile));
+    }
+    return profile;
+}
+
+std::string UserProfileCache::getUsername(const std::string &user_id, const std::string &fallback)
+{
+    auto profile = get(user_id);
+    if (!profile.has_value() || profile.value().username.empty())
+        return fallback;
+    return profile.value().username;
+}
+
+void UserProfileCache::invalidate(const std::string &user_id)
+{
+    drop(user_id);
+    if (auto bus = std::atomic_load(&bus_))
+        bus->publish({FanoutBus::Kind::ProfileChanged, user_id, ""});
+}
+
+void UserProfileCache::drop(const std::string &user_id)
+{
+    generation_.fetch_add(1, std::memory_order_acq_rel);
+    cache_.erase(user_id);
+}
+
+void UserProfileCache::attachBus(const std::shared_ptr<FanoutBus> &bus)
+{
+    bus->onMessage(FanoutBus::Kind::ProfileChanged, [this](const FanoutBus::Message &message)
+                   { drop(message.room); });
+    std::atomic_store(&bus_, bus);
+}
+
+UserProfileCache::Stats UserProfileCache::getStats() const
+{
+    return cache_.getStats();
+}
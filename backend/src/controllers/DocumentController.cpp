@@ -1,12 +1,85 @@
 #include "controllers/DocumentController.h"
 #include "services/DocumentService.h"
 #include "services/CollaborationService.h"
-#include "repositories/UserRepository.h"
-#include "repositories/DocumentRepository.h"
+#include "services/EditService.h"
+#include "cache/UserProfileCache.h"
+#include "cache/ResponseCache.h"
+#include "utils/Compression.h"
+#include "utils/OperationJson.h"
 #include "models/Document.h"
 #include "models/Collaborator.h"
 #include <stdexcept>
 
+namespace {
+    // Strong validator: a document's (id, version) pair never names two
+    // different bodies, since every update and rename bumps the version
+    std::string documentETag(const std::string &doc_id, int version)
+    {
+        return "\"" + doc_id + "-v" + std::to_string(version) + "\"";
+    }
+
+    std::string versionedUrl(const std::string &doc_id, int version)
+    {
+        return "/api/documents/" + doc_id + "/versions/" + std::to_string(version);
+    }
+
+    // If-None-Match is a comma-separated list of entity tags, or "*"
+    bool etagMatches(const std::string &if_none_match, const std::string &etag)
+    {
+        size_t pos = 0;
+        while (pos < if_none_match.size())
+        {
+            size_t end = if_none_match.find(',', pos);
+            if (end == std::string::npos)
+                end = if_none_match.size();
+
+            std::string candidate = if_none_match.substr(pos, end - pos);
+            size_t first = candidate.find_first_not_of(" \t");
+            if (first != std::string::npos)
+            {
+                candidate = candidate.substr(first, candidate.find_last_not_of(" \t") - first + 1);
+                // Weak comparison is what If-None-Match calls for
+                if (candidate.compare(0, 2, "W/") == 0)
+                    candidate = candidate.substr(2);
+                if (candidate == "*" || candidate == etag)
+                    return true;
+            }
+            pos = end + 1;
+        }
+        return false;
+    }
+
+    // Responses depend on the caller's token, so only private caches may
+    // keep them. The latest version must be revalidated; a specific version
+    // never changes.
+    void setCacheHeaders(crow::response &res, const std::string &etag, bool immutable)
+    {
+        res.set_header("ETag", etag);
+        res.set_header("Vary", "Authorization, Accept-Encoding");
+        res.set_header("Cache-Control", immutable ? "private, max-age=31536000, immutable" : "private, no-cache");
+    }
+
+    // Writes a cached body, pre-gzipped when the client accepts it
+    crow::response cachedDocumentResponse(const crow::request &req, const std::string &doc_id,
+                                          std::shared_ptr<const CachedResponse> entry)
+    {
+        crow::response res(200);
+        res.set_header("Content-Type", "application/json");
+        if (entry->body.size() >= ResponseCache::GZIP_MIN_BYTES &&
+            Compression::acceptsGzip(req.get_header_value("Accept-Encoding")))
+        {
+            entry = ResponseCache::getInstance().withGzip(doc_id, entry);
+            res.set_header("Content-Encoding", "gzip");
+            res.body = entry->body_gzip;
+        }
+        else
+        {
+            res.body = entry->body;
+        }
+        return res;
+    }
+}
+
 // Document Management
 crow::response DocumentController::getAllDocuments(const crow::request &req, const std::string &user_id)
 {
@@ -98,17 +171,29 @@ crow::response DocumentController::getDocument(const crow::request &req, const s
 {
     try
     {
-        Document doc = DocumentService::getDocumentById(doc_id, user_id);
+        // The access check and version lookup never read the body
+        int version = DocumentService::getDocumentVersion(doc_id, user_id);
 
-        crow::json::wvalue response;
-        response["document"] = {
-            {"id", doc.getId()},
-            {"title", doc.getTitle()},
-            {"content", doc.getContent()},
-            {"owner_id", doc.getOwnerId()},
-            {"created_at", doc.getCreatedAt()},
-            {"updated_at", doc.getUpdatedAt()}};
-        return crow::response(200, response);
+        // Conditional GET: the client already has the current copy
+        std::string if_none_match = req.get_header_value("If-None-Match");
+        if (!if_none_match.empty() && etagMatches(if_none_match, documentETag(doc_id, version)))
+        {
+            crow::response res(304);
+            setCacheHeaders(res, documentETag(doc_id, version), false);
+            res.set_header("Content-Location", versionedUrl(doc_id, version));
+            return res;
+        }
+
+        auto entry = ResponseCache::getInstance().find(doc_id, version);
+        if (!entry)
+        {
+            entry = ResponseCache::getInstance().getOrBuild(DocumentService::getDocumentById(doc_id, user_id));
+        }
+
+        crow::response res = cachedDocumentResponse(req, doc_id, entry);
+        setCacheHeaders(res, documentETag(doc_id, entry->version), false);
+        res.set_header("Content-Location", versionedUrl(doc_id, entry->version));
+        return res;
     }
     catch (const std::invalid_argument &e)
     {
@@ -194,13 +279,9 @@ crow::response DocumentController::updateDocument(const crow::request &req, cons
             // Try to get current document version
             try
             {
-                DocumentRepository repo;
-                auto currentDoc = repo.findById(doc_id);
-                if (currentDoc.has_value())
-                {
-                    response["current_version"] = currentDoc.value().getVersion();
-                    response["current_content"] = currentDoc.value().getContent();
-                }
+                Document currentDoc = DocumentService::getDocumentById(doc_id, user_id);
+                response["current_version"] = currentDoc.getVersion();
+                response["current_content"] = currentDoc.getContent();
             }
             catch (...)
             {
@@ -212,6 +293,10 @@ crow::response DocumentController::updateDocument(const crow::request &req, cons
         {
             return crow::response(403, response); // Forbidden
         }
+        if (error_msg.find("NOT_OWNER") != std::string::npos)
+        {
+            return crow::response(503, response); // Service Unavailable
+        }
         return crow::response(404, response); // Not Found
     }
     catch (const std::exception &e)
@@ -265,6 +350,10 @@ crow::response DocumentController::renameDocument(const crow::request &req, cons
         {
             return crow::response(403, response); // Forbidden
         }
+        if (error_msg.find("NOT_OWNER") != std::string::npos)
+        {
+            return crow::response(503, response); // Service Unavailable
+        }
         return crow::response(404, response); // Not Found
     }
     catch (const std::exception &e)
@@ -331,8 +420,7 @@ crow::response DocumentController::shareDocument(const crow::request &req, const
         Collaborator collab = CollaborationService::shareDocument(doc_id, user_id, collaborator_email, permission);
 
         // Get collaborator user info
-        UserRepository userRepo;
-        auto collaboratorUser = userRepo.findById(collab.getUserId());
+        auto collaboratorUser = UserProfileCache::getInstance().get(collab.getUserId());
 
         crow::json::wvalue response;
         response["message"] = "Document shared successfully";
@@ -348,9 +436,9 @@ crow::response DocumentController::shareDocument(const crow::request &req, const
         if (collaboratorUser.has_value())
         {
             response["collaborator"] = {
-                {"id", collaboratorUser.value().getId()},
-                {"username", collaboratorUser.value().getUsername()},
-                {"email", collaboratorUser.value().getEmail()}};
+                {"id", collaboratorUser.value().id},
+                {"username", collaboratorUser.value().username},
+                {"email", collaboratorUser.value().email}};
         }
 
         return crow::response(201, response);
@@ -387,7 +475,7 @@ crow::response DocumentController::getCollaborators(const crow::request &req, co
         std::vector<Collaborator> collaborators = CollaborationService::getCollaborators(doc_id, user_id);
 
         // Get user info for each collaborator
-        UserRepository userRepo;
+        auto &profiles = UserProfileCache::getInstance();
         std::vector<crow::json::wvalue> collabList;
 
         for (const auto &collab : collaborators)
@@ -407,11 +495,11 @@ crow::response DocumentController::getCollaborators(const crow::request &req, co
             {
                 if (!collab.getUserId().empty())
                 {
-                    auto collaboratorUser = userRepo.findById(collab.getUserId());
+                    auto collaboratorUser = profiles.get(collab.getUserId());
                     if (collaboratorUser.has_value())
                     {
-                        collabJson["username"] = collaboratorUser.value().getUsername().empty() ? "" : collaboratorUser.value().getUsername();
-                        collabJson["email"] = collaboratorUser.value().getEmail().empty() ? "" : collaboratorUser.value().getEmail();
+                        collabJson["username"] = collaboratorUser.value().username;
+                        collabJson["email"] = collaboratorUser.value().email;
                     }
                 }
             }
@@ -424,10 +512,10 @@ crow::response DocumentController::getCollaborators(const crow::request &req, co
             {
                 if (!collab.getSharedBy().empty())
                 {
-                    auto sharedByUser = userRepo.findById(collab.getSharedBy());
+                    auto sharedByUser = profiles.get(collab.getSharedBy());
                     if (sharedByUser.has_value())
                     {
-                        collabJson["shared_by_username"] = sharedByUser.value().getUsername().empty() ? "" : sharedByUser.value().getUsername();
+                        collabJson["shared_by_username"] = sharedByUser.value().username;
                     }
                 }
             }
@@ -582,6 +670,72 @@ crow::response DocumentController::getVersionHistory(const crow::request &req, c
     return crow::response(200, response);
 }
 
+crow::response DocumentController::getDocumentVersion(const crow::request &req, const std::string &doc_id, int version, const std::string &user_id)
+{
+    try
+    {
+        std::string etag = documentETag(doc_id, version);
+
+        // A version-addressed URL never changes, so a matching tag only needs
+        // the access check
+        std::string if_none_match = req.get_header_value("If-None-Match");
+        if (!if_none_match.empty() && etagMatches(if_none_match, etag))
+        {
+            int current_version = DocumentService::getDocumentVersion(doc_id, user_id);
+            if (current_version >= version)
+            {
+                crow::response res(304);
+                setCacheHeaders(res, etag, true);
+                return res;
+            }
+        }
+
+        int current_version = DocumentService::getDocumentVersion(doc_id, user_id);
+        auto entry = ResponseCache::getInstance().find(doc_id, version);
+        if (!entry && current_version == version)
+        {
+            entry = ResponseCache::getInstance().getOrBuild(DocumentService::getDocumentById(doc_id, user_id));
+        }
+
+        // Only the current version is stored
+        if (!entry || entry->version != version)
+        {
+            crow::json::wvalue response;
+            response["error"] = "Version not available";
+            response["current_version"] = current_version;
+            response["current_url"] = versionedUrl(doc_id, current_version);
+            return crow::response(404, response);
+        }
+
+        crow::response res = cachedDocumentResponse(req, doc_id, entry);
+        setCacheHeaders(res, etag, true);
+        return res;
+    }
+    catch (const std::invalid_argument &e)
+    {
+        crow::json::wvalue response;
+        response["error"] = e.what();
+        return crow::response(400, response);
+    }
+    catch (const std::runtime_error &e)
+    {
+        crow::json::wvalue response;
+        response["error"] = e.what();
+        std::string error_msg = e.what();
+        if (error_msg.find("Access denied") != std::string::npos)
+        {
+            return crow::response(403, response); // Forbidden
+        }
+        return crow::response(404, response); // Not Found
+    }
+    catch (const std::exception &e)
+    {
+        crow::json::wvalue response;
+        response["error"] = e.what();
+        return crow::response(500, response);
+    }
+}
+
 crow::response DocumentController::restoreVersion(const crow::request &req, const std::string &doc_id, const std::string &version_id, const std::string &user_id)
 {
     crow::json::wvalue response;
@@ -592,16 +746,105 @@ crow::response DocumentController::restoreVersion(const crow::request &req, cons
 // Real-time Collaboration
 crow::response DocumentController::applyOperation(const crow::request &req, const std::string &doc_id, const std::string &user_id)
 {
-    crow::json::wvalue response;
-    response["message"] = "Operation applied";
-    return crow::response(200, response);
+    try
+    {
+        auto body = crow::json::load(req.body);
+        if (!body || !body.has("revision") || !body.has("ops"))
+        {
+            crow::json::wvalue response;
+            response["error"] = "revision and ops are required";
+            return crow::response(400, response);
+        }
+
+        auto applied = EditService::submitOperations(doc_id, user_id, static_cast<int>(body["revision"].i()),
+                                                     OperationJson::parse(body["ops"]));
+
+        crow::response res(200, "{\"revision\":" + std::to_string(applied.revision) +
+                                    ",\"ops\":" + OperationJson::serialize(applied.ops) + "}");
+        res.set_header("Content-Type", "application/json");
+        return res;
+    }
+    catch (const std::logic_error &e)
+    {
+        // Malformed operations or positions outside the document
+        crow::json::wvalue response;
+        response["error"] = e.what();
+        return crow::response(400, response);
+    }
+    catch (const std::runtime_error &e)
+    {
+        crow::json::wvalue response;
+        response["error"] = e.what();
+        std::string error_msg = e.what();
+        if (error_msg.find("REVISION_TOO_OLD") != std::string::npos)
+        {
+            response["resync"] = true;
+            return crow::response(409, response);
+        }
+        if (error_msg.find("Access denied") != std::string::npos)
+        {
+            return crow::response(403, response);
+        }
+        if (error_msg.find("NOT_OWNER") != std::string::npos)
+        {
+            return crow::response(503, response);
+        }
+        return crow::response(404, response);
+    }
 }
 
 crow::response DocumentController::getPendingOperations(const crow::request &req, const std::string &doc_id, const std::string &user_id)
 {
-    crow::json::wvalue response;
-    response["operations"] = crow::json::wvalue::list();
-    return crow::response(200, response);
+    try
+    {
+        auto since_param = req.url_params.get("since");
+        if (!since_param)
+        {
+            crow::json::wvalue response;
+            response["error"] = "since is required";
+            return crow::response(400, response);
+        }
+
+        int current_revision = 0;
+        auto operations = EditService::getOperationsSince(doc_id, user_id, std::stoi(since_param), current_revision);
+
+        std::string body = "{\"revision\":" + std::to_string(current_revision) + ",\"operations\":[";
+        for (size_t i = 0; i < operations.size(); ++i)
+        {
+            if (i > 0)
+                body += ',';
+            body += "{\"revision\":" + std::to_string(operations[i].revision) +
+                    ",\"userId\":" + crow::json::wvalue(operations[i].user_id).dump() +
+                    ",\"ops\":" + OperationJson::serialize(operations[i].ops) + "}";
+        }
+        body += "]}";
+
+        crow::response res(200, body);
+        res.set_header("Content-Type", "application/json");
+        return res;
+    }
+    catch (const std::logic_error &e)
+    {
+        crow::json::wvalue response;
+        response["error"] = e.what();
+        return crow::response(400, response);
+    }
+    catch (const std::runtime_error &e)
+    {
+        crow::json::wvalue response;
+        response["error"] = e.what();
+        std::string error_msg = e.what();
+        if (error_msg.find("REVISION_TOO_OLD") != std::string::npos)
+        {
+            response["resync"] = true;
+            return crow::response(409, response);
+        }
+        if (error_msg.find("Access denied") != std::string::npos)
+        {
+            return crow::response(403, response);
+        }
+        return crow::response(404, response);
+    }
 }
 
 void DocumentController::handleWebSocketMessage(crow::websocket::connection &conn, const std::string &data, const std::string &doc_id)
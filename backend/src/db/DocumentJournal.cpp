@@ -0,0 +1,350 @@
+#include "db/DocumentJournal.h"
+#include "services/OperationalTransform.h"
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+    const char *JOURNAL_EXTENSION = ".journal";
+    // A snapshot being written, renamed over the journal once complete
+    const char *TEMP_EXTENSION = ".tmp";
+    const uint32_t SNAPSHOT_MAGIC = 0x4c4e4a44; // "DJNL"
+    const uint32_t DELTA_MAGIC = 0x544c4a44;    // "DJLT"
+    const size_t WRITE_BUFFER = 64 * 1024;
+    const size_t LEAF_SLACK = Rope::LEAF_MAX;
+
+    void putU32(std::string &out, uint32_t value)
+    {
+        char bytes[4];
+        std::memcpy(bytes, &value, 4);
+        out.append(bytes, 4);
+    }
+
+    void putString(std::string &out, const std::string &value)
+    {
+        putU32(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    bool getU32(const std::string &in, size_t &pos, uint32_t &value)
+    {
+        if (pos + 4 > in.size())
+            return false;
+        std::memcpy(&value, in.data() + pos, 4);
+        pos += 4;
+        return true;
+    }
+
+    bool getString(const std::string &in, size_t &pos, std::string &value)
+    {
+        uint32_t length;
+        if (!getU32(in, pos, length) || pos + length > in.size())
+            return false;
+        value.assign(in, pos, length);
+        pos += length;
+        return true;
+    }
+
+    bool writeAll(int fd, const char *data, size_t length)
+    {
+        while (length > 0)
+        {
+            ssize_t written = ::write(fd, data, length);
+            if (written < 0)
+                return false;
+            data += written;
+            length -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    // Makes a rename in path's directory durable
+    void syncDirectory(const std::string &path)
+    {
+        std::string dir = std::filesystem::path(path).parent_path().string();
+        int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+const size_t DocumentJournal::MIN_DELTA_BYTES;
+
+// Record layout: magic, payload length, crc32(payload), payload
+// Snapshot payload: version, id, title, owner_id, content
+// Delta payload: base version, version, title, op count, then per op its
+// type, position, length and text
+DocumentJournal::DocumentJournal(const std::string &path)
+    : path_(path), fd_(-1), size_(0), snapshot_size_(0), version_(-1)
+{
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0)
+    {
+        std::cerr << "Failed to open journal: " << path << std::endl;
+        return;
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) == 0)
+        size_ = static_cast<size_t>(st.st_size);
+}
+
+DocumentJournal::~DocumentJournal()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+bool DocumentJournal::needsSnapshot() const
+{
+    return version_ < 0 || size_ - snapshot_size_ > std::max(snapshot_size_, MIN_DELTA_BYTES);
+}
+
+bool DocumentJournal::writeSnapshot(const Document &document, const Rope &content)
+{
+    std::string temp_path = path_ + TEMP_EXTENSION;
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open journal: " << temp_path << std::endl;
+        return false;
+    }
+
+    std::string header;
+    putU32(header, static_cast<uint32_t>(document.getVersion()));
+    putString(header, document.getId());
+    putString(header, document.getTitle());
+    putString(header, document.getOwnerId());
+    putU32(header, static_cast<uint32_t>(content.size()));
+
+    // Checksum and write the content chunk by chunk instead of flattening
+    // it; chunks are gathered into WRITE_BUFFER-sized writes
+    uLong checksum = crc32(0L, reinterpret_cast<const Bytef *>(header.data()), header.size());
+    content.forEachChunk([&checksum](const std::string &chunk)
+                         { checksum = crc32(checksum, reinterpret_cast<const Bytef *>(chunk.data()), chunk.size()); });
+
+    std::string buffer;
+    buffer.reserve(std::min(header.size() + content.size() + 12, WRITE_BUFFER + LEAF_SLACK));
+    putU32(buffer, SNAPSHOT_MAGIC);
+    putU32(buffer, static_cast<uint32_t>(header.size() + content.size()));
+    putU32(buffer, static_cast<uint32_t>(checksum));
+    buffer.append(header);
+
+    bool ok = true;
+    content.forEachChunk([&](const std::string &chunk)
+                         {
+        if (!ok)
+            return;
+        buffer.append(chunk);
+        if (buffer.size() >= WRITE_BUFFER)
+        {
+            ok = writeAll(fd, buffer.data(), buffer.size());
+            buffer.clear();
+        } });
+    if (ok && !buffer.empty())
+        ok = writeAll(fd, buffer.data(), buffer.size());
+    ok = ok && ::fdatasync(fd) == 0;
+    ::close(fd);
+
+    // The old journal stays in place until the new one is complete
+    if (!ok || ::rename(temp_path.c_str(), path_.c_str()) != 0)
+    {
+        std::cerr << "Failed to write journal: " << path_ << std::endl;
+        ::unlink(temp_path.c_str());
+        return false;
+    }
+    syncDirectory(path_);
+
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_APPEND);
+    if (fd_ < 0)
+    {
+        std::cerr << "Failed to open journal: " << path_ << std::endl;
+        version_ = -1;
+        return false;
+    }
+    size_ = snapshot_size_ = header.size() + content.size() + 12;
+    version_ = document.getVersion();
+    return true;
+}
+
+bool DocumentJournal::appendDelta(const Document &document, const std::vector<TextOperation> &ops)
+{
+    if (fd_ < 0 || version_ < 0)
+        return false;
+
+    std::string payload;
+    putU32(payload, static_cast<uint32_t>(version_));
+    putU32(payload, static_cast<uint32_t>(document.getVersion()));
+    putString(payload, document.getTitle());
+    putU32(payload, static_cast<uint32_t>(ops.size()));
+    for (const auto &op : ops)
+    {
+        payload += static_cast<char>(op.type == TextOperation::Type::Insert ? 0 : 1);
+        putU32(payload, static_cast<uint32_t>(op.position));
+        putU32(payload, static_cast<uint32_t>(op.length));
+        putString(payload, op.text);
+    }
+
+    std::string record;
+    record.reserve(payload.size() + 12);
+    putU32(record, DELTA_MAGIC);
+    putU32(record, static_cast<uint32_t>(payload.size()));
+    putU32(record, static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef *>(payload.data()), payload.size())));
+    record += payload;
+
+    if (!writeAll(fd_, record.data(), record.size()))
+    {
+        // Drop the partial record so later appends stay readable
+        std::cerr << "Failed to write journal: " << path_ << std::endl;
+        if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+            std::cerr << "Failed to truncate journal: " << path_ << std::endl;
+        return false;
+    }
+    size_ += record.size();
+    version_ = document.getVersion();
+    return true;
+}
+
+bool DocumentJournal::sync()
+{
+    return fd_ >= 0 && ::fdatasync(fd_) == 0;
+}
+
+bool DocumentJournal::reset()
+{
+    if (fd_ < 0 || ::ftruncate(fd_, 0) != 0)
+        return false;
+    size_ = snapshot_size_ = 0;
+    version_ = -1;
+    return ::fdatasync(fd_) == 0;
+}
+
+void DocumentJournal::remove()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    ::unlink(path_.c_str());
+    size_ = snapshot_size_ = 0;
+    version_ = -1;
+}
+
+std::string DocumentJournal::pathFor(const std::string &dir, const std::string &doc_id)
+{
+    return dir + "/" + doc_id + JOURNAL_EXTENSION;
+}
+
+std::optional<Document> DocumentJournal::read(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return std::nullopt;
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::optional<Document> last;
+    std::string content;
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        uint32_t magic, length, checksum;
+        if (!getU32(data, pos, magic) || (magic != SNAPSHOT_MAGIC && magic != DELTA_MAGIC) ||
+            !getU32(data, pos, length) || !getU32(data, pos, checksum) ||
+            pos + length > data.size())
+            break;
+
+        std::string payload = data.substr(pos, length);
+        pos += length;
+
+        if (crc32(0L, reinterpret_cast<const Bytef *>(payload.data()), payload.size()) != checksum)
+            break;
+
+        size_t p = 0;
+        if (magic == SNAPSHOT_MAGIC)
+        {
+            uint32_t version;
+            std::string id, title, owner_id;
+            if (!getU32(payload, p, version) || !getString(payload, p, id) ||
+                !getString(payload, p, title) || !getString(payload, p, owner_id) ||
+                !getString(payload, p, content))
+                break;
+
+            Document doc(id, title, "", owner_id);
+            doc.setVersion(static_cast<int>(version));
+            last = doc;
+            continue;
+        }
+
+        uint32_t base, version, count;
+        std::string title;
+        if (!last.has_value() || !getU32(payload, p, base) || !getU32(payload, p, version) ||
+            !getString(payload, p, title) || !getU32(payload, p, count) ||
+            static_cast<int>(base) != last->getVersion())
+            break;
+
+        std::vector<TextOperation> ops;
+        bool intact = true;
+        for (uint32_t i = 0; i < count && intact; ++i)
+        {
+            uint32_t position, op_length;
+            std::string text;
+            intact = p < payload.size();
+            if (!intact)
+                break;
+            bool insert = payload[p++] == 0;
+            intact = getU32(payload, p, position) && getU32(payload, p, op_length) && getString(payload, p, text);
+            if (intact)
+                ops.push_back(insert ? TextOperation::insert(position, text) : TextOperation::remove(position, op_length));
+        }
+        if (!intact)
+            break;
+
+        try
+        {
+            OperationalTransform::apply(content, ops);
+        }
+        catch (const std::exception &)
+        {
+            break;
+        }
+        last->setTitle(title);
+        last->setVersion(static_cast<int>(version));
+    }
+
+    if (last.has_value())
+        last->setContent(content);
+    return last;
+}
+
+std::vector<std::string> DocumentJournal::list(const std::string &dir)
+{
+    std::vector<std::string> paths;
+    std::vector<std::filesystem::path> stale;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (!entry.is_regular_file())
+            continue;
+        if (entry.path().extension() == JOURNAL_EXTENSION)
+            paths.push_back(entry.path().string());
+        else if (entry.path().extension() == TEMP_EXTENSION)
+            stale.push_back(entry.path());
+    }
+    for (const auto &path : stale)
+        std::filesystem::remove(path, ec);
+    return paths;
+}
@@ -3,10 +3,40 @@
 #include "crow/middlewares/cors.h"
 #include "routes/routes.h"
 #include "db/Database.h"
+#include "repositories/DocumentRepository.h"
+#include "services/DocumentSessionManager.h"
+#include "cache/AccessRecorder.h"
+#include "cache/AclIndex.h"
+#include "cache/CacheWarmer.h"
+#include "cache/TokenCache.h"
+#include "cache/UserProfileCache.h"
+#include "utils/RoomCoalescer.h"
+#include "utils/Heartbeat.h"
+#include "utils/BrokerBus.h"
+#include "utils/WebSocketManager.h"
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+
+namespace
+{
+    std::string envOr(const char *name, const std::string &fallback)
+    {
+        const char *value = std::getenv(name);
+        return value && *value ? value : fallback;
+    }
+}
 
 int main()
 {
+    // Several processes on one host share the database; each needs its own
+    // port, journal directory and warmup log, and DOCS_FANOUT_SOCKET joins
+    // their rooms
+    const auto port = static_cast<uint16_t>(std::stoi(envOr("DOCS_PORT", "8080")));
+    const std::string journal_dir = envOr("DOCS_JOURNAL_DIR", "docs_journal");
+    const std::string warmup_log = envOr("DOCS_WARMUP_LOG", "docs_warmup.log");
+    const std::string fanout_socket = envOr("DOCS_FANOUT_SOCKET", "");
+
     // Initialize database
     auto &db = Database::getInstance();
     if (!db.initialize("docs_backend.db"))
@@ -17,6 +47,39 @@ int main()
 
     std::cout << "Database initialized successfully" << std::endl;
 
+    // Replay journals from an unclean exit and start write-behind persistence
+    auto &sessions = DocumentSessionManager::getInstance();
+    sessions.start(journal_dir);
+
+    // Prefetch what was hot before the last shutdown, in the background
+    auto &warmer = CacheWarmer::getInstance();
+    warmer.start(AccessRecorder::load(warmup_log));
+    AccessRecorder::getInstance().start(warmup_log);
+
+    // Rooms, revisions and cache invalidations (documents, access lists,
+    // revoked tokens and profiles) are relayed to the other processes; the
+    // first one to start hosts the broker
+    std::shared_ptr<BrokerBus> fanout;
+    if (!fanout_socket.empty())
+    {
+        fanout = std::make_shared<BrokerBus>(fanout_socket);
+        WebSocketManager::getInstance().attachBus(fanout);
+        sessions.attachBus(fanout);
+        DocumentRepository::attachBus(fanout);
+        AclIndex::getInstance().attachBus(fanout);
+        TokenCache::getInstance().attachBus(fanout);
+        UserProfileCache::getInstance().attachBus(fanout);
+        fanout->start();
+    }
+
+    // Cursor and save notifications go out once per room per tick
+    auto &coalescer = RoomCoalescer::getInstance();
+    coalescer.start(RoomCoalescer::DEFAULT_TICK);
+
+    // Pings idle WebSocket connections and reaps the ones that stay silent
+    auto &heartbeat = Heartbeat::getInstance();
+    heartbeat.start(Heartbeat::DEFAULT_TIMEOUT);
+
     // Enable CORS
     crow::App<crow::CORSHandler> app;
     auto &cors = app.get_middleware<crow::CORSHandler>();
@@ -29,11 +92,19 @@ int main()
     // Setup all routes
     setupRoutes(app);
 
-    std::cout << "Server starting on port 8080..." << std::endl;
+    std::cout << "Server starting on port " << port << "..." << std::endl;
     // Start server - bind to all interfaces (0.0.0.0) for network access
-    app.bindaddr("0.0.0.0").port(8080).multithreaded().run();
+    app.bindaddr("0.0.0.0").port(port).multithreaded().run();
 
     // Cleanup
+    heartbeat.stop();
+    coalescer.stop();
+    warmer.stop();
+    AccessRecorder::getInstance().stop();
+    sessions.shutdown();
+    // After the final persists, so their invalidations still go out
+    if (fanout)
+        fanout->stop();
     db.close();
     return 0;
 }
@@ -0,0 +1,21 @@
+#include "models/Operation.h"
+#include "utils/Utf16.h"
+
+TextOperation TextOperation::insert(size_t position, const std::string &text)
+{
+    TextOperation op;
+    op.type = Type::Insert;
+    op.position = position;
+    op.text = text;
+    op.length = Utf16::length(text);
+    return op;
+}
+
+TextOperation TextOperation::remove(size_t position, size_t length)
+{
+    TextOperation op;
+    op.type = Type::Delete;
+    op.position = position;
+    op.length = length;
+    return op;
+}
@@ -1,13 +1,62 @@
 #include "repositories/DocumentRepository.h"
 #include "db/Database.h"
+#include "cache/DocumentCache.h"
+#include "cache/ResponseCache.h"
+#include "utils/FanoutBus.h"
 #include <sqlite3.h>
 #include <sstream>
 #include <iomanip>
 #include <random>
 #include <iostream>
 
+namespace
+{
+    // Set once at startup; read with std::atomic_load
+    std::shared_ptr<FanoutBus> fanout;
+
+    void dropCached(const std::string &id, int min_version)
+    {
+        if (min_version < 0)
+        {
+            DocumentCache::getInstance().invalidate(id);
+            ResponseCache::getInstance().invalidate(id);
+        }
+        else
+        {
+            DocumentCache::getInstance().invalidate(id, min_version);
+            ResponseCache::getInstance().invalidate(id, min_version);
+        }
+    }
+}
+
 DocumentRepository::DocumentRepository() {}
 
+void DocumentRepository::attachBus(const std::shared_ptr<FanoutBus> &bus)
+{
+    bus->onMessage(FanoutBus::Kind::Invalidate, [](const FanoutBus::Message &message)
+                   {
+        int min_version = message.payload.empty() ? -1 : std::stoi(message.payload);
+        // Under the database mutex like a local write, so a read that began
+        // before the other process wrote cannot cache its row afterwards
+        std::lock_guard<std::mutex> lock(Database::getInstance().getMutex());
+        dropCached(message.room, min_version); });
+    std::atomic_store(&fanout, bus);
+}
+
+void DocumentRepository::invalidate(const std::string &id, int min_version)
+{
+    dropCached(id, min_version);
+    if (auto bus = std::atomic_load(&fanout))
+    {
+        FanoutBus::Message message;
+        message.kind = FanoutBus::Kind::Invalidate;
+        message.room = id;
+        if (min_version >= 0)
+            message.payload = std::to_string(min_version);
+        bus->publish(message);
+    }
+}
+
 std::string DocumentRepository::generateId()
 {
     // Generate UUID-like ID
@@ -94,12 +143,16 @@ std::optional<Document> DocumentRepository::createDocument(const Document &docum
         return std::nullopt;
     }
 
-    // Fetch the created document with timestamps
-    return findById(id);
+    // Fetch the created document with timestamps (already holding the lock)
+    return fetchById(conn, id);
 }
 
 std::optional<Document> DocumentRepository::findById(const std::string &id)
 {
+    auto &cache = DocumentCache::getInstance();
+    if (auto cached = cache.get(id))
+        return *cached;
+
     auto &db = Database::getInstance();
     std::lock_guard<std::mutex> lock(db.getMutex());
     sqlite3 *conn = db.getConnection();
@@ -107,6 +160,14 @@ std::optional<Document> DocumentRepository::findById(const std::string &id)
     if (!conn)
         return std::nullopt;
 
+    return fetchById(conn, id);
+}
+
+// Caller must hold the database mutex. Populating the cache under the same
+// lock that writers hold while invalidating keeps a slow reader from
+// re-inserting a row that was updated after it was read.
+std::optional<Document> DocumentRepository::fetchById(sqlite3 *conn, const std::string &id)
+{
     const char *sql = "SELECT id, title, content, owner_id, version, created_at, updated_at FROM documents WHERE id = ?";
 
     sqlite3_stmt *stmt;
@@ -123,6 +184,7 @@ std::optional<Document> DocumentRepository::findById(const std::string &id)
     {
         Document doc = mapRowToDocument(stmt);
         sqlite3_finalize(stmt);
+        DocumentCache::getInstance().put(doc);
         return doc;
     }
 
@@ -209,12 +271,67 @@ bool DocumentRepository::updateDocument(const Document &document)
         return false;
     }
 
+    invalidate(id_str, expected_version + 1);
+    return true;
+}
+
+bool DocumentRepository::persistSnapshot(const Document &document, int expected_version)
+{
+    auto &db = Database::getInstance();
+    std::lock_guard<std::mutex> lock(db.getMutex());
+    sqlite3 *conn = db.getConnection();
+
+    if (!conn)
+        return false;
+
+    const char *sql = R"(
+        UPDATE documents 
+        SET title = ?, content = ?, version = ?, updated_at = datetime('now')
+        WHERE id = ? AND version = ?
+    )";
+
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, nullptr);
+
+    if (rc != SQLITE_OK)
+    {
+        std::cerr << "SQL error: " << sqlite3_errmsg(conn) << std::endl;
+        return false;
+    }
+
+    std::string title_str = document.getTitle();
+    std::string content_str = document.getContent();
+    std::string id_str = document.getId();
+
+    sqlite3_bind_text(stmt, 1, title_str.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, content_str.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, document.getVersion());
+    sqlite3_bind_text(stmt, 4, id_str.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 5, expected_version);
+
+    rc = sqlite3_step(stmt);
+    int rows_affected = sqlite3_changes(conn);
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_DONE)
+    {
+        std::cerr << "SQL error: " << sqlite3_errmsg(conn) << std::endl;
+        return false;
+    }
+
+    if (rows_affected == 0)
+    {
+        return false;
+    }
+
+    invalidate(id_str, document.getVersion());
     return true;
 }
 
 bool DocumentRepository::deleteDocument(const std::string &id)
 {
     auto &db = Database::getInstance();
+    std::lock_guard<std::mutex> lock(db.getMutex());
     sqlite3 *conn = db.getConnection();
 
     if (!conn)
@@ -242,6 +359,7 @@ bool DocumentRepository::deleteDocument(const std::string &id)
         return false;
     }
 
+    invalidate(id, -1);
     return true;
 }
 
@@ -258,3 +376,71 @@ bool DocumentRepository::isOwner(const std::string &doc_id, const std::string &u
 
     return doc.value().getOwnerId() == user_id;
 }
+
+std::optional<std::string> DocumentRepository::findOwnerId(const std::string &id)
+{
+    auto &db = Database::getInstance();
+    std::lock_guard<std::mutex> lock(db.getMutex());
+    sqlite3 *conn = db.getConnection();
+
+    if (!conn)
+        return std::nullopt;
+
+    const char *sql = "SELECT owner_id FROM documents WHERE id = ?";
+
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, nullptr);
+
+    if (rc != SQLITE_OK)
+        return std::nullopt;
+
+    sqlite3_bind_text(stmt, 1, id.c_str(), -1, SQLITE_TRANSIENT);
+
+    rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW)
+    {
+        const char *owner_id = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        std::string result = owner_id ? owner_id : "";
+        sqlite3_finalize(stmt);
+        return result;
+    }
+
+    sqlite3_finalize(stmt);
+    return std::nullopt;
+}
+
+std::optional<int> DocumentRepository::findVersion(const std::string &id)
+{
+    if (auto cached = DocumentCache::getInstance().peek(id))
+        return cached->getVersion();
+
+    auto &db = Database::getInstance();
+    std::lock_guard<std::mutex> lock(db.getMutex());
+    sqlite3 *conn = db.getConnection();
+
+    if (!conn)
+        return std::nullopt;
+
+    const char *sql = "SELECT version FROM documents WHERE id = ?";
+
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, nullptr);
+
+    if (rc != SQLITE_OK)
+        return std::nullopt;
+
+    sqlite3_bind_text(stmt, 1, id.c_str(), -1, SQLITE_TRANSIENT);
+
+    rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW)
+    {
+        int version = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+        return version;
+    }
+
+    sqlite3_finalize(stmt);
+    return std::nullopt;
+}
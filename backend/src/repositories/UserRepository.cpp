@@ -1,5 +1,6 @@
 #include "repositories/UserRepository.h"
 #include "db/Database.h"
+#include "cache/UserProfileCache.h"
 #include <sqlite3.h>
 #include <sstream>
 #include <iomanip>
@@ -246,6 +247,7 @@ bool UserRepository::updateUser(const User& user)
     rc = sqlite3_step(stmt);
     sqlite3_finalize(stmt);
     
+    UserProfileCache::getInstance().invalidate(id_str);
     return rc == SQLITE_DONE;
 }
 
@@ -271,6 +273,7 @@ bool UserRepository::deleteUser(const std::string& id)
     rc = sqlite3_step(stmt);
     sqlite3_finalize(stmt);
     
+    UserProfileCache::getInstance().invalidate(id);
     return rc == SQLITE_DONE;
 }
 
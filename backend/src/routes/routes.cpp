@@ -2,17 +2,350 @@
 #include "controllers/AuthController.h"
 #include "controllers/DocumentController.h"
 #include "utils/JWT.h"
+#include "utils/Crypto.h"
 #include "utils/WebSocketManager.h"
+#include "utils/RoomCoalescer.h"
+#include "utils/Heartbeat.h"
+#include "cache/DocumentCache.h"
+#include "cache/AclIndex.h"
+#include "cache/UserProfileCache.h"
+#include "cache/TokenCache.h"
+#include "cache/ResponseCache.h"
+#include "cache/CacheWarmer.h"
 #include "services/CollaborationService.h"
 #include "services/DocumentService.h"
-#include "repositories/DocumentRepository.h"
-#include "repositories/UserRepository.h"
+#include "services/DocumentSessionManager.h"
+#include "services/EditService.h"
+#include "utils/OperationJson.h"
+#include "utils/BinaryProtocol.h"
 #include "models/Document.h"
 #include "crow/middlewares/cors.h"
 #include "crow/json.h"
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <sstream>
 
+namespace {
+    template <typename Stats>
+    crow::json::wvalue cacheStatsToJson(const Stats &stats)
+    {
+        crow::json::wvalue json;
+        json["hits"] = stats.hits;
+        json["misses"] = stats.misses;
+        json["hit_ratio"] = stats.hitRatio();
+        json["insertions"] = stats.insertions;
+        json["evictions"] = stats.evictions;
+        json["invalidations"] = stats.invalidations;
+        json["rejections"] = stats.rejections;
+        json["entries"] = stats.entries;
+        json["bytes"] = stats.bytes;
+        json["capacity_bytes"] = stats.capacity_bytes;
+        return json;
+    }
+
+    // Feeds the handler's latency into the time-to-steady-state windows
+    struct LatencyProbe
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ~LatencyProbe()
+        {
+            CacheWarmer::getInstance().recordLatency(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+        }
+    };
+
+    // "saved" frame for doc. The escaped content comes from the response
+    // cache, so a version is escaped once and later GETs of it are hits.
+    std::string savedFrame(const Document &doc, const std::string &user_id)
+    {
+        auto entry = ResponseCache::getInstance().getOrBuild(doc);
+        const std::string &content_json = entry->content_json;
+
+        std::string frame;
+        frame.reserve(content_json.size() + user_id.size() + 64);
+        frame += "{\"type\":\"saved\",\"version\":";
+        frame += std::to_string(doc.getVersion());
+        frame += ",\"userId\":";
+        frame += crow::json::wvalue(user_id).dump();
+        frame += ",\"content\":";
+        frame += content_json;
+        frame += "}";
+        return frame;
+    }
+
+    // "snapshot" frame a joining connection opens with: the room's text,
+    // title and version and who is in it, so it paints without a REST round
+    // trip. Ops newer than version follow it on the same connection.
+    std::string snapshotFrame(const Document &doc, const std::vector<WebSocketManager::Participant> &participants, bool channel)
+    {
+        auto entry = ResponseCache::getInstance().getOrBuild(doc);
+        const std::string &content_json = entry->content_json;
+
+        std::string frame;
+        frame.reserve(content_json.size() + doc.getTitle().size() + participants.size() * 64 + 128);
+        frame += '{';
+        if (channel)
+        {
+            frame += "\"doc\":";
+            frame += crow::json::wvalue(doc.getId()).dump();
+            frame += ',';
+        }
+        frame += "\"type\":\"snapshot\",\"version\":";
+        frame += std::to_string(doc.getVersion());
+        frame += ",\"title\":";
+        frame += crow::json::wvalue(doc.getTitle()).dump();
+        frame += ",\"content\":";
+        frame += content_json;
+        frame += ",\"participants\":[";
+        for (size_t i = 0; i < participants.size(); ++i)
+        {
+            const auto &participant = participants[i];
+            if (i > 0)
+                frame += ',';
+            frame += "{\"user_id\":";
+            frame += crow::json::wvalue(participant.user_id).dump();
+            frame += ",\"username\":";
+            frame += crow::json::wvalue(participant.username).dump();
+            if (participant.has_cursor)
+            {
+                frame += ",\"position\":";
+                frame += std::to_string(participant.cursor);
+            }
+            frame += '}';
+        }
+        frame += "]}";
+        return frame;
+    }
+
+    // Documents one connection may subscribe to besides its own
+    const size_t MAX_CHANNELS = 64;
+
+    struct ConnectionData
+    {
+        // Empty for a connection opened for channels only
+        std::string doc_id;
+        std::string user_id;
+        // Negotiated at connect: BinaryProtocol (?protocol=bin1) and deflate
+        OutboundQueue::Wire wire;
+        // Client session, and where a reconnecting client left off
+        WebSocketManager::Resume resume;
+        // Documents subscribed to over this connection
+        std::vector<std::string> channels;
+        // Stamped on every message, for Heartbeat
+        std::shared_ptr<Heartbeat::Liveness> liveness;
+        // Serializes the handlers with a reap on the heartbeat thread
+        std::mutex mutex;
+        // Left its rooms when Heartbeat gave up on it; the close that
+        // follows has nothing left to do
+        bool reaped = false;
+    };
+
+    std::string lookupUsername(const std::string &user_id)
+    {
+        try {
+            return UserProfileCache::getInstance().getUsername(user_id);
+        } catch (...) {
+            // Use default username if lookup fails
+            return "User";
+        }
+    }
+
+    // Document a client message is for: the connection's own, or the
+    // channel it names if subscribed; empty otherwise
+    std::string targetOf(const ConnectionData &data, const std::string &channel)
+    {
+        if (channel.empty())
+            return data.doc_id;
+        if (std::find(data.channels.begin(), data.channels.end(), channel) != data.channels.end())
+            return channel;
+        return "";
+    }
+
+    // Replies about a channel name it, as its broadcasts do
+    void tagChannel(crow::json::wvalue &msg, const ConnectionData &data, const std::string &doc_id)
+    {
+        if (doc_id != data.doc_id) {
+            msg["doc"] = doc_id;
+        }
+    }
+
+    // ?resume=<session>&stream=<n>&seq=<n> from a reconnecting client; a
+    // fresh session otherwise
+    WebSocketManager::Resume parseResume(const crow::request &req)
+    {
+        WebSocketManager::Resume resume{Crypto::generateToken(), 0, 0};
+        auto session = req.url_params.get("resume");
+        auto stream = req.url_params.get("stream");
+        auto seq = req.url_params.get("seq");
+        if (!session || !stream || !seq)
+            return resume;
+
+        std::string token(session);
+        if (token.size() != 32 || !std::all_of(token.begin(), token.end(), [](char c)
+                                               { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); }))
+            return resume;
+        try {
+            resume.stream = std::stoull(stream);
+            resume.seq = std::stoull(seq);
+        } catch (const std::exception&) {
+            resume.stream = 0;
+            resume.seq = 0;
+            return resume;
+        }
+        resume.session = std::move(token);
+        return resume;
+    }
+
+    void sendOpError(crow::websocket::connection &conn, const ConnectionData &data, const std::string &doc_id, const std::string &error)
+    {
+        crow::json::wvalue error_msg;
+        error_msg["type"] = "op_error";
+        error_msg["error"] = error;
+        tagChannel(error_msg, data, doc_id);
+        if (auto session = DocumentSessionManager::getInstance().find(doc_id)) {
+            error_msg["revision"] = session->getVersion();
+        }
+        WebSocketManager::getInstance().sendTo(&conn, error_msg.dump());
+    }
+
+    // Sequenced by the document's session; the sender gets an ack, peers
+    // get the transformed operation
+    void submitOperations(crow::websocket::connection &conn, const ConnectionData &data, const std::string &doc_id, int revision,
+                          std::vector<TextOperation> ops)
+    {
+        try {
+            EditService::submitOperations(doc_id, data.user_id, revision, std::move(ops), &conn);
+        } catch (const std::exception& e) {
+            sendOpError(conn, data, doc_id, e.what());
+        }
+    }
+
+    // Coalesced per room: peers get the latest position per user once per
+    // tick rather than every update
+    void publishCursor(crow::websocket::connection &conn, const ConnectionData &data, const std::string &doc_id, bool has_position,
+                       size_t position)
+    {
+        std::string username = lookupUsername(data.user_id);
+        
+        // Kept for the snapshot of anyone joining later
+        WebSocketManager::getInstance().setCursor(doc_id, &conn, has_position, position);
+        
+        crow::json::wvalue cursor_wmsg;
+        cursor_wmsg["type"] = "cursor";
+        if (has_position) {
+            cursor_wmsg["position"] = static_cast<int>(position);
+        }
+        cursor_wmsg["userId"] = data.user_id;
+        cursor_wmsg["username"] = username;
+        
+        OutboundQueue::Frame frame;
+        frame.data = OutboundQueue::share(cursor_wmsg.dump());
+        frame.user = BinaryProtocol::internUser(data.user_id, username);
+        frame.binary = OutboundQueue::share(BinaryProtocol::cursorFrame(frame.user, has_position, position));
+        RoomCoalescer::getInstance().cursor(doc_id, data.user_id, std::move(frame));
+    }
+
+    // Joins doc_id's room, as the connection's document or as a channel,
+    // and announces the user unless it is back within the grace period
+    void enterRoom(crow::websocket::connection &conn, const ConnectionData &data, const std::string &doc_id,
+                   const WebSocketManager::Resume &resume, bool channel)
+    {
+        auto &rooms = WebSocketManager::getInstance();
+        std::string username = lookupUsername(data.user_id);
+        auto join = [&]()
+        {
+            return channel ? rooms.subscribe(doc_id, &conn, username, resume)
+                           : rooms.joinDocument(doc_id, &conn, data.user_id, username, data.wire, resume);
+        };
+        
+        auto session = DocumentSessionManager::getInstance().join(doc_id);
+        bool resumed = false;
+        try {
+            if (session) {
+                // Holding the sequencer, no operation lands between the
+                // snapshot and the frames queued after it
+                std::lock_guard<std::mutex> order(session->sequencer());
+                resumed = join();
+                if (!resumed) {
+                    rooms.sendTo(&conn, snapshotFrame(session->snapshot(), rooms.getParticipants(doc_id), channel));
+                }
+            } else {
+                resumed = join();
+            }
+        } catch (...) {
+            DocumentSessionManager::getInstance().leave(doc_id);
+            throw;
+        }
+        
+        // Back within the grace period: the room never saw it leave
+        if (RoomCoalescer::getInstance().returned(doc_id, data.resume.session, data.user_id)) {
+            std::cout << "[WebSocket] Session " << (resumed ? "resumed" : "returned") << " for user " << data.user_id
+                      << " in document " << doc_id << std::endl;
+            return;
+        }
+        
+        crow::json::wvalue join_msg;
+        join_msg["type"] = "user_joined";
+        join_msg["user_id"] = data.user_id;
+        join_msg["username"] = username;
+        join_msg["doc_id"] = doc_id;
+        rooms.broadcastToDocument(doc_id, join_msg.dump(), &conn);
+    }
+
+    // Leaves doc_id's room. code is the close code; anything but a normal
+    // close holds the user_left back in case the client resumes.
+    void exitRoom(crow::websocket::connection &conn, const ConnectionData &data, const std::string &doc_id, uint16_t code)
+    {
+        crow::json::wvalue leave_msg;
+        leave_msg["type"] = "user_left";
+        leave_msg["user_id"] = data.user_id;
+        leave_msg["doc_id"] = doc_id;
+        std::string leave_msg_str = leave_msg.dump();
+        RoomCoalescer::getInstance().dropUser(doc_id, data.user_id);
+        if (code == 1000 || code == 1001) {
+            WebSocketManager::getInstance().broadcastToDocument(doc_id, leave_msg_str, &conn);
+        } else {
+            // Dropped, or closed by the server; the client will try to resume
+            RoomCoalescer::getInstance().departed(doc_id, data.resume.session, data.user_id, std::move(leave_msg_str));
+        }
+        
+        WebSocketManager::getInstance().leaveDocument(doc_id, &conn);
+        DocumentSessionManager::getInstance().leave(doc_id);
+    }
+
+    // Leaves every room and stops all sending; once per connection
+    void exitAll(crow::websocket::connection &conn, ConnectionData &data, uint16_t code)
+    {
+        if (data.reaped)
+            return;
+        if (!data.doc_id.empty()) {
+            exitRoom(conn, data, data.doc_id, code);
+        }
+        for (const auto& channel : data.channels) {
+            exitRoom(conn, data, channel, code);
+        }
+        WebSocketManager::getInstance().leaveAll(&conn);
+    }
+
+    // Heartbeat gave up on conn: its client is gone, so it leaves now rather
+    // than when TCP notices, and the room sees it leave without a grace
+    // period
+    void reapConnection(crow::websocket::connection *conn)
+    {
+        auto* data = static_cast<ConnectionData*>(conn->userdata());
+        if (!data)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(data->mutex);
+            exitAll(*conn, *data, 1001);
+            data->reaped = true;
+        }
+        std::cout << "[WebSocket] Reaped unresponsive connection of user " << data->user_id << std::endl;
+        conn->close("Heartbeat timeout", 1001);
+    }
+}
+
 // Middleware to verify JWT token and extract user info
 std::pair<bool, std::string> verifyAndExtractUser(const crow::request &req)
 {
@@ -54,6 +387,89 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
         response["service"] = "docs-backend";
         return crow::response(200, response); });
 
+    // In-process cache statistics
+    CROW_ROUTE(app, "/metrics")
+        .methods("GET"_method)([]()
+                               {
+        crow::json::wvalue response;
+        response["document_cache"] = cacheStatsToJson(DocumentCache::getInstance().getStats());
+
+        auto acl_stats = AclIndex::getInstance().getStats();
+        response["acl_index"]["documents"] = acl_stats.documents;
+        response["acl_index"]["hits"] = acl_stats.hits;
+        response["acl_index"]["loads"] = acl_stats.loads;
+        response["acl_index"]["updates"] = acl_stats.updates;
+
+        response["user_profile_cache"] = cacheStatsToJson(UserProfileCache::getInstance().getStats());
+
+        response["token_cache"] = cacheStatsToJson(TokenCache::getInstance().getStats());
+        response["token_cache"]["revoked"] = TokenCache::getInstance().revokedCount();
+
+        response["response_cache"] = cacheStatsToJson(ResponseCache::getInstance().getStats());
+
+        auto session_stats = DocumentSessionManager::getInstance().getStats();
+        response["document_sessions"]["active"] = session_stats.active_sessions;
+        response["document_sessions"]["persists"] = session_stats.persists;
+        response["document_sessions"]["persist_failures"] = session_stats.persist_failures;
+        response["document_sessions"]["persists_deferred"] = session_stats.persists_deferred;
+        response["document_sessions"]["journal_records"] = session_stats.journal_records;
+        response["document_sessions"]["journal_snapshots"] = session_stats.journal_snapshots;
+        response["document_sessions"]["journal_syncs"] = session_stats.journal_syncs;
+        response["document_sessions"]["recovered"] = session_stats.recovered;
+
+        auto coalescer_stats = RoomCoalescer::getInstance().getStats();
+        response["room_coalescing"]["frames_in"] = coalescer_stats.frames_in;
+        response["room_coalescing"]["superseded"] = coalescer_stats.superseded;
+        response["room_coalescing"]["flushes"] = coalescer_stats.flushes;
+        response["room_coalescing"]["sends"] = coalescer_stats.sends;
+        response["room_coalescing"]["leaves_held"] = coalescer_stats.leaves_held;
+        response["room_coalescing"]["leaves_cancelled"] = coalescer_stats.leaves_cancelled;
+
+        auto room_stats = WebSocketManager::getInstance().getStats();
+        response["rooms"]["resumes"] = room_stats.resumes;
+        response["rooms"]["resume_gaps"] = room_stats.resume_gaps;
+        response["rooms"]["replayed_frames"] = room_stats.replayed_frames;
+        response["rooms"]["subscribes"] = room_stats.subscribes;
+        response["rooms"]["relayed_out"] = room_stats.relayed_out;
+        response["rooms"]["relayed_in"] = room_stats.relayed_in;
+        
+        auto heartbeat_stats = Heartbeat::getInstance().getStats();
+        response["heartbeat"]["watched"] = heartbeat_stats.watched;
+        response["heartbeat"]["pings"] = heartbeat_stats.pings;
+        response["heartbeat"]["reaped"] = heartbeat_stats.reaped;
+
+        auto outbound_stats = OutboundQueue::getStats();
+        response["outbound"]["frames_sent"] = outbound_stats.frames_sent;
+        response["outbound"]["batches_sent"] = outbound_stats.batches_sent;
+        response["outbound"]["presence_collapsed"] = outbound_stats.presence_collapsed;
+        response["outbound"]["presence_dropped"] = outbound_stats.presence_dropped;
+        response["outbound"]["slow_disconnects"] = outbound_stats.slow_disconnects;
+
+        auto deflate_stats = FrameDeflater::getStats();
+        response["deflate"]["frames"] = deflate_stats.frames;
+        response["deflate"]["bytes_in"] = deflate_stats.bytes_in;
+        response["deflate"]["bytes_out"] = deflate_stats.bytes_out;
+        response["deflate"]["shared_reuses"] = deflate_stats.shared_reuses;
+
+        auto warmup_stats = CacheWarmer::getInstance().getStats();
+        response["warmup"]["running"] = warmup_stats.running;
+        response["warmup"]["documents_planned"] = warmup_stats.documents_planned;
+        response["warmup"]["documents_warmed"] = warmup_stats.documents_warmed;
+        response["warmup"]["users_planned"] = warmup_stats.users_planned;
+        response["warmup"]["users_warmed"] = warmup_stats.users_warmed;
+        response["warmup"]["failures"] = warmup_stats.failures;
+        response["warmup"]["duration_ms"] = warmup_stats.duration_ms;
+        response["warmup"]["window_seconds"] = CacheWarmer::WINDOW_SECONDS;
+        std::vector<crow::json::wvalue> window_p99;
+        for (auto p99 : warmup_stats.window_p99_us)
+            window_p99.emplace_back(p99);
+        response["warmup"]["window_p99_us"] = std::move(window_p99);
+        if (warmup_stats.time_to_steady_state_ms)
+            response["warmup"]["time_to_steady_state_ms"] = warmup_stats.time_to_steady_state_ms.value();
+        else
+            response["warmup"]["time_to_steady_state_ms"] = nullptr;
+        return crow::response(200, response); });
+
     // ==================== AUTH ROUTES ====================
 
     // User registration
@@ -106,6 +522,9 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
             return crow::response(401, "{\"error\":\"Unauthorized\"}");
         }
         
+        // Revoke the presented token so cached verifications stop accepting it
+        JWT::revoke(req.get_header_value("Authorization").substr(7));
+        
         crow::json::wvalue response;
         response["message"] = "Logged out successfully";
         return crow::response(200, response); });
@@ -116,6 +535,7 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
     CROW_ROUTE(app, "/api/documents")
         .methods("GET"_method)([](const crow::request &req)
                                {
+        LatencyProbe probe;
         auto [valid, user_id] = verifyAndExtractUser(req);
         if (!valid) {
             return crow::response(401, "{\"error\":\"Unauthorized\"}");
@@ -150,6 +570,7 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
     CROW_ROUTE(app, "/api/documents/<string>")
         .methods("GET"_method)([](const crow::request &req, std::string doc_id)
                                {
+        LatencyProbe probe;
         auto [valid, user_id] = verifyAndExtractUser(req);
         if (!valid) {
             return crow::response(401, "{\"error\":\"Unauthorized\"}");
@@ -167,6 +588,7 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
     CROW_ROUTE(app, "/api/documents/<string>")
         .methods("PATCH"_method)([](const crow::request &req, std::string doc_id)
                                  {
+        LatencyProbe probe;
         auto [valid, user_id] = verifyAndExtractUser(req);
         if (!valid) {
             return crow::response(401, "{\"error\":\"Unauthorized\"}");
@@ -303,6 +725,23 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
             return crow::response(500, response);
         } });
 
+    // Get a specific version (immutable, long-lived cacheable)
+    CROW_ROUTE(app, "/api/documents/<string>/versions/<int>")
+        .methods("GET"_method)([](const crow::request &req, std::string doc_id, int version)
+                               {
+        auto [valid, user_id] = verifyAndExtractUser(req);
+        if (!valid) {
+            return crow::response(401, "{\"error\":\"Unauthorized\"}");
+        }
+        
+        try {
+            return DocumentController::getDocumentVersion(req, doc_id, version, user_id);
+        } catch (const std::exception& e) {
+            crow::json::wvalue response;
+            response["error"] = e.what();
+            return crow::response(500, response);
+        } });
+
     // Restore specific version
     CROW_ROUTE(app, "/api/documents/<string>/versions/<string>/restore")
         .methods("POST"_method)([](const crow::request &req, std::string doc_id, std::string version_id)
@@ -356,23 +795,25 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
             return crow::response(500, response);
         } });
 
-    struct ConnectionData
-    {
-        std::string doc_id;
-        std::string user_id;
-    };
+    // Connections Heartbeat finds dead leave their rooms as if closed
+    Heartbeat::getInstance().onTimeout(reapConnection);
+
+    // A session that caught up with the process owning its room (or took
+    // the room over) repaints this process's members; channels get the
+    // frame tagged like any other
+    DocumentSessionManager::getInstance().onResync([](const std::string &doc_id, const DocumentSession &session)
+                                                   {
+        auto &rooms = WebSocketManager::getInstance();
+        rooms.broadcastLocally(doc_id, snapshotFrame(session.snapshot(), rooms.getParticipants(doc_id), false)); });
 
     CROW_WEBSOCKET_ROUTE(app, "/api/documents/ws/connect")
         .onaccept([](const crow::request &req, void **userdata)
                   {
             std::cout << "[WebSocket] Connection attempt to: " << req.url << std::endl;
+            // Without doc_id the connection only carries channels
             auto doc_id_param = req.url_params.get("doc_id");
-            if (!doc_id_param) {
-                std::cout << "[WebSocket] Missing doc_id parameter" << std::endl;
-                return false;
-            }
-            std::string doc_id = std::string(doc_id_param);
-            std::cout << "[WebSocket] Document ID: " << doc_id << std::endl;
+            std::string doc_id = doc_id_param ? std::string(doc_id_param) : std::string();
+            std::cout << "[WebSocket] Document ID: " << (doc_id.empty() ? "(channels only)" : doc_id) << std::endl;
             auto token_param = req.url_params.get("token");
             if (!token_param) {
                 std::cout << "[WebSocket] Missing token parameter" << std::endl;
@@ -391,155 +832,223 @@ void setupRoutes(crow::App<crow::CORSHandler> &app)
                 return false;
             }
             std::cout << "[WebSocket] User ID: " << user_id << std::endl;
-            bool hasAccess = CollaborationService::checkAccess(doc_id, user_id, "read");
+            bool hasAccess = doc_id.empty() || CollaborationService::checkAccess(doc_id, user_id, "read");
             if (!hasAccess) {
                 std::cout << "[WebSocket] Access denied for user " << user_id << " to document " << doc_id << std::endl;
                 return false;
             }
             
+            OutboundQueue::Wire wire;
+            auto protocol_param = req.url_params.get("protocol");
+            wire.binary = protocol_param && std::string(protocol_param) == BinaryProtocol::NAME;
+            wire.deflate = FrameDeflater::negotiate(req.url_params.get("deflate"), req.url_params.get("deflate_takeover"),
+                                                    req.url_params.get("deflate_window_bits"));
+            
             std::cout << "[WebSocket] Connection accepted for user " << user_id << " to document " << doc_id << std::endl;
-            *userdata = new ConnectionData{doc_id, user_id};
+            *userdata = new ConnectionData{doc_id, user_id, wire, parseResume(req)};
             return true; })
         .onopen([](crow::websocket::connection &conn)
                 {
             auto* data = static_cast<ConnectionData*>(conn.userdata());
             if (data) {
+                LatencyProbe probe;
+                std::lock_guard<std::mutex> lock(data->mutex);
                 std::cout << "[WebSocket] Connection opened for user " << data->user_id << " to document " << data->doc_id << std::endl;
-                WebSocketManager::getInstance().joinDocument(data->doc_id, &conn, data->user_id);
-                
-                std::string username = "User";
-                try {
-                    UserRepository userRepo;
-                    auto user = userRepo.findById(data->user_id);
-                    if (user.has_value()) {
-                        username = user.value().getUsername();
-                    }
-                } catch (...) {
-                    // Use default username if lookup fails
+                if (data->doc_id.empty()) {
+                    WebSocketManager::getInstance().connect(&conn, data->user_id, data->wire, data->resume.session);
+                } else {
+                    enterRoom(conn, *data, data->doc_id, data->resume, false);
                 }
-                
-                crow::json::wvalue join_msg;
-                join_msg["type"] = "user_joined";
-                join_msg["user_id"] = data->user_id;
-                join_msg["username"] = username;
-                join_msg["doc_id"] = data->doc_id;
-                std::string join_msg_str = join_msg.dump();
-                WebSocketManager::getInstance().broadcastToDocument(data->doc_id, join_msg_str, &conn);
+                if (data->wire.binary) {
+                    // Tells the client it may send binary frames too
+                    OutboundQueue::Frame hello;
+                    hello.binary = OutboundQueue::share(BinaryProtocol::helloFrame());
+                    hello.priority = OutboundQueue::Priority::Control;
+                    WebSocketManager::getInstance().sendTo(&conn, hello);
+                }
+                data->liveness = Heartbeat::getInstance().watch(&conn);
             } })
-        .onclose([](crow::websocket::connection &conn, const std::string &reason, uint16_t)
+        .onclose([](crow::websocket::connection &conn, const std::string &reason, uint16_t code)
                  {
             auto* data = static_cast<ConnectionData*>(conn.userdata());
             if (data) {
-                crow::json::wvalue leave_msg;
-                leave_msg["type"] = "user_left";
-                leave_msg["user_id"] = data->user_id;
-                leave_msg["doc_id"] = data->doc_id;
-                std::string leave_msg_str = leave_msg.dump();
-                WebSocketManager::getInstance().broadcastToDocument(data->doc_id, leave_msg_str);
-                
-                WebSocketManager::getInstance().leaveAll(&conn);
+                Heartbeat::getInstance().forget(&conn);
+                {
+                    std::lock_guard<std::mutex> lock(data->mutex);
+                    exitAll(conn, *data, code);
+                }
                 delete data;
             } })
         .onmessage([](crow::websocket::connection &conn, const std::string &data, bool is_binary)
                    {
-            if (is_binary) return;
-            
             try {
                 auto* conn_data = static_cast<ConnectionData*>(conn.userdata());
                 if (!conn_data) return;
+                if (conn_data->liveness) conn_data->liveness->touch();
+                
+                std::lock_guard<std::mutex> lock(conn_data->mutex);
+                if (conn_data->reaped) return;
+                
+                if (is_binary) {
+                    if (!conn_data->wire.binary) return;
+                    
+                    BinaryProtocol::ClientMessage message;
+                    try {
+                        message = BinaryProtocol::decode(data);
+                    } catch (const std::invalid_argument& e) {
+                        if (data.empty() || static_cast<uint8_t>(data[0]) != BinaryProtocol::SUBMIT || conn_data->doc_id.empty()) throw;
+                        sendOpError(conn, *conn_data, conn_data->doc_id, e.what());
+                        return;
+                    }
+                    
+                    if (message.type == BinaryProtocol::RECEIPT) {
+                        WebSocketManager::getInstance().acknowledge(&conn, message.count);
+                        return;
+                    }
+                    std::string doc_id = targetOf(*conn_data, message.channel);
+                    if (doc_id.empty()) return;
+                    if (message.type == BinaryProtocol::SUBMIT) {
+                        submitOperations(conn, *conn_data, doc_id, message.revision, std::move(message.ops));
+                    } else if (message.type == BinaryProtocol::CLIENT_CURSOR) {
+                        publishCursor(conn, *conn_data, doc_id, message.has_position, message.position);
+                    }
+                    return;
+                }
                 
                 auto msg = crow::json::load(data);
                 if (!msg) return;
                 
                 std::string type = msg["type"].s();
                 
-                if (type == "edit") {
-                    std::cout << "[WebSocket] Received edit message from user " << conn_data->user_id << " for document " << conn_data->doc_id << std::endl;
-                    auto edit_msg = crow::json::load(data);
-                    if (edit_msg) {
-                        // Create a new message with userId included
-                        crow::json::wvalue broadcast_msg;
-                        broadcast_msg["type"] = "edit";
-                        if (edit_msg.has("content")) {
-                            broadcast_msg["content"] = std::string(edit_msg["content"].s());
-                        }
-                        if (edit_msg.has("version")) {
-                            broadcast_msg["version"] = static_cast<int>(edit_msg["version"].i());
-                        }
-                        broadcast_msg["userId"] = conn_data->user_id;
-                        std::string edit_msg_str = broadcast_msg.dump();
-                        WebSocketManager::getInstance().broadcastToDocument(conn_data->doc_id, edit_msg_str);
-                        std::cout << "[WebSocket] Broadcasted edit message to all users in document " << conn_data->doc_id << std::endl;
-                    } else {
-                        WebSocketManager::getInstance().broadcastToDocument(conn_data->doc_id, data, &conn);
+                if (type == "pong") {
+                    // Answers a heartbeat ping; arriving was all it had to do
+                    return;
+                }
+                
+                if (type == "recv") {
+                    // Receipt for flow control: frames received so far
+                    if (msg.has("count")) {
+                        WebSocketManager::getInstance().acknowledge(&conn, msg["count"].u());
                     }
-                } else if (type == "cursor") {
-                    std::string username = "User";
-                    try {
-                        UserRepository userRepo;
-                        auto user = userRepo.findById(conn_data->user_id);
-                        if (user.has_value()) {
-                            username = user.value().getUsername();
+                    return;
+                }
+                
+                if (type == "subscribe" || type == "unsubscribe") {
+                    std::string doc_id = msg.has("doc_id") ? std::string(msg["doc_id"].s()) : std::string();
+                    auto& channels = conn_data->channels;
+                    bool subscribed = std::find(channels.begin(), channels.end(), doc_id) != channels.end();
+                    
+                    if (type == "unsubscribe") {
+                        if (subscribed) {
+                            exitRoom(conn, *conn_data, doc_id, 1000);
+                            channels.erase(std::remove(channels.begin(), channels.end(), doc_id), channels.end());
                         }
-                    } catch (...) {
-                        // Use default username if lookup fails
+                        crow::json::wvalue reply;
+                        reply["type"] = "unsubscribed";
+                        reply["doc"] = doc_id;
+                        WebSocketManager::getInstance().sendTo(&conn, reply.dump());
+                        return;
                     }
                     
-                    auto cursor_msg = crow::json::load(data);
-                    if (cursor_msg) {
-                        crow::json::wvalue cursor_wmsg;
-                        cursor_wmsg["type"] = "cursor";
-                        if (cursor_msg.has("position")) {
-                            cursor_wmsg["position"] = static_cast<int>(cursor_msg["position"].i());
-                        }
-                        if (cursor_msg.has("userId")) {
-                            cursor_wmsg["userId"] = std::string(cursor_msg["userId"].s());
+                    // Each channel is checked like a connection to it
+                    std::string error;
+                    if (doc_id.empty()) {
+                        error = "doc_id is required";
+                    } else if (doc_id == conn_data->doc_id || subscribed) {
+                        error = "Already subscribed to this document";
+                    } else if (channels.size() >= MAX_CHANNELS) {
+                        error = "Too many subscriptions";
+                    } else if (!CollaborationService::checkAccess(doc_id, conn_data->user_id, "read")) {
+                        error = "Access denied";
+                    }
+                    if (!error.empty()) {
+                        crow::json::wvalue reply;
+                        reply["type"] = "subscribe_error";
+                        reply["doc"] = doc_id;
+                        reply["error"] = error;
+                        WebSocketManager::getInstance().sendTo(&conn, reply.dump());
+                        return;
+                    }
+                    
+                    // stream and seq: where a client resubscribing after a
+                    // reconnect left off in this channel
+                    WebSocketManager::Resume resume{conn_data->resume.session, 0, 0};
+                    if (msg.has("stream") && msg.has("seq")) {
+                        resume.stream = msg["stream"].u();
+                        resume.seq = msg["seq"].u();
+                    }
+                    enterRoom(conn, *conn_data, doc_id, resume, true);
+                    channels.push_back(doc_id);
+                    std::cout << "[WebSocket] User " << conn_data->user_id << " subscribed to document " << doc_id << std::endl;
+                    return;
+                }
+                
+                std::string doc_id = targetOf(*conn_data, msg.has("doc") ? std::string(msg["doc"].s()) : std::string());
+                if (doc_id.empty()) return;
+                
+                if (type == "op") {
+                    std::vector<TextOperation> ops;
+                    try {
+                        if (!msg.has("revision") || !msg.has("ops")) {
+                            throw std::invalid_argument("op needs revision and ops");
                         }
-                        cursor_wmsg["username"] = username;
-                        std::string cursor_msg_str = cursor_wmsg.dump();
-                        WebSocketManager::getInstance().broadcastToDocument(conn_data->doc_id, cursor_msg_str, &conn);
-                    } else {
-                        WebSocketManager::getInstance().broadcastToDocument(conn_data->doc_id, data, &conn);
+                        ops = OperationJson::parse(msg["ops"]);
+                    } catch (const std::exception& e) {
+                        sendOpError(conn, *conn_data, doc_id, e.what());
+                        return;
                     }
+                    submitOperations(conn, *conn_data, doc_id, static_cast<int>(msg["revision"].i()), std::move(ops));
+                } else if (type == "cursor") {
+                    publishCursor(conn, *conn_data, doc_id, msg.has("position"),
+                                  msg.has("position") ? static_cast<size_t>(std::max<int64_t>(0, msg["position"].i())) : 0);
                 } else if (type == "save") {
-                    if (msg.has("content")) {
-                        try {
+                    // The room persists write-behind, so a save only has to
+                    // land content the server has not seen; otherwise it is
+                    // acknowledged with the version the next write covers
+                    try {
+                        auto session = DocumentSessionManager::getInstance().find(doc_id);
+                        int version = session ? session->getVersion() : DocumentService::getDocumentVersion(doc_id, conn_data->user_id);
+                        if (msg.has("content")) {
                             std::string content = msg["content"].s();
                             std::string title = msg.has("title") ? std::string(msg["title"].s()) : std::string("");
                             int expected_version = msg.has("version") ? static_cast<int>(msg["version"].i()) : -1;
                             
-                            DocumentRepository docRepo;
-                            auto doc = docRepo.findById(conn_data->doc_id);
-                            if (doc.has_value()) {
-                                std::string doc_title = title.empty() ? doc.value().getTitle() : title;
-                                
-                                DocumentService::updateDocument(
-                                    conn_data->doc_id,
-                                    conn_data->user_id,
-                                    doc_title,
-                                    content,
-                                    expected_version
-                                );
-                                
-                                auto updatedDoc = docRepo.findById(conn_data->doc_id);
-                                if (updatedDoc.has_value()) {
-                                    crow::json::wvalue save_msg;
-                                    save_msg["type"] = "saved";
-                                    save_msg["content"] = updatedDoc.value().getContent();
-                                    save_msg["version"] = updatedDoc.value().getVersion();
-                                    save_msg["userId"] = conn_data->user_id;
-                                    std::string save_msg_str = save_msg.dump();
-                                    
-                                    WebSocketManager::getInstance().broadcastToDocument(conn_data->doc_id, save_msg_str);
-                                }
+                            std::string doc_title = title;
+                            if (doc_title.empty()) {
+                                doc_title = session ? session->getTitle() : DocumentService::getDocumentById(doc_id, conn_data->user_id).getTitle();
                             }
-                        } catch (const std::exception& e) {
-                            crow::json::wvalue error_msg;
-                            error_msg["type"] = "save_error";
-                            error_msg["error"] = e.what();
-                            std::string error_msg_str = error_msg.dump();
-                            conn.send_text(error_msg_str);
+                            
+                            Document updatedDoc = DocumentService::updateDocument(
+                                doc_id,
+                                conn_data->user_id,
+                                doc_title,
+                                content,
+                                expected_version,
+                                &conn
+                            );
+                            
+                            if (updatedDoc.getVersion() != version) {
+                                RoomCoalescer::getInstance().saved(doc_id, updatedDoc.getVersion(),
+                                                                   savedFrame(updatedDoc, conn_data->user_id));
+                            }
+                            version = updatedDoc.getVersion();
+                        }
+                        
+                        crow::json::wvalue ack;
+                        ack["type"] = "save_ack";
+                        ack["version"] = version;
+                        tagChannel(ack, *conn_data, doc_id);
+                        if (session) {
+                            ack["persistedVersion"] = session->getPersistedVersion();
                         }
+                        WebSocketManager::getInstance().sendTo(&conn, ack.dump());
+                    } catch (const std::exception& e) {
+                        crow::json::wvalue error_msg;
+                        error_msg["type"] = "save_error";
+                        error_msg["error"] = e.what();
+                        tagChannel(error_msg, *conn_data, doc_id);
+                        std::string error_msg_str = error_msg.dump();
+                        WebSocketManager::getInstance().sendTo(&conn, error_msg_str);
                     }
                 }
             } catch (const std::exception& e) {
@@ -1,7 +1,7 @@
 #include "services/CollaborationService.h"
 #include "repositories/CollaboratorRepository.h"
-#include "repositories/DocumentRepository.h"
 #include "repositories/UserRepository.h"
+#include "cache/AclIndex.h"
 #include "models/Collaborator.h"
 #include "models/User.h"
 #include <stdexcept>
@@ -21,14 +21,13 @@ Collaborator CollaborationService::shareDocument(const std::string& doc_id, cons
     }
     
     // Validate document exists and user is owner
-    DocumentRepository docRepo;
-    auto doc = docRepo.findById(doc_id);
-    if (!doc.has_value())
+    auto acl = AclIndex::getInstance().get(doc_id);
+    if (!acl)
     {
         throw std::runtime_error("Document not found");
     }
     
-    if (doc.value().getOwnerId() != owner_id)
+    if (acl->owner_id != owner_id)
     {
         throw std::runtime_error("Access denied: Only document owner can share");
     }
@@ -60,6 +59,7 @@ Collaborator CollaborationService::shareDocument(const std::string& doc_id, cons
         {
             throw std::runtime_error("Failed to update collaboration");
         }
+        AclIndex::getInstance().grant(doc_id, collaborator_id, permission);
         
         auto updated = collabRepo.findCollaborator(doc_id, collaborator_id);
         if (!updated.has_value())
@@ -78,6 +78,7 @@ Collaborator CollaborationService::shareDocument(const std::string& doc_id, cons
         {
             throw std::runtime_error("Failed to create collaboration");
         }
+        AclIndex::getInstance().grant(doc_id, collaborator_id, permission);
         
         return created.value();
     }
@@ -91,21 +92,14 @@ std::vector<Collaborator> CollaborationService::getCollaborators(const std::stri
     }
     
     // Check if user is owner or collaborator
-    DocumentRepository docRepo;
-    auto doc = docRepo.findById(doc_id);
-    if (!doc.has_value())
+    auto acl = AclIndex::getInstance().get(doc_id);
+    if (!acl)
     {
         throw std::runtime_error("Document not found");
     }
     
-    bool isOwner = doc.value().getOwnerId() == user_id;
-    bool isCollaborator = false;
-    
-    if (!isOwner)
-    {
-        CollaboratorRepository collabRepo;
-        isCollaborator = collabRepo.isCollaborator(doc_id, user_id);
-    }
+    bool isOwner = acl->owner_id == user_id;
+    bool isCollaborator = acl->permissionsFor(user_id) != ACL_NONE;
     
     if (!isOwner && !isCollaborator)
     {
@@ -131,14 +125,13 @@ Collaborator CollaborationService::updatePermission(const std::string& doc_id, c
     }
     
     // Validate document exists and user is owner
-    DocumentRepository docRepo;
-    auto doc = docRepo.findById(doc_id);
-    if (!doc.has_value())
+    auto acl = AclIndex::getInstance().get(doc_id);
+    if (!acl)
     {
         throw std::runtime_error("Document not found");
     }
     
-    if (doc.value().getOwnerId() != owner_id)
+    if (acl->owner_id != owner_id)
     {
         throw std::runtime_error("Access denied: Only document owner can update permissions");
     }
@@ -156,6 +149,7 @@ Collaborator CollaborationService::updatePermission(const std::string& doc_id, c
     {
         throw std::runtime_error("Failed to update permission");
     }
+    AclIndex::getInstance().grant(doc_id, collaborator_id, permission);
     
     // Return updated collaboration
     auto updated = collabRepo.findCollaborator(doc_id, collaborator_id);
@@ -176,14 +170,13 @@ void CollaborationService::removeCollaborator(const std::string& doc_id, const s
     }
     
     // Validate document exists and user is owner
-    DocumentRepository docRepo;
-    auto doc = docRepo.findById(doc_id);
-    if (!doc.has_value())
+    auto acl = AclIndex::getInstance().get(doc_id);
+    if (!acl)
     {
         throw std::runtime_error("Document not found");
     }
     
-    if (doc.value().getOwnerId() != owner_id)
+    if (acl->owner_id != owner_id)
     {
         throw std::runtime_error("Access denied: Only document owner can remove collaborators");
     }
@@ -201,6 +194,7 @@ void CollaborationService::removeCollaborator(const std::string& doc_id, const s
     {
         throw std::runtime_error("Failed to remove collaborator");
     }
+    AclIndex::getInstance().revoke(doc_id, collaborator_id);
 }
 
 std::vector<std::string> CollaborationService::getSharedDocumentIds(const std::string& user_id)
@@ -230,17 +224,8 @@ bool CollaborationService::checkAccess(const std::string& doc_id, const std::str
         return false;
     }
     
-    // Check if user is owner (owners always have full access)
-    DocumentRepository docRepo;
-    auto doc = docRepo.findById(doc_id);
-    if (doc.has_value() && doc.value().getOwnerId() == user_id)
-    {
-        return true;
-    }
-    
-    // Check if user is collaborator with required permission
-    CollaboratorRepository collabRepo;
-    return collabRepo.hasAccess(doc_id, user_id, required_permission);
+    // Owner and collaborator permissions come from the in-memory ACL index
+    return AclIndex::getInstance().checkAccess(doc_id, user_id, AclIndex::maskFor(required_permission));
 }
 
 
@@ -1,9 +1,16 @@
 #include "services/DocumentService.h"
 #include "services/CollaborationService.h"
+#include "services/DocumentSessionManager.h"
+#include "services/EditService.h"
+#include "utils/WebSocketManager.h"
 #include "repositories/DocumentRepository.h"
+#include "cache/AclIndex.h"
+#include "cache/AccessRecorder.h"
 #include "models/Document.h"
+#include "utils/Utf16.h"
 #include <stdexcept>
 #include <algorithm>
+#include <optional>
 
 Document DocumentService::createDocument(const std::string& owner_id, const std::string& title, const std::string& content)
 {
@@ -18,6 +25,11 @@ Document DocumentService::createDocument(const std::string& owner_id, const std:
         throw std::invalid_argument("Title must be 1-255 characters and not empty");
     }
     
+    if (!Utf16::isValidUtf8(content))
+    {
+        throw std::invalid_argument("Content must be valid UTF-8");
+    }
+    
     // Create document
     Document doc("", title, content, owner_id);
     DocumentRepository repo;
@@ -27,6 +39,7 @@ Document DocumentService::createDocument(const std::string& owner_id, const std:
     {
         throw std::runtime_error("Failed to create document");
     }
+    AclIndex::getInstance().setOwner(createdDoc.value().getId(), owner_id);
     
     return createdDoc.value();
 }
@@ -38,8 +51,17 @@ Document DocumentService::getDocumentById(const std::string& doc_id, const std::
         throw std::invalid_argument("Document ID and User ID are required");
     }
     
-    DocumentRepository repo;
-    auto doc = repo.findById(doc_id);
+    // An active session holds newer state than the database
+    std::optional<Document> doc;
+    if (auto session = DocumentSessionManager::getInstance().find(doc_id))
+    {
+        doc = session->snapshot();
+    }
+    else
+    {
+        DocumentRepository repo;
+        doc = repo.findById(doc_id);
+    }
     
     if (!doc.has_value())
     {
@@ -55,9 +77,44 @@ Document DocumentService::getDocumentById(const std::string& doc_id, const std::
         throw std::runtime_error("Access denied: You don't have permission to access this document");
     }
     
+    AccessRecorder::getInstance().recordDocument(doc_id);
+    AccessRecorder::getInstance().recordUser(user_id);
     return doc.value();
 }
 
+int DocumentService::getDocumentVersion(const std::string& doc_id, const std::string& user_id)
+{
+    if (doc_id.empty() || user_id.empty())
+    {
+        throw std::invalid_argument("Document ID and User ID are required");
+    }
+    
+    auto acl = AclIndex::getInstance().get(doc_id);
+    if (!acl)
+    {
+        throw std::runtime_error("Document not found");
+    }
+    
+    if (!AclIndex::getInstance().checkAccess(doc_id, user_id, ACL_READ))
+    {
+        throw std::runtime_error("Access denied: You don't have permission to access this document");
+    }
+    
+    if (auto session = DocumentSessionManager::getInstance().find(doc_id))
+    {
+        return session->getVersion();
+    }
+    
+    DocumentRepository repo;
+    auto version = repo.findVersion(doc_id);
+    if (!version.has_value())
+    {
+        throw std::runtime_error("Document not found");
+    }
+    
+    return version.value();
+}
+
 std::vector<Document> DocumentService::getAllUserDocuments(const std::string& user_id)
 {
     if (user_id.empty())
@@ -65,6 +122,8 @@ std::vector<Document> DocumentService::getAllUserDocuments(const std::string& us
         throw std::invalid_argument("User ID is required");
     }
     
+    AccessRecorder::getInstance().recordUser(user_id);
+    
     DocumentRepository repo;
     std::vector<Document> documents;
     
@@ -72,10 +131,25 @@ std::vector<Document> DocumentService::getAllUserDocuments(const std::string& us
     std::vector<Document> ownedDocs = repo.findByOwnerId(user_id);
     documents.insert(documents.end(), ownedDocs.begin(), ownedDocs.end());
     
+    auto &sessions = DocumentSessionManager::getInstance();
+    for (auto &doc : documents)
+    {
+        if (auto session = sessions.find(doc.getId()))
+        {
+            doc = session->snapshot();
+        }
+    }
+    
     // Get shared documents
     std::vector<std::string> sharedDocIds = CollaborationService::getSharedDocumentIds(user_id);
     for (const auto& docId : sharedDocIds)
     {
+        if (auto session = sessions.find(docId))
+        {
+            documents.push_back(session->snapshot());
+            continue;
+        }
+        
         auto doc = repo.findById(docId);
         if (doc.has_value())
         {
@@ -86,7 +160,8 @@ std::vector<Document> DocumentService::getAllUserDocuments(const std::string& us
     return documents;
 }
 
-Document DocumentService::updateDocument(const std::string& doc_id, const std::string& user_id, const std::string& title, const std::string& content, int expected_version)
+Document DocumentService::updateDocument(const std::string& doc_id, const std::string& user_id, const std::string& title, const std::string& content, int expected_version,
+                                         crow::websocket::connection* origin)
 {
     if (doc_id.empty() || user_id.empty())
     {
@@ -98,6 +173,38 @@ Document DocumentService::updateDocument(const std::string& doc_id, const std::s
         throw std::invalid_argument("Title must be 1-255 characters and not empty");
     }
     
+    if (!Utf16::isValidUtf8(content))
+    {
+        throw std::invalid_argument("Content must be valid UTF-8");
+    }
+    
+    // Active rooms apply edits in memory; the session persists them write-behind
+    if (auto session = DocumentSessionManager::getInstance().find(doc_id))
+    {
+        if (!CollaborationService::checkAccess(doc_id, user_id, "write"))
+        {
+            throw std::runtime_error("Access denied: You don't have permission to update this document");
+        }
+        if (!WebSocketManager::getInstance().ownsDocument(doc_id))
+        {
+            throw std::runtime_error("NOT_OWNER: Document is being edited through another server process");
+        }
+        
+        // Sequenced like operations, so the room sees the save in the
+        // same order as the edits around it
+        std::lock_guard<std::mutex> order(session->sequencer());
+        AppliedOperation applied;
+        if (auto updated = session->apply(title, content, expected_version, &applied))
+        {
+            if (applied.revision > 0)
+            {
+                applied.user_id = user_id;
+                EditService::announce(doc_id, applied, origin);
+            }
+            return updated.value();
+        }
+    }
+    
     DocumentRepository repo;
     
     // Check if document exists
@@ -162,6 +269,31 @@ Document DocumentService::renameDocument(const std::string& doc_id, const std::s
         throw std::invalid_argument("Title must be 1-255 characters and not empty");
     }
     
+    if (auto session = DocumentSessionManager::getInstance().find(doc_id))
+    {
+        auto acl = AclIndex::getInstance().get(doc_id);
+        if (!acl || acl->owner_id != user_id)
+        {
+            throw std::runtime_error("Access denied: You don't have permission to rename this document");
+        }
+        if (!WebSocketManager::getInstance().ownsDocument(doc_id))
+        {
+            throw std::runtime_error("NOT_OWNER: Document is being edited through another server process");
+        }
+        
+        std::lock_guard<std::mutex> order(session->sequencer());
+        AppliedOperation applied;
+        if (auto renamed = session->rename(new_title, &applied))
+        {
+            if (applied.revision > 0)
+            {
+                applied.user_id = user_id;
+                EditService::announce(doc_id, applied);
+            }
+            return renamed.value();
+        }
+    }
+    
     DocumentRepository repo;
     
     // Check if document exists and user owns it
@@ -220,5 +352,7 @@ void DocumentService::deleteDocument(const std::string& doc_id, const std::strin
     {
         throw std::runtime_error("Failed to delete document");
     }
+    DocumentSessionManager::getInstance().discard(doc_id);
+    AclIndex::getInstance().erase(doc_id);
 }
 
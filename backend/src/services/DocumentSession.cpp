@@ -0,0 +1,393 @@
+#include "services/DocumentSession.h"
+#include "services/OperationalTransform.h"
+#include <stdexcept>
+
+const size_t DocumentSession::MAX_HISTORY;
+
+DocumentSession::DocumentSession(const Document &persisted)
+    : document_(persisted),
+      content_(persisted.getContent()),
+      persisted_title_(persisted.getTitle()),
+      persisted_content_(content_),
+      persisted_version_(persisted.getVersion()),
+      journaled_version_(persisted.getVersion()),
+      connections_(0),
+      closed_(false),
+      following_(false),
+      last_edit_(Clock::now()),
+      last_persist_(Clock::now())
+{
+    document_.setContent("");
+}
+
+Document DocumentSession::snapshot() const
+{
+    State current = state();
+    current.document.setContent(current.content.toString());
+    return current.document;
+}
+
+DocumentSession::State DocumentSession::state() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {document_, content_};
+}
+
+std::string DocumentSession::getTitle() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return document_.getTitle();
+}
+
+int DocumentSession::getVersion() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return document_.getVersion();
+}
+
+std::optional<Document> DocumentSession::apply(const std::string &title, const std::string &content, int expected_version,
+                                               AppliedOperation *recorded)
+{
+    // Diff outside the lock against a snapshot; only if an edit lands in
+    // the meantime is the diff redone under the lock
+    State base = state();
+    AppliedOperation applied;
+    applied.ops = OperationalTransform::replace(base.content.toString(), content);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+        return std::nullopt;
+
+    int current_version = document_.getVersion();
+    if (expected_version > 0 && current_version != expected_version)
+    {
+        throw std::runtime_error("VERSION_CONFLICT: Document was modified by another user. Current version: " + std::to_string(current_version) + ", Expected: " + std::to_string(expected_version));
+    }
+
+    if (current_version != base.document.getVersion())
+        applied.ops = OperationalTransform::replace(content_.toString(), content);
+
+    if (applied.ops.empty() && title == document_.getTitle())
+    {
+        Document unchanged = document_;
+        unchanged.setContent(content);
+        return unchanged;
+    }
+
+    // Applying the delta keeps the unchanged parts of the rope shared
+    OperationalTransform::apply(content_, applied.ops);
+    document_.setTitle(title);
+    document_.setVersion(current_version + 1);
+    last_edit_ = Clock::now();
+
+    applied.revision = document_.getVersion();
+    if (recorded)
+        *recorded = applied;
+    record(std::move(applied));
+
+    Document result = document_;
+    result.setContent(content);
+    return result;
+}
+
+std::optional<Document> DocumentSession::rename(const std::string &title, AppliedOperation *recorded)
+{
+    State renamed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_)
+            return std::nullopt;
+
+        document_.setTitle(title);
+        document_.setVersion(document_.getVersion() + 1);
+        last_edit_ = Clock::now();
+
+        AppliedOperation applied;
+        applied.revision = document_.getVersion();
+        if (recorded)
+            *recorded = applied;
+        record(std::move(applied));
+        renamed = {document_, content_};
+    }
+
+    renamed.document.setContent(renamed.content.toString());
+    return renamed.document;
+}
+
+std::optional<AppliedOperation> DocumentSession::applyOperations(int base_revision, std::vector<TextOperation> ops, const std::string &user_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+        return std::nullopt;
+
+    int current = document_.getVersion();
+    if (base_revision > current)
+    {
+        throw std::invalid_argument("Revision " + std::to_string(base_revision) + " is ahead of the document (" + std::to_string(current) + ")");
+    }
+
+    if (base_revision < current)
+    {
+        checkHistoryReaches(base_revision);
+        for (const auto &entry : history_)
+        {
+            if (entry.revision > base_revision)
+                ops = OperationalTransform::transform(ops, entry.ops);
+        }
+    }
+
+    OperationalTransform::apply(content_, ops);
+    document_.setVersion(current + 1);
+    last_edit_ = Clock::now();
+
+    AppliedOperation applied;
+    applied.revision = current + 1;
+    applied.user_id = user_id;
+    applied.ops = std::move(ops);
+    record(applied);
+    return applied;
+}
+
+std::vector<AppliedOperation> DocumentSession::operationsSince(int revision) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<AppliedOperation> result;
+    if (revision >= document_.getVersion())
+        return result;
+
+    checkHistoryReaches(revision);
+    for (const auto &entry : history_)
+    {
+        if (entry.revision > revision)
+            result.push_back(entry);
+    }
+    return result;
+}
+
+std::optional<std::vector<TextOperation>> DocumentSession::operationsBetween(int from, int to) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<TextOperation> ops;
+    int next = from + 1;
+    for (const auto &entry : history_)
+    {
+        if (entry.revision <= from)
+            continue;
+        if (entry.revision > to)
+            break;
+        if (entry.revision != next)
+            return std::nullopt;
+        ops.insert(ops.end(), entry.ops.begin(), entry.ops.end());
+        ++next;
+    }
+    if (next != to + 1)
+        return std::nullopt;
+    return ops;
+}
+
+void DocumentSession::record(AppliedOperation applied)
+{
+    history_.push_back(std::move(applied));
+    while (history_.size() > MAX_HISTORY)
+        history_.pop_front();
+}
+
+void DocumentSession::checkHistoryReaches(int revision) const
+{
+    if (history_.empty() || history_.front().revision > revision + 1)
+    {
+        throw std::runtime_error("REVISION_TOO_OLD: Revision " + std::to_string(revision) + " is no longer available, current revision is " + std::to_string(document_.getVersion()));
+    }
+}
+
+size_t DocumentSession::addConnection()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ++connections_;
+}
+
+size_t DocumentSession::removeConnection()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (connections_ > 0)
+        --connections_;
+    return connections_;
+}
+
+size_t DocumentSession::connectionCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return connections_;
+}
+
+bool DocumentSession::isDirty() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return document_.getVersion() != persisted_version_;
+}
+
+bool DocumentSession::needsJournal() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return document_.getVersion() != journaled_version_;
+}
+
+int DocumentSession::getPersistedVersion() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return persisted_version_;
+}
+
+void DocumentSession::markPersisted(const State &persisted)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    persisted_title_ = persisted.document.getTitle();
+    persisted_content_ = persisted.content;
+    persisted_version_ = persisted.document.getVersion();
+    last_persist_ = Clock::now();
+}
+
+void DocumentSession::markJournaled(int version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    journaled_version_ = version;
+}
+
+std::optional<AppliedOperation> DocumentSession::merge(const Document &database)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+        return std::nullopt;
+
+    std::string base = persisted_content_.toString();
+    auto external = OperationalTransform::replace(base, database.getContent());
+    auto local = OperationalTransform::replace(base, content_.toString());
+
+    AppliedOperation applied;
+    applied.ops = OperationalTransform::transform(external, local);
+    bool retitled = database.getTitle() != persisted_title_ && document_.getTitle() == persisted_title_;
+
+    persisted_title_ = database.getTitle();
+    persisted_content_ = Rope(database.getContent());
+    persisted_version_ = database.getVersion();
+
+    int current = document_.getVersion();
+    if (applied.ops.empty() && !retitled && current > database.getVersion())
+        return std::nullopt;
+
+    OperationalTransform::apply(content_, applied.ops);
+    if (retitled)
+        document_.setTitle(database.getTitle());
+
+    int next = current + 1;
+    if (next <= database.getVersion())
+    {
+        // Revisions skip ahead; operations against old ones must resync
+        next = database.getVersion() + 1;
+        history_.clear();
+    }
+    document_.setVersion(next);
+    last_edit_ = Clock::now();
+
+    applied.revision = next;
+    record(applied);
+    return applied;
+}
+
+bool DocumentSession::isFollowing() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return following_;
+}
+
+void DocumentSession::startFollowing()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    following_ = true;
+    settleLocked();
+}
+
+bool DocumentSession::follow(const AppliedOperation &applied, const std::string &title)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int current = document_.getVersion();
+    if (closed_ || applied.revision <= current)
+        return true;
+    if (applied.revision != current + 1)
+        return false;
+
+    OperationalTransform::apply(content_, applied.ops);
+    document_.setTitle(title);
+    document_.setVersion(applied.revision);
+    last_edit_ = Clock::now();
+    record(applied);
+    settleLocked();
+    return true;
+}
+
+bool DocumentSession::resync(const Document &owner)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+        return false;
+    bool changed = replaceLocked(owner);
+    settleLocked();
+    return changed;
+}
+
+bool DocumentSession::adopt(const Document &database)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+        return false;
+    bool changed = replaceLocked(database);
+    following_ = false;
+    persisted_title_ = database.getTitle();
+    persisted_content_ = Rope(database.getContent());
+    persisted_version_ = database.getVersion();
+    journaled_version_ = database.getVersion();
+    return changed;
+}
+
+bool DocumentSession::replaceLocked(const Document &document)
+{
+    document_.setTitle(document.getTitle());
+    if (document.getVersion() == document_.getVersion())
+        return false;
+
+    content_ = Rope(document.getContent());
+    document_.setVersion(document.getVersion());
+    last_edit_ = Clock::now();
+    // Operations against this copy's revisions no longer apply
+    history_.clear();
+    return true;
+}
+
+void DocumentSession::settleLocked()
+{
+    persisted_title_ = document_.getTitle();
+    persisted_content_ = content_;
+    persisted_version_ = document_.getVersion();
+    journaled_version_ = document_.getVersion();
+}
+
+bool DocumentSession::close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (connections_ > 0 || document_.getVersion() != persisted_version_)
+        return false;
+    closed_ = true;
+    return true;
+}
+
+DocumentSession::Clock::time_point DocumentSession::lastEdit() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_edit_;
+}
+
+DocumentSession::Clock::time_point DocumentSession::lastPersist() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_persist_;
+}
@@ -0,0 +1,704 @@
+#include "services/DocumentSessionManager.h"
+#include "services/EditService.h"
+#include "repositories/DocumentRepository.h"
+#include "cache/AccessRecorder.h"
+#include "cache/DocumentCache.h"
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+const std::chrono::milliseconds DocumentSessionManager::JOURNAL_INTERVAL(200);
+const std::chrono::milliseconds DocumentSessionManager::IDLE_PERSIST_DELAY(2000);
+const std::chrono::milliseconds DocumentSessionManager::MAX_PERSIST_INTERVAL(10000);
+// At most 12 writes per session per minute
+const std::chrono::milliseconds DocumentSessionManager::MIN_PERSIST_SPACING(5000);
+const size_t DocumentSessionManager::MAX_ROOM_SCALE;
+
+namespace
+{
+    void putU32(std::string &out, uint32_t value)
+    {
+        char bytes[4];
+        std::memcpy(bytes, &value, 4);
+        out.append(bytes, 4);
+    }
+
+    void putString(std::string &out, const std::string &value)
+    {
+        putU32(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    bool getU32(const std::string &in, size_t &pos, uint32_t &value)
+    {
+        if (pos + 4 > in.size())
+            return false;
+        std::memcpy(&value, in.data() + pos, 4);
+        pos += 4;
+        return true;
+    }
+
+    bool getString(const std::string &in, size_t &pos, std::string &value)
+    {
+        uint32_t length;
+        if (!getU32(in, pos, length) || pos + length > in.size())
+            return false;
+        value.assign(in, pos, length);
+        pos += length;
+        return true;
+    }
+
+    // Revision payload: revision, user, title, op count, then per op u8
+    // type, position, length and text
+    std::string encodeRevision(const AppliedOperation &applied, const std::string &title)
+    {
+        std::string out;
+        putU32(out, static_cast<uint32_t>(applied.revision));
+        putString(out, applied.user_id);
+        putString(out, title);
+        putU32(out, static_cast<uint32_t>(applied.ops.size()));
+        for (const auto &op : applied.ops)
+        {
+            out += static_cast<char>(op.isInsert() ? 0 : 1);
+            putU32(out, static_cast<uint32_t>(op.position));
+            putU32(out, static_cast<uint32_t>(op.length));
+            putString(out, op.text);
+        }
+        return out;
+    }
+
+    bool decodeRevision(const std::string &in, AppliedOperation &applied, std::string &title)
+    {
+        size_t pos = 0;
+        uint32_t revision, count;
+        if (!getU32(in, pos, revision) || !getString(in, pos, applied.user_id) || !getString(in, pos, title) ||
+            !getU32(in, pos, count))
+            return false;
+        applied.revision = static_cast<int>(revision);
+        applied.ops.clear();
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (pos >= in.size())
+                return false;
+            TextOperation op;
+            op.type = in[pos++] == 0 ? TextOperation::Type::Insert : TextOperation::Type::Delete;
+            uint32_t position, length;
+            if (!getU32(in, pos, position) || !getU32(in, pos, length) || !getString(in, pos, op.text))
+                return false;
+            op.position = position;
+            op.length = length;
+            applied.ops.push_back(std::move(op));
+        }
+        return pos == in.size();
+    }
+
+    // Sync payload: version, title, content
+    std::string encodeSync(const Document &document)
+    {
+        std::string out;
+        putU32(out, static_cast<uint32_t>(document.getVersion()));
+        putString(out, document.getTitle());
+        putString(out, document.getContent());
+        return out;
+    }
+
+    bool decodeSync(const std::string &in, Document &document)
+    {
+        size_t pos = 0;
+        uint32_t version;
+        std::string title, content;
+        if (!getU32(in, pos, version) || !getString(in, pos, title) || !getString(in, pos, content) || pos != in.size())
+            return false;
+        document.setVersion(static_cast<int>(version));
+        document.setTitle(title);
+        document.setContent(content);
+        return true;
+    }
+}
+
+DocumentSessionManager &DocumentSessionManager::getInstance()
+{
+    static DocumentSessionManager instance;
+    return instance;
+}
+
+DocumentSessionManager::DocumentSessionManager()
+    : running_(false), wake_(false), persists_(0), persist_failures_(0), persists_deferred_(0),
+      journal_records_(0), journal_snapshots_(0), journal_syncs_(0), recovered_(0)
+{
+}
+
+DocumentSessionManager::~DocumentSessionManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (worker_.joinable())
+        worker_.join();
+}
+
+void DocumentSessionManager::start(const std::string &journal_dir)
+{
+    journal_dir_ = journal_dir;
+
+    std::error_code ec;
+    std::filesystem::create_directories(journal_dir_, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to create journal directory " << journal_dir_ << ": " << ec.message() << std::endl;
+    }
+
+    recover();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_)
+        return;
+    running_ = true;
+    worker_ = std::thread(&DocumentSessionManager::run, this);
+}
+
+void DocumentSessionManager::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (worker_.joinable())
+        worker_.join();
+
+    flush(true);
+    std::cout << "Document sessions flushed" << std::endl;
+}
+
+std::shared_ptr<DocumentSession> DocumentSessionManager::join(const std::string &doc_id)
+{
+    AccessRecorder::getInstance().recordDocument(doc_id);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(doc_id);
+        if (it != sessions_.end())
+        {
+            it->second->addConnection();
+            return it->second;
+        }
+    }
+
+    // Load outside the lock; a concurrent first join may win the insert
+    DocumentRepository repo;
+    auto doc = repo.findById(doc_id);
+    if (!doc.has_value())
+        return nullptr;
+
+    auto session = std::make_shared<DocumentSession>(doc.value());
+
+    bool created;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto inserted = sessions_.emplace(doc_id, session);
+        inserted.first->second->addConnection();
+        created = inserted.second;
+        session = inserted.first->second;
+    }
+
+    // Another process sequences the document; its state, not the
+    // database's, is current
+    auto bus = std::atomic_load(&bus_);
+    if (created && bus && bus->lease(doc_id) == FanoutBus::Lease::Following)
+    {
+        session->startFollowing();
+        requestSync(doc_id, true);
+    }
+    return session;
+}
+
+void DocumentSessionManager::leave(const std::string &doc_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(doc_id);
+    if (it == sessions_.end())
+        return;
+
+    if (it->second->removeConnection() == 0)
+    {
+        wake_ = true;
+        cv_.notify_all();
+    }
+}
+
+std::shared_ptr<DocumentSession> DocumentSessionManager::find(const std::string &doc_id) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(doc_id);
+    return it != sessions_.end() ? it->second : nullptr;
+}
+
+void DocumentSessionManager::discard(const std::string &doc_id)
+{
+    std::lock_guard<std::mutex> io_lock(io_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_.erase(doc_id);
+        auto bus = std::atomic_load(&bus_);
+        if (held_.erase(doc_id) && bus)
+            bus->unsubscribe(doc_id);
+    }
+
+    auto it = journals_.find(doc_id);
+    if (it != journals_.end())
+    {
+        it->second->remove();
+        journals_.erase(it);
+    }
+    else if (!journal_dir_.empty())
+    {
+        std::error_code ec;
+        std::filesystem::remove(DocumentJournal::pathFor(journal_dir_, doc_id), ec);
+    }
+}
+
+DocumentSessionManager::Stats DocumentSessionManager::getStats() const
+{
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats.active_sessions = sessions_.size();
+    }
+    stats.persists = persists_.load();
+    stats.persist_failures = persist_failures_.load();
+    stats.persists_deferred = persists_deferred_.load();
+    stats.journal_records = journal_records_.load();
+    stats.journal_snapshots = journal_snapshots_.load();
+    stats.journal_syncs = journal_syncs_.load();
+    stats.recovered = recovered_.load();
+    return stats;
+}
+
+void DocumentSessionManager::run()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, JOURNAL_INTERVAL, [this]
+                         { return !running_ || wake_; });
+            if (!running_)
+                break;
+            wake_ = false;
+        }
+
+        try
+        {
+            flush(false);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Document session flush failed: " << e.what() << std::endl;
+        }
+    }
+}
+
+void DocumentSessionManager::flush(bool force)
+{
+    std::vector<std::pair<std::string, std::shared_ptr<DocumentSession>>> active;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active.assign(sessions_.begin(), sessions_.end());
+    }
+
+    std::lock_guard<std::mutex> io_lock(io_mutex_);
+
+    // Group commit: append every changed session, then sync each journal
+    // once. A journal takes the operations since its last record, or a
+    // snapshot when those outgrow it or have left the history.
+    if (!journal_dir_.empty())
+    {
+        struct Pending
+        {
+            DocumentJournal *journal;
+            std::shared_ptr<DocumentSession> session;
+            int version;
+        };
+        std::vector<Pending> pending;
+
+        for (const auto &[doc_id, session] : active)
+        {
+            if (!session->needsJournal())
+                continue;
+
+            auto state = session->state();
+            DocumentJournal &journal = journalFor(doc_id);
+            std::optional<std::vector<TextOperation>> ops;
+            if (!journal.needsSnapshot())
+                ops = session->operationsBetween(journal.version(), state.document.getVersion());
+            bool written = ops.has_value() ? journal.appendDelta(state.document, ops.value())
+                                           : journal.writeSnapshot(state.document, state.content);
+            if (written)
+            {
+                if (!ops.has_value())
+                    journal_snapshots_++;
+                pending.push_back({&journal, session, state.document.getVersion()});
+                journal_records_++;
+            }
+        }
+
+        for (const auto &entry : pending)
+        {
+            if (entry.journal->sync())
+            {
+                entry.session->markJournaled(entry.version);
+                journal_syncs_++;
+            }
+        }
+    }
+
+    auto now = DocumentSession::Clock::now();
+    for (const auto &[doc_id, session] : active)
+    {
+        if (!session->isDirty())
+            continue;
+
+        if (force || persistDue(*session, now))
+            persist(doc_id, session);
+    }
+
+    // Evict clean sessions nobody is connected to
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &[doc_id, session] : active)
+    {
+        auto it = sessions_.find(doc_id);
+        if (it == sessions_.end() || it->second != session || !session->close())
+            continue;
+
+        sessions_.erase(it);
+        // Written, so the next owner finds it in the database
+        auto bus = std::atomic_load(&bus_);
+        if (held_.erase(doc_id) && bus)
+            bus->unsubscribe(doc_id);
+        auto journal = journals_.find(doc_id);
+        if (journal != journals_.end())
+        {
+            journal->second->remove();
+            journals_.erase(journal);
+        }
+    }
+}
+
+bool DocumentSessionManager::persistDue(const DocumentSession &session, DocumentSession::Clock::time_point now)
+{
+    size_t connections = session.connectionCount();
+    auto since_edit = now - session.lastEdit();
+    auto since_persist = now - session.lastPersist();
+
+    bool due = connections == 0;
+    if (!due)
+    {
+        // Busier rooms seldom go quiet for long, and each write flattens a
+        // document more people are waiting on: 1, 2, 3, 4x for 1, 2-3, 4-7
+        // and 8+ connections
+        size_t scale = 1;
+        while (scale < MAX_ROOM_SCALE && connections >= (size_t(1) << scale))
+            ++scale;
+        due = since_edit >= IDLE_PERSIST_DELAY * scale ||
+              since_persist >= MAX_PERSIST_INTERVAL * scale;
+    }
+    if (!due)
+        return false;
+
+    if (since_persist < MIN_PERSIST_SPACING)
+    {
+        persists_deferred_++;
+        return false;
+    }
+    return true;
+}
+
+void DocumentSessionManager::persist(const std::string &doc_id, const std::shared_ptr<DocumentSession> &session, bool announce)
+{
+    // Taken in O(1); the session keeps editing while this copy is flattened
+    auto state = session->state();
+    Document doc = state.document;
+    doc.setContent(state.content.toString());
+    int expected_version = session->getPersistedVersion();
+
+    DocumentRepository repo;
+    if (repo.persistSnapshot(doc, expected_version))
+    {
+        session->markPersisted(state);
+        persists_++;
+
+        // Nothing newer than the database left to recover
+        if (!journal_dir_.empty() && session->getVersion() == doc.getVersion())
+            journalFor(doc_id).reset();
+        return;
+    }
+
+    persist_failures_++;
+    auto database_version = repo.findVersion(doc_id);
+    if (!database_version.has_value())
+    {
+        std::cerr << "Document " << doc_id << " disappeared while its session was active" << std::endl;
+        session->markPersisted(session->state());
+        return;
+    }
+
+    if (database_version.value() != expected_version)
+        mergeDatabase(doc_id, session, database_version.value(), announce);
+}
+
+void DocumentSessionManager::mergeDatabase(const std::string &doc_id, const std::shared_ptr<DocumentSession> &session,
+                                           int database_version, bool announce)
+{
+    // Written outside the session; its changes join the session's as an
+    // edit the room receives, and the next write carries both
+    std::cerr << "Document " << doc_id << " changed underneath its session (database version " << database_version
+              << ", expected " << session->getPersistedVersion() << "); merging" << std::endl;
+    DocumentCache::getInstance().invalidate(doc_id);
+    DocumentRepository repo;
+    auto database = repo.findById(doc_id);
+    if (!database.has_value())
+        return;
+
+    std::lock_guard<std::mutex> order(session->sequencer());
+    auto merged = session->merge(database.value());
+    if (merged && announce)
+        EditService::announce(doc_id, merged.value());
+}
+
+void DocumentSessionManager::recover()
+{
+    DocumentRepository repo;
+    for (const auto &path : DocumentJournal::list(journal_dir_))
+    {
+        auto doc = DocumentJournal::read(path);
+        if (doc.has_value())
+        {
+            auto database_version = repo.findVersion(doc->getId());
+            if (database_version.has_value() && doc->getVersion() > database_version.value())
+            {
+                if (!repo.persistSnapshot(doc.value(), database_version.value()))
+                {
+                    std::cerr << "Failed to recover journal " << path << std::endl;
+                    continue;
+                }
+                recovered_++;
+                std::cout << "Recovered document " << doc->getId() << " at version " << doc->getVersion() << " from journal" << std::endl;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+}
+
+DocumentJournal &DocumentSessionManager::journalFor(const std::string &doc_id)
+{
+    auto it = journals_.find(doc_id);
+    if (it == journals_.end())
+    {
+        it = journals_.emplace(doc_id, std::make_unique<DocumentJournal>(DocumentJournal::pathFor(journal_dir_, doc_id))).first;
+    }
+    return *it->second;
+}
+
+void DocumentSessionManager::attachBus(const std::shared_ptr<FanoutBus> &bus)
+{
+    bus->onMessage(FanoutBus::Kind::Revision, [this](const FanoutBus::Message &message)
+                   { followRevision(message); });
+    bus->onMessage(FanoutBus::Kind::SyncRequest, [this](const FanoutBus::Message &message)
+                   { answerSync(message.room); });
+    bus->onMessage(FanoutBus::Kind::Sync, [this](const FanoutBus::Message &message)
+                   { takeSync(message); });
+    bus->onLease([this](const std::string &doc_id, FanoutBus::Lease lease)
+                 { leased(doc_id, lease); });
+    std::atomic_store(&bus_, bus);
+}
+
+void DocumentSessionManager::onResync(ResyncHandler handler)
+{
+    std::atomic_store(&resync_handler_, std::shared_ptr<const ResyncHandler>(std::make_shared<ResyncHandler>(std::move(handler))));
+}
+
+void DocumentSessionManager::relay(const std::string &doc_id, const AppliedOperation &applied)
+{
+    auto bus = std::atomic_load(&bus_);
+    if (!bus || !bus->owns(doc_id))
+        return;
+    auto session = find(doc_id);
+    if (!session)
+        return;
+
+    FanoutBus::Message message;
+    message.kind = FanoutBus::Kind::Revision;
+    message.room = doc_id;
+    message.payload = encodeRevision(applied, session->getTitle());
+    bus->publish(message);
+
+    // Released when the session is evicted, after its last write
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (held_.insert(doc_id).second)
+        bus->subscribe(doc_id);
+}
+
+void DocumentSessionManager::leased(const std::string &doc_id, FanoutBus::Lease lease)
+{
+    auto session = find(doc_id);
+    if (lease == FanoutBus::Lease::Following)
+    {
+        if (!session)
+            return;
+        if (!session->isFollowing())
+            demote(doc_id, session);
+        requestSync(doc_id, true);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        syncing_.erase(doc_id);
+    }
+    if (lease != FanoutBus::Lease::Owned || !session || !session->isFollowing())
+        return;
+
+    // The previous owner wrote its revisions before giving the room up,
+    // unless it died first or the bus lost it; either way the database is
+    // where this process takes over from
+    DocumentCache::getInstance().invalidate(doc_id);
+    DocumentRepository repo;
+    auto database = repo.findById(doc_id);
+    if (!database.has_value())
+        return;
+
+    std::lock_guard<std::mutex> order(session->sequencer());
+    if (!session->adopt(database.value()))
+        return;
+    std::cerr << "Document " << doc_id << " taken over at database version " << database->getVersion() << std::endl;
+    if (auto handler = std::atomic_load(&resync_handler_))
+        (*handler)(doc_id, *session);
+    if (auto bus = std::atomic_load(&bus_))
+        publishSync(*bus, doc_id, database.value());
+}
+
+void DocumentSessionManager::demote(const std::string &doc_id, const std::shared_ptr<DocumentSession> &session)
+{
+    // Revisions made before the broker answered, or while the bus was
+    // degraded, reach the database, where the owner merges them into the
+    // room; they are not announced here, as the room is the owner's to
+    // sequence
+    std::lock_guard<std::mutex> io_lock(io_mutex_);
+    for (int attempt = 0; attempt < 3 && session->isDirty(); ++attempt)
+        persist(doc_id, session, false);
+    if (session->isDirty())
+        std::cerr << "Document " << doc_id << " could not be written before following another process; edits since version "
+                  << session->getPersistedVersion() << " are lost" << std::endl;
+
+    std::lock_guard<std::mutex> order(session->sequencer());
+    session->startFollowing();
+}
+
+void DocumentSessionManager::requestSync(const std::string &doc_id, bool again)
+{
+    auto bus = std::atomic_load(&bus_);
+    if (!bus)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!syncing_.insert(doc_id).second && !again)
+            return;
+    }
+
+    FanoutBus::Message message;
+    message.kind = FanoutBus::Kind::SyncRequest;
+    message.room = doc_id;
+    bus->publish(message);
+}
+
+void DocumentSessionManager::followRevision(const FanoutBus::Message &message)
+{
+    auto session = find(message.room);
+    if (!session || !session->isFollowing())
+        return;
+
+    AppliedOperation applied;
+    std::string title;
+    if (!decodeRevision(message.payload, applied, title))
+        throw std::runtime_error("Malformed relayed revision");
+
+    bool followed;
+    {
+        std::lock_guard<std::mutex> order(session->sequencer());
+        followed = session->follow(applied, title);
+    }
+    if (!followed)
+        requestSync(message.room);
+}
+
+void DocumentSessionManager::answerSync(const std::string &doc_id)
+{
+    auto bus = std::atomic_load(&bus_);
+    if (!bus || !bus->owns(doc_id))
+        return;
+
+    auto session = find(doc_id);
+    if (!session || session->isFollowing())
+    {
+        // Evicted once written, so the database has it
+        DocumentRepository repo;
+        if (auto database = repo.findById(doc_id))
+            publishSync(*bus, doc_id, database.value());
+        return;
+    }
+
+    {
+        // A follower that wrote revisions of its own before following asks
+        // right after; they join the room's before it gets the state
+        std::lock_guard<std::mutex> io_lock(io_mutex_);
+        DocumentRepository repo;
+        auto database_version = repo.findVersion(doc_id);
+        if (database_version.has_value() && database_version.value() != session->getPersistedVersion())
+            mergeDatabase(doc_id, session, database_version.value(), true);
+    }
+
+    // Under the sequencer, so revisions after it are relayed after it
+    std::lock_guard<std::mutex> order(session->sequencer());
+    publishSync(*bus, doc_id, session->snapshot());
+}
+
+void DocumentSessionManager::takeSync(const FanoutBus::Message &message)
+{
+    auto bus = std::atomic_load(&bus_);
+    if (bus && bus->owns(message.room))
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        syncing_.erase(message.room);
+    }
+
+    auto session = find(message.room);
+    if (!session || !session->isFollowing())
+        return;
+
+    Document owner;
+    if (!decodeSync(message.payload, owner))
+        throw std::runtime_error("Malformed relayed document state");
+
+    std::lock_guard<std::mutex> order(session->sequencer());
+    if (!session->resync(owner))
+        return;
+    if (auto handler = std::atomic_load(&resync_handler_))
+        (*handler)(message.room, *session);
+}
+
+void DocumentSessionManager::publishSync(FanoutBus &bus, const std::string &doc_id, const Document &document)
+{
+    FanoutBus::Message message;
+    message.kind = FanoutBus::Kind::Sync;
+    message.room = doc_id;
+    message.payload = encodeSync(document);
+    bus.publish(message);
+}
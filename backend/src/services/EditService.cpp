@@ -0,0 +1,121 @@
+#include "services/EditService.h"
+#include "services/CollaborationService.h"
+#include "services/DocumentService.h"
+#include "services/DocumentSessionManager.h"
+#include "utils/BinaryProtocol.h"
+#include "utils/OperationJson.h"
+#include "utils/WebSocketManager.h"
+#include <optional>
+#include <stdexcept>
+
+AppliedOperation EditService::submitOperations(const std::string &doc_id, const std::string &user_id, int base_revision,
+                                               std::vector<TextOperation> ops, crow::websocket::connection *origin)
+{
+    if (doc_id.empty() || user_id.empty())
+    {
+        throw std::invalid_argument("Document ID and User ID are required");
+    }
+
+    if (!CollaborationService::checkAccess(doc_id, user_id, "write"))
+    {
+        throw std::runtime_error("Access denied: You don't have permission to update this document");
+    }
+
+    if (!WebSocketManager::getInstance().ownsDocument(doc_id))
+    {
+        throw std::runtime_error("NOT_OWNER: Document is being edited through another server process");
+    }
+
+    auto &sessions = DocumentSessionManager::getInstance();
+
+    // Edits without an open room (REST) hold the session for the call; the
+    // release persists them like a last leave
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        bool joined = false;
+        auto session = sessions.find(doc_id);
+        if (!session)
+        {
+            session = sessions.join(doc_id);
+            joined = true;
+        }
+        if (!session)
+        {
+            throw std::runtime_error("Document not found");
+        }
+
+        std::optional<AppliedOperation> applied;
+        try
+        {
+            std::lock_guard<std::mutex> order(session->sequencer());
+            applied = session->applyOperations(base_revision, ops, user_id);
+            if (applied)
+            {
+                announce(doc_id, applied.value(), origin);
+            }
+        }
+        catch (...)
+        {
+            if (joined)
+                sessions.leave(doc_id);
+            throw;
+        }
+
+        if (joined)
+            sessions.leave(doc_id);
+        if (applied)
+            return applied.value();
+
+        // The session was evicted between lookup and apply; load it again
+    }
+
+    throw std::runtime_error("Failed to apply operation");
+}
+
+void EditService::announce(const std::string &doc_id, const AppliedOperation &applied, crow::websocket::connection *origin)
+{
+    // Ahead of the frames, so followers' sessions have the revision by the
+    // time their members see it
+    DocumentSessionManager::getInstance().relay(doc_id, applied);
+
+    auto &rooms = WebSocketManager::getInstance();
+    OutboundQueue::Frame frame;
+    frame.data = OutboundQueue::share(OperationJson::opFrame(applied));
+    frame.user = BinaryProtocol::internUser(applied.user_id);
+    frame.binary = OutboundQueue::share(BinaryProtocol::opFrame(applied, frame.user));
+
+    if (origin)
+    {
+        // The ack takes the operation's place in the room's order, so a
+        // resumed origin gets it replayed too
+        OutboundQueue::Frame ack;
+        ack.data = OutboundQueue::share(OperationJson::ackFrame(applied.revision));
+        ack.binary = OutboundQueue::share(BinaryProtocol::ackFrame(applied.revision));
+        rooms.broadcastToDocument(doc_id, frame, origin, ack);
+    }
+    else
+    {
+        rooms.broadcastToDocument(doc_id, frame);
+    }
+}
+
+std::vector<AppliedOperation> EditService::getOperationsSince(const std::string &doc_id, const std::string &user_id, int revision, int &current_revision)
+{
+    if (auto session = DocumentSessionManager::getInstance().find(doc_id))
+    {
+        if (!CollaborationService::checkAccess(doc_id, user_id, "read"))
+        {
+            throw std::runtime_error("Access denied: You don't have permission to access this document");
+        }
+        current_revision = session->getVersion();
+        return session->operationsSince(revision);
+    }
+
+    // Without a session the history is gone; only an up-to-date client is fine
+    current_revision = DocumentService::getDocumentVersion(doc_id, user_id);
+    if (revision < current_revision)
+    {
+        throw std::runtime_error("REVISION_TOO_OLD: Revision " + std::to_string(revision) + " is no longer available, current revision is " + std::to_string(current_revision));
+    }
+    return {};
+}
@@ -0,0 +1,151 @@
+#include "services/OperationalTransform.h"
+#include "utils/TextDiff.h"
+#include "utils/Utf16.h"
+#include <algorithm>
+#include <stdexcept>
+
+OperationalTransform::Operations OperationalTransform::transform(const Operations &ops, const Operations &against)
+{
+    return transformPair(ops, against).first;
+}
+
+std::pair<OperationalTransform::Operations, OperationalTransform::Operations>
+OperationalTransform::transformPair(const Operations &a, const Operations &b)
+{
+    if (a.empty() || b.empty())
+        return {a, b};
+
+    if (a.size() == 1 && b.size() == 1)
+        return {transformComponent(a[0], b[0], false), transformComponent(b[0], a[0], true)};
+
+    // Peel one component off the longer side; the other side is carried
+    // forward past it so each step compares operations on the same state
+    if (a.size() > 1)
+    {
+        auto [head, b_after_head] = transformPair(Operations{a[0]}, b);
+        auto [tail, b_after_all] = transformPair(Operations(a.begin() + 1, a.end()), b_after_head);
+        head.insert(head.end(), tail.begin(), tail.end());
+        return {head, b_after_all};
+    }
+
+    auto [a_after_head, head] = transformPair(a, Operations{b[0]});
+    auto [a_after_all, tail] = transformPair(a_after_head, Operations(b.begin() + 1, b.end()));
+    head.insert(head.end(), tail.begin(), tail.end());
+    return {a_after_all, head};
+}
+
+OperationalTransform::Operations OperationalTransform::transformComponent(TextOperation a, const TextOperation &b, bool a_wins_ties)
+{
+    if (a.isInsert())
+    {
+        if (b.isInsert())
+        {
+            if (b.position < a.position || (b.position == a.position && !a_wins_ties))
+                a.position += b.length;
+        }
+        else if (a.position > b.position)
+        {
+            // Inside the deleted range the insert lands where the range was
+            a.position = a.position >= b.position + b.length ? a.position - b.length : b.position;
+        }
+        return {a};
+    }
+
+    size_t a_end = a.position + a.length;
+
+    if (b.isInsert())
+    {
+        if (b.position >= a_end)
+            return {a};
+        if (b.position <= a.position)
+        {
+            a.position += b.length;
+            return {a};
+        }
+
+        // Insert inside the deleted range survives: delete around it
+        size_t before = b.position - a.position;
+        return {TextOperation::remove(a.position, before),
+                TextOperation::remove(a.position + b.length, a.length - before)};
+    }
+
+    size_t b_end = b.position + b.length;
+    if (a_end <= b.position)
+        return {a};
+    if (a.position >= b_end)
+    {
+        a.position -= b.length;
+        return {a};
+    }
+
+    size_t overlap = std::min(a_end, b_end) - std::max(a.position, b.position);
+    if (a.length == overlap)
+        return {};
+
+    a.length -= overlap;
+    a.position = std::min(a.position, b.position);
+    return {a};
+}
+
+void OperationalTransform::apply(std::string &content, const Operations &ops)
+{
+    // Check ranges up front so a bad operation leaves content untouched
+    size_t length = Utf16::length(content);
+    for (const auto &op : ops)
+    {
+        if (op.isInsert())
+        {
+            if (op.position > length)
+                throw std::out_of_range("Insert position past end of document");
+            length += op.length;
+        }
+        else
+        {
+            if (op.position + op.length > length)
+                throw std::out_of_range("Delete range past end of document");
+            length -= op.length;
+        }
+    }
+
+    // Offsets can still split a surrogate pair; a single component fails
+    // before it mutates, longer sequences work on a copy
+    std::string scratch;
+    std::string &target = ops.size() > 1 ? (scratch = content) : content;
+
+    for (const auto &op : ops)
+    {
+        size_t begin = Utf16::toByteOffset(target, op.position);
+        if (op.isInsert())
+        {
+            target.insert(begin, op.text);
+        }
+        else
+        {
+            size_t end = Utf16::toByteOffset(target, op.length, begin);
+            target.erase(begin, end - begin);
+        }
+    }
+
+    if (ops.size() > 1)
+        content.swap(scratch);
+}
+
+void OperationalTransform::apply(Rope &content, const Operations &ops)
+{
+    // Edits build new nodes and share the rest, so working on a copy costs
+    // nothing and a failing component leaves content as it was
+    Rope target = content;
+    for (const auto &op : ops)
+    {
+        if (op.isInsert())
+            target.insert(op.position, op.text);
+        else
+            target.erase(op.position, op.length);
+    }
+    content = std::move(target);
+}
+
+OperationalTransform::Operations OperationalTransform::replace(const std::string &old_content, const std::string &new_content)
+{
+    return TextDiff::compute(old_content, new_content);
+}
@@ -0,0 +1,281 @@
+#include "utils/BinaryProtocol.h"
+#include "utils/OperationJson.h"
+#include "utils/Utf16.h"
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+const uint32_t BinaryProtocol::VERSION;
+const char *const BinaryProtocol::NAME = "bin1";
+
+namespace
+{
+    std::shared_mutex users_mutex;
+    std::unordered_map<std::string, uint32_t> user_index;
+    std::vector<BinaryProtocol::InternedUser> users(1);
+
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string &frame) : data_(frame.data()), end_(frame.data() + frame.size()) {}
+
+        uint64_t varint()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (data_ == end_)
+                    throw std::invalid_argument("Truncated binary frame");
+                uint8_t byte = static_cast<uint8_t>(*data_++);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+            throw std::invalid_argument("Varint too long");
+        }
+
+        size_t size()
+        {
+            uint64_t value = varint();
+            if (value > std::numeric_limits<uint32_t>::max())
+                throw std::invalid_argument("Value out of range");
+            return static_cast<size_t>(value);
+        }
+
+        std::string string()
+        {
+            size_t length = size();
+            if (length > static_cast<size_t>(end_ - data_))
+                throw std::invalid_argument("Truncated binary frame");
+            std::string value(data_, length);
+            data_ += length;
+            return value;
+        }
+
+        bool done() const { return data_ == end_; }
+
+    private:
+        const char *data_;
+        const char *end_;
+    };
+}
+
+uint32_t BinaryProtocol::internUser(const std::string &user_id, const std::string &username)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(users_mutex);
+        auto it = user_index.find(user_id);
+        if (it != user_index.end() && (username.empty() || users[it->second].username == username))
+            return it->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(users_mutex);
+    auto it = user_index.find(user_id);
+    if (it == user_index.end())
+    {
+        uint32_t index = static_cast<uint32_t>(users.size());
+        users.push_back({user_id, username, 0});
+        user_index.emplace(user_id, index);
+        return index;
+    }
+    InternedUser &user = users[it->second];
+    if (!username.empty() && user.username != username)
+    {
+        user.username = username;
+        user.generation++;
+    }
+    return it->second;
+}
+
+bool BinaryProtocol::lookupUser(uint32_t index, InternedUser &user)
+{
+    std::shared_lock<std::shared_mutex> lock(users_mutex);
+    if (index == 0 || index >= users.size())
+        return false;
+    user = users[index];
+    return true;
+}
+
+void BinaryProtocol::putVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+void BinaryProtocol::putString(std::string &out, const std::string &value)
+{
+    putVarint(out, value.size());
+    out += value;
+}
+
+std::string BinaryProtocol::helloFrame()
+{
+    std::string frame;
+    putVarint(frame, HELLO);
+    putVarint(frame, VERSION);
+    return frame;
+}
+
+std::string BinaryProtocol::userFrame(uint32_t index, const InternedUser &user)
+{
+    std::string frame;
+    frame.reserve(user.user_id.size() + user.username.size() + 8);
+    putVarint(frame, USER);
+    putVarint(frame, index);
+    putString(frame, user.user_id);
+    putString(frame, user.username);
+    return frame;
+}
+
+std::string BinaryProtocol::opFrame(const AppliedOperation &applied, uint32_t user)
+{
+    size_t size = 16;
+    for (const auto &op : applied.ops)
+        size += op.text.size() + 12;
+
+    std::string frame;
+    frame.reserve(size);
+    putVarint(frame, OP);
+    putVarint(frame, static_cast<uint64_t>(applied.revision));
+    putVarint(frame, user);
+    putVarint(frame, applied.ops.size());
+    for (const auto &op : applied.ops)
+    {
+        putVarint(frame, op.isInsert() ? 0 : 1);
+        putVarint(frame, op.position);
+        if (op.isInsert())
+            putString(frame, op.text);
+        else
+            putVarint(frame, op.length);
+    }
+    return frame;
+}
+
+std::string BinaryProtocol::ackFrame(int revision)
+{
+    std::string frame;
+    putVarint(frame, ACK);
+    putVarint(frame, static_cast<uint64_t>(revision));
+    return frame;
+}
+
+std::string BinaryProtocol::cursorFrame(uint32_t user, bool has_position, size_t position)
+{
+    std::string frame;
+    putVarint(frame, CURSOR);
+    putVarint(frame, user);
+    putVarint(frame, has_position ? position + 1 : 0);
+    return frame;
+}
+
+std::string BinaryProtocol::batchFrame(const std::vector<std::shared_ptr<const std::string>> &messages)
+{
+    size_t size = 8;
+    for (const auto &message : messages)
+        size += message->size() + 4;
+
+    std::string frame;
+    frame.reserve(size);
+    putVarint(frame, BATCH);
+    putVarint(frame, messages.size());
+    for (const auto &message : messages)
+        putString(frame, *message);
+    return frame;
+}
+
+std::string BinaryProtocol::seqFrame(uint64_t seq, const std::string &message)
+{
+    std::string frame;
+    frame.reserve(message.size() + 11);
+    putVarint(frame, SEQ);
+    putVarint(frame, seq);
+    frame += message;
+    return frame;
+}
+
+std::string BinaryProtocol::channelFrame(const std::string &doc_id, const std::string &message)
+{
+    std::string frame;
+    frame.reserve(message.size() + doc_id.size() + 6);
+    putVarint(frame, CHANNEL);
+    putString(frame, doc_id);
+    frame += message;
+    return frame;
+}
+
+BinaryProtocol::ClientMessage BinaryProtocol::decode(const std::string &frame)
+{
+    Reader reader(frame);
+    ClientMessage message;
+    uint64_t type = reader.varint();
+    if (type == CHANNEL)
+    {
+        message.channel = reader.string();
+        if (message.channel.empty())
+            throw std::invalid_argument("Empty channel");
+        type = reader.varint();
+    }
+
+    if (type == SUBMIT)
+    {
+        message.type = SUBMIT;
+        size_t revision = reader.size();
+        if (revision > static_cast<size_t>(std::numeric_limits<int>::max()))
+            throw std::invalid_argument("Revision out of range");
+        message.revision = static_cast<int>(revision);
+
+        size_t count = reader.size();
+        if (count > OperationJson::MAX_COMPONENTS)
+            throw std::invalid_argument("Too many operation components");
+        message.ops.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t kind = reader.size();
+            size_t position = reader.size();
+            if (kind == 0)
+            {
+                std::string text = reader.string();
+                if (!Utf16::isValidUtf8(text))
+                    throw std::invalid_argument("Insert text must be valid UTF-8");
+                if (!text.empty())
+                    message.ops.push_back(TextOperation::insert(position, text));
+            }
+            else if (kind == 1)
+            {
+                size_t length = reader.size();
+                if (length > 0)
+                    message.ops.push_back(TextOperation::remove(position, length));
+            }
+            else
+            {
+                throw std::invalid_argument("Unknown operation kind");
+            }
+        }
+    }
+    else if (type == CLIENT_CURSOR)
+    {
+        message.type = CLIENT_CURSOR;
+        size_t position = reader.size();
+        message.has_position = position > 0;
+        message.position = position > 0 ? position - 1 : 0;
+    }
+    else if (type == RECEIPT)
+    {
+        message.type = RECEIPT;
+        message.count = reader.varint();
+    }
+    else
+    {
+        throw std::invalid_argument("Unknown binary message type");
+    }
+
+    if (!reader.done())
+        throw std::invalid_argument("Trailing bytes in binary frame");
+    return message;
+}
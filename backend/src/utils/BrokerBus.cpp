@@ -0,0 +1,510 @@
+#include "utils/BrokerBus.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+const std::chrono::milliseconds BrokerBus::RECONNECT_DELAY(1000);
+const size_t BrokerBus::MAX_BACKLOG;
+
+BrokerBus::BrokerBus(const std::string &path, bool host)
+    : path_(path), host_(host), lock_fd_(-1), subscribes_(0), connected_(false), degraded_(false), running_(false),
+      wake_pending_(false), wake_{-1, -1}, hosting_(false), published_(0), delivered_(0), dropped_(0), oversize_(0), reconnects_(0)
+{
+}
+
+BrokerBus::~BrokerBus()
+{
+    stop();
+}
+
+void BrokerBus::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_)
+        return;
+    if (pipe(wake_) != 0)
+        throw std::runtime_error("Fanout bus cannot create its wake pipe");
+    fcntl(wake_[0], F_SETFL, fcntl(wake_[0], F_GETFL, 0) | O_NONBLOCK);
+    running_ = true;
+    worker_ = std::thread(&BrokerBus::run, this);
+}
+
+void BrokerBus::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_)
+            return;
+        running_ = false;
+        wakeLocked();
+    }
+    if (worker_.joinable())
+        worker_.join();
+
+    if (broker_)
+    {
+        broker_->stop();
+        broker_.reset();
+        hosting_ = false;
+    }
+    // Lets another process take over as host
+    if (lock_fd_ >= 0)
+    {
+        close(lock_fd_);
+        lock_fd_ = -1;
+    }
+    close(wake_[0]);
+    close(wake_[1]);
+    wake_[0] = wake_[1] = -1;
+}
+
+void BrokerBus::subscribe(const std::string &room)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Subscription &subscription = rooms_[room];
+    if (subscription.count++ > 0)
+        return;
+    if (connected_)
+    {
+        subscription.number = ++subscribes_;
+        queue(FanoutBroker::Op::Subscribe, Message{Kind::Broadcast, room, ""});
+    }
+    else if (degraded_)
+    {
+        subscription.lease = Lease::Owned;
+    }
+}
+
+void BrokerBus::unsubscribe(const std::string &room)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rooms_.find(room);
+    if (it == rooms_.end() || --it->second.count > 0)
+        return;
+    rooms_.erase(it);
+    if (connected_)
+        queue(FanoutBroker::Op::Unsubscribe, Message{Kind::Broadcast, room, ""});
+}
+
+FanoutBus::Lease BrokerBus::lease(const std::string &room) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rooms_.find(room);
+    return it != rooms_.end() ? it->second.lease : Lease::None;
+}
+
+FanoutBus::Lease BrokerBus::awaitLease(const std::string &room, std::chrono::milliseconds timeout) const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    Lease current = Lease::None;
+    leased_.wait_for(lock, timeout, [&]
+                     {
+        auto it = rooms_.find(room);
+        current = it != rooms_.end() ? it->second.lease : Lease::None;
+        return current != Lease::Pending; });
+    return current;
+}
+
+void BrokerBus::publish(const Message &message)
+{
+    // Only this process's room members get it; the local broadcast this is
+    // part of must not fail over it
+    if (!FanoutBroker::fits(message))
+    {
+        dropped_++;
+        if (oversize_++ == 0)
+            std::cerr << "[Fanout] Not relaying " << message.payload.size() << " bytes for " << message.room
+                      << ", over the " << FanoutBroker::MAX_MESSAGE << " byte limit" << std::endl;
+        return;
+    }
+
+    // Encoded outside the lock; publishers only contend for the append
+    std::string bytes = FanoutBroker::encode(FanoutBroker::Op::Publish, message);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!connected_ || out_.size() > MAX_BACKLOG)
+    {
+        dropped_++;
+        return;
+    }
+    out_ += bytes;
+    published_++;
+    wakeLocked();
+}
+
+void BrokerBus::onMessage(Kind kind, Handler handler)
+{
+    handlers_[static_cast<size_t>(kind)] = std::move(handler);
+}
+
+void BrokerBus::onLease(LeaseHandler handler)
+{
+    lease_handler_ = std::move(handler);
+}
+
+void BrokerBus::queue(FanoutBroker::Op op, const Message &message)
+{
+    out_ += FanoutBroker::encode(op, message);
+    wakeLocked();
+}
+
+void BrokerBus::wakeLocked()
+{
+    if (wake_pending_)
+        return;
+    wake_pending_ = true;
+    char byte = 0;
+    (void)!write(wake_[1], &byte, 1);
+}
+
+int BrokerBus::connect()
+{
+    int fd = FanoutBroker::connect(path_);
+    if (fd < 0 && host_ && host())
+        fd = FanoutBroker::connect(path_);
+    return fd;
+}
+
+bool BrokerBus::host()
+{
+    if (broker_)
+        return false;
+
+    if (lock_fd_ < 0)
+    {
+        std::string lock_path = path_ + ".lock";
+        lock_fd_ = open(lock_path.c_str(), O_RDWR | O_CREAT, 0600);
+        if (lock_fd_ < 0)
+            return false;
+    }
+    // Held until this process stops the bus or exits
+    if (flock(lock_fd_, LOCK_EX | LOCK_NB) != 0)
+        return false;
+
+    try
+    {
+        broker_.reset(new FanoutBroker(path_));
+        broker_->start();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[Fanout] " << e.what() << std::endl;
+        broker_.reset();
+        flock(lock_fd_, LOCK_UN);
+        return false;
+    }
+    hosting_ = true;
+    std::cout << "[Fanout] Hosting the broker at " << path_ << std::endl;
+    return true;
+}
+
+void BrokerBus::run()
+{
+    int fd = -1;
+    bool first = true;
+    std::string in;
+    std::string sending;
+    size_t sent = 0;
+
+    auto disconnect = [&]
+    {
+        close(fd);
+        fd = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            connected_ = false;
+            out_.clear();
+        }
+        std::cerr << "[Fanout] Lost the broker at " << path_ << std::endl;
+        degrade();
+    };
+
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_)
+                break;
+        }
+
+        if (fd < 0)
+        {
+            fd = connect();
+            if (fd < 0)
+            {
+                degrade();
+                pollfd wake{wake_[0], POLLIN, 0};
+                poll(&wake, 1, static_cast<int>(RECONNECT_DELAY.count()));
+                std::lock_guard<std::mutex> lock(mutex_);
+                char drain[64];
+                while (read(wake_[0], drain, sizeof(drain)) > 0)
+                {
+                }
+                wake_pending_ = false;
+                continue;
+            }
+
+            in.clear();
+            sending.clear();
+            sent = 0;
+            std::lock_guard<std::mutex> lock(mutex_);
+            out_.clear();
+            degraded_ = false;
+            resetLeasesLocked();
+            subscribes_ = 0;
+            for (auto &room : rooms_)
+            {
+                room.second.number = ++subscribes_;
+                out_ += FanoutBroker::encode(FanoutBroker::Op::Subscribe, Message{Kind::Broadcast, room.first, ""});
+            }
+            connected_ = true;
+            if (!first)
+                reconnects_++;
+            first = false;
+        }
+
+        // Everything queued since the last write goes out in one call
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (sent == sending.size())
+            {
+                sending.clear();
+                sent = 0;
+            }
+            sending += out_;
+            out_.clear();
+            wake_pending_ = false;
+        }
+        if (sent < sending.size())
+        {
+            iovec iov{const_cast<char *>(sending.data() + sent), sending.size() - sent};
+            ssize_t n = FanoutBroker::sendSome(fd, &iov, 1);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                disconnect();
+                continue;
+            }
+            if (n > 0)
+                sent += static_cast<size_t>(n);
+        }
+
+        pollfd fds[2] = {{fd, static_cast<short>(POLLIN | (sent < sending.size() ? POLLOUT : 0)), 0},
+                         {wake_[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            disconnect();
+            continue;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(wake_[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        char buffer[64 * 1024];
+        bool open = true;
+        while (true)
+        {
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n > 0)
+            {
+                in.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+
+        size_t offset = 0;
+        try
+        {
+            FanoutBroker::Parsed parsed;
+            while (size_t size = FanoutBroker::parse(in.data() + offset, in.size() - offset, parsed))
+            {
+                dispatch(in.data() + offset, parsed);
+                offset += size;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[Fanout] " << e.what() << std::endl;
+            open = false;
+        }
+        in.erase(0, offset);
+        if (!open)
+            disconnect();
+    }
+
+    if (fd >= 0)
+    {
+        // What was published right before stop (the last invalidations)
+        // still goes out, unless the broker is too slow to take it
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sending += out_;
+            out_.clear();
+        }
+        while (sent < sending.size())
+        {
+            iovec iov{const_cast<char *>(sending.data() + sent), sending.size() - sent};
+            ssize_t n = FanoutBroker::sendSome(fd, &iov, 1);
+            if (n > 0)
+            {
+                sent += static_cast<size_t>(n);
+                continue;
+            }
+            pollfd writable{fd, POLLOUT, 0};
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && poll(&writable, 1, 100) > 0)
+                continue;
+            break;
+        }
+        close(fd);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    connected_ = false;
+    degraded_ = false;
+    resetLeasesLocked();
+}
+
+void BrokerBus::dispatch(const char *data, const FanoutBroker::Parsed &parsed)
+{
+    if (parsed.op == FanoutBroker::Op::Own || parsed.op == FanoutBroker::Op::Follow)
+    {
+        leased(parsed, std::string(data + parsed.payload, parsed.payload_size));
+        return;
+    }
+    if (parsed.op != FanoutBroker::Op::Publish)
+        return;
+    const Handler &handler = handlers_[static_cast<size_t>(parsed.kind)];
+    if (!handler)
+        return;
+
+    Message message;
+    message.kind = parsed.kind;
+    message.room = parsed.room;
+    message.payload.assign(data + parsed.payload, parsed.payload_size);
+    delivered_++;
+    try
+    {
+        handler(message);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[Fanout] Handler failed for " << message.room << ": " << e.what() << std::endl;
+    }
+}
+
+void BrokerBus::leased(const FanoutBroker::Parsed &parsed, const std::string &subscription)
+{
+    // Stale if the room was left, or left and joined again, since the
+    // Subscribe this answers
+    auto current = [&]
+    {
+        auto it = rooms_.find(parsed.room);
+        return it != rooms_.end() && std::to_string(it->second.number) == subscription ? it : rooms_.end();
+    };
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (current() == rooms_.end())
+            return;
+    }
+
+    Lease lease = parsed.op == FanoutBroker::Op::Own ? Lease::Owned : Lease::Following;
+    // Before lease() changes, so nothing is sequenced against a copy the
+    // handler is still bringing up to date
+    notifyLease(parsed.room, lease);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = current();
+        if (it != rooms_.end())
+            it->second.lease = lease;
+    }
+    leased_.notify_all();
+}
+
+void BrokerBus::notifyLease(const std::string &room, Lease lease)
+{
+    if (!lease_handler_)
+        return;
+    try
+    {
+        lease_handler_(room, lease);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[Fanout] Lease handler failed for " << room << ": " << e.what() << std::endl;
+    }
+}
+
+void BrokerBus::resetLeasesLocked()
+{
+    for (auto &room : rooms_)
+        room.second.lease = Lease::Pending;
+}
+
+void BrokerBus::degrade()
+{
+    // A followed room stays Pending, holding its edits back, until its
+    // copy has been taken over from the database
+    std::vector<std::string> followed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!degraded_)
+            std::cerr << "[Fanout] Owning every room until the broker is back" << std::endl;
+        degraded_ = true;
+        for (auto &room : rooms_)
+        {
+            if (room.second.lease == Lease::Following)
+            {
+                room.second.lease = Lease::Pending;
+                followed.push_back(room.first);
+            }
+            else
+            {
+                room.second.lease = Lease::Owned;
+            }
+        }
+    }
+    leased_.notify_all();
+
+    for (const auto &room : followed)
+    {
+        notifyLease(room, Lease::Owned);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = rooms_.find(room);
+            if (it != rooms_.end() && degraded_)
+                it->second.lease = Lease::Owned;
+        }
+        leased_.notify_all();
+    }
+}
+
+BrokerBus::Stats BrokerBus::getStats() const
+{
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats.connected = connected_;
+    }
+    stats.hosting = hosting_.load();
+    stats.published = published_.load();
+    stats.delivered = delivered_.load();
+    stats.dropped = dropped_.load();
+    stats.oversize = oversize_.load();
+    stats.reconnects = reconnects_.load();
+    return stats;
+}
@@ -0,0 +1,54 @@
+#include "utils/Compression.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+std::string Compression::gzip(const std::string& input, int level)
+{
+    z_stream stream{};
+    // windowBits 15 + 16 selects the gzip wrapper
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("Failed to initialize gzip stream");
+    }
+    
+    std::string output;
+    output.resize(deflateBound(&stream, input.size()));
+    
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    stream.avail_out = static_cast<uInt>(output.size());
+    
+    int rc = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    
+    if (rc != Z_STREAM_END)
+    {
+        throw std::runtime_error("Failed to gzip data");
+    }
+    
+    output.resize(stream.total_out);
+    return output;
+}
+
+bool Compression::acceptsGzip(const std::string& accept_encoding)
+{
+    std::string lower = accept_encoding;
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    
+    size_t pos = lower.find("gzip");
+    if (pos == std::string::npos)
+        return false;
+    
+    // Reject an explicit "gzip;q=0"
+    size_t end = lower.find(',', pos);
+    std::string coding = lower.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    size_t q = coding.find("q=");
+    if (q == std::string::npos)
+        return true;
+    return std::atof(coding.c_str() + q + 2) > 0.0;
+}
@@ -7,17 +7,22 @@
 
 std::string Crypto::generateSalt()
 {
-    unsigned char salt[16];
-    if (RAND_bytes(salt, sizeof(salt)) != 1)
+    return generateToken();
+}
+
+std::string Crypto::generateToken()
+{
+    unsigned char bytes[16];
+    if (RAND_bytes(bytes, sizeof(bytes)) != 1)
     {
-        throw std::runtime_error("Failed to generate salt");
+        throw std::runtime_error("Failed to generate random bytes");
     }
     
     std::ostringstream oss;
     oss << std::hex;
     for (int i = 0; i < 16; ++i)
     {
-        oss << std::setw(2) << std::setfill('0') << static_cast<int>(salt[i]);
+        oss << std::setw(2) << std::setfill('0') << static_cast<int>(bytes[i]);
     }
     return oss.str();
 }
@@ -0,0 +1,497 @@
+#include "utils/FanoutBroker.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const size_t FanoutBroker::HEADER_SIZE;
+const size_t FanoutBroker::MAX_MESSAGE;
+const size_t FanoutBroker::PRESENCE_BACKLOG;
+const size_t FanoutBroker::MAX_BACKLOG;
+
+namespace
+{
+    // Writes at most this many queued messages per sendmsg
+    const int MAX_IOV = 64;
+
+    bool setNonBlocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    bool makeAddress(const std::string &path, sockaddr_un &address)
+    {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+            return false;
+        std::memcpy(address.sun_path, path.data(), path.size());
+        return true;
+    }
+
+    uint32_t readU32(const char *data)
+    {
+        const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+        return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+    }
+}
+
+FanoutBroker::FanoutBroker(const std::string &path)
+    : path_(path), listen_fd_(-1), wake_{-1, -1}, running_(false), peer_count_(0), room_count_(0),
+      published_(0), relayed_(0), presence_dropped_(0), disconnected_(0), leases_(0)
+{
+}
+
+FanoutBroker::~FanoutBroker()
+{
+    stop();
+}
+
+void FanoutBroker::start()
+{
+    if (running_)
+        return;
+
+    sockaddr_un address;
+    if (!makeAddress(path_, address))
+        throw std::runtime_error("Fanout socket path is empty or too long: " + path_);
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0)
+        throw std::runtime_error(std::string("Fanout socket: ") + std::strerror(errno));
+
+    // Whoever starts the broker owns the path; a file left there is stale
+    unlink(path_.c_str());
+    if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd_, 128) != 0 || !setNonBlocking(listen_fd_) || pipe(wake_) != 0)
+    {
+        std::string error = std::strerror(errno);
+        close(listen_fd_);
+        listen_fd_ = -1;
+        throw std::runtime_error("Fanout broker cannot listen on " + path_ + ": " + error);
+    }
+    setNonBlocking(wake_[0]);
+
+    running_ = true;
+    worker_ = std::thread(&FanoutBroker::run, this);
+}
+
+void FanoutBroker::stop()
+{
+    if (!running_.exchange(false))
+        return;
+
+    char byte = 0;
+    (void)!write(wake_[1], &byte, 1);
+    if (worker_.joinable())
+        worker_.join();
+
+    std::vector<int> fds;
+    for (const auto &entry : peers_)
+        fds.push_back(entry.first);
+    for (int fd : fds)
+        drop(fd);
+
+    close(listen_fd_);
+    close(wake_[0]);
+    close(wake_[1]);
+    listen_fd_ = wake_[0] = wake_[1] = -1;
+    unlink(path_.c_str());
+}
+
+void FanoutBroker::run()
+{
+    std::vector<pollfd> fds;
+    while (running_)
+    {
+        fds.clear();
+        fds.push_back({listen_fd_, POLLIN, 0});
+        fds.push_back({wake_[0], POLLIN, 0});
+        for (const auto &entry : peers_)
+        {
+            short events = POLLIN;
+            if (!entry.second.out.empty())
+                events |= POLLOUT;
+            fds.push_back({entry.first, events, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "[Fanout] Broker poll failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(wake_[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        if (fds[0].revents & POLLIN)
+            acceptPeers();
+
+        for (size_t i = 2; i < fds.size(); ++i)
+        {
+            auto it = peers_.find(fds[i].fd);
+            if (it == peers_.end() || it->second.closing)
+                continue;
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !readFrom(it->second))
+                it->second.closing = true;
+        }
+
+        // Written straight away rather than on the next POLLOUT, which
+        // would cost a round of poll per hop
+        std::vector<int> gone;
+        for (auto &entry : peers_)
+        {
+            Peer &peer = entry.second;
+            if (!peer.closing && !peer.out.empty() && !flush(peer))
+                peer.closing = true;
+            if (peer.closing)
+                gone.push_back(entry.first);
+        }
+        for (int fd : gone)
+            drop(fd);
+    }
+}
+
+void FanoutBroker::acceptPeers()
+{
+    while (true)
+    {
+        int fd = accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0)
+            return;
+        if (!setNonBlocking(fd))
+        {
+            close(fd);
+            continue;
+        }
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        peers_[fd].fd = fd;
+        peer_count_ = peers_.size();
+    }
+}
+
+bool FanoutBroker::readFrom(Peer &peer)
+{
+    char buffer[64 * 1024];
+    bool open = true;
+    while (true)
+    {
+        ssize_t n = read(peer.fd, buffer, sizeof(buffer));
+        if (n > 0)
+        {
+            peer.in.append(buffer, static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        break;
+    }
+
+    size_t offset = 0;
+    try
+    {
+        Parsed parsed;
+        while (size_t size = parse(peer.in.data() + offset, peer.in.size() - offset, parsed))
+        {
+            handle(peer, parsed, peer.in.data() + offset);
+            offset += size;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[Fanout] Dropping process: " << e.what() << std::endl;
+        return false;
+    }
+    peer.in.erase(0, offset);
+    return open;
+}
+
+void FanoutBroker::handle(Peer &from, const Parsed &parsed, const char *data)
+{
+    switch (parsed.op)
+    {
+    case Op::Subscribe:
+        from.subscribes++;
+        if (from.rooms.emplace(parsed.room, from.subscribes).second)
+        {
+            auto &fds = rooms_[parsed.room];
+            fds.push_back(from.fd);
+            room_count_ = rooms_.size();
+            lease(from, parsed.room, fds.size() == 1 ? Op::Own : Op::Follow);
+        }
+        return;
+
+    case Op::Unsubscribe:
+        if (from.rooms.erase(parsed.room))
+            leave(parsed.room, from.fd);
+        return;
+
+    case Op::Own:
+    case Op::Follow:
+        // Only the broker sends them
+        return;
+
+    case Op::Publish:
+        break;
+    }
+
+    published_++;
+    std::shared_ptr<const std::string> bytes;
+    auto send = [&](Peer &peer)
+    {
+        if (!bytes)
+            bytes = std::make_shared<const std::string>(data, parsed.size);
+        enqueue(peer, bytes, parsed.kind);
+    };
+
+    if (FanoutBus::toAllProcesses(parsed.kind))
+    {
+        for (auto &entry : peers_)
+        {
+            if (entry.first != from.fd)
+                send(entry.second);
+        }
+        return;
+    }
+
+    auto it = rooms_.find(parsed.room);
+    if (it == rooms_.end())
+        return;
+    for (int fd : it->second)
+    {
+        auto peer = peers_.find(fd);
+        if (fd != from.fd && peer != peers_.end())
+            send(peer->second);
+    }
+}
+
+void FanoutBroker::enqueue(Peer &peer, const std::shared_ptr<const std::string> &bytes, FanoutBus::Kind kind)
+{
+    if (peer.closing)
+        return;
+    if (kind == FanoutBus::Kind::Presence && peer.backlog > PRESENCE_BACKLOG)
+    {
+        presence_dropped_++;
+        return;
+    }
+
+    peer.out.push_back(bytes);
+    peer.backlog += bytes->size();
+    relayed_++;
+    if (peer.backlog > MAX_BACKLOG)
+    {
+        std::cerr << "[Fanout] Disconnecting a process " << peer.backlog << " bytes behind" << std::endl;
+        peer.closing = true;
+        disconnected_++;
+    }
+}
+
+bool FanoutBroker::flush(Peer &peer)
+{
+    while (!peer.out.empty())
+    {
+        iovec iov[MAX_IOV];
+        int count = 0;
+        for (auto it = peer.out.begin(); it != peer.out.end() && count < MAX_IOV; ++it, ++count)
+        {
+            size_t skip = count == 0 ? peer.out_offset : 0;
+            iov[count].iov_base = const_cast<char *>((*it)->data() + skip);
+            iov[count].iov_len = (*it)->size() - skip;
+        }
+
+        ssize_t n = sendSome(peer.fd, iov, count);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        size_t written = static_cast<size_t>(n);
+        while (written > 0)
+        {
+            size_t left = peer.out.front()->size() - peer.out_offset;
+            if (written < left)
+            {
+                peer.out_offset += written;
+                break;
+            }
+            written -= left;
+            peer.backlog -= peer.out.front()->size();
+            peer.out.pop_front();
+            peer.out_offset = 0;
+        }
+    }
+    return true;
+}
+
+void FanoutBroker::drop(int fd)
+{
+    auto it = peers_.find(fd);
+    if (it == peers_.end())
+        return;
+
+    for (const auto &room : it->second.rooms)
+        leave(room.first, fd);
+    close(fd);
+    peers_.erase(it);
+    peer_count_ = peers_.size();
+}
+
+void FanoutBroker::leave(const std::string &room, int fd)
+{
+    auto it = rooms_.find(room);
+    if (it == rooms_.end())
+        return;
+
+    auto &fds = it->second;
+    bool owner = !fds.empty() && fds.front() == fd;
+    fds.erase(std::remove(fds.begin(), fds.end(), fd), fds.end());
+    if (fds.empty())
+    {
+        rooms_.erase(it);
+        room_count_ = rooms_.size();
+        return;
+    }
+
+    if (owner)
+    {
+        auto next = peers_.find(fds.front());
+        if (next != peers_.end())
+            lease(next->second, room);
+    }
+}
+
+void FanoutBroker::lease(Peer &peer, const std::string &room, Op op)
+{
+    if (peer.closing)
+        return;
+    FanoutBus::Message message;
+    message.room = room;
+    message.payload = std::to_string(peer.rooms[room]);
+    auto bytes = std::make_shared<const std::string>(encode(op, message));
+    peer.out.push_back(bytes);
+    peer.backlog += bytes->size();
+    if (op == Op::Own)
+        leases_++;
+}
+
+FanoutBroker::Stats FanoutBroker::getStats() const
+{
+    Stats stats;
+    stats.peers = peer_count_.load();
+    stats.rooms = room_count_.load();
+    stats.published = published_.load();
+    stats.relayed = relayed_.load();
+    stats.presence_dropped = presence_dropped_.load();
+    stats.disconnected = disconnected_.load();
+    stats.leases = leases_.load();
+    return stats;
+}
+
+bool FanoutBroker::fits(const FanoutBus::Message &message)
+{
+    return message.room.size() <= 0xFFFF && message.payload.size() <= MAX_MESSAGE;
+}
+
+std::string FanoutBroker::encode(Op op, const FanoutBus::Message &message)
+{
+    if (!fits(message))
+        throw std::runtime_error("Fanout message too large");
+
+    uint32_t length = static_cast<uint32_t>(HEADER_SIZE - 4 + message.room.size() + message.payload.size());
+    uint16_t room = static_cast<uint16_t>(message.room.size());
+
+    std::string bytes;
+    bytes.reserve(4 + length);
+    bytes += static_cast<char>(length & 0xFF);
+    bytes += static_cast<char>((length >> 8) & 0xFF);
+    bytes += static_cast<char>((length >> 16) & 0xFF);
+    bytes += static_cast<char>((length >> 24) & 0xFF);
+    bytes += static_cast<char>(op);
+    bytes += static_cast<char>(message.kind);
+    bytes += static_cast<char>(room & 0xFF);
+    bytes += static_cast<char>(room >> 8);
+    bytes += message.room;
+    bytes += message.payload;
+    return bytes;
+}
+
+size_t FanoutBroker::parse(const char *data, size_t size, Parsed &parsed)
+{
+    if (size < 4)
+        return 0;
+    size_t length = readU32(data);
+    if (length < HEADER_SIZE - 4 || length > MAX_MESSAGE + 0xFFFF + HEADER_SIZE)
+        throw std::runtime_error("Malformed fanout message length");
+    if (size < 4 + length)
+        return 0;
+
+    uint8_t op = static_cast<uint8_t>(data[4]);
+    uint8_t kind = static_cast<uint8_t>(data[5]);
+    size_t room = static_cast<size_t>(static_cast<uint8_t>(data[6])) | static_cast<size_t>(static_cast<uint8_t>(data[7])) << 8;
+    if (op < 1 || op > 5 || kind < 1 || kind >= FanoutBus::KIND_COUNT || HEADER_SIZE + room > 4 + length)
+        throw std::runtime_error("Malformed fanout message");
+
+    parsed.op = static_cast<Op>(op);
+    parsed.kind = static_cast<FanoutBus::Kind>(kind);
+    parsed.room.assign(data + HEADER_SIZE, room);
+    parsed.payload = HEADER_SIZE + room;
+    parsed.payload_size = 4 + length - parsed.payload;
+    parsed.size = 4 + length;
+    return parsed.size;
+}
+
+int FanoutBroker::connect(const std::string &path)
+{
+    sockaddr_un address;
+    if (!makeAddress(path, address))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || !setNonBlocking(fd))
+    {
+        close(fd);
+        return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+ssize_t FanoutBroker::sendSome(int fd, const struct iovec *iov, int count)
+{
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = const_cast<iovec *>(iov);
+    message.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+    ssize_t n;
+    do
+    {
+        n = sendmsg(fd, &message, flags);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
@@ -0,0 +1,137 @@
+#include "utils/FrameDeflater.h"
+#include "utils/BinaryProtocol.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+const size_t FrameDeflater::THRESHOLD;
+const int FrameDeflater::MIN_WINDOW_BITS;
+const int FrameDeflater::MAX_WINDOW_BITS;
+const int FrameDeflater::MEM_LEVEL;
+const int FrameDeflater::LEVEL;
+
+namespace
+{
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<uint64_t> shared_reuses{0};
+
+    void count(size_t in, size_t out)
+    {
+        frames++;
+        bytes_in += in;
+        bytes_out += out;
+    }
+
+    // Deflates input onto the end of output with the given flush mode
+    void deflateInto(z_stream &stream, const std::string &input, int flush, std::string &output)
+    {
+        size_t start = output.size();
+        output.resize(start + deflateBound(&stream, input.size()) + 16);
+
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef *>(&output[start]);
+        stream.avail_out = static_cast<uInt>(output.size() - start);
+
+        int rc = deflate(&stream, flush);
+        if ((flush == Z_FINISH && rc != Z_STREAM_END) || (flush != Z_FINISH && rc != Z_OK) || stream.avail_in != 0)
+            throw std::runtime_error("Failed to deflate frame");
+        output.resize(output.size() - stream.avail_out);
+    }
+}
+
+FrameDeflater::Options FrameDeflater::negotiate(const char *deflate, const char *takeover, const char *window_bits)
+{
+    Options options;
+    options.enabled = deflate && std::strcmp(deflate, "1") == 0;
+    options.context_takeover = options.enabled && takeover && std::strcmp(takeover, "1") == 0;
+    options.window_bits = MAX_WINDOW_BITS;
+    if (window_bits)
+        options.window_bits = std::clamp(std::atoi(window_bits), MIN_WINDOW_BITS, MAX_WINDOW_BITS);
+    return options;
+}
+
+FrameDeflater::FrameDeflater(int window_bits)
+    : stream_{}, window_bits_(window_bits), ready_(false)
+{
+}
+
+FrameDeflater::~FrameDeflater()
+{
+    if (ready_)
+        deflateEnd(&stream_);
+}
+
+std::string FrameDeflater::header(const std::string &message, bool binary)
+{
+    std::string frame;
+    BinaryProtocol::putVarint(frame, BinaryProtocol::DEFLATE);
+    frame += static_cast<char>(binary ? 1 : 0);
+    BinaryProtocol::putVarint(frame, message.size());
+    return frame;
+}
+
+std::string FrameDeflater::wrap(const std::string &message, bool binary)
+{
+    // Allocated on first use, so connections that never send a large
+    // frame hold no stream
+    if (!ready_)
+    {
+        // Negative window bits select raw deflate
+        if (deflateInit2(&stream_, LEVEL, Z_DEFLATED, -window_bits_, MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error("Failed to initialize deflate stream");
+        ready_ = true;
+    }
+
+    std::string frame = header(message, binary);
+    deflateInto(stream_, message, Z_SYNC_FLUSH, frame);
+
+    // A sync flush always ends in an empty stored block; the client adds
+    // it back
+    if (frame.size() >= 4 && frame.compare(frame.size() - 4, 4, std::string("\x00\x00\xff\xff", 4)) == 0)
+        frame.resize(frame.size() - 4);
+
+    count(message.size(), frame.size());
+    return frame;
+}
+
+std::string FrameDeflater::wrapOnce(const std::string &message, bool binary, int window_bits)
+{
+    z_stream stream{};
+    if (deflateInit2(&stream, LEVEL, Z_DEFLATED, -window_bits, MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("Failed to initialize deflate stream");
+
+    std::string frame = header(message, binary);
+    try
+    {
+        deflateInto(stream, message, Z_FINISH, frame);
+    }
+    catch (...)
+    {
+        deflateEnd(&stream);
+        throw;
+    }
+    deflateEnd(&stream);
+
+    count(message.size(), frame.size());
+    return frame;
+}
+
+void FrameDeflater::countSharedReuse()
+{
+    shared_reuses++;
+}
+
+FrameDeflater::Stats FrameDeflater::getStats()
+{
+    Stats stats;
+    stats.frames = frames.load();
+    stats.bytes_in = bytes_in.load();
+    stats.bytes_out = bytes_out.load();
+    stats.shared_reuses = shared_reuses.load();
+    return stats;
+}
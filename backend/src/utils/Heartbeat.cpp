@@ -0,0 +1,188 @@
+#include "utils/Heartbeat.h"
+#include "utils/WebSocketManager.h"
+#include <vector>
+
+const std::chrono::milliseconds Heartbeat::TICK(1000);
+const std::chrono::seconds Heartbeat::DEFAULT_TIMEOUT(40);
+const char *const Heartbeat::PING = "{\"type\":\"ping\"}";
+
+void Heartbeat::Liveness::touch()
+{
+    seen_ms_.store(Heartbeat::nowMs(), std::memory_order_relaxed);
+}
+
+Heartbeat &Heartbeat::getInstance()
+{
+    static Heartbeat instance;
+    return instance;
+}
+
+Heartbeat::Heartbeat()
+    : wheel_(tickOf(nowMs())), running_(false), timeout_(DEFAULT_TIMEOUT), pings_(0), reaped_(0)
+{
+}
+
+Heartbeat::~Heartbeat()
+{
+    stop();
+}
+
+int64_t Heartbeat::nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t Heartbeat::tickOf(int64_t ms)
+{
+    // Rounded up, so a timer never fires before its deadline
+    return static_cast<uint64_t>((ms + TICK.count() - 1) / TICK.count());
+}
+
+uint64_t Heartbeat::keyOf(crow::websocket::connection *conn)
+{
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(conn));
+}
+
+void Heartbeat::start(std::chrono::seconds timeout)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_)
+        return;
+    timeout_ = timeout;
+    running_ = true;
+    worker_ = std::thread(&Heartbeat::run, this);
+}
+
+void Heartbeat::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (worker_.joinable())
+        worker_.join();
+}
+
+void Heartbeat::onTimeout(Reaper reaper)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    reaper_ = std::move(reaper);
+}
+
+std::shared_ptr<Heartbeat::Liveness> Heartbeat::watch(crow::websocket::connection *conn)
+{
+    auto liveness = std::make_shared<Liveness>();
+    int64_t now = nowMs();
+    liveness->seen_ms_.store(now, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t key = keyOf(conn);
+    watched_[key] = Watched{conn, liveness, -1};
+    wheel_.schedule(key, tickOf(now + timeout_.count() / 2));
+    return liveness;
+}
+
+void Heartbeat::forget(crow::websocket::connection *conn)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    reaped_cv_.wait(lock, [&]
+                    { return reaping_.count(conn) == 0; });
+    uint64_t key = keyOf(conn);
+    watched_.erase(key);
+    wheel_.cancel(key);
+}
+
+void Heartbeat::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_)
+    {
+        cv_.wait_for(lock, TICK, [this]
+                     { return !running_; });
+        if (!running_)
+            break;
+
+        lock.unlock();
+        tick();
+        lock.lock();
+    }
+}
+
+void Heartbeat::tick()
+{
+    std::vector<crow::websocket::connection *> dead;
+    Reaper reaper;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t now = nowMs();
+        int64_t timeout = std::chrono::duration_cast<std::chrono::milliseconds>(timeout_).count();
+
+        std::vector<uint64_t> due;
+        wheel_.advance(tickOf(now), due);
+        for (uint64_t key : due)
+        {
+            auto it = watched_.find(key);
+            if (it == watched_.end())
+                continue;
+
+            Watched &watched = it->second;
+            int64_t seen = watched.liveness->seen_ms_.load(std::memory_order_relaxed);
+            if (now - seen >= timeout && reaper_)
+            {
+                dead.push_back(watched.conn);
+                reaping_.insert(watched.conn);
+                watched_.erase(it);
+                continue;
+            }
+
+            // Heard from since the last ping (or never pinged): wait for
+            // half the timeout of silence before asking
+            int64_t next = seen + timeout;
+            if (watched.pinged_ms < seen)
+            {
+                if (now - seen >= timeout / 2)
+                {
+                    // Queued like any frame; a closed connection drops it
+                    WebSocketManager::getInstance().sendTo(watched.conn, PING, OutboundQueue::Priority::Control);
+                    watched.pinged_ms = now;
+                    pings_++;
+                }
+                else
+                {
+                    next = seen + timeout / 2;
+                }
+            }
+            wheel_.schedule(key, tickOf(next));
+        }
+        reaper = reaper_;
+    }
+
+    if (dead.empty())
+        return;
+
+    for (auto *conn : dead)
+    {
+        reaper(conn);
+        reaped_++;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto *conn : dead)
+            reaping_.erase(conn);
+    }
+    reaped_cv_.notify_all();
+}
+
+Heartbeat::Stats Heartbeat::getStats() const
+{
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats.watched = watched_.size();
+    }
+    stats.pings = pings_.load();
+    stats.reaped = reaped_.load();
+    return stats;
+}
@@ -1,4 +1,5 @@
 #include "utils/JWT.h"
+#include "cache/TokenCache.h"
 #include <sstream>
 #include <iomanip>
 #include <openssl/hmac.h>
@@ -7,6 +8,8 @@
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
 #include <ctime>
+#include <limits>
+#include <optional>
 #include <stdexcept>
 
 namespace {
@@ -89,69 +92,92 @@ std::string JWT::generate(const std::string& user_id)
     return data + "." + encodedSignature;
 }
 
-bool JWT::verify(const std::string& token)
-{
-    size_t dot1 = token.find('.');
-    size_t dot2 = token.find('.', dot1 + 1);
-    
-    if (dot1 == std::string::npos || dot2 == std::string::npos)
-        return false;
-    
-    std::string header = token.substr(0, dot1);
-    std::string payload = token.substr(dot1 + 1, dot2 - dot1 - 1);
-    std::string signature = token.substr(dot2 + 1);
-    
-    // Verify signature
-    std::string data = header + "." + payload;
-    std::string expectedSignature = base64Encode(createHMAC(data));
-    
-    if (signature != expectedSignature)
-        return false;
-    
-    // Decode payload to check expiration
-    std::string decodedPayload = base64Decode(payload);
-    // Simple expiration check (in production, parse JSON properly)
-    size_t expPos = decodedPayload.find("\"exp\":");
-    if (expPos != std::string::npos)
+namespace {
+    // Checks signature and expiry, decoding the payload once and pulling out
+    // both claims we care about
+    std::optional<VerifiedToken> verifyClaims(const std::string& token)
     {
-        size_t expStart = decodedPayload.find_first_of("0123456789", expPos);
-        size_t expEnd = decodedPayload.find_first_not_of("0123456789", expStart);
-        std::string expStr = decodedPayload.substr(expStart, expEnd - expStart);
-        std::time_t expTime = std::stoll(expStr);
-        std::time_t now = std::time(nullptr);
+        size_t dot1 = token.find('.');
+        if (dot1 == std::string::npos)
+            return std::nullopt;
+        size_t dot2 = token.find('.', dot1 + 1);
+        if (dot2 == std::string::npos)
+            return std::nullopt;
         
-        if (now > expTime)
-            return false;
+        std::string header = token.substr(0, dot1);
+        std::string payload = token.substr(dot1 + 1, dot2 - dot1 - 1);
+        std::string signature = token.substr(dot2 + 1);
+        
+        // Verify signature
+        std::string data = header + "." + payload;
+        std::string expectedSignature = base64Encode(createHMAC(data));
+        
+        if (signature != expectedSignature)
+            return std::nullopt;
+        
+        std::string decodedPayload = base64Decode(payload);
+        VerifiedToken claims{"", std::numeric_limits<std::time_t>::max()};
+        
+        // Simple expiration check (in production, parse JSON properly)
+        size_t expPos = decodedPayload.find("\"exp\":");
+        if (expPos != std::string::npos)
+        {
+            size_t expStart = decodedPayload.find_first_of("0123456789", expPos);
+            size_t expEnd = decodedPayload.find_first_not_of("0123456789", expStart);
+            std::string expStr = decodedPayload.substr(expStart, expEnd - expStart);
+            claims.exp = std::stoll(expStr);
+            
+            if (std::time(nullptr) > claims.exp)
+                return std::nullopt;
+        }
+        
+        // Extract user_id from payload
+        size_t userIdPos = decodedPayload.find("\"user_id\":\"");
+        if (userIdPos != std::string::npos)
+        {
+            size_t start = userIdPos + 11; // Length of "user_id":"
+            size_t end = decodedPayload.find('"', start);
+            if (end != std::string::npos)
+            {
+                claims.user_id = decodedPayload.substr(start, end - start);
+            }
+        }
+        
+        return claims;
     }
-    
-    return true;
+}
+
+bool JWT::verify(const std::string& token)
+{
+    // A revoked token stays signed and unexpired; logout must still stick
+    return verifyClaims(token).has_value() && !TokenCache::getInstance().isRevoked(TokenCache::digest(token));
 }
 
 std::string JWT::verifyAndGetUserId(const std::string& token)
 {
-    if (!verify(token))
+    // Tokens already verified are a single hash lookup
+    auto& cache = TokenCache::getInstance();
+    std::string digest = TokenCache::digest(token);
+    if (auto cached = cache.lookup(digest))
+        return cached->user_id;
+    
+    auto claims = verifyClaims(token);
+    if (!claims.has_value() || claims->user_id.empty())
         return "";
     
-    size_t dot1 = token.find('.');
-    size_t dot2 = token.find('.', dot1 + 1);
-    
-    if (dot1 == std::string::npos || dot2 == std::string::npos)
+    // Refuses revoked tokens
+    if (!cache.insert(digest, claims.value()))
         return "";
     
-    std::string payload = token.substr(dot1 + 1, dot2 - dot1 - 1);
-    std::string decodedPayload = base64Decode(payload);
-    
-    // Extract user_id from payload
-    size_t userIdPos = decodedPayload.find("\"user_id\":\"");
-    if (userIdPos != std::string::npos)
-    {
-        size_t start = userIdPos + 11; // Length of "user_id":"
-        size_t end = decodedPayload.find('"', start);
-        if (end != std::string::npos)
-        {
-            return decodedPayload.substr(start, end - start);
-        }
-    }
+    return claims->user_id;
+}
+
+bool JWT::revoke(const std::string& token)
+{
+    auto claims = verifyClaims(token);
+    if (!claims.has_value())
+        return false;
     
-    return "";
+    TokenCache::getInstance().revoke(TokenCache::digest(token), claims->exp);
+    return true;
 }
@@ -0,0 +1,97 @@
+#include "utils/OperationJson.h"
+#include "utils/Utf16.h"
+#include <stdexcept>
+
+const size_t OperationJson::MAX_COMPONENTS;
+
+std::vector<TextOperation> OperationJson::parse(const crow::json::rvalue &ops)
+{
+    if (!ops || ops.t() != crow::json::type::List)
+        throw std::invalid_argument("ops must be a list");
+    if (ops.size() > MAX_COMPONENTS)
+        throw std::invalid_argument("Too many operation components");
+
+    std::vector<TextOperation> result;
+    result.reserve(ops.size());
+    for (const auto &component : ops)
+    {
+        if (component.t() != crow::json::type::Object || !component.has("type") || !component.has("position") ||
+            component["position"].t() != crow::json::type::Number || component["position"].i() < 0)
+        {
+            throw std::invalid_argument("Operation needs a type and a non-negative position");
+        }
+
+        std::string type = component["type"].s();
+        size_t position = static_cast<size_t>(component["position"].i());
+
+        if (type == "insert")
+        {
+            if (!component.has("text") || component["text"].t() != crow::json::type::String)
+                throw std::invalid_argument("Insert needs text");
+            std::string text = component["text"].s();
+            if (!Utf16::isValidUtf8(text))
+                throw std::invalid_argument("Insert text must be valid UTF-8");
+            if (!text.empty())
+                result.push_back(TextOperation::insert(position, text));
+        }
+        else if (type == "delete")
+        {
+            if (!component.has("length") || component["length"].t() != crow::json::type::Number || component["length"].i() < 0)
+                throw std::invalid_argument("Delete needs a non-negative length");
+            size_t length = static_cast<size_t>(component["length"].i());
+            if (length > 0)
+                result.push_back(TextOperation::remove(position, length));
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown operation type: " + type);
+        }
+    }
+    return result;
+}
+
+std::string OperationJson::serialize(const std::vector<TextOperation> &ops)
+{
+    std::string out = "[";
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        const auto &op = ops[i];
+        if (i > 0)
+            out += ',';
+        if (op.isInsert())
+        {
+            out += "{\"type\":\"insert\",\"position\":";
+            out += std::to_string(op.position);
+            out += ",\"text\":";
+            out += crow::json::wvalue(op.text).dump();
+            out += '}';
+        }
+        else
+        {
+            out += "{\"type\":\"delete\",\"position\":";
+            out += std::to_string(op.position);
+            out += ",\"length\":";
+            out += std::to_string(op.length);
+            out += '}';
+        }
+    }
+    out += ']';
+    return out;
+}
+
+std::string OperationJson::opFrame(const AppliedOperation &applied)
+{
+    std::string frame = "{\"type\":\"op\",\"revision\":";
+    frame += std::to_string(applied.revision);
+    frame += ",\"userId\":";
+    frame += crow::json::wvalue(applied.user_id).dump();
+    frame += ",\"ops\":";
+    frame += serialize(applied.ops);
+    frame += '}';
+    return frame;
+}
+
+std::string OperationJson::ackFrame(int revision)
+{
+    return "{\"type\":\"ack\",\"revision\":" + std::to_string(revision) + "}";
+}
@@ -0,0 +1,392 @@
+#include "utils/OutboundQueue.h"
+#include "utils/BinaryProtocol.h"
+#include <atomic>
+
+const size_t OutboundQueue::WINDOW_BYTES;
+const size_t OutboundQueue::MAX_QUEUED_BYTES;
+const size_t OutboundQueue::PRESENCE_HIGH_WATER;
+const size_t OutboundQueue::BACKLOG_HIGH_WATER;
+const size_t OutboundQueue::MAX_BATCH_BYTES;
+const uint16_t OutboundQueue::SLOW_CLOSE_CODE;
+const std::chrono::seconds OutboundQueue::SLOW_TIMEOUT(15);
+
+namespace
+{
+    std::atomic<uint64_t> frames_sent{0};
+    std::atomic<uint64_t> batches_sent{0};
+    std::atomic<uint64_t> presence_collapsed{0};
+    std::atomic<uint64_t> presence_dropped{0};
+    std::atomic<uint64_t> slow_disconnects{0};
+}
+
+namespace
+{
+    // The bytes of buffer for Crow, which takes ownership of a string per
+    // send: moved out when this was the last reference, copied otherwise
+    std::string release(OutboundQueue::Buffer &&buffer)
+    {
+        if (buffer.use_count() == 1)
+            return std::move(const_cast<std::string &>(*buffer));
+        return *buffer;
+    }
+}
+
+OutboundQueue::Buffer OutboundQueue::share(std::string data)
+{
+    return std::make_shared<std::string>(std::move(data));
+}
+
+const OutboundQueue::Buffer &OutboundQueue::SharedDeflate::get(const Buffer &message, bool binary, int window_bits)
+{
+    auto key = std::make_pair(message.get(), window_bits);
+    auto it = frames_.find(key);
+    if (it != frames_.end())
+    {
+        FrameDeflater::countSharedReuse();
+        return it->second;
+    }
+    return frames_.emplace(key, share(FrameDeflater::wrapOnce(*message, binary, window_bits))).first->second;
+}
+
+OutboundQueue::OutboundQueue(crow::websocket::connection *conn)
+    : OutboundQueue(conn, Wire())
+{
+}
+
+OutboundQueue::OutboundQueue(crow::websocket::connection *conn, const Wire &wire)
+    : conn_(conn), wire_(wire), closed_(false), unkeyed_presence_(0), queued_bytes_(0), backlogged_(false),
+      flow_control_(false), sent_(0), acked_(0), in_flight_bytes_(0)
+{
+    if (wire_.deflate.enabled && wire_.deflate.context_takeover)
+        deflater_.reset(new FrameDeflater(wire_.deflate.window_bits));
+}
+
+bool OutboundQueue::push(const Frame &frame, SharedDeflate *shared)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!closed_ && queued_bytes_ == 0 && !(flow_control_ && in_flight_bytes_ >= WINDOW_BYTES))
+    {
+        // Nothing waiting and room in the window: no need to queue
+        if (!(wire_.binary && frame.binary) && !frame.data)
+            return true;
+        Entry definition;
+        if (wire_.binary && frame.binary && defineUser(frame.user, definition))
+            transmit(std::move(definition), 1);
+        transmit(render(frame, shared), 1);
+        return true;
+    }
+    if (!enqueue(frame, shared))
+        return false;
+    pump();
+    return !closed_;
+}
+
+bool OutboundQueue::push(const std::vector<Frame> &frames, SharedDeflate *shared)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &frame : frames)
+    {
+        if (!enqueue(frame, shared))
+            return false;
+    }
+    pump();
+    return !closed_;
+}
+
+void OutboundQueue::acknowledge(uint64_t received)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+        return;
+
+    if (!flow_control_)
+    {
+        // Frames sent before the first receipt were not tracked
+        flow_control_ = true;
+        acked_ = sent_;
+    }
+    else
+    {
+        if (received > sent_)
+            received = sent_;
+        while (acked_ < received && !in_flight_.empty())
+        {
+            in_flight_bytes_ -= in_flight_.front();
+            in_flight_.pop_front();
+            ++acked_;
+        }
+    }
+    pump();
+}
+
+void OutboundQueue::close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    clear();
+}
+
+size_t OutboundQueue::queuedBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_bytes_;
+}
+
+OutboundQueue::Stats OutboundQueue::getStats()
+{
+    Stats stats;
+    stats.frames_sent = frames_sent.load();
+    stats.batches_sent = batches_sent.load();
+    stats.presence_collapsed = presence_collapsed.load();
+    stats.presence_dropped = presence_dropped.load();
+    stats.slow_disconnects = slow_disconnects.load();
+    return stats;
+}
+
+bool OutboundQueue::defineUser(uint32_t user, Entry &definition)
+{
+    // Called with mutex_ held. Definitions are control frames, so they go
+    // out ahead of any queued frame that refers to them.
+    BinaryProtocol::InternedUser interned;
+    if (user == 0 || !BinaryProtocol::lookupUser(user, interned))
+        return false;
+
+    auto it = known_users_.find(user);
+    if (it != known_users_.end() && it->second == interned.generation)
+        return false;
+    known_users_[user] = interned.generation;
+    definition = Entry{share(BinaryProtocol::userFrame(user, interned)), true};
+    return true;
+}
+
+OutboundQueue::Entry OutboundQueue::render(const Frame &frame, SharedDeflate *shared)
+{
+    // Called with mutex_ held
+    bool binary = wire_.binary && frame.binary;
+    const Buffer &data = binary ? frame.binary : frame.data;
+
+    // With context takeover frames are deflated as they are sent, in order
+    const FrameDeflater::Options &deflate = wire_.deflate;
+    if (!deflate.enabled || deflate.context_takeover || data->size() < FrameDeflater::THRESHOLD)
+        return Entry{data, binary, false};
+    if (shared)
+        return Entry{shared->get(data, binary, deflate.window_bits), true, true};
+    return Entry{share(FrameDeflater::wrapOnce(*data, binary, deflate.window_bits)), true, true};
+}
+
+bool OutboundQueue::enqueue(const Frame &frame, SharedDeflate *shared)
+{
+    // Called with mutex_ held
+    if (closed_)
+        return false;
+    if (!(wire_.binary && frame.binary) && !frame.data)
+        return true;
+
+    Entry definition;
+    if (wire_.binary && frame.binary && defineUser(frame.user, definition) &&
+        !enqueue(std::move(definition), Priority::Control, std::string()))
+    {
+        return false;
+    }
+    return enqueue(render(frame, shared), frame.priority, frame.key);
+}
+
+bool OutboundQueue::enqueue(Entry &&entry, Priority priority, const std::string &key)
+{
+    // Called with mutex_ held
+    size_t size = entry.size();
+    if (priority == Priority::Presence)
+    {
+        std::string presence_key = key.empty() ? "#" + std::to_string(unkeyed_presence_++) : key;
+
+        auto it = presence_.find(presence_key);
+        if (it != presence_.end())
+        {
+            queued_bytes_ = queued_bytes_ - it->second.size() + size;
+            it->second = std::move(entry);
+            presence_collapsed++;
+            return true;
+        }
+        if (queued_bytes_ + size > PRESENCE_HIGH_WATER)
+        {
+            presence_dropped++;
+            return true;
+        }
+        presence_order_.push_back(presence_key);
+        presence_.emplace(std::move(presence_key), std::move(entry));
+    }
+    else
+    {
+        if (queued_bytes_ + size > MAX_QUEUED_BYTES)
+            dropPresence();
+        if (queued_bytes_ + size > MAX_QUEUED_BYTES)
+        {
+            disconnectSlow();
+            return false;
+        }
+        (priority == Priority::Control ? control_ : edits_).push_back(std::move(entry));
+    }
+    queued_bytes_ += size;
+
+    if (queued_bytes_ > BACKLOG_HIGH_WATER)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!backlogged_)
+        {
+            backlogged_ = true;
+            backlogged_since_ = now;
+        }
+        else if (now - backlogged_since_ > SLOW_TIMEOUT)
+        {
+            disconnectSlow();
+            return false;
+        }
+    }
+    return true;
+}
+
+void OutboundQueue::pump()
+{
+    // Called with mutex_ held
+    while (!closed_ && queued_bytes_ > 0)
+    {
+        if (flow_control_ && in_flight_bytes_ >= WINDOW_BYTES)
+            break;
+
+        // Frames of one wire form, in priority order, up to MAX_BATCH_BYTES
+        std::vector<Buffer> frames;
+        bool binary = false;
+        bool deflated = false;
+        size_t bytes = 0;
+        auto fits = [&](const Entry &entry)
+        {
+            return frames.empty() || (!deflated && !entry.deflated && entry.binary == binary &&
+                                      bytes + entry.size() <= MAX_BATCH_BYTES);
+        };
+        auto take = [&](Entry &&entry)
+        {
+            binary = entry.binary;
+            deflated = entry.deflated;
+            bytes += entry.size();
+            queued_bytes_ -= entry.size();
+            frames.push_back(std::move(entry.data));
+        };
+
+        bool full = false;
+        for (auto *queue : {&control_, &edits_})
+        {
+            while (!queue->empty() && fits(queue->front()))
+            {
+                take(std::move(queue->front()));
+                queue->pop_front();
+            }
+            if (!queue->empty())
+            {
+                full = true;
+                break;
+            }
+        }
+        while (!full && !presence_order_.empty())
+        {
+            auto it = presence_.find(presence_order_.front());
+            if (!fits(it->second))
+                break;
+            take(std::move(it->second));
+            presence_.erase(it);
+            presence_order_.pop_front();
+        }
+
+        Entry wire;
+        wire.binary = binary;
+        wire.deflated = deflated;
+        if (frames.size() == 1)
+        {
+            wire.data = std::move(frames.front());
+        }
+        else if (binary)
+        {
+            wire.data = share(BinaryProtocol::batchFrame(frames));
+            batches_sent++;
+        }
+        else
+        {
+            std::string batch;
+            batch.reserve(bytes + frames.size() + 32);
+            batch += "{\"type\":\"batch\",\"messages\":[";
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                if (i > 0)
+                    batch += ',';
+                batch += *frames[i];
+            }
+            batch += "]}";
+            wire.data = share(std::move(batch));
+            batches_sent++;
+        }
+
+        transmit(std::move(wire), frames.size());
+    }
+
+    if (queued_bytes_ <= BACKLOG_HIGH_WATER)
+        backlogged_ = false;
+}
+
+void OutboundQueue::transmit(Entry &&wire, size_t frames)
+{
+    // Called with mutex_ held
+    if (deflater_ && !wire.deflated && wire.size() >= FrameDeflater::THRESHOLD)
+    {
+        wire.data = share(deflater_->wrap(*wire.data, wire.binary));
+        wire.binary = true;
+    }
+
+    size_t wire_size = wire.size();
+    if (wire.binary)
+        conn_->send_binary(release(std::move(wire.data)));
+    else
+        conn_->send_text(release(std::move(wire.data)));
+    frames_sent += frames;
+    ++sent_;
+    if (flow_control_)
+    {
+        in_flight_.push_back(wire_size);
+        in_flight_bytes_ += wire_size;
+    }
+    else
+    {
+        acked_ = sent_;
+    }
+}
+
+void OutboundQueue::dropPresence()
+{
+    // Called with mutex_ held
+    for (const auto &entry : presence_)
+        queued_bytes_ -= entry.second.size();
+    presence_dropped += presence_.size();
+    presence_.clear();
+    presence_order_.clear();
+}
+
+void OutboundQueue::disconnectSlow()
+{
+    // Called with mutex_ held. The hint bypasses the window: the client
+    // should drop its state and reload rather than wait for the backlog.
+    closed_ = true;
+    clear();
+    slow_disconnects++;
+    conn_->send_text("{\"type\":\"resync\",\"reason\":\"slow_consumer\"}");
+    conn_->close("slow consumer", SLOW_CLOSE_CODE);
+}
+
+void OutboundQueue::clear()
+{
+    control_.clear();
+    edits_.clear();
+    presence_.clear();
+    presence_order_.clear();
+    queued_bytes_ = 0;
+    backlogged_ = false;
+    in_flight_.clear();
+    in_flight_bytes_ = 0;
+}
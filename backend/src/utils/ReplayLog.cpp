@@ -0,0 +1,114 @@
+#include "utils/ReplayLog.h"
+#include "utils/BinaryProtocol.h"
+
+const size_t ReplayLog::MAX_FRAMES;
+const size_t ReplayLog::MAX_BYTES;
+
+ReplayLog::ReplayLog(uint64_t stream)
+    : stream_(stream), seq_(0), bytes_(0)
+{
+}
+
+ReplayLog::Entry ReplayLog::append(const OutboundQueue::Frame &frame, const std::string &origin,
+                                   const OutboundQueue::Frame *origin_frame)
+{
+    Entry entry;
+    if (frame.priority == OutboundQueue::Priority::Presence)
+    {
+        entry.frame = frame;
+        if (origin_frame)
+            entry.origin_frame = *origin_frame;
+        return entry;
+    }
+
+    entry.seq = ++seq_;
+    entry.frame = stamp(frame, entry.seq);
+    entry.origin = origin;
+    if (origin_frame)
+        entry.origin_frame = stamp(*origin_frame, entry.seq);
+
+    bytes_ += sizeOf(entry.frame) + sizeOf(entry.origin_frame);
+    entries_.push_back(entry);
+
+    // The newest frame always stays, however large
+    while (entries_.size() > 1 && (entries_.size() > MAX_FRAMES || bytes_ > MAX_BYTES))
+    {
+        bytes_ -= sizeOf(entries_.front().frame) + sizeOf(entries_.front().origin_frame);
+        entries_.pop_front();
+    }
+    return entry;
+}
+
+bool ReplayLog::since(uint64_t stream, uint64_t seq, const std::string &session,
+                      std::vector<OutboundQueue::Frame> &missed) const
+{
+    if (stream != stream_ || seq > seq_)
+        return false;
+    if (seq == seq_)
+        return true;
+    if (entries_.empty() || entries_.front().seq > seq + 1)
+        return false;
+
+    // Entries are contiguous, oldest first
+    for (auto it = entries_.begin() + static_cast<std::ptrdiff_t>(seq + 1 - entries_.front().seq); it != entries_.end(); ++it)
+    {
+        if (!session.empty() && it->origin == session)
+        {
+            if (it->origin_frame.data || it->origin_frame.binary)
+                missed.push_back(it->origin_frame);
+        }
+        else
+        {
+            missed.push_back(it->frame);
+        }
+    }
+    return true;
+}
+
+std::string ReplayLog::sessionFrame(const std::string &session, uint64_t stream, uint64_t seq, bool resumed)
+{
+    // session is generated hex and needs no escaping
+    std::string frame = "{\"type\":\"session\",\"session\":\"";
+    frame += session;
+    frame += "\",\"stream\":";
+    frame += std::to_string(stream);
+    frame += ",\"latest\":";
+    frame += std::to_string(seq);
+    frame += resumed ? ",\"resumed\":true}" : ",\"resumed\":false}";
+    return frame;
+}
+
+OutboundQueue::Frame ReplayLog::stamp(const OutboundQueue::Frame &frame, uint64_t seq)
+{
+    OutboundQueue::Frame stamped = frame;
+    stamped.priority = OutboundQueue::Priority::Edit;
+    stamped.key.clear();
+
+    if (frame.data)
+    {
+        // {"seq":n, followed by the rest of the object
+        const std::string &json = *frame.data;
+        std::string data;
+        data.reserve(json.size() + 24);
+        data += "{\"seq\":";
+        data += std::to_string(seq);
+        if (json.size() > 2)
+        {
+            data += ',';
+            data.append(json, 1, std::string::npos);
+        }
+        else
+        {
+            data += '}';
+        }
+        stamped.data = OutboundQueue::share(std::move(data));
+    }
+    if (frame.binary)
+        stamped.binary = OutboundQueue::share(BinaryProtocol::seqFrame(seq, *frame.binary));
+    return stamped;
+}
+
+size_t ReplayLog::sizeOf(const OutboundQueue::Frame &frame)
+{
+    return (frame.data ? frame.data->size() : 0) + (frame.binary ? frame.binary->size() : 0);
+}
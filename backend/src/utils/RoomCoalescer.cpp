@@ -0,0 +1,197 @@
+#include "utils/RoomCoalescer.h"
+#include "utils/WebSocketManager.h"
+#include <vector>
+
+const std::chrono::milliseconds RoomCoalescer::DEFAULT_TICK(50);
+const std::chrono::milliseconds RoomCoalescer::LEAVE_GRACE(10000);
+
+RoomCoalescer &RoomCoalescer::getInstance()
+{
+    static RoomCoalescer instance;
+    return instance;
+}
+
+RoomCoalescer::RoomCoalescer()
+    : running_(false), tick_(DEFAULT_TICK), frames_in_(0), superseded_(0), flushes_(0), sends_(0),
+      leaves_held_(0), leaves_cancelled_(0)
+{
+}
+
+RoomCoalescer::~RoomCoalescer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (worker_.joinable())
+        worker_.join();
+}
+
+void RoomCoalescer::start(std::chrono::milliseconds tick)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_)
+        return;
+    tick_ = tick;
+    running_ = true;
+    worker_ = std::thread(&RoomCoalescer::run, this);
+}
+
+void RoomCoalescer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (worker_.joinable())
+        worker_.join();
+
+    // Connections are going away with the server; nothing left to tell them
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.clear();
+    departures_.clear();
+}
+
+void RoomCoalescer::cursor(const std::string &doc_id, const std::string &user_id, OutboundQueue::Frame frame)
+{
+    frame.priority = OutboundQueue::Priority::Presence;
+    frame.key = user_id;
+
+    frames_in_++;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &cursors = pending_[doc_id].cursors;
+    auto it = cursors.find(user_id);
+    if (it != cursors.end())
+    {
+        superseded_++;
+        it->second = std::move(frame);
+    }
+    else
+    {
+        cursors.emplace(user_id, std::move(frame));
+    }
+}
+
+void RoomCoalescer::saved(const std::string &doc_id, int version, std::string frame)
+{
+    frames_in_++;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Room &room = pending_[doc_id];
+    if (!room.saved.empty())
+    {
+        superseded_++;
+        if (room.saved_version > version)
+            return;
+    }
+    room.saved = std::move(frame);
+    room.saved_version = version;
+}
+
+void RoomCoalescer::dropUser(const std::string &doc_id, const std::string &user_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.find(doc_id);
+    if (it != pending_.end())
+        it->second.cursors.erase(user_id);
+}
+
+void RoomCoalescer::departed(const std::string &doc_id, const std::string &session, const std::string &user_id, std::string frame)
+{
+    leaves_held_++;
+    std::lock_guard<std::mutex> lock(mutex_);
+    departures_[departureKey(session, doc_id)] = {doc_id, user_id, std::move(frame), std::chrono::steady_clock::now() + LEAVE_GRACE};
+}
+
+bool RoomCoalescer::returned(const std::string &doc_id, const std::string &session, const std::string &user_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = departures_.find(departureKey(session, doc_id));
+    if (it == departures_.end() || it->second.user_id != user_id)
+        return false;
+    departures_.erase(it);
+    leaves_cancelled_++;
+    return true;
+}
+
+std::string RoomCoalescer::departureKey(const std::string &session, const std::string &doc_id)
+{
+    // A session spans every room of a multiplexed connection
+    return session + '\n' + doc_id;
+}
+
+void RoomCoalescer::flush()
+{
+    std::unordered_map<std::string, Room> rooms;
+    std::vector<Departure> left;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rooms.swap(pending_);
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = departures_.begin(); it != departures_.end();)
+        {
+            if (it->second.deadline <= now)
+            {
+                left.push_back(std::move(it->second));
+                it = departures_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    for (const auto &departure : left)
+        WebSocketManager::getInstance().broadcastToDocument(departure.doc_id, departure.frame);
+
+    for (auto &[doc_id, room] : rooms)
+    {
+        std::vector<OutboundQueue::Frame> frames;
+        frames.reserve(room.cursors.size() + 1);
+        for (auto &[user_id, cursor] : room.cursors)
+            frames.push_back(std::move(cursor));
+        if (!room.saved.empty())
+        {
+            OutboundQueue::Frame frame;
+            frame.data = OutboundQueue::share(std::move(room.saved));
+            frames.push_back(std::move(frame));
+        }
+        if (frames.empty())
+            continue;
+
+        // Each connection's queue sends these as one frame
+        flushes_++;
+        sends_ += WebSocketManager::getInstance().broadcastToDocument(doc_id, frames);
+    }
+}
+
+RoomCoalescer::Stats RoomCoalescer::getStats() const
+{
+    Stats stats;
+    stats.frames_in = frames_in_.load();
+    stats.superseded = superseded_.load();
+    stats.flushes = flushes_.load();
+    stats.sends = sends_.load();
+    stats.leaves_held = leaves_held_.load();
+    stats.leaves_cancelled = leaves_cancelled_.load();
+    return stats;
+}
+
+void RoomCoalescer::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_)
+    {
+        cv_.wait_for(lock, tick_, [this]
+                     { return !running_; });
+        if (!running_)
+            break;
+
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
@@ -0,0 +1,194 @@
+#include "utils/Rope.h"
+#include "utils/Utf16.h"
+#include <algorithm>
+#include <stdexcept>
+
+const size_t Rope::LEAF_TARGET;
+const size_t Rope::LEAF_MAX;
+
+namespace {
+    // Moves end back to the start of the UTF-8 sequence it lands in
+    size_t sequenceBoundary(const std::string &text, size_t begin, size_t end)
+    {
+        while (end > begin && end < text.size() && (static_cast<unsigned char>(text[end]) & 0xC0) == 0x80)
+            --end;
+        return end;
+    }
+}
+
+Rope::Rope(const std::string &text)
+    : root_(build(text, 0, text.size()))
+{
+}
+
+Rope::NodePtr Rope::build(const std::string &text, size_t begin, size_t end)
+{
+    if (begin >= end)
+        return nullptr;
+
+    if (end - begin <= LEAF_MAX)
+        return leaf(text.substr(begin, end - begin));
+
+    // Split at a chunk-aligned midpoint so the tree comes out balanced
+    size_t chunks = (end - begin + LEAF_TARGET - 1) / LEAF_TARGET;
+    size_t mid = sequenceBoundary(text, begin, begin + (chunks / 2) * LEAF_TARGET);
+    if (mid == begin)
+        mid = begin + (chunks / 2) * LEAF_TARGET;
+
+    return branch(build(text, begin, mid), build(text, mid, end));
+}
+
+Rope::NodePtr Rope::leaf(std::string text)
+{
+    size_t utf16 = Utf16::length(text);
+    return leaf(std::move(text), utf16);
+}
+
+Rope::NodePtr Rope::leaf(std::string text, size_t utf16)
+{
+    if (text.empty())
+        return nullptr;
+
+    auto node = std::make_shared<Node>();
+    node->bytes = text.size();
+    node->utf16 = utf16;
+    node->text = std::move(text);
+    return node;
+}
+
+Rope::NodePtr Rope::branch(NodePtr left, NodePtr right)
+{
+    auto node = std::make_shared<Node>();
+    node->bytes = left->bytes + right->bytes;
+    node->utf16 = left->utf16 + right->utf16;
+    node->height = std::max(left->height, right->height) + 1;
+    node->left = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+Rope::NodePtr Rope::balance(NodePtr left, NodePtr right)
+{
+    // AVL rotations; join never leaves the heights more than two apart
+    if (heightOf(left) > heightOf(right) + 1)
+    {
+        if (heightOf(left->left) >= heightOf(left->right))
+            return branch(left->left, branch(left->right, std::move(right)));
+
+        const NodePtr &pivot = left->right;
+        return branch(branch(left->left, pivot->left), branch(pivot->right, std::move(right)));
+    }
+    if (heightOf(right) > heightOf(left) + 1)
+    {
+        if (heightOf(right->right) >= heightOf(right->left))
+            return branch(branch(std::move(left), right->left), right->right);
+
+        const NodePtr &pivot = right->left;
+        return branch(branch(std::move(left), pivot->left), branch(pivot->right, right->right));
+    }
+    return branch(std::move(left), std::move(right));
+}
+
+Rope::NodePtr Rope::join(const NodePtr &left, const NodePtr &right)
+{
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+
+    // Adjacent small leaves merge, so keystroke-sized edits do not fragment
+    // the tree into one-character chunks
+    if (left->height == 0 && right->height == 0 && left->bytes + right->bytes <= LEAF_MAX)
+        return leaf(left->text + right->text, left->utf16 + right->utf16);
+
+    if (left->height > right->height + 1)
+        return balance(left->left, join(left->right, right));
+    if (right->height > left->height + 1)
+        return balance(join(left, right->left), right->right);
+    return branch(left, right);
+}
+
+std::pair<Rope::NodePtr, Rope::NodePtr> Rope::split(const NodePtr &node, size_t utf16_position)
+{
+    if (!node)
+        return {nullptr, nullptr};
+    if (utf16_position == 0)
+        return {nullptr, node};
+    if (utf16_position >= node->utf16)
+        return {node, nullptr};
+
+    if (node->height == 0)
+    {
+        // The one scan per split; both halves know their lengths from it
+        size_t bytes = Utf16::toByteOffset(node->text, utf16_position);
+        return {leaf(node->text.substr(0, bytes), utf16_position),
+                leaf(node->text.substr(bytes), node->utf16 - utf16_position)};
+    }
+
+    size_t left_units = node->left->utf16;
+    if (utf16_position == left_units)
+        return {node->left, node->right};
+
+    if (utf16_position < left_units)
+    {
+        auto parts = split(node->left, utf16_position);
+        return {parts.first, join(parts.second, node->right)};
+    }
+
+    auto parts = split(node->right, utf16_position - left_units);
+    return {join(node->left, parts.first), parts.second};
+}
+
+size_t Rope::byteOffset(size_t utf16_position) const
+{
+    if (utf16_position > utf16Length())
+        throw std::out_of_range("Offset past end of document");
+
+    size_t bytes = 0;
+    const Node *node = root_.get();
+    while (node && node->height > 0)
+    {
+        if (utf16_position <= node->left->utf16)
+        {
+            node = node->left.get();
+        }
+        else
+        {
+            utf16_position -= node->left->utf16;
+            bytes += node->left->bytes;
+            node = node->right.get();
+        }
+    }
+
+    if (!node)
+        return 0;
+    return bytes + Utf16::toByteOffset(node->text, utf16_position);
+}
+
+void Rope::insert(size_t utf16_position, const std::string &text)
+{
+    if (utf16_position > utf16Length())
+        throw std::out_of_range("Offset past end of document");
+
+    auto parts = split(root_, utf16_position);
+    root_ = join(join(parts.first, build(text, 0, text.size())), parts.second);
+}
+
+void Rope::erase(size_t utf16_position, size_t utf16_length)
+{
+    if (utf16_position + utf16_length > utf16Length())
+        throw std::out_of_range("Offset past end of document");
+
+    auto head = split(root_, utf16_position);
+    auto tail = split(head.second, utf16_length);
+    root_ = join(head.first, tail.second);
+}
+
+std::string Rope::toString() const
+{
+    std::string result;
+    result.reserve(size());
+    forEachChunk([&result](const std::string &chunk)
+                 { result.append(chunk); });
+    return result;
+}
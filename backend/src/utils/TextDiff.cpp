@@ -0,0 +1,240 @@
+#include "utils/TextDiff.h"
+#include "utils/Utf16.h"
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXT_DIFF_SIMD 1
+#endif
+
+const int TextDiff::MAX_EDIT_DISTANCE;
+const size_t TextDiff::MAX_MIDDLE_BYTES;
+constexpr std::chrono::microseconds TextDiff::DEFAULT_BUDGET;
+
+namespace {
+    inline bool isContinuation(char c)
+    {
+        return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+    }
+
+    // Appends a component, merging it into the previous one when they touch
+    void push(TextDiff::Operations &ops, TextOperation op)
+    {
+        if (!ops.empty())
+        {
+            TextOperation &last = ops.back();
+            if (op.isInsert() && last.isInsert() && last.position + last.length == op.position)
+            {
+                last.text += op.text;
+                last.length += op.length;
+                return;
+            }
+            if (op.isDelete() && last.isDelete() && last.position == op.position)
+            {
+                last.length += op.length;
+                return;
+            }
+        }
+        ops.push_back(std::move(op));
+    }
+}
+
+size_t TextDiff::commonPrefix(const char *a, const char *b, size_t length)
+{
+    size_t i = 0;
+#ifdef TEXT_DIFF_SIMD
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        unsigned mismatch = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFF;
+        if (mismatch)
+            return i + static_cast<size_t>(__builtin_ctz(mismatch));
+    }
+#endif
+    while (i < length && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+size_t TextDiff::commonSuffix(const char *a, const char *b, size_t length)
+{
+    // a and b point one past the last byte
+    size_t i = 0;
+#ifdef TEXT_DIFF_SIMD
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a - i - 16));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b - i - 16));
+        unsigned mismatch = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFF;
+        if (mismatch)
+            return i + static_cast<size_t>(__builtin_clz(mismatch) - 16);
+    }
+#endif
+    while (i < length && a[-1 - static_cast<std::ptrdiff_t>(i)] == b[-1 - static_cast<std::ptrdiff_t>(i)])
+        ++i;
+    return i;
+}
+
+TextDiff::Operations TextDiff::compute(const std::string &old_text, const std::string &new_text, std::chrono::microseconds budget)
+{
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    size_t shorter = std::min(old_text.size(), new_text.size());
+
+    // Trim to code point boundaries so the middle starts and ends whole
+    size_t prefix = commonPrefix(old_text.data(), new_text.data(), shorter);
+    while (prefix > 0 && ((prefix < old_text.size() && isContinuation(old_text[prefix])) ||
+                          (prefix < new_text.size() && isContinuation(new_text[prefix]))))
+        --prefix;
+
+    size_t suffix = commonSuffix(old_text.data() + old_text.size(), new_text.data() + new_text.size(), shorter - prefix);
+    while (suffix > 0 && isContinuation(old_text[old_text.size() - suffix]))
+        --suffix;
+
+    Operations ops;
+    std::string_view old_middle(old_text.data() + prefix, old_text.size() - prefix - suffix);
+    std::string_view new_middle(new_text.data() + prefix, new_text.size() - prefix - suffix);
+    if (old_middle.empty() && new_middle.empty())
+        return ops;
+
+    size_t position = Utf16::length(old_text, 0, prefix);
+    if (!old_middle.empty() && !new_middle.empty() && old_middle.size() + new_middle.size() <= MAX_MIDDLE_BYTES)
+    {
+        auto a = tokenize(old_middle);
+        auto b = tokenize(new_middle);
+        std::string script = myers(a, b, deadline);
+        if (!script.empty())
+        {
+            size_t x = 0, y = 0;
+            for (char step : script)
+            {
+                if (step == '=')
+                {
+                    position += a[x++].units;
+                    ++y;
+                }
+                else if (step == '-')
+                {
+                    push(ops, TextOperation::remove(position, a[x++].units));
+                }
+                else
+                {
+                    TextOperation op;
+                    op.type = TextOperation::Type::Insert;
+                    op.position = position;
+                    op.length = b[y].units;
+                    op.text.assign(b[y].bytes.data(), b[y].bytes.size());
+                    position += b[y++].units;
+                    push(ops, std::move(op));
+                }
+            }
+            return ops;
+        }
+    }
+
+    // Replace the middle wholesale; exact when one side of it is empty
+    if (!old_middle.empty())
+        ops.push_back(TextOperation::remove(position, Utf16::length(old_text, prefix, old_text.size() - suffix)));
+    if (!new_middle.empty())
+        ops.push_back(TextOperation::insert(position, std::string(new_middle)));
+    return ops;
+}
+
+std::vector<TextDiff::Token> TextDiff::tokenize(std::string_view text)
+{
+    // Same unit counting as Utf16::length: a lead byte and its
+    // continuation bytes form one token
+    std::vector<Token> tokens;
+    tokens.reserve(text.size());
+    size_t i = 0;
+    while (i < text.size())
+    {
+        size_t begin = i++;
+        while (i < text.size() && isContinuation(text[i]))
+            ++i;
+
+        unsigned char lead = static_cast<unsigned char>(text[begin]);
+        size_t units = isContinuation(text[begin]) ? 0 : ((lead & 0xF8) == 0xF0 ? 2 : 1);
+        tokens.push_back({text.substr(begin, i - begin), units});
+    }
+    return tokens;
+}
+
+std::string TextDiff::myers(const std::vector<Token> &a, const std::vector<Token> &b, std::chrono::steady_clock::time_point deadline)
+{
+    const int n = static_cast<int>(a.size());
+    const int m = static_cast<int>(b.size());
+    const int limit = std::min(n + m, MAX_EDIT_DISTANCE);
+    if (std::abs(n - m) > limit)
+        return {};
+
+    // v[k] is the furthest x reached on diagonal k = x - y. Row d of the
+    // trace keeps diagonals -d..d and starts at d * d.
+    std::vector<int> v(2 * static_cast<size_t>(limit) + 3, 0);
+    const int offset = limit + 1;
+    std::vector<int> trace;
+
+    int found = -1;
+    for (int d = 0; d <= limit && found < 0; ++d)
+    {
+        if ((d & 15) == 15 && std::chrono::steady_clock::now() > deadline)
+            return {};
+
+        for (int k = -d; k <= d; k += 2)
+        {
+            int x;
+            if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                x = v[offset + k + 1];
+            else
+                x = v[offset + k - 1] + 1;
+
+            int y = x - k;
+            while (x < n && y < m && a[x].bytes == b[y].bytes)
+            {
+                ++x;
+                ++y;
+            }
+            v[offset + k] = x;
+
+            if (x >= n && y >= m)
+                found = d;
+        }
+        trace.insert(trace.end(), v.begin() + offset - d, v.begin() + offset + d + 1);
+    }
+    if (found < 0)
+        return {};
+
+    // Walk back from the end, then reverse
+    std::string script;
+    int x = n, y = m;
+    for (int d = found; d > 0; --d)
+    {
+        const int *previous = trace.data() + static_cast<size_t>(d - 1) * (d - 1) + (d - 1);
+        int k = x - y;
+        int previous_k;
+        if (k == -d || (k != d && previous[k - 1] < previous[k + 1]))
+            previous_k = k + 1;
+        else
+            previous_k = k - 1;
+
+        int previous_x = previous[previous_k];
+        int previous_y = previous_x - previous_k;
+
+        // The snake starts one step past the previous point
+        int start_x = previous_k == k + 1 ? previous_x : previous_x + 1;
+        while (x > start_x)
+        {
+            script += '=';
+            --x;
+            --y;
+        }
+        script += previous_k == k + 1 ? '+' : '-';
+        x = previous_x;
+        y = previous_y;
+    }
+    script.append(static_cast<size_t>(x), '=');
+
+    std::reverse(script.begin(), script.end());
+    return script;
+}
@@ -0,0 +1,90 @@
+#include "utils/TimerWheel.h"
+
+const unsigned TimerWheel::SLOT_BITS;
+const size_t TimerWheel::SLOTS;
+const size_t TimerWheel::LEVELS;
+const uint64_t TimerWheel::RANGE;
+
+TimerWheel::TimerWheel(uint64_t now)
+    : now_(now)
+{
+}
+
+void TimerWheel::schedule(uint64_t key, uint64_t when)
+{
+    auto it = timers_.find(key);
+    if (it != timers_.end())
+    {
+        unlink(it->second);
+        timers_.erase(it);
+    }
+
+    if (when <= now_)
+        when = now_ + 1;
+    if (when - now_ > RANGE)
+        when = now_ + RANGE;
+    place(key, when);
+}
+
+void TimerWheel::cancel(uint64_t key)
+{
+    auto it = timers_.find(key);
+    if (it == timers_.end())
+        return;
+    unlink(it->second);
+    timers_.erase(it);
+}
+
+void TimerWheel::advance(uint64_t now, std::vector<uint64_t> &expired)
+{
+    while (now_ < now)
+    {
+        ++now_;
+
+        // Upper levels first: a timer may drop more than one level
+        for (size_t level = LEVELS - 1; level > 0; --level)
+        {
+            if ((now_ & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) == 0)
+                cascade(level);
+        }
+
+        std::vector<uint64_t> due;
+        due.swap(wheels_[0][now_ & (SLOTS - 1)]);
+        for (uint64_t key : due)
+        {
+            timers_.erase(key);
+            expired.push_back(key);
+        }
+    }
+}
+
+void TimerWheel::place(uint64_t key, uint64_t when)
+{
+    // The lowest level whose current turn when falls in; its slot there is
+    // still ahead of now_
+    size_t level = 0;
+    while (level < LEVELS - 1 && (when >> (SLOT_BITS * (level + 1))) != (now_ >> (SLOT_BITS * (level + 1))))
+        ++level;
+
+    uint32_t slot = static_cast<uint32_t>((when >> (SLOT_BITS * level)) & (SLOTS - 1));
+    auto &timers = wheels_[level][slot];
+    timers.push_back(key);
+    timers_[key] = Timer{when, static_cast<uint32_t>(level), slot, timers.size() - 1};
+}
+
+void TimerWheel::unlink(const Timer &timer)
+{
+    auto &timers = wheels_[timer.level][timer.slot];
+    uint64_t last = timers.back();
+    timers[timer.index] = last;
+    timers_[last].index = timer.index;
+    timers.pop_back();
+}
+
+void TimerWheel::cascade(size_t level)
+{
+    std::vector<uint64_t> moving;
+    moving.swap(wheels_[level][(now_ >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+    for (uint64_t key : moving)
+        place(key, timers_[key].when);
+}
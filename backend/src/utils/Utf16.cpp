@@ -0,0 +1,191 @@
+#include "utils/Utf16.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define UTF16_SIMD 1
+#endif
+
+namespace {
+    inline bool isContinuation(unsigned char c)
+    {
+        return (c & 0xC0) == 0x80;
+    }
+
+    // UTF-16 units contributed by a byte: one per sequence start, plus one
+    // for the low surrogate of a 4-byte sequence. Continuation bytes, stray
+    // ones included, contribute nothing.
+    inline size_t unitsOf(unsigned char c)
+    {
+        return (isContinuation(c) ? 0 : 1) + ((c & 0xF8) == 0xF0 ? 1 : 0);
+    }
+
+#ifdef UTF16_SIMD
+    const size_t BLOCK = 16;
+
+    // unitsOf summed over 16 bytes. Signed compares: continuation bytes are
+    // -128..-65 and 4-byte leads -16..-9.
+    inline size_t blockUnits(const char *p)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int high = _mm_movemask_epi8(v);
+        if (high == 0)
+            return BLOCK;
+
+        __m128i starts = _mm_cmpgt_epi8(v, _mm_set1_epi8(-65));
+        __m128i four = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-17)), _mm_cmplt_epi8(v, _mm_set1_epi8(-8)));
+        return static_cast<size_t>(__builtin_popcount(_mm_movemask_epi8(starts)) +
+                                   __builtin_popcount(_mm_movemask_epi8(four)));
+    }
+
+    // True when all 64 bytes at p are ASCII
+    inline bool asciiRun(const char *p)
+    {
+        const __m128i *v = reinterpret_cast<const __m128i *>(p);
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(v), _mm_loadu_si128(v + 1)),
+                                   _mm_or_si128(_mm_loadu_si128(v + 2), _mm_loadu_si128(v + 3)));
+        return _mm_movemask_epi8(any) == 0;
+    }
+#endif
+}
+
+size_t Utf16::length(const std::string &utf8, size_t begin, size_t end)
+{
+    end = std::min(end, utf8.size());
+    const char *data = utf8.data();
+    size_t units = 0;
+    size_t i = begin;
+
+#ifdef UTF16_SIMD
+    // Per-byte counters: subtracting a compare mask adds one per match.
+    // A byte gains at most 2 per block, so fold into the total with
+    // psadbw every 127 blocks before a lane can overflow.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i continuation_max = _mm_set1_epi8(-65);
+    const __m128i four_min = _mm_set1_epi8(-17);
+    const __m128i four_max = _mm_set1_epi8(-8);
+    while (i + BLOCK <= end)
+    {
+        size_t blocks = std::min<size_t>((end - i) / BLOCK, 127);
+        __m128i counts = zero;
+        for (size_t b = 0; b < blocks; ++b, i += BLOCK)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            __m128i four = _mm_and_si128(_mm_cmpgt_epi8(v, four_min), _mm_cmplt_epi8(v, four_max));
+            counts = _mm_sub_epi8(counts, _mm_cmpgt_epi8(v, continuation_max));
+            counts = _mm_sub_epi8(counts, four);
+        }
+        __m128i sums = _mm_sad_epu8(counts, zero);
+        units += static_cast<size_t>(_mm_cvtsi128_si32(sums)) + static_cast<size_t>(_mm_extract_epi16(sums, 4));
+    }
+#endif
+
+    for (; i < end; ++i)
+        units += unitsOf(static_cast<unsigned char>(data[i]));
+    return units;
+}
+
+size_t Utf16::toByteOffset(const std::string &utf8, size_t utf16_offset, size_t start_byte)
+{
+    const char *data = utf8.data();
+    size_t size = utf8.size();
+    size_t pos = start_byte;
+    size_t remaining = utf16_offset;
+
+#ifdef UTF16_SIMD
+    // Skip whole blocks while the target lies beyond them. A sequence cut
+    // by the block edge is counted at its lead byte, so its continuation
+    // bytes are stepped over afterwards.
+    bool skipped = false;
+    while (pos + BLOCK <= size)
+    {
+        size_t units = blockUnits(data + pos);
+        if (units >= remaining)
+            break;
+        remaining -= units;
+        pos += BLOCK;
+        skipped = true;
+    }
+    if (skipped)
+    {
+        while (pos < size && isContinuation(static_cast<unsigned char>(data[pos])))
+            ++pos;
+    }
+#endif
+
+    while (remaining > 0)
+    {
+        if (pos >= size)
+            throw std::out_of_range("Offset past end of document");
+
+        size_t units = unitsOf(static_cast<unsigned char>(data[pos]));
+        if (units > remaining)
+            throw std::invalid_argument("Offset splits a surrogate pair");
+        remaining -= units;
+
+        ++pos;
+        while (pos < size && isContinuation(static_cast<unsigned char>(data[pos])))
+            ++pos;
+    }
+    return pos;
+}
+
+bool Utf16::isValidUtf8(const std::string &utf8)
+{
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(utf8.data());
+    size_t size = utf8.size();
+    size_t i = 0;
+
+    while (i < size)
+    {
+#ifdef UTF16_SIMD
+        // Text is mostly ASCII; check it 64 bytes at a time
+        while (i + 64 <= size && asciiRun(utf8.data() + i))
+            i += 64;
+        if (i >= size)
+            break;
+#endif
+        unsigned char c = data[i];
+        if (c < 0x80)
+        {
+            ++i;
+            continue;
+        }
+
+        // Second-byte ranges exclude overlong forms, UTF-16 surrogates
+        // (U+D800..U+DFFF) and code points above U+10FFFF
+        size_t length;
+        unsigned char low = 0x80, high = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF)
+            length = 2;
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            length = 3;
+            if (c == 0xE0)
+                low = 0xA0;
+            else if (c == 0xED)
+                high = 0x9F;
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            length = 4;
+            if (c == 0xF0)
+                low = 0x90;
+            else if (c == 0xF4)
+                high = 0x8F;
+        }
+        else
+            return false;
+
+        if (i + length > size || data[i + 1] < low || data[i + 1] > high)
+            return false;
+        for (size_t k = 2; k < length; ++k)
+        {
+            if (!isContinuation(data[i + k]))
+                return false;
+        }
+        i += length;
+    }
+    return true;
+}
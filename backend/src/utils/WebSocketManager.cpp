@@ -1,5 +1,16 @@
 #include "utils/WebSocketManager.h"
+#include "utils/BinaryProtocol.h"
 #include <algorithm>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <unordered_set>
+
+const size_t WebSocketManager::SHARD_COUNT;
+const std::chrono::seconds WebSocketManager::RESUME_WINDOW(60);
+const std::chrono::milliseconds WebSocketManager::LEASE_WAIT(2000);
+const size_t WebSocketManager::ConnectionDirectory::CAPACITY;
+const size_t WebSocketManager::ConnectionDirectory::MAX_PROBE;
 
 WebSocketManager& WebSocketManager::getInstance()
 {
@@ -7,124 +18,851 @@ WebSocketManager& WebSocketManager::getInstance()
     return instance;
 }
 
-void WebSocketManager::joinDocument(const std::string& doc_id, crow::websocket::connection* conn, const std::string& user_id)
+WebSocketManager::WebSocketManager()
+{
+    for (auto& shard : shards_)
+    {
+        shard.rooms = std::make_shared<const Rooms>();
+    }
+}
+
+void WebSocketManager::attachBus(const std::shared_ptr<FanoutBus>& bus)
+{
+    bus->onMessage(FanoutBus::Kind::Broadcast, [this](const FanoutBus::Message& message) { deliver(message); });
+    bus->onMessage(FanoutBus::Kind::Presence, [this](const FanoutBus::Message& message) { deliver(message); });
+    
+    for (auto& shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : *std::atomic_load(&shard.rooms))
+        {
+            bus->subscribe(entry.first);
+        }
+    }
+    std::atomic_store(&bus_, bus);
+}
+
+bool WebSocketManager::ownsDocument(const std::string& doc_id)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto bus = std::atomic_load(&bus_);
+    if (!bus)
+    {
+        return true;
+    }
     
-    document_rooms_[doc_id].insert(conn);
-    connection_info_[conn] = {doc_id, user_id};
-    document_users_[doc_id].insert(user_id);
+    // Without a room here nothing is relayed; an edit made outside one
+    // reaches the database, and the owner merges it on its next write
+    auto rooms = std::atomic_load(&shardFor(doc_id).rooms);
+    if (rooms->find(doc_id) == rooms->end())
+    {
+        return true;
+    }
+    return bus->awaitLease(doc_id, LEASE_WAIT) == FanoutBus::Lease::Owned;
 }
 
-void WebSocketManager::leaveDocument(const std::string& doc_id, crow::websocket::connection* conn)
+WebSocketManager::Room::Room(const std::string& doc_id, uint64_t stream)
+    : doc_id(doc_id), log(stream)
+{
+    channel_prefix = "{\"doc\":\"";
+    for (char c : doc_id)
+    {
+        if (c == '"' || c == '\\')
+        {
+            channel_prefix += '\\';
+            channel_prefix += c;
+        }
+        else if (static_cast<unsigned char>(c) >= 0x20)
+        {
+            channel_prefix += c;
+        }
+    }
+    channel_prefix += "\",";
+}
+
+WebSocketManager::Shard& WebSocketManager::shardFor(const std::string& doc_id)
+{
+    return shards_[std::hash<std::string>{}(doc_id) % SHARD_COUNT];
+}
+
+WebSocketManager::Shard& WebSocketManager::shardFor(crow::websocket::connection* conn)
+{
+    // The low bits of the pointer are alignment
+    return shards_[(reinterpret_cast<uintptr_t>(conn) >> 6) % SHARD_COUNT];
+}
+
+void WebSocketManager::connect(crow::websocket::connection* conn, const std::string& user_id, const OutboundQueue::Wire& wire,
+                               const std::string& session)
+{
+    leaveAll(conn);
+    addLink(shardFor(conn), conn, user_id, wire, session, "");
+}
+
+bool WebSocketManager::joinDocument(const std::string& doc_id, crow::websocket::connection* conn, const std::string& user_id,
+                                    const std::string& username, const OutboundQueue::Wire& wire, const Resume& resume)
+{
+    leaveAll(conn);
+    
+    // Homed with its document, so a single-room connection only ever
+    // touches one shard
+    auto link = addLink(shardFor(doc_id), conn, user_id, wire, resume.session, doc_id);
+    return join(doc_id, link, username, resume, false);
+}
+
+bool WebSocketManager::subscribe(const std::string& doc_id, crow::websocket::connection* conn, const std::string& username,
+                                 const Resume& resume)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t index = directory_.find(conn);
+    if (index >= SHARD_COUNT)
+    {
+        throw std::runtime_error("Connection is not registered");
+    }
     
-    auto it = document_rooms_.find(doc_id);
-    if (it != document_rooms_.end())
+    std::shared_ptr<Link> link;
     {
-        it->second.erase(conn);
-        if (it->second.empty())
+        Shard& home = shards_[index];
+        std::lock_guard<std::mutex> lock(home.mutex);
+        auto it = home.links.find(conn);
+        if (it == home.links.end())
+        {
+            throw std::runtime_error("Connection is not registered");
+        }
+        link = it->second;
+        if (std::find(link->rooms.begin(), link->rooms.end(), doc_id) != link->rooms.end())
         {
-            document_rooms_.erase(it);
+            throw std::runtime_error("Already subscribed to this document");
         }
+        link->rooms.push_back(doc_id);
+    }
+    
+    subscribes_++;
+    Resume from{link->session, resume.stream, resume.seq};
+    return join(doc_id, link, username, from, true);
+}
+
+std::shared_ptr<WebSocketManager::Link> WebSocketManager::addLink(Shard& home, crow::websocket::connection* conn, const std::string& user_id,
+                                                                  const OutboundQueue::Wire& wire, const std::string& session,
+                                                                  const std::string& doc_id)
+{
+    auto link = std::make_shared<Link>();
+    link->conn = conn;
+    link->user_id = user_id;
+    link->session = session;
+    link->outbound = std::make_shared<OutboundQueue>(conn, wire);
+    if (!doc_id.empty())
+    {
+        link->rooms.push_back(doc_id);
     }
     
-    auto conn_it = connection_info_.find(conn);
-    if (conn_it != connection_info_.end())
+    std::lock_guard<std::mutex> lock(home.mutex);
+    home.links[conn] = link;
+    directory_.insert(conn, static_cast<uint32_t>(&home - shards_.data()));
+    return link;
+}
+
+std::shared_ptr<WebSocketManager::Link> WebSocketManager::findLink(crow::websocket::connection* conn)
+{
+    uint32_t index = directory_.find(conn);
+    if (index >= SHARD_COUNT)
     {
-        std::string user_id = conn_it->second.second;
-        connection_info_.erase(conn_it);
+        return nullptr;
+    }
+    
+    Shard& home = shards_[index];
+    std::lock_guard<std::mutex> lock(home.mutex);
+    auto it = home.links.find(conn);
+    return it != home.links.end() ? it->second : nullptr;
+}
+
+bool WebSocketManager::join(const std::string& doc_id, const std::shared_ptr<Link>& link, const std::string& username,
+                            const Resume& resume, bool channel)
+{
+    Shard& shard = shardFor(doc_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    expireRooms(shard);
+    
+    auto rooms = std::atomic_load(&shard.rooms);
+    std::shared_ptr<Room> room;
+    auto it = rooms->find(doc_id);
+    if (it != rooms->end())
+    {
+        room = it->second;
+    }
+    else
+    {
+        // A new stream, so seqs from an earlier room never match
+        std::random_device random;
+        uint64_t stream = 0;
+        while (stream == 0)
+        {
+            stream = random();
+        }
+        room = std::make_shared<Room>(doc_id, stream);
+        room->members = std::make_shared<const Members>();
+        auto updated = std::make_shared<Rooms>(*rooms);
+        (*updated)[doc_id] = room;
+        std::atomic_store(&shard.rooms, std::shared_ptr<const Rooms>(std::move(updated)));
         
-        // Remove user from document_users
-        auto users_it = document_users_.find(doc_id);
-        if (users_it != document_users_.end())
+        if (auto bus = std::atomic_load(&bus_))
         {
-            users_it->second.erase(user_id);
-            if (users_it->second.empty())
+            bus->subscribe(doc_id);
+        }
+    }
+    
+    auto member = std::make_shared<Member>();
+    member->conn = link->conn;
+    member->user_id = link->user_id;
+    member->username = username;
+    member->session = link->session;
+    member->outbound = link->outbound;
+    member->channel = channel;
+    
+    std::lock_guard<std::mutex> order(room->order);
+    auto members = std::make_shared<Members>(*std::atomic_load(&room->members));
+    members->push_back(member);
+    std::atomic_store(&room->members, std::shared_ptr<const Members>(std::move(members)));
+    shard.members[link->conn][doc_id] = member;
+    
+    if (resume.session.empty())
+    {
+        return false;
+    }
+    
+    bool resumed = false;
+    if (resume.stream != 0)
+    {
+        std::vector<OutboundQueue::Frame> missed;
+        resumed = room->log.since(resume.stream, resume.seq, resume.session, missed);
+        if (resumed)
+        {
+            resumes_++;
+            replayed_frames_ += missed.size();
+            if (channel)
+            {
+                for (auto& frame : missed)
+                {
+                    frame = channelFrame(*room, frame);
+                }
+            }
+            if (!missed.empty())
             {
-                document_users_.erase(users_it);
+                member->outbound->push(missed);
             }
         }
+        else
+        {
+            resume_gaps_++;
+        }
+    }
+    
+    OutboundQueue::Frame session;
+    session.data = OutboundQueue::share(ReplayLog::sessionFrame(resume.session, room->log.stream(), room->log.seq(), resumed));
+    member->outbound->push(channel ? channelFrame(*room, session) : session);
+    return resumed;
+}
+
+void WebSocketManager::leaveDocument(const std::string& doc_id, crow::websocket::connection* conn)
+{
+    {
+        Shard& shard = shardFor(doc_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        removeMember(shard, conn, doc_id);
+    }
+    
+    uint32_t index = directory_.find(conn);
+    if (index >= SHARD_COUNT)
+    {
+        return;
+    }
+    Shard& home = shards_[index];
+    std::lock_guard<std::mutex> lock(home.mutex);
+    auto it = home.links.find(conn);
+    if (it != home.links.end())
+    {
+        auto& rooms = it->second->rooms;
+        rooms.erase(std::remove(rooms.begin(), rooms.end(), doc_id), rooms.end());
     }
 }
 
 void WebSocketManager::leaveAll(crow::websocket::connection* conn)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t index = directory_.find(conn);
+    if (index >= SHARD_COUNT)
+    {
+        return;
+    }
     
-    auto conn_it = connection_info_.find(conn);
-    if (conn_it != connection_info_.end())
+    std::shared_ptr<Link> link;
     {
-        std::string doc_id = conn_it->second.first;
-        std::string user_id = conn_it->second.second;
+        Shard& home = shards_[index];
+        std::lock_guard<std::mutex> lock(home.mutex);
+        auto it = home.links.find(conn);
+        if (it == home.links.end())
+        {
+            return;
+        }
+        link = std::move(it->second);
+        home.links.erase(it);
+        directory_.erase(conn);
+    }
+    
+    // Waits for an in-flight send to this connection only
+    link->outbound->close();
+    
+    // One shard at a time; rooms are never locked together
+    for (const auto& doc_id : link->rooms)
+    {
+        Shard& shard = shardFor(doc_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        removeMember(shard, conn, doc_id);
+    }
+}
+
+void WebSocketManager::removeMember(Shard& shard, crow::websocket::connection* conn, const std::string& doc_id)
+{
+    auto conn_it = shard.members.find(conn);
+    if (conn_it == shard.members.end())
+    {
+        return;
+    }
+    auto member_it = conn_it->second.find(doc_id);
+    if (member_it == conn_it->second.end())
+    {
+        return;
+    }
+    std::shared_ptr<Member> member = std::move(member_it->second);
+    conn_it->second.erase(member_it);
+    if (conn_it->second.empty())
+    {
+        shard.members.erase(conn_it);
+    }
+    
+    auto rooms = std::atomic_load(&shard.rooms);
+    auto it = rooms->find(doc_id);
+    if (it == rooms->end())
+    {
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> order(it->second->order);
+        auto members = std::make_shared<Members>(*std::atomic_load(&it->second->members));
+        members->erase(std::remove(members->begin(), members->end(), member), members->end());
         
-        // Remove from document room
-        auto room_it = document_rooms_.find(doc_id);
-        if (room_it != document_rooms_.end())
+        // The room and its log stay for RESUME_WINDOW in case the client is back
+        if (members->empty())
         {
-            room_it->second.erase(conn);
-            if (room_it->second.empty())
-            {
-                document_rooms_.erase(room_it);
-            }
+            it->second->emptied = std::chrono::steady_clock::now();
+            shard.emptied.emplace_back(it->second->emptied, doc_id);
+        }
+        std::atomic_store(&it->second->members, std::shared_ptr<const Members>(std::move(members)));
+    }
+    expireRooms(shard);
+}
+
+void WebSocketManager::expireRooms(Shard& shard)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::shared_ptr<Rooms> updated;
+    while (!shard.emptied.empty() && now - shard.emptied.front().first >= RESUME_WINDOW)
+    {
+        auto [emptied, doc_id] = std::move(shard.emptied.front());
+        shard.emptied.pop_front();
+        
+        // Skip rooms that were joined again since, even if empty once more
+        const Rooms& rooms = updated ? *updated : *std::atomic_load(&shard.rooms);
+        auto it = rooms.find(doc_id);
+        if (it == rooms.end() || it->second->emptied != emptied || !std::atomic_load(&it->second->members)->empty())
+        {
+            continue;
         }
         
-        // Remove from document users
-        auto users_it = document_users_.find(doc_id);
-        if (users_it != document_users_.end())
+        if (!updated)
         {
-            users_it->second.erase(user_id);
-            if (users_it->second.empty())
-            {
-                document_users_.erase(users_it);
-            }
+            updated = std::make_shared<Rooms>(*std::atomic_load(&shard.rooms));
         }
+        updated->erase(doc_id);
         
-        connection_info_.erase(conn_it);
+        if (auto bus = std::atomic_load(&bus_))
+        {
+            bus->unsubscribe(doc_id);
+        }
     }
+    
+    if (updated)
+    {
+        std::atomic_store(&shard.rooms, std::shared_ptr<const Rooms>(std::move(updated)));
+    }
+}
+
+std::shared_ptr<WebSocketManager::Room> WebSocketManager::loadRoom(const std::string& doc_id)
+{
+    auto rooms = std::atomic_load(&shardFor(doc_id).rooms);
+    auto it = rooms->find(doc_id);
+    return it != rooms->end() ? it->second : nullptr;
+}
+
+std::shared_ptr<const WebSocketManager::Members> WebSocketManager::loadMembers(const std::string& doc_id)
+{
+    auto room = loadRoom(doc_id);
+    return room ? std::atomic_load(&room->members) : nullptr;
 }
 
-void WebSocketManager::broadcastToDocument(const std::string& doc_id, const std::string& message, crow::websocket::connection* exclude_conn)
+size_t WebSocketManager::broadcastToDocument(const std::string& doc_id, const std::string& message, crow::websocket::connection* exclude_conn,
+                                             OutboundQueue::Priority priority)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    OutboundQueue::Frame frame;
+    frame.data = OutboundQueue::share(message);
+    frame.priority = priority;
+    return broadcast(doc_id, {frame}, exclude_conn, nullptr);
+}
+
+size_t WebSocketManager::broadcastToDocument(const std::string& doc_id, const OutboundQueue::Frame& frame, crow::websocket::connection* exclude_conn)
+{
+    return broadcast(doc_id, {frame}, exclude_conn, nullptr);
+}
+
+size_t WebSocketManager::broadcastToDocument(const std::string& doc_id, const std::vector<OutboundQueue::Frame>& frames, crow::websocket::connection* exclude_conn)
+{
+    return broadcast(doc_id, frames, exclude_conn, nullptr);
+}
+
+size_t WebSocketManager::broadcastToDocument(const std::string& doc_id, const OutboundQueue::Frame& frame, crow::websocket::connection* origin,
+                                             const OutboundQueue::Frame& origin_frame)
+{
+    return broadcast(doc_id, {frame}, origin, &origin_frame);
+}
+
+size_t WebSocketManager::broadcastLocally(const std::string& doc_id, const std::string& message)
+{
+    OutboundQueue::Frame frame;
+    frame.data = OutboundQueue::share(message);
+    return broadcast(doc_id, {frame}, nullptr, nullptr, false);
+}
+
+size_t WebSocketManager::broadcast(const std::string& doc_id, const std::vector<OutboundQueue::Frame>& frames,
+                                   crow::websocket::connection* origin, const OutboundQueue::Frame* origin_frame, bool relay)
+{
+    auto bus = relay ? std::atomic_load(&bus_) : nullptr;
+    auto room = loadRoom(doc_id);
+    if (!room)
+    {
+        // Other processes may still have the room
+        if (bus)
+        {
+            publish(*bus, doc_id, frames);
+        }
+        return 0;
+    }
     
-    auto it = document_rooms_.find(doc_id);
-    if (it != document_rooms_.end())
+    std::lock_guard<std::mutex> order(room->order);
+    auto members = std::atomic_load(&room->members);
+    
+    // Under the order lock, so other processes get the room's frames in
+    // the order it numbers them
+    if (bus)
+    {
+        publish(*bus, doc_id, frames);
+    }
+    
+    std::shared_ptr<Member> sender;
+    for (const auto& member : *members)
+    {
+        if (member->conn == origin)
+        {
+            sender = member;
+            break;
+        }
+    }
+    
+    // Numbered once for the room; the log keeps the same buffers
+    std::vector<OutboundQueue::Frame> numbered;
+    std::vector<OutboundQueue::Frame> for_sender;
+    numbered.reserve(frames.size());
+    for (const auto& frame : frames)
+    {
+        auto entry = room->log.append(frame, sender ? sender->session : std::string(), origin_frame);
+        numbered.push_back(std::move(entry.frame));
+        if (entry.origin_frame.data || entry.origin_frame.binary)
+        {
+            for_sender.push_back(std::move(entry.origin_frame));
+        }
+    }
+    
+    // Deflated once per window size for the whole room; channels share a
+    // tagged copy, built on the first one
+    OutboundQueue::SharedDeflate shared;
+    std::vector<OutboundQueue::Frame> tagged;
+    std::vector<OutboundQueue::Frame> tagged_for_sender;
+    bool tagged_built = false;
+    size_t sent = 0;
+    for (const auto& member : *members)
     {
-        for (auto* conn : it->second)
+        if (member->channel && !tagged_built)
         {
-            if (conn != exclude_conn)
+            for (const auto& frame : numbered)
+            {
+                tagged.push_back(channelFrame(*room, frame));
+            }
+            for (const auto& frame : for_sender)
             {
-                conn->send_text(message);
+                tagged_for_sender.push_back(channelFrame(*room, frame));
             }
+            tagged_built = true;
+        }
+        
+        const auto& batch = member->channel ? (member == sender ? tagged_for_sender : tagged)
+                                            : (member == sender ? for_sender : numbered);
+        if (batch.empty())
+        {
+            continue;
+        }
+        bool pushed = batch.size() == 1 ? member->outbound->push(batch.front(), &shared) : member->outbound->push(batch, &shared);
+        if (pushed)
+        {
+            ++sent;
+        }
+    }
+    return sent;
+}
+
+void WebSocketManager::deliver(const FanoutBus::Message& message)
+{
+    std::vector<OutboundQueue::Frame> frames;
+    if (!decodeFrames(message.payload, frames))
+    {
+        throw std::runtime_error("Malformed relayed frames");
+    }
+    if (!frames.empty())
+    {
+        relayed_in_ += frames.size();
+        broadcast(message.room, frames, nullptr, nullptr, false);
+    }
+}
+
+void WebSocketManager::publish(FanoutBus& bus, const std::string& doc_id, const std::vector<OutboundQueue::Frame>& frames)
+{
+    FanoutBus::Message message;
+    bool presence = true;
+    message.payload = encodeFrames(frames, presence);
+    if (message.payload.empty())
+    {
+        return;
+    }
+    message.kind = presence ? FanoutBus::Kind::Presence : FanoutBus::Kind::Broadcast;
+    message.room = doc_id;
+    bus.publish(message);
+    relayed_out_ += frames.size();
+}
+
+std::string WebSocketManager::encodeFrames(const std::vector<OutboundQueue::Frame>& frames, bool& presence)
+{
+    // Per frame: u8 priority, u16 key length, key, u32 data length, data
+    // (lengths little-endian). Frames that only exist in binary are local.
+    std::string payload;
+    presence = true;
+    for (const auto& frame : frames)
+    {
+        if (!frame.data || frame.key.size() > 0xFFFF)
+        {
+            continue;
+        }
+        presence = presence && frame.priority == OutboundQueue::Priority::Presence;
+        
+        uint16_t key = static_cast<uint16_t>(frame.key.size());
+        uint32_t size = static_cast<uint32_t>(frame.data->size());
+        payload += static_cast<char>(frame.priority);
+        payload += static_cast<char>(key & 0xFF);
+        payload += static_cast<char>(key >> 8);
+        payload += frame.key;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            payload += static_cast<char>((size >> shift) & 0xFF);
+        }
+        payload += *frame.data;
+    }
+    return payload;
+}
+
+bool WebSocketManager::decodeFrames(const std::string& payload, std::vector<OutboundQueue::Frame>& frames)
+{
+    const auto* bytes = reinterpret_cast<const unsigned char*>(payload.data());
+    size_t offset = 0;
+    while (offset < payload.size())
+    {
+        if (payload.size() - offset < 3 || bytes[offset] > static_cast<unsigned char>(OutboundQueue::Priority::Presence))
+        {
+            return false;
+        }
+        OutboundQueue::Frame frame;
+        frame.priority = static_cast<OutboundQueue::Priority>(bytes[offset]);
+        size_t key = bytes[offset + 1] | static_cast<size_t>(bytes[offset + 2]) << 8;
+        offset += 3;
+        if (payload.size() - offset < key + 4)
+        {
+            return false;
+        }
+        frame.key.assign(payload, offset, key);
+        offset += key;
+        
+        size_t size = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            size |= static_cast<size_t>(bytes[offset++]) << shift;
+        }
+        if (payload.size() - offset < size)
+        {
+            return false;
         }
+        frame.data = OutboundQueue::share(payload.substr(offset, size));
+        offset += size;
+        frames.push_back(std::move(frame));
+    }
+    return true;
+}
+
+OutboundQueue::Frame WebSocketManager::channelFrame(const Room& room, const OutboundQueue::Frame& frame)
+{
+    OutboundQueue::Frame tagged = frame;
+    if (frame.data)
+    {
+        // {"doc":"<doc_id>", followed by the rest of the object
+        const std::string& json = *frame.data;
+        std::string data;
+        data.reserve(room.channel_prefix.size() + json.size());
+        data += room.channel_prefix;
+        if (json.size() > 2)
+        {
+            data.append(json, 1, std::string::npos);
+        }
+        else
+        {
+            data.back() = '}';
+        }
+        tagged.data = OutboundQueue::share(std::move(data));
+    }
+    if (frame.binary)
+    {
+        tagged.binary = OutboundQueue::share(BinaryProtocol::channelFrame(room.doc_id, *frame.binary));
+    }
+    // Presence collapses per room, not across a connection's rooms
+    if (!frame.key.empty())
+    {
+        tagged.key = room.doc_id + '\n' + frame.key;
+    }
+    return tagged;
+}
+
+std::shared_ptr<WebSocketManager::Member> WebSocketManager::findMember(const std::string& doc_id, crow::websocket::connection* conn)
+{
+    Shard& shard = shardFor(doc_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto conn_it = shard.members.find(conn);
+    if (conn_it == shard.members.end())
+    {
+        return nullptr;
+    }
+    auto it = conn_it->second.find(doc_id);
+    return it != conn_it->second.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<OutboundQueue> WebSocketManager::findQueue(crow::websocket::connection* conn)
+{
+    auto link = findLink(conn);
+    return link ? link->outbound : nullptr;
+}
+
+bool WebSocketManager::sendTo(crow::websocket::connection* conn, const std::string& message, OutboundQueue::Priority priority)
+{
+    OutboundQueue::Frame frame;
+    frame.data = OutboundQueue::share(message);
+    frame.priority = priority;
+    return sendTo(conn, frame);
+}
+
+bool WebSocketManager::sendTo(crow::websocket::connection* conn, const OutboundQueue::Frame& frame)
+{
+    auto outbound = findQueue(conn);
+    return outbound && outbound->push(frame);
+}
+
+void WebSocketManager::acknowledge(crow::websocket::connection* conn, uint64_t received)
+{
+    if (auto outbound = findQueue(conn))
+    {
+        outbound->acknowledge(received);
     }
 }
 
 std::vector<std::string> WebSocketManager::getDocumentUsers(const std::string& doc_id)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
     std::vector<std::string> users;
-    auto it = document_users_.find(doc_id);
-    if (it != document_users_.end())
+    auto members = loadMembers(doc_id);
+    if (members)
     {
-        users.assign(it->second.begin(), it->second.end());
+        std::unordered_set<std::string> seen;
+        for (const auto& member : *members)
+        {
+            if (seen.insert(member->user_id).second)
+            {
+                users.push_back(member->user_id);
+            }
+        }
     }
     return users;
 }
 
-bool WebSocketManager::isUserInDocument(const std::string& doc_id, const std::string& user_id)
+std::vector<WebSocketManager::Participant> WebSocketManager::getParticipants(const std::string& doc_id)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Participant> participants;
+    auto members = loadMembers(doc_id);
+    if (!members)
+    {
+        return participants;
+    }
     
-    auto it = document_users_.find(doc_id);
-    if (it != document_users_.end())
+    std::unordered_map<std::string, size_t> index;
+    for (const auto& member : *members)
     {
-        return it->second.find(user_id) != it->second.end();
+        auto [it, added] = index.emplace(member->user_id, participants.size());
+        if (added)
+        {
+            participants.push_back({member->user_id, member->username, false, 0});
+        }
+        
+        Participant& participant = participants[it->second];
+        int64_t cursor = member->cursor.load(std::memory_order_relaxed);
+        if (!participant.has_cursor && cursor >= 0)
+        {
+            participant.has_cursor = true;
+            participant.cursor = static_cast<size_t>(cursor);
+        }
+    }
+    return participants;
+}
+
+void WebSocketManager::setCursor(const std::string& doc_id, crow::websocket::connection* conn, bool has_position, size_t position)
+{
+    if (auto member = findMember(doc_id, conn))
+    {
+        member->cursor.store(has_position ? static_cast<int64_t>(position) : -1, std::memory_order_relaxed);
+    }
+}
+
+bool WebSocketManager::isUserInDocument(const std::string& doc_id, const std::string& user_id)
+{
+    auto members = loadMembers(doc_id);
+    if (members)
+    {
+        for (const auto& member : *members)
+        {
+            if (member->user_id == user_id)
+            {
+                return true;
+            }
+        }
     }
     return false;
 }
 
+WebSocketManager::Stats WebSocketManager::getStats() const
+{
+    Stats stats;
+    stats.resumes = resumes_.load();
+    stats.resume_gaps = resume_gaps_.load();
+    stats.replayed_frames = replayed_frames_.load();
+    stats.subscribes = subscribes_.load();
+    stats.relayed_out = relayed_out_.load();
+    stats.relayed_in = relayed_in_.load();
+    return stats;
+}
+
+WebSocketManager::ConnectionDirectory::ConnectionDirectory()
+    : slots_(new Slot[CAPACITY])
+{
+}
+
+size_t WebSocketManager::ConnectionDirectory::home(crow::websocket::connection* conn) const
+{
+    // Fibonacci hashing of the pointer; the low bits are alignment
+    uint64_t key = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(conn));
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 48) & (CAPACITY - 1);
+}
+
+void WebSocketManager::ConnectionDirectory::insert(crow::websocket::connection* conn, uint32_t shard)
+{
+    uintptr_t key = reinterpret_cast<uintptr_t>(conn);
+    size_t start = home(conn);
+    for (size_t probe = 0; probe < MAX_PROBE; ++probe)
+    {
+        Slot& slot = slots_[(start + probe) & (CAPACITY - 1)];
+        uintptr_t current = slot.key.load(std::memory_order_relaxed);
+        if ((current == EMPTY || current == TOMBSTONE) &&
+            slot.key.compare_exchange_strong(current, RESERVED, std::memory_order_acquire))
+        {
+            // Publish the shard before the key so a reader that sees the
+            // key also sees its shard
+            slot.shard.store(shard, std::memory_order_relaxed);
+            slot.key.store(key, std::memory_order_release);
+            return;
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    overflow_[conn] = shard;
+    overflow_size_.store(overflow_.size(), std::memory_order_release);
+}
 
+uint32_t WebSocketManager::ConnectionDirectory::find(crow::websocket::connection* conn)
+{
+    uintptr_t key = reinterpret_cast<uintptr_t>(conn);
+    size_t start = home(conn);
+    for (size_t probe = 0; probe < MAX_PROBE; ++probe)
+    {
+        Slot& slot = slots_[(start + probe) & (CAPACITY - 1)];
+        uintptr_t current = slot.key.load(std::memory_order_acquire);
+        if (current == key)
+        {
+            return slot.shard.load(std::memory_order_relaxed);
+        }
+        if (current == EMPTY)
+        {
+            return static_cast<uint32_t>(SHARD_COUNT);
+        }
+    }
+    
+    if (overflow_size_.load(std::memory_order_acquire) == 0)
+    {
+        return static_cast<uint32_t>(SHARD_COUNT);
+    }
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    auto it = overflow_.find(conn);
+    return it != overflow_.end() ? it->second : static_cast<uint32_t>(SHARD_COUNT);
+}
+
+void WebSocketManager::ConnectionDirectory::erase(crow::websocket::connection* conn)
+{
+    uintptr_t key = reinterpret_cast<uintptr_t>(conn);
+    size_t start = home(conn);
+    for (size_t probe = 0; probe < MAX_PROBE; ++probe)
+    {
+        Slot& slot = slots_[(start + probe) & (CAPACITY - 1)];
+        uintptr_t current = slot.key.load(std::memory_order_acquire);
+        if (current == key)
+        {
+            slot.key.store(TOMBSTONE, std::memory_order_release);
+            return;
+        }
+        if (current == EMPTY)
+        {
+            break;
+        }
+    }
+    
+    if (overflow_size_.load(std::memory_order_acquire) == 0)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    overflow_.erase(conn);
+    overflow_size_.store(overflow_.size(), std::memory_order_release);
+}
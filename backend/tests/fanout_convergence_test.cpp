@@ -0,0 +1,337 @@
+// Two docs_app processes sharing one database and one fanout broker, with a
+// client in each. The first edits the document, from right after it joins,
+// before the broker has leased it the room; the second joins while
+// those edits are still unwritten, and its client must end up with the
+// same text, from the snapshot it joins with, the snapshots its process
+// sends when it catches up with the owner, and the REST catch-up a client
+// runs on a gap. Then the first process exits, taking the broker with it,
+// and the second, owning the room alone and then from the broker it hosts
+// itself, must take edits on top of everything the first made.
+// Each process is a fork of this one and talks to the other only through
+// the broker, the database and marker files in a scratch directory.
+//
+//   cmake -S . -B build -DDOCS_BUILD_TESTS=ON && cmake --build build --target fanout_convergence_test
+//   ctest --test-dir build -R fanout_convergence
+
+#include "db/Database.h"
+#include "repositories/DocumentRepository.h"
+#include "services/AuthService.h"
+#include "services/DocumentService.h"
+#include "services/DocumentSessionManager.h"
+#include "services/EditService.h"
+#include "services/OperationalTransform.h"
+#include "utils/BrokerBus.h"
+#include "utils/Utf16.h"
+#include "utils/WebSocketManager.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+    const int EDITS_BEFORE_JOIN = 20;
+    const int EDITS_AFTER_JOIN = 20;
+    const std::chrono::seconds TIMEOUT(15);
+
+    // Frames go nowhere; the client's text is rebuilt from what it would
+    // read instead
+    struct FakeConnection : crow::websocket::connection
+    {
+        void send_binary(std::string) override {}
+        void send_text(std::string) override {}
+        void send_ping(std::string) override {}
+        void send_pong(std::string) override {}
+        void close(std::string const &, uint16_t) override {}
+        std::string get_remote_ip() override { return "127.0.0.1"; }
+        std::string get_subprotocol() const override { return ""; }
+    };
+
+    struct Scratch
+    {
+        std::string dir;
+
+        std::string path(const std::string &name) const { return dir + "/" + name; }
+        void mark(const std::string &name, const std::string &text = "") const
+        {
+            std::ofstream(path(name + ".tmp")) << text;
+            std::filesystem::rename(path(name + ".tmp"), path(name));
+        }
+        std::string read(const std::string &name) const
+        {
+            std::ifstream in(path(name));
+            std::stringstream text;
+            text << in.rdbuf();
+            return text.str();
+        }
+    };
+
+    bool waitUntil(const std::function<bool()> &done)
+    {
+        auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+        while (!done())
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+
+    bool waitFor(const Scratch &scratch, const std::string &name)
+    {
+        return waitUntil([&] { return std::filesystem::exists(scratch.path(name)); });
+    }
+
+    int fail(const std::string &process, const std::string &what)
+    {
+        std::cerr << "[" << process << "] FAIL: " << what << std::endl;
+        return 1;
+    }
+
+    // What a client holds: the text at a revision, moved on by snapshot
+    // frames and by the operations it catches up with
+    struct Client
+    {
+        std::mutex mutex;
+        std::string text;
+        int revision = 0;
+
+        void snapshot(const Document &document)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            text = document.getContent();
+            revision = document.getVersion();
+        }
+
+        // The editor's catch-up: operations since its revision, or the
+        // whole document once they are gone
+        void catchUp(const std::string &doc_id, const std::string &user_id)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            try
+            {
+                int current = 0;
+                for (const auto &applied : EditService::getOperationsSince(doc_id, user_id, revision, current))
+                {
+                    if (applied.revision != revision + 1)
+                        break;
+                    OperationalTransform::apply(text, applied.ops);
+                    revision = applied.revision;
+                }
+            }
+            catch (const std::exception &)
+            {
+                Document document = DocumentService::getDocumentById(doc_id, user_id);
+                text = document.getContent();
+                revision = document.getVersion();
+            }
+        }
+
+        std::string current()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return text;
+        }
+    };
+
+    struct Process
+    {
+        std::string name;
+        std::shared_ptr<BrokerBus> bus;
+        FakeConnection conn;
+
+        Process(const std::string &name, const Scratch &scratch) : name(name)
+        {
+            if (!Database::getInstance().initialize(scratch.path("docs.db")))
+                throw std::runtime_error("cannot open the database");
+            DocumentSessionManager::getInstance().start(scratch.path(name + "_journal"));
+
+            bus = std::make_shared<BrokerBus>(scratch.path("fanout.sock"));
+            WebSocketManager::getInstance().attachBus(bus);
+            DocumentSessionManager::getInstance().attachBus(bus);
+            DocumentRepository::attachBus(bus);
+        }
+
+        // Like a WebSocket join: the session, then the room, and the
+        // snapshot under the session's sequencer
+        void join(const std::string &doc_id, const std::string &user_id, Client &client)
+        {
+            auto session = DocumentSessionManager::getInstance().join(doc_id);
+            if (!session)
+                throw std::runtime_error("document not found");
+            std::lock_guard<std::mutex> order(session->sequencer());
+            WebSocketManager::getInstance().joinDocument(doc_id, &conn, user_id, name);
+            client.snapshot(session->snapshot());
+        }
+
+        void stop()
+        {
+            DocumentSessionManager::getInstance().shutdown();
+            bus->stop();
+            Database::getInstance().close();
+        }
+    };
+
+    // Appends text at the end of the document, as a client up to date
+    // with it would
+    void append(const std::string &doc_id, const std::string &user_id, const std::string &text)
+    {
+        auto session = DocumentSessionManager::getInstance().find(doc_id);
+        auto state = session->state();
+        size_t end = Utf16::length(state.content.toString());
+        EditService::submitOperations(doc_id, user_id, state.document.getVersion(), {TextOperation::insert(end, text)});
+    }
+
+    int setup(const Scratch &scratch)
+    {
+        if (!Database::getInstance().initialize(scratch.path("docs.db")))
+            return fail("setup", "cannot create the database");
+        User user = AuthService::registerUser("fanout@example.com", "fanout_test", "correct-horse");
+        Document document = DocumentService::createDocument(user.getId(), "Fanout", "start:");
+        scratch.mark("ids", user.getId() + "\n" + document.getId());
+        Database::getInstance().close();
+        return 0;
+    }
+
+    int owner(const Scratch &scratch, const std::string &user_id, const std::string &doc_id)
+    {
+        Process process("one", scratch);
+        Client client;
+        process.bus->start();
+        process.join(doc_id, user_id, client);
+
+        // The first of these waits for the lease rather than being refused.
+        // All of them land well inside IDLE_PERSIST_DELAY, so none is
+        // written when the second process joins.
+        for (int i = 0; i < EDITS_BEFORE_JOIN; ++i)
+            append(doc_id, user_id, "a");
+        scratch.mark("edited");
+
+        if (!waitFor(scratch, "joined"))
+            return fail(process.name, "the second process never joined");
+        for (int i = 0; i < EDITS_AFTER_JOIN; ++i)
+            append(doc_id, user_id, "b");
+
+        std::string expected = DocumentSessionManager::getInstance().find(doc_id)->snapshot().getContent();
+        client.catchUp(doc_id, user_id);
+        if (client.current() != expected)
+            return fail(process.name, "client has \"" + client.current() + "\", expected \"" + expected + "\"");
+        scratch.mark("expected", expected);
+
+        if (!waitFor(scratch, "converged"))
+            return fail(process.name, "the second process never converged");
+        process.stop();
+        return 0;
+    }
+
+    int follower(const Scratch &scratch, const std::string &user_id, const std::string &doc_id)
+    {
+        if (!waitFor(scratch, "edited"))
+            return fail("two", "the first process never edited");
+
+        Process process("two", scratch);
+        Client client;
+        DocumentSessionManager::getInstance().onResync([&](const std::string &, const DocumentSession &session)
+                                                       { client.snapshot(session.snapshot()); });
+        process.bus->start();
+        process.join(doc_id, user_id, client);
+        if (!waitUntil([&] { return process.bus->lease(doc_id) == FanoutBus::Lease::Following; }))
+            return fail(process.name, "never followed the room");
+        scratch.mark("joined");
+
+        if (!waitFor(scratch, "expected"))
+            return fail(process.name, "the first process never finished editing");
+        std::string expected = scratch.read("expected");
+        bool converged = waitUntil([&]
+                                   {
+            client.catchUp(doc_id, user_id);
+            return client.current() == expected; });
+        if (!converged)
+            return fail(process.name, "client has \"" + client.current() + "\", expected \"" + expected + "\"");
+        scratch.mark("converged");
+
+        // The first process exits; this one takes the room over
+        if (!waitUntil([&] { return WebSocketManager::getInstance().ownsDocument(doc_id); }))
+            return fail(process.name, "never took the room over");
+        append(doc_id, user_id, "c");
+        expected += "c";
+        client.catchUp(doc_id, user_id);
+        if (client.current() != expected)
+            return fail(process.name, "client has \"" + client.current() + "\" after taking over, expected \"" + expected + "\"");
+
+        process.stop();
+        Database::getInstance().initialize(scratch.path("docs.db"));
+        auto stored = DocumentRepository().findById(doc_id);
+        if (!stored.has_value() || stored->getContent() != expected)
+            return fail(process.name, "database has \"" + (stored ? stored->getContent() : std::string()) + "\"");
+        return 0;
+    }
+
+    // Runs body in a child process; returns its pid
+    pid_t spawn(const std::function<int()> &body)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int code = 1;
+            try
+            {
+                code = body();
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "FAIL: " << e.what() << std::endl;
+            }
+            std::exit(code);
+        }
+        return pid;
+    }
+
+    bool succeeded(pid_t pid)
+    {
+        int status = 0;
+        return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+}
+
+int main()
+{
+    // Children fork before any thread starts; each opens everything itself
+    char dir[] = "/tmp/fanout_convergence_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    Scratch scratch{dir};
+
+    bool passed = succeeded(spawn([&] { return setup(scratch); }));
+    if (passed)
+    {
+        std::istringstream ids(scratch.read("ids"));
+        std::string user_id, doc_id;
+        std::getline(ids, user_id);
+        std::getline(ids, doc_id);
+
+        pid_t one = spawn([&] { return owner(scratch, user_id, doc_id); });
+        pid_t two = spawn([&] { return follower(scratch, user_id, doc_id); });
+        bool first = succeeded(one);
+        bool second = succeeded(two);
+        passed = first && second;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    std::cout << (passed ? "PASS" : "FAIL") << ": two processes converge on one document" << std::endl;
+    return passed ? 0 : 1;
+}
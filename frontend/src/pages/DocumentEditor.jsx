@@ -3,6 +3,7 @@ import { useNavigate, useParams } from 'react-router-dom';
 import { useAuth } from '../contexts/AuthContext';
 import { documentsAPI, collaborationAPI } from '../services/api';
 import { websocketService } from '../services/websocket';
+import { OTClient, diffOps, applyOps, transformIndex } from '../services/ot';
 import CursorOverlay from '../components/CursorOverlay';
 import './DocumentEditor.css';
 
@@ -26,6 +27,9 @@ export default function DocumentEditor() {
   const isApplyingRemoteEdit = useRef(false);
   const textareaRef = useRef(null);
   const lastSaveVersionRef = useRef(1); // Track last successfully saved version
+  const otClientRef = useRef(null); // Sequencing state for operations sent over the WebSocket
+  const catchingUpRef = useRef(false);
+  const sentOnRef = useRef(0); // Connection the outstanding operation was sent on
   const [showShareModal, setShowShareModal] = useState(false);
   const [showCollaborators, setShowCollaborators] = useState(false);
   const [collaborators, setCollaborators] = useState([]);
@@ -38,10 +42,15 @@ export default function DocumentEditor() {
   const navigate = useNavigate();
 
   useEffect(() => {
+    // The socket opens with a snapshot of the room, so the editor paints
+    // without waiting on the REST fetch; that brings ownership and sharing
+    otClientRef.current = null;
+    connectWebSocket();
     loadDocument();
     
     // Cleanup WebSocket on unmount
     return () => {
+      otClientRef.current = null;
       websocketService.disconnect();
       setActiveUsers([]);
       setUserCursors(new Map());
@@ -75,6 +84,9 @@ export default function DocumentEditor() {
     
     // Don't auto-save if we're applying a remote edit
     if (isApplyingRemoteEdit.current) return;
+
+    // Connected editors stream operations; the server persists them
+    if (wsConnected) return;
     
     // Debounce auto-save - wait 2 seconds after user stops typing
     const autoSaveTimer = setTimeout(async () => {
@@ -88,6 +100,7 @@ export default function DocumentEditor() {
         // Update both version state and last saved version
         setVersion(data.document.version);
         lastSaveVersionRef.current = data.document.version;
+        resetOTClient(data.document.version);
         setDocument(data.document);
         // Clear any conflict errors on successful save
         setConflictData(null);
@@ -115,24 +128,19 @@ export default function DocumentEditor() {
     }, 2000); // 2 second debounce
 
     return () => clearTimeout(autoSaveTimer);
-  }, [content, title, id, document, isOwner, permission]);
+  }, [content, title, id, document, isOwner, permission, wsConnected]);
 
-  const loadDocument = async () => {
+  // reload starts over from the server's copy and reconnects; otherwise
+  // the content only fills in if the socket's snapshot has not yet
+  const loadDocument = async (reload = false) => {
     try {
-      setLoading(true);
+      if (reload || !otClientRef.current) setLoading(true);
       const data = await documentsAPI.getById(id);
       setDocument(data.document);
-      setTitle(data.document.title);
-      setContent(data.document.content || '');
-      contentRef.current = data.document.content || '';
-      const docVersion = data.document.version || 1;
-      setVersion(docVersion);
-      lastSaveVersionRef.current = docVersion; // Initialize last saved version
-      historyRef.current = {
-        stack: [{ content: data.document.content || '', selectionStart: 0, selectionEnd: 0 }],
-        index: 0
-      };
-      setHistoryIndex(0);
+      if (reload || !otClientRef.current) {
+        setTitle(data.document.title);
+        resetContent(data.document.content || '', data.document.version || 1);
+      }
       
       // Check if user is owner
       const userId = localStorage.getItem('user_id');
@@ -150,8 +158,10 @@ export default function DocumentEditor() {
         await loadCollaborators();
       }
       
-      console.log('[DocumentEditor] Connecting WebSocket for document:', id);
-      connectWebSocket();
+      if (reload) {
+        console.log('[DocumentEditor] Reconnecting WebSocket for document:', id);
+        connectWebSocket();
+      }
     } catch (err) {
       setError(err.message || 'Failed to load document');
       if (err.message.includes('Access denied') || err.message.includes('not found')) {
@@ -202,14 +212,101 @@ export default function DocumentEditor() {
         });
       }
     });
+  };
+
+  // Replaces the text and starts editing from revision
+  const resetContent = (text, revision) => {
+    setContent(text);
+    contentRef.current = text;
+    setVersion(revision);
+    lastSaveVersionRef.current = revision;
+    resetOTClient(revision);
+    historyRef.current = {
+      stack: [{ content: text, selectionStart: 0, selectionEnd: 0 }],
+      index: 0
+    };
+    setHistoryIndex(0);
+  };
+
+  // The room as this connection joined it; later operations follow it
+  const applySnapshot = (snapshot) => {
+    const userId = localStorage.getItem('user_id');
+    const others = (snapshot.participants || []).filter(p => p.user_id !== userId);
+
+    resetContent(snapshot.content || '', snapshot.version);
+    setTitle(snapshot.title);
+    setDocument(prev => prev && { ...prev, title: snapshot.title, content: snapshot.content, version: snapshot.version });
+    setActiveUsers(others.map(p => ({ user_id: p.user_id, username: p.username || 'User' })));
+    setUserCursors(new Map(others
+      .filter(p => p.position !== undefined)
+      .map(p => [p.user_id, { position: p.position, username: p.username || 'User', timestamp: Date.now() }])));
+    setLoading(false);
+  };
 
-    // Listen for edit messages
-    websocketService.on('edit', (message) => {
-      console.log('[DocumentEditor] Edit message received via listener:', message);
-      handleRemoteEdit(message);
+  const resetOTClient = (revision) => {
+    otClientRef.current = new OTClient(revision, (baseRevision, ops) => {
+      sentOnRef.current = websocketService.connectionId;
+      websocketService.sendOperation(baseRevision, ops);
     });
   };
 
+  // Applies already-transformed remote operations, keeping the local selection
+  const applyRemoteOps = (ops, revision) => {
+    const textarea = textareaRef.current;
+    const selectionStart = textarea ? textarea.selectionStart : 0;
+    const selectionEnd = textarea ? textarea.selectionEnd : 0;
+    const newContent = applyOps(contentRef.current, ops);
+
+    isApplyingRemoteEdit.current = true;
+    setContent(newContent);
+    contentRef.current = newContent;
+    setVersion(revision);
+    lastSaveVersionRef.current = revision;
+
+    setTimeout(() => {
+      if (textarea && ops.length > 0) {
+        textarea.setSelectionRange(transformIndex(selectionStart, ops), transformIndex(selectionEnd, ops));
+      }
+      isApplyingRemoteEdit.current = false;
+    }, 0);
+  };
+
+  const handleRemoteOperation = (message) => {
+    const client = otClientRef.current;
+    if (!client) return;
+
+    const ops = client.applyRemote(message.revision, message.ops || []);
+    if (ops) {
+      applyRemoteOps(ops, message.revision);
+    } else if (message.revision > client.revision + 1) {
+      catchUp();
+    }
+  };
+
+  // Fetches operations missed by this client; falls back to a reload when the
+  // server no longer has them
+  const catchUp = async () => {
+    const client = otClientRef.current;
+    if (!client || catchingUpRef.current) return;
+    catchingUpRef.current = true;
+
+    try {
+      const data = await documentsAPI.getOperations(id, client.revision);
+      for (const entry of data.operations || []) {
+        if (entry.revision <= client.revision) continue;
+        const ops = client.applyRemote(entry.revision, entry.ops);
+        if (!ops) break;
+        applyRemoteOps(ops, entry.revision);
+      }
+    } catch (err) {
+      if (err.status === 409) {
+        await loadDocument(true);
+      }
+    } finally {
+      catchingUpRef.current = false;
+    }
+  };
+
   const handleWebSocketMessage = (message) => {
     switch (message.type) {
       case 'user_joined':
@@ -232,18 +329,52 @@ export default function DocumentEditor() {
           });
         }
         break;
-      case 'edit':
-        handleRemoteEdit(message);
+      case 'snapshot':
+        applySnapshot(message);
         break;
-      case 'saved':
-        if (message.version) {
-          setVersion(message.version);
-          lastSaveVersionRef.current = message.version;
+      case 'op':
+        handleRemoteOperation(message);
+        break;
+      case 'ack':
+        if (otClientRef.current && otClientRef.current.ack(message.revision)) {
+          setVersion(message.revision);
+          lastSaveVersionRef.current = message.revision;
+        } else {
+          catchUp();
+        }
+        break;
+      case 'op_error':
+        console.warn('[DocumentEditor] Operation rejected, reloading:', message.error);
+        if (message.error && message.error.startsWith('NOT_OWNER')) {
+          setError('This document is being edited through another server; your last change was not saved');
+        }
+        loadDocument(true);
+        break;
+      case 'resumed':
+        // Missed frames were replayed, acks included; an operation still
+        // unacknowledged from the old connection never reached the server
+        if (otClientRef.current && sentOnRef.current !== websocketService.connectionId) {
+          otClientRef.current.resend();
         }
-        if (message.content !== undefined) {
-          handleRemoteEdit(message);
+        break;
+      case 'resync':
+        // The server could not bring this connection up to date; start over
+        console.warn('[DocumentEditor] Out of sync with the room, reloading:', message.reason);
+        loadDocument(true);
+        break;
+      case 'saved':
+        // Full-content saves are sequenced like operations; fetch them as such
+        if (otClientRef.current && message.version > otClientRef.current.revision) {
+          catchUp();
         }
         break;
+      case 'save_ack':
+        setSaving(false);
+        break;
+      case 'save_error':
+        setSaving(false);
+        setError(message.error || 'Failed to save document');
+        break;
       case 'cursor':
         if (message.userId && message.userId !== localStorage.getItem('user_id') && message.position !== undefined) {
           setUserCursors(prev => {
@@ -262,70 +393,6 @@ export default function DocumentEditor() {
     }
   };
 
-  const handleRemoteEdit = (message) => {
-    console.log('[DocumentEditor] handleRemoteEdit called:', message);
-    
-    const currentUserId = localStorage.getItem('user_id');
-    const messageUserId = message.userId || message.user_id;
-    
-    console.log('[DocumentEditor] Current userId:', currentUserId, 'Message userId:', messageUserId);
-    
-    if (messageUserId === currentUserId) {
-      console.log('[DocumentEditor] Ignoring own edit');
-      if (message.version) {
-        setVersion(message.version);
-        lastSaveVersionRef.current = message.version;
-      }
-      return;
-    }
-
-    if (message.content !== undefined) {
-      const currentContent = contentRef.current;
-      const newContent = message.content;
-      
-      if (currentContent !== newContent) {
-        console.log('Applying remote edit from user:', messageUserId, 'Content length:', newContent.length);
-        
-        isApplyingRemoteEdit.current = true;
-        
-        const textarea = textareaRef.current;
-        const cursorPos = textarea ? textarea.selectionStart : 0;
-        
-        setConflictData(null);
-        setError('');
-        
-        setContent(newContent);
-        contentRef.current = newContent;
-        
-        if (document) {
-          setDocument({ ...document, content: newContent, version: message.version || document.version });
-        }
-        
-        if (message.version) {
-          setVersion(message.version);
-          lastSaveVersionRef.current = message.version;
-        }
-        
-        if (textarea && cursorPos <= newContent.length) {
-          setTimeout(() => {
-            textarea.setSelectionRange(cursorPos, cursorPos);
-          }, 0);
-        }
-        
-        setTimeout(() => {
-          isApplyingRemoteEdit.current = false;
-        }, 200);
-      } else {
-        if (message.version) {
-          setVersion(message.version);
-          lastSaveVersionRef.current = message.version;
-        }
-        setConflictData(null);
-        setError('');
-      }
-    }
-  };
-
   const checkPermission = async () => {
     try {
       const collabs = await collaborationAPI.getCollaborators(id);
@@ -359,6 +426,14 @@ export default function DocumentEditor() {
       return;
     }
 
+    // Edits already reached the server as operations and the room persists
+    // them; ask only for confirmation of the scheduled write
+    if (websocketService.isConnected()) {
+      setSaving(true);
+      websocketService.send({ type: 'save' });
+      return;
+    }
+
     try {
       setSaving(true);
       setError('');
@@ -400,7 +475,7 @@ export default function DocumentEditor() {
 
   const handleRefresh = async () => {
     setConflictData(null);
-    await loadDocument();
+    await loadDocument(true);
   };
 
   const handleTitleBlur = async () => {
@@ -483,8 +558,6 @@ export default function DocumentEditor() {
   };
 
   const applyContentChange = (newContent, options = {}) => {
-    if (isApplyingRemoteEdit.current) return;
-
     const { fromHistory = false, selectionStart, selectionEnd } = options;
 
     if (!fromHistory) {
@@ -494,19 +567,14 @@ export default function DocumentEditor() {
       pushHistory(newContent, selStart, selEnd);
     }
 
+    const ops = diffOps(contentRef.current, newContent);
     setContent(newContent);
     contentRef.current = newContent;
 
-    if (websocketService.isConnected() && (isOwner || permission === 'write')) {
+    if (websocketService.isConnected() && otClientRef.current && (isOwner || permission === 'write')) {
       setConflictData(null);
       setError('');
-
-      console.log('[DocumentEditor] 📤 Sending edit via WebSocket, content length:', newContent.length);
-      websocketService.sendEdit({
-        content: newContent,
-        version: lastSaveVersionRef.current,
-        userId: localStorage.getItem('user_id')
-      });
+      otClientRef.current.applyLocal(ops);
     }
   };
 
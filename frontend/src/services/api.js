@@ -146,6 +146,10 @@ export const documentsAPI = {
       method: 'DELETE',
     });
   },
+
+  getOperations: async (docId, since) => {
+    return fetchWithAuth(`/documents/${docId}/operations?since=${since}`);
+  },
 };
 
 // Collaboration API
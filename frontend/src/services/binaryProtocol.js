@@ -0,0 +1,251 @@
+// Client side of the server's BinaryProtocol (bin1): varint message types and
+// integers, length-prefixed UTF-8 strings, and users interned by index. The
+// decoder turns server frames into the same message objects as the JSON
+// protocol, so the editor does not care which one is in use.
+
+export const PROTOCOL_NAME = 'bin1';
+
+const HELLO = 1;
+const USER = 2;
+const OP = 3;
+const ACK = 4;
+const CURSOR = 5;
+const BATCH = 6;
+const DEFLATE = 7;
+const SEQ = 8;
+const CHANNEL = 9;
+const SUBMIT = 16;
+const CLIENT_CURSOR = 17;
+const RECEIPT = 18;
+
+const encoder = new TextEncoder();
+const decoder = new TextDecoder();
+
+class Writer {
+  constructor() {
+    this.bytes = [];
+  }
+
+  varint(value) {
+    while (value >= 0x80) {
+      this.bytes.push((value % 0x80) | 0x80);
+      value = Math.floor(value / 0x80);
+    }
+    this.bytes.push(value);
+  }
+
+  string(value) {
+    const utf8 = encoder.encode(value);
+    this.varint(utf8.length);
+    for (const byte of utf8) this.bytes.push(byte);
+  }
+
+  finish() {
+    return new Uint8Array(this.bytes);
+  }
+}
+
+class Reader {
+  constructor(bytes) {
+    this.bytes = bytes;
+    this.offset = 0;
+  }
+
+  varint() {
+    let value = 0;
+    let scale = 1;
+    for (;;) {
+      if (this.offset >= this.bytes.length) throw new Error('Truncated binary frame');
+      const byte = this.bytes[this.offset++];
+      value += (byte & 0x7f) * scale;
+      if (!(byte & 0x80)) return value;
+      scale *= 0x80;
+    }
+  }
+
+  string() {
+    const length = this.varint();
+    const end = this.offset + length;
+    if (end > this.bytes.length) throw new Error('Truncated binary frame');
+    const value = decoder.decode(this.bytes.subarray(this.offset, end));
+    this.offset = end;
+    return value;
+  }
+
+  bytesOf(length) {
+    const end = this.offset + length;
+    if (end > this.bytes.length) throw new Error('Truncated binary frame');
+    const value = this.bytes.subarray(this.offset, end);
+    this.offset = end;
+    return value;
+  }
+}
+
+export const encodeSubmit = (revision, ops) => {
+  const writer = new Writer();
+  writer.varint(SUBMIT);
+  writer.varint(revision);
+  writer.varint(ops.length);
+  for (const op of ops) {
+    writer.varint(op.type === 'insert' ? 0 : 1);
+    writer.varint(op.position);
+    if (op.type === 'insert') writer.string(op.text);
+    else writer.varint(op.length);
+  }
+  return writer.finish();
+};
+
+export const encodeCursor = (position) => {
+  const writer = new Writer();
+  writer.varint(CLIENT_CURSOR);
+  writer.varint(position === undefined || position === null ? 0 : position + 1);
+  return writer.finish();
+};
+
+export const encodeReceipt = (count) => {
+  const writer = new Writer();
+  writer.varint(RECEIPT);
+  writer.varint(count);
+  return writer.finish();
+};
+
+// Decodes server frames for one connection; holds its interned users
+export class BinaryDecoder {
+  constructor() {
+    this.users = new Map();
+    this.negotiated = false;
+  }
+
+  // Returns the messages in the frame, in the JSON protocol's shape
+  decode(buffer) {
+    const messages = [];
+    this.decodeInto(buffer instanceof Uint8Array ? buffer : new Uint8Array(buffer), messages);
+    return messages;
+  }
+
+  decodeInto(bytes, messages) {
+    const reader = new Reader(bytes);
+    const type = reader.varint();
+    switch (type) {
+      case HELLO:
+        reader.varint();
+        this.negotiated = true;
+        break;
+      case USER: {
+        const index = reader.varint();
+        const userId = reader.string();
+        const username = reader.string();
+        this.users.set(index, { userId, username });
+        break;
+      }
+      case OP: {
+        const revision = reader.varint();
+        const user = this.users.get(reader.varint());
+        const count = reader.varint();
+        const ops = [];
+        for (let i = 0; i < count; i++) {
+          const kind = reader.varint();
+          const position = reader.varint();
+          if (kind === 0) ops.push({ type: 'insert', position, text: reader.string() });
+          else ops.push({ type: 'delete', position, length: reader.varint() });
+        }
+        messages.push({ type: 'op', revision, userId: user ? user.userId : undefined, ops });
+        break;
+      }
+      case ACK:
+        messages.push({ type: 'ack', revision: reader.varint() });
+        break;
+      case CURSOR: {
+        const user = this.users.get(reader.varint());
+        const position = reader.varint();
+        const message = { type: 'cursor', userId: user ? user.userId : undefined, username: user ? user.username : undefined };
+        if (position > 0) message.position = position - 1;
+        messages.push(message);
+        break;
+      }
+      case BATCH: {
+        const count = reader.varint();
+        for (let i = 0; i < count; i++) {
+          this.decodeInto(reader.bytesOf(reader.varint()), messages);
+        }
+        break;
+      }
+      case SEQ: {
+        // The room's sequence number for the message that follows
+        const seq = reader.varint();
+        const first = messages.length;
+        this.decodeInto(bytes.subarray(reader.offset), messages);
+        for (let i = first; i < messages.length; i++) messages[i].seq = seq;
+        break;
+      }
+      case CHANNEL: {
+        // A subscribed document's message, tagged like its JSON "doc"
+        const doc = reader.string();
+        const first = messages.length;
+        this.decodeInto(bytes.subarray(reader.offset), messages);
+        for (let i = first; i < messages.length; i++) messages[i].doc = doc;
+        break;
+      }
+      default:
+        throw new Error(`Unknown binary message type ${type}`);
+    }
+  }
+}
+
+// Large frames may arrive deflated (see the server's FrameDeflater):
+// DEFLATE, form (0 JSON, 1 binary), length, raw deflate data
+export const deflateSupported = () => typeof DecompressionStream !== 'undefined';
+
+export const isDeflated = (bytes) => bytes.length > 0 && bytes[0] === DEFLATE;
+
+const SYNC_TAIL = new Uint8Array([0x00, 0x00, 0xff, 0xff]);
+
+export class Inflater {
+  // With context takeover one stream spans the connection
+  constructor(contextTakeover) {
+    this.contextTakeover = contextTakeover;
+    this.stream = null;
+  }
+
+  // Resolves to a string (JSON) or an ArrayBuffer (binary protocol)
+  async inflate(bytes) {
+    const reader = new Reader(bytes);
+    reader.varint();
+    const binary = reader.bytesOf(1)[0] === 1;
+    const length = reader.varint();
+    const data = bytes.subarray(reader.offset);
+
+    let output;
+    if (this.contextTakeover) {
+      if (!this.stream) {
+        const stream = new DecompressionStream('deflate-raw');
+        this.stream = { writer: stream.writable.getWriter(), reader: stream.readable.getReader() };
+      }
+      const chunk = new Uint8Array(data.length + SYNC_TAIL.length);
+      chunk.set(data);
+      chunk.set(SYNC_TAIL, data.length);
+      this.stream.writer.write(chunk);
+      output = await readBytes(this.stream.reader, length);
+    } else {
+      const stream = new DecompressionStream('deflate-raw');
+      const writer = stream.writable.getWriter();
+      writer.write(data);
+      writer.close();
+      output = await readBytes(stream.readable.getReader(), length);
+    }
+
+    return binary ? output.buffer : decoder.decode(output);
+  }
+}
+
+async function readBytes(reader, length) {
+  const output = new Uint8Array(length);
+  let offset = 0;
+  while (offset < length) {
+    const { value, done } = await reader.read();
+    if (done) throw new Error('Deflated frame ended early');
+    output.set(value.subarray(0, length - offset), offset);
+    offset += value.length;
+  }
+  return output;
+}
@@ -0,0 +1,162 @@
+// Operational transform for plain-text edits. Positions are UTF-16 code units
+// (JavaScript string indices) and the rules mirror the server's engine, so a
+// client and the server transform the same way.
+
+export const insertOp = (position, text) => ({ type: 'insert', position, text });
+export const deleteOp = (position, length) => ({ type: 'delete', position, length });
+
+const opLength = (op) => (op.type === 'insert' ? op.text.length : op.length);
+
+// a rewritten to apply after b; ties between inserts go to b unless aWinsTies
+function transformComponent(a, b, aWinsTies) {
+  const bLength = opLength(b);
+
+  if (a.type === 'insert') {
+    let position = a.position;
+    if (b.type === 'insert') {
+      if (b.position < position || (b.position === position && !aWinsTies)) {
+        position += bLength;
+      }
+    } else if (position > b.position) {
+      position = position >= b.position + bLength ? position - bLength : b.position;
+    }
+    return [insertOp(position, a.text)];
+  }
+
+  const aEnd = a.position + a.length;
+
+  if (b.type === 'insert') {
+    if (b.position >= aEnd) return [a];
+    if (b.position <= a.position) return [deleteOp(a.position + bLength, a.length)];
+    const before = b.position - a.position;
+    return [deleteOp(a.position, before), deleteOp(a.position + bLength, a.length - before)];
+  }
+
+  const bEnd = b.position + bLength;
+  if (aEnd <= b.position) return [a];
+  if (a.position >= bEnd) return [deleteOp(a.position - bLength, a.length)];
+
+  const overlap = Math.min(aEnd, bEnd) - Math.max(a.position, b.position);
+  if (a.length === overlap) return [];
+  return [deleteOp(Math.min(a.position, b.position), a.length - overlap)];
+}
+
+// [a after b, b after a]; b was sequenced first and wins insert ties
+export function transformPair(a, b) {
+  if (a.length === 0 || b.length === 0) return [a, b];
+
+  if (a.length === 1 && b.length === 1) {
+    return [transformComponent(a[0], b[0], false), transformComponent(b[0], a[0], true)];
+  }
+
+  if (a.length > 1) {
+    const [head, bAfterHead] = transformPair([a[0]], b);
+    const [tail, bAfterAll] = transformPair(a.slice(1), bAfterHead);
+    return [head.concat(tail), bAfterAll];
+  }
+
+  const [aAfterHead, head] = transformPair(a, [b[0]]);
+  const [aAfterAll, tail] = transformPair(aAfterHead, b.slice(1));
+  return [aAfterAll, head.concat(tail)];
+}
+
+export function applyOps(text, ops) {
+  return ops.reduce((result, op) => (op.type === 'insert'
+    ? result.slice(0, op.position) + op.text + result.slice(op.position)
+    : result.slice(0, op.position) + result.slice(op.position + op.length)), text);
+}
+
+const isHighSurrogate = (code) => code >= 0xd800 && code <= 0xdbff;
+const isLowSurrogate = (code) => code >= 0xdc00 && code <= 0xdfff;
+
+// Operations turning oldText into newText: one replaced range between the
+// common prefix and suffix, never splitting a surrogate pair
+export function diffOps(oldText, newText) {
+  if (oldText === newText) return [];
+
+  const maxPrefix = Math.min(oldText.length, newText.length);
+  let prefix = 0;
+  while (prefix < maxPrefix && oldText.charCodeAt(prefix) === newText.charCodeAt(prefix)) prefix++;
+  if (prefix > 0 && isHighSurrogate(oldText.charCodeAt(prefix - 1))) prefix--;
+
+  const maxSuffix = maxPrefix - prefix;
+  let suffix = 0;
+  while (suffix < maxSuffix &&
+    oldText.charCodeAt(oldText.length - 1 - suffix) === newText.charCodeAt(newText.length - 1 - suffix)) suffix++;
+  if (suffix > 0 && isLowSurrogate(oldText.charCodeAt(oldText.length - suffix))) suffix--;
+
+  const ops = [];
+  const removed = oldText.length - prefix - suffix;
+  if (removed > 0) ops.push(deleteOp(prefix, removed));
+  const inserted = newText.slice(prefix, newText.length - suffix);
+  if (inserted) ops.push(insertOp(prefix, inserted));
+  return ops;
+}
+
+// Where a caret at index ends up after ops are applied
+export function transformIndex(index, ops) {
+  return ops.reduce((current, op) => {
+    if (op.type === 'insert') {
+      return op.position < current ? current + op.text.length : current;
+    }
+    if (op.position >= current) return current;
+    return current - Math.min(op.length, current - op.position);
+  }, index);
+}
+
+// Client half of the protocol: at most one operation in flight, later local
+// edits buffered until the server acknowledges it. Remote operations are
+// transformed past both before they touch the local text.
+export class OTClient {
+  constructor(revision, send) {
+    this.revision = revision;
+    this.send = send;
+    this.outstanding = null;
+    this.buffer = null;
+  }
+
+  applyLocal(ops) {
+    if (ops.length === 0) return;
+    if (this.outstanding) {
+      this.buffer = this.buffer ? this.buffer.concat(ops) : ops;
+      return;
+    }
+    this.outstanding = ops;
+    this.send(this.revision, ops);
+  }
+
+  // Returns false when revisions are not contiguous and the client must resync
+  ack(revision) {
+    if (!this.outstanding || revision !== this.revision + 1) return false;
+    this.revision = revision;
+    this.outstanding = this.buffer;
+    this.buffer = null;
+    if (this.outstanding) this.send(this.revision, this.outstanding);
+    return true;
+  }
+
+  // Operations to apply locally, or null when a revision was missed
+  applyRemote(revision, ops) {
+    if (revision !== this.revision + 1) return null;
+    this.revision = revision;
+
+    let remote = ops;
+    if (this.outstanding) {
+      [this.outstanding, remote] = transformPair(this.outstanding, remote);
+    }
+    if (this.buffer) {
+      [this.buffer, remote] = transformPair(this.buffer, remote);
+    }
+    return remote;
+  }
+
+  // Sends the outstanding operation again, for a reconnect that may have
+  // lost it; the server acks it in order either way
+  resend() {
+    if (this.outstanding) this.send(this.revision, this.outstanding);
+  }
+
+  hasPending() {
+    return Boolean(this.outstanding || this.buffer);
+  }
+}
@@ -1,3 +1,17 @@
+import {
+  BinaryDecoder,
+  Inflater,
+  PROTOCOL_NAME,
+  deflateSupported,
+  encodeCursor,
+  encodeReceipt,
+  encodeSubmit,
+  isDeflated
+} from './binaryProtocol';
+
+const RECEIPT_EVERY = 16;
+const RECEIPT_DELAY = 100;
+
 class WebSocketService {
   constructor() {
     this.ws = null;
@@ -7,6 +21,20 @@ class WebSocketService {
     this.reconnectDelay = 1000;
     this.listeners = new Map();
     this.isConnecting = false;
+    this.received = 0;
+    this.receiptCount = 0;
+    this.receiptTimer = null;
+    // Bumped on every open, so callers can tell which connection sent what
+    this.connectionId = 0;
+    this.resetSession();
+  }
+
+  // The server numbers room frames; a reconnect presents the session and
+  // the last number seen and is sent only what it missed
+  resetSession() {
+    this.session = null;
+    this.stream = 0;
+    this.lastSeq = 0;
   }
 
   getWebSocketUrl(docId) {
@@ -31,6 +59,9 @@ class WebSocketService {
     }
 
     this.isConnecting = true;
+    if (this.docId !== docId) {
+      this.resetSession();
+    }
     this.docId = docId;
     
     if (this.ws) {
@@ -49,13 +80,22 @@ class WebSocketService {
     }
 
     const wsUrl = this.getWebSocketUrl(docId);
-    const wsUrlWithParams = `${wsUrl}?doc_id=${encodeURIComponent(docId)}&token=${encodeURIComponent(token)}`;
+    // Ask for the binary protocol; the server answers with HELLO if it has it.
+    // Large frames are deflated if the browser can inflate them.
+    const deflate = deflateSupported() ? '&deflate=1' : '';
+    const resume = this.session ? `&resume=${this.session}&stream=${this.stream}&seq=${this.lastSeq}` : '';
+    const wsUrlWithParams = `${wsUrl}?doc_id=${encodeURIComponent(docId)}&token=${encodeURIComponent(token)}&protocol=${PROTOCOL_NAME}${deflate}${resume}`;
     
     console.log('[WebSocket] Attempting to connect to:', wsUrlWithParams);
     console.log('[WebSocket] Token length:', token.length);
     
     try {
       this.ws = new WebSocket(wsUrlWithParams);
+      this.ws.binaryType = 'arraybuffer';
+      this.decoder = new BinaryDecoder();
+      this.inflater = new Inflater(false);
+      // Inflating is asynchronous; the chain keeps messages in order
+      this.inbound = Promise.resolve();
       console.log('[WebSocket] WebSocket object created, readyState:', this.ws.readyState);
       
       const connectionTimeout = setTimeout(() => {
@@ -73,20 +113,18 @@ class WebSocketService {
         clearTimeout(connectionTimeout);
         this.reconnectAttempts = 0;
         this.isConnecting = false;
+        this.connectionId++;
+        // The first receipt turns on the server's flow control
+        this.received = 0;
+        this.receiptCount = 0;
+        this.sendReceipt();
         this.onOpen();
       };
 
       this.ws.onmessage = (event) => {
-        try {
-          const message = JSON.parse(event.data);
-          console.log('[WebSocket] 📨 Message received:', message.type, message);
-          if (onMessage) {
-            onMessage(message);
-          }
-          this.handleMessage(message);
-        } catch (err) {
-          console.error('[WebSocket] Error parsing message:', err, event.data);
-        }
+        this.received++;
+        this.scheduleReceipt();
+        this.inbound = this.inbound.then(() => this.receive(event.data, onMessage));
       };
 
       this.ws.onerror = (error) => {
@@ -103,6 +141,8 @@ class WebSocketService {
       this.ws.onclose = (event) => {
         console.log('[WebSocket] Connection closed. Code:', event.code, 'Reason:', event.reason || 'No reason');
         clearTimeout(connectionTimeout);
+        clearTimeout(this.receiptTimer);
+        this.receiptTimer = null;
         this.isConnecting = false;
         this.ws = null;
         
@@ -139,6 +179,71 @@ class WebSocketService {
     }
   }
 
+  async receive(data, onMessage) {
+    try {
+      if (typeof data !== 'string' && isDeflated(new Uint8Array(data))) {
+        data = await this.inflater.inflate(new Uint8Array(data));
+      }
+
+      let messages;
+      if (typeof data !== 'string') {
+        messages = this.decoder.decode(data);
+      } else {
+        const message = JSON.parse(data);
+        console.log('[WebSocket] 📨 Message received:', message.type, message);
+        // The server coalesces cursor and save notifications per room tick
+        messages = message.type === 'batch' && Array.isArray(message.messages)
+          ? message.messages
+          : [message];
+      }
+      messages.forEach(inner => {
+        // Server heartbeat: answering keeps the connection from being reaped
+        if (inner.type === 'ping') {
+          if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+            this.ws.send(JSON.stringify({ type: 'pong' }));
+          }
+          return;
+        }
+        inner = this.sequence(inner);
+        if (!inner) {
+          return;
+        }
+        if (onMessage) {
+          onMessage(inner);
+        }
+        this.handleMessage(inner);
+      });
+    } catch (err) {
+      console.error('[WebSocket] Error parsing message:', err, data);
+    }
+  }
+
+  // Tracks room sequence numbers and the session handshake. Returns the
+  // message to deliver, or null for one that was already delivered or is
+  // handled here.
+  sequence(message) {
+    if (message.type === 'session') {
+      this.session = message.session;
+      this.stream = message.stream;
+      this.lastSeq = Math.max(message.resumed ? this.lastSeq : 0, message.latest);
+      // Not resumed (a fresh join, or too much was missed to replay): a
+      // snapshot of the room follows
+      return message.resumed ? { type: 'resumed' } : null;
+    }
+
+    if (message.seq !== undefined) {
+      if (message.seq <= this.lastSeq) return null;
+      this.lastSeq = message.seq;
+      return message;
+    }
+
+    // A slow connection is closed right after this; the reconnect resumes
+    if (message.type === 'resync' && message.reason === 'slow_consumer' && this.session) {
+      return null;
+    }
+    return message;
+  }
+
   disconnect() {
     if (this.ws) {
       this.ws.close(1000, 'Client disconnect');
@@ -146,6 +251,7 @@ class WebSocketService {
     }
     this.docId = null;
     this.reconnectAttempts = 0;
+    this.resetSession();
   }
 
   send(message) {
@@ -158,16 +264,49 @@ class WebSocketService {
     }
   }
 
-  sendEdit(operation) {
-    const message = {
-      type: 'edit',
-      ...operation
-    };
-    console.log('[WebSocket] 📤 Sending edit:', message);
-    this.send(message);
+  // Tells the server how many frames have arrived so it can send more; a
+  // burst is acknowledged once, after RECEIPT_EVERY frames or RECEIPT_DELAY
+  sendReceipt() {
+    clearTimeout(this.receiptTimer);
+    this.receiptTimer = null;
+    if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+      this.ws.send(this.isBinary()
+        ? encodeReceipt(this.received)
+        : JSON.stringify({ type: 'recv', count: this.received }));
+      this.receiptCount = this.received;
+    }
+  }
+
+  scheduleReceipt() {
+    if (this.received - this.receiptCount >= RECEIPT_EVERY) {
+      this.sendReceipt();
+    } else if (!this.receiptTimer) {
+      this.receiptTimer = setTimeout(() => this.sendReceipt(), RECEIPT_DELAY);
+    }
+  }
+
+  // True once the server has agreed to the binary protocol
+  isBinary() {
+    return !!(this.decoder && this.decoder.negotiated);
+  }
+
+  sendOperation(revision, ops) {
+    if (this.isBinary() && this.isConnected()) {
+      this.ws.send(encodeSubmit(revision, ops));
+      return;
+    }
+    this.send({
+      type: 'op',
+      revision,
+      ops
+    });
   }
 
   sendCursor(data) {
+    if (this.isBinary() && this.isConnected()) {
+      this.ws.send(encodeCursor(data.position));
+      return;
+    }
     this.send({
       type: 'cursor',
       position: data.position,